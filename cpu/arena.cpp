@@ -0,0 +1,66 @@
+// Bump allocator over one mapped region.
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+static size_t pageRound(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return (size + page - 1) / page * page;
+}
+
+bool arenaInit(Arena* arena, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+    if (size == 0) return true;
+
+    size = pageRound(size);
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return false;
+#ifdef MADV_HUGEPAGE
+    madvise(base, size, MADV_HUGEPAGE);
+#endif
+
+    arena->base = (char*)base;
+    arena->size = size;
+    return true;
+}
+
+bool arenaReserve(Arena* arena, size_t size)
+{
+    if (arena->size >= size) return true;
+    arenaDestroy(arena);
+    return arenaInit(arena, size);
+}
+
+void* arenaAlloc(Arena* arena, size_t bytes, size_t align)
+{
+    if (align == 0) align = ARENA_ALIGN;
+    size_t offset = (arena->used + align - 1) & ~(align - 1);
+    if (offset + bytes > arena->size) return NULL;
+
+    arena->used = offset + bytes;
+    if (arena->used > arena->peak) arena->peak = arena->used;
+    return arena->base + offset;
+}
+
+void arenaPrefault(Arena* arena)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < arena->size; offset += page)
+        ((volatile char*)arena->base)[offset] = 0;
+}
+
+void arenaReset(Arena* arena)
+{
+    arena->used = 0;
+}
+
+void arenaDestroy(Arena* arena)
+{
+    if (arena->base) munmap(arena->base, arena->size);
+    memset(arena, 0, sizeof(*arena));
+}
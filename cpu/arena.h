@@ -0,0 +1,38 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+// Bump allocator over one mapped region.
+//
+// Allocations are never freed individually; arenaReset() rewinds the arena so
+// the next round of allocations lands on memory that is already faulted in.
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 64
+
+typedef struct {
+    char*  base;
+    size_t size;
+    size_t used;
+    size_t peak;
+} Arena;
+
+// Maps size bytes (rounded up to a page). Returns false on failure.
+bool arenaInit(Arena* arena, size_t size);
+
+// Makes sure the arena holds at least size bytes, remapping if it is smaller.
+// Only valid while nothing is allocated from it.
+bool arenaReserve(Arena* arena, size_t size);
+
+// Returns align-aligned memory (align 0 means ARENA_ALIGN), or NULL if the
+// arena is exhausted
+void* arenaAlloc(Arena* arena, size_t bytes, size_t align);
+
+// Touches every page so later timings do not include page faults
+void arenaPrefault(Arena* arena);
+
+void arenaReset(Arena* arena);
+
+void arenaDestroy(Arena* arena);
+
+#endif // _ARENA_H_
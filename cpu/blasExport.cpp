@@ -0,0 +1,423 @@
+// Standard BLAS and CBLAS entry points backed by the GEMM engine.
+//
+// Exports sgemm_/dgemm_/cgemm_/zgemm_ (Fortran ABI, column-major) and
+// cblas_sgemm/dgemm/cgemm/zgemm (row- or column-major), so programs linked
+// against a BLAS pick up the engine without being rebuilt:
+//
+//     LD_PRELOAD=./libmatmulblas.so ./app
+//
+// or by putting the library in place of libblas.so.3. Every intercepted call
+// is counted and timed; with MATMUL_BLAS_STATS=<file> (or - for stderr) the
+// totals per routine are written when the program exits. With
+// MATMUL_BLAS_FORWARD=1 calls go on to the next library that defines the
+// symbol instead, which profiles an application's BLAS without replacing it.
+// MATMUL_NUM_THREADS sets the engine's thread count (default all CPUs).
+//
+// Column-major C = op(A) op(B) is row-major C' = op(B)' op(A)' on the same
+// memory, so Fortran calls reach the row-major engine with the operands
+// swapped. Complex products are four real products on split real and
+// imaginary planes.
+//
+// Build:  g++ -O3 -march=native -fopenmp -fPIC -shared blasExport.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp -lpthread -ldl
+//             -o libmatmulblas.so
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <dlfcn.h>
+
+#include "gemm.h"
+
+// CBLAS enum values
+#define CBLAS_ROW_MAJOR  101
+#define CBLAS_COL_MAJOR  102
+#define CBLAS_NO_TRANS   111
+#define CBLAS_TRANS      112
+#define CBLAS_CONJ_TRANS 113
+
+// op() of an operand; conjugation only matters for complex
+#define OP_N 0
+#define OP_T 1
+#define OP_C 2
+
+////////////////////////////////////////////////////////////////////////////////
+// Call statistics
+////////////////////////////////////////////////////////////////////////////////
+
+#define ROUTINE_SGEMM 0
+#define ROUTINE_DGEMM 1
+#define ROUTINE_CGEMM 2
+#define ROUTINE_ZGEMM 3
+#define ROUTINE_COUNT 4
+
+#define API_FORTRAN 0
+#define API_CBLAS   1
+
+static const char* routineNames[ROUTINE_COUNT] = { "sgemm", "dgemm", "cgemm", "zgemm" };
+static const char* apiNames[2] = { "fortran", "cblas" };
+
+// Updated with atomics; callers may be on any thread
+static struct {
+    uint64_t calls;
+    uint64_t nanoseconds;
+    uint64_t maxNanoseconds;
+    uint64_t flops;
+} stats[ROUTINE_COUNT][2];
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void countCall(int routine, int api, uint64_t start, int M, int N, int K)
+{
+    uint64_t ns = nowNs() - start;
+    // a complex multiply-add is 8 real flops
+    uint64_t flops = (routine >= ROUTINE_CGEMM ? 8 : 2) * (uint64_t)M * N * K;
+
+    __atomic_add_fetch(&stats[routine][api].calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats[routine][api].nanoseconds, ns, __ATOMIC_RELAXED);
+
+    uint64_t seen = __atomic_load_n(&stats[routine][api].maxNanoseconds, __ATOMIC_RELAXED);
+    while (ns > seen && !__atomic_compare_exchange_n(&stats[routine][api].maxNanoseconds, &seen, ns,
+                                                     true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_add_fetch(&stats[routine][api].flops, flops, __ATOMIC_RELAXED);
+}
+
+static void reportStats()
+{
+    const char* path = getenv("MATMUL_BLAS_STATS");
+    if (!path || !*path) return;
+
+    FILE* fp = (strcmp(path, "-") == 0) ? stderr : fopen(path, "w");
+    if (!fp) {
+        fprintf(stderr, "blas: cannot write statistics to %s\n", path);
+        return;
+    }
+
+    fprintf(fp, "%-8s %-8s %10s %12s %12s %12s %10s\n",
+            "routine", "api", "calls", "total_sec", "mean_us", "max_us", "GFlop/s");
+    for (int r = 0; r < ROUTINE_COUNT; ++r)
+        for (int a = 0; a < 2; ++a) {
+            uint64_t calls = stats[r][a].calls;
+            if (calls == 0) continue;
+            double sec = stats[r][a].nanoseconds * 1.0e-9;
+            fprintf(fp, "%-8s %-8s %10lu %12.6f %12.3f %12.3f %10.3f\n",
+                    routineNames[r], apiNames[a], (unsigned long)calls, sec,
+                    sec * 1.0e6 / calls, stats[r][a].maxNanoseconds * 1.0e-3,
+                    sec > 0.0 ? (double)stats[r][a].flops * 1.0e-9 / sec : 0.0);
+        }
+    if (fp != stderr) fclose(fp);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Library setup
+////////////////////////////////////////////////////////////////////////////////
+
+typedef void (*FortranGemm)(const char*, const char*, const int*, const int*, const int*,
+                            const void*, const void*, const int*, const void*, const int*,
+                            const void*, void*, const int*, size_t, size_t);
+typedef void (*CblasSgemm)(int, int, int, int, int, int, float, const void*, int,
+                           const void*, int, float, void*, int);
+typedef void (*CblasDgemm)(int, int, int, int, int, int, double, const void*, int,
+                           const void*, int, double, void*, int);
+typedef void (*CblasComplexGemm)(int, int, int, int, int, int, const void*, const void*, int,
+                                 const void*, int, const void*, void*, int);
+
+// Next definitions of our symbols, when forwarding
+static void* forward[ROUTINE_COUNT][2];
+
+__attribute__((constructor))
+static void blasExportInit()
+{
+    const char* threads = getenv("MATMUL_NUM_THREADS");
+    if (threads && *threads) gemmSetNumThreads(atoi(threads));
+
+    const char* fwd = getenv("MATMUL_BLAS_FORWARD");
+    if (fwd && atoi(fwd) != 0) {
+        static const char* fortranNames[ROUTINE_COUNT] = { "sgemm_", "dgemm_", "cgemm_", "zgemm_" };
+        static const char* cblasNames[ROUTINE_COUNT] =
+            { "cblas_sgemm", "cblas_dgemm", "cblas_cgemm", "cblas_zgemm" };
+        for (int r = 0; r < ROUTINE_COUNT; ++r) {
+            forward[r][API_FORTRAN] = dlsym(RTLD_NEXT, fortranNames[r]);
+            forward[r][API_CBLAS] = dlsym(RTLD_NEXT, cblasNames[r]);
+        }
+    }
+}
+
+__attribute__((destructor))
+static void blasExportFini()
+{
+    reportStats();
+    gemmShutdown();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Products
+////////////////////////////////////////////////////////////////////////////////
+
+static int fortranOp(char c)
+{
+    switch (c) {
+        case 'N': case 'n': return OP_N;
+        case 'T': case 't': return OP_T;
+        case 'C': case 'c': return OP_C;
+    }
+    return -1;
+}
+
+static int cblasOp(int t)
+{
+    switch (t) {
+        case CBLAS_NO_TRANS:   return OP_N;
+        case CBLAS_TRANS:      return OP_T;
+        case CBLAS_CONJ_TRANS: return OP_C;
+    }
+    return -1;
+}
+
+static void realGemm(float alpha, const float* A, int lda, const float* B, int ldb,
+                     float beta, float* C, int ldc, int opA, int opB, int M, int N, int K)
+{
+    gemmSgemm(opA != OP_N, opB != OP_N, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+static void realGemm(double alpha, const double* A, int lda, const double* B, int ldb,
+                     double beta, double* C, int ldc, int opA, int opB, int M, int N, int K)
+{
+    gemmDgemm(opA != OP_N, opB != OP_N, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+// Splits a rows x cols interleaved complex matrix into contiguous planes,
+// negating the imaginary part for a conjugated operand
+template <typename T>
+static void splitPlanes(const T* X, int ld, int rows, int cols, bool conj, T* re, T* im)
+{
+    T sign = conj ? -1 : 1;
+    for (int i = 0; i < rows; ++i) {
+        const T* x = X + 2 * (size_t)i * ld;
+        T* r = re + (size_t)i * cols;
+        T* m = im + (size_t)i * cols;
+        for (int j = 0; j < cols; ++j) {
+            r[j] = x[2 * j];
+            m[j] = sign * x[2 * j + 1];
+        }
+    }
+}
+
+// Row-major complex C = alpha op(A) op(B) + beta C, by the 4M method:
+// Re = Ar Br - Ai Bi, Im = Ar Bi + Ai Br, then alpha and beta applied
+// element by element
+template <typename T>
+static void complexGemm(int opA, int opB, int M, int N, int K,
+                        const T* alpha, const T* A, int lda, const T* B, int ldb,
+                        const T* beta, T* C, int ldc)
+{
+    int aRows = (opA == OP_N) ? M : K, aCols = (opA == OP_N) ? K : M;
+    int bRows = (opB == OP_N) ? K : N, bCols = (opB == OP_N) ? N : K;
+
+    size_t aSize = (size_t)aRows * aCols, bSize = (size_t)bRows * bCols, cSize = (size_t)M * N;
+    T* work = (T*)malloc(sizeof(T) * 2 * (aSize + bSize + cSize));
+    if (!work) {
+        fprintf(stderr, "blas: out of memory for a %dx%dx%d complex product\n", M, N, K);
+        return;
+    }
+    T* Ar = work;       T* Ai = Ar + aSize;
+    T* Br = Ai + aSize; T* Bi = Br + bSize;
+    T* Pr = Bi + bSize; T* Pi = Pr + cSize;
+
+    if (K > 0) {
+        splitPlanes(A, lda, aRows, aCols, opA == OP_C, Ar, Ai);
+        splitPlanes(B, ldb, bRows, bCols, opB == OP_C, Br, Bi);
+    }
+    realGemm((T)1, Ar, aCols, Br, bCols, (T)0, Pr, N, opA, opB, M, N, K);
+    realGemm((T)-1, Ai, aCols, Bi, bCols, (T)1, Pr, N, opA, opB, M, N, K);
+    realGemm((T)1, Ar, aCols, Bi, bCols, (T)0, Pi, N, opA, opB, M, N, K);
+    realGemm((T)1, Ai, aCols, Br, bCols, (T)1, Pi, N, opA, opB, M, N, K);
+
+    T ar = alpha[0], ai = alpha[1], br = beta[0], bi = beta[1];
+    bool betaZero = (br == 0 && bi == 0);
+    for (int i = 0; i < M; ++i) {
+        T* c = C + 2 * (size_t)i * ldc;
+        const T* pr = Pr + (size_t)i * N;
+        const T* pi = Pi + (size_t)i * N;
+        for (int j = 0; j < N; ++j) {
+            T re = ar * pr[j] - ai * pi[j];
+            T im = ar * pi[j] + ai * pr[j];
+            // as in BLAS, C is not read when beta is 0
+            if (!betaZero) {
+                T cr = c[2 * j], ci = c[2 * j + 1];
+                re += br * cr - bi * ci;
+                im += br * ci + bi * cr;
+            }
+            c[2 * j] = re;
+            c[2 * j + 1] = im;
+        }
+    }
+    free(work);
+}
+
+// Row-major product of any of the four types; alpha and beta point at one
+// element (two for complex)
+static void rowMajorGemm(int routine, int opA, int opB, int M, int N, int K,
+                         const void* alpha, const void* A, int lda, const void* B, int ldb,
+                         const void* beta, void* C, int ldc)
+{
+    if (M <= 0 || N <= 0) return;
+
+    switch (routine) {
+        case ROUTINE_SGEMM:
+            gemmSgemm(opA != OP_N, opB != OP_N, M, N, K, *(const float*)alpha,
+                      (const float*)A, lda, (const float*)B, ldb,
+                      *(const float*)beta, (float*)C, ldc);
+            break;
+        case ROUTINE_DGEMM:
+            gemmDgemm(opA != OP_N, opB != OP_N, M, N, K, *(const double*)alpha,
+                      (const double*)A, lda, (const double*)B, ldb,
+                      *(const double*)beta, (double*)C, ldc);
+            break;
+        case ROUTINE_CGEMM:
+            complexGemm(opA, opB, M, N, K, (const float*)alpha, (const float*)A, lda,
+                        (const float*)B, ldb, (const float*)beta, (float*)C, ldc);
+            break;
+        case ROUTINE_ZGEMM:
+            complexGemm(opA, opB, M, N, K, (const double*)alpha, (const double*)A, lda,
+                        (const double*)B, ldb, (const double*)beta, (double*)C, ldc);
+            break;
+    }
+}
+
+static void fortranGemm(int routine, const char* transa, const char* transb,
+                        const int* m, const int* n, const int* k,
+                        const void* alpha, const void* A, const int* lda,
+                        const void* B, const int* ldb,
+                        const void* beta, void* C, const int* ldc)
+{
+    uint64_t start = nowNs();
+
+    if (forward[routine][API_FORTRAN]) {
+        ((FortranGemm)forward[routine][API_FORTRAN])(transa, transb, m, n, k, alpha, A, lda,
+                                                     B, ldb, beta, C, ldc, 1, 1);
+    } else {
+        int opA = fortranOp(*transa), opB = fortranOp(*transb);
+        if (opA < 0 || opB < 0) {
+            fprintf(stderr, "blas: %s_ called with invalid transpose '%c%c'\n",
+                    routineNames[routine], *transa, *transb);
+            return;
+        }
+        rowMajorGemm(routine, opB, opA, *n, *m, *k, alpha, B, *ldb, A, *lda, beta, C, *ldc);
+    }
+
+    countCall(routine, API_FORTRAN, start, *m, *n, *k);
+}
+
+static void cblasGemm(int routine, int order, int transA, int transB, int M, int N, int K,
+                      const void* alpha, const void* A, int lda, const void* B, int ldb,
+                      const void* beta, void* C, int ldc)
+{
+    uint64_t start = nowNs();
+
+    if (forward[routine][API_CBLAS]) {
+        // real routines take alpha and beta by value, complex ones by pointer
+        void* next = forward[routine][API_CBLAS];
+        if (routine == ROUTINE_SGEMM)
+            ((CblasSgemm)next)(order, transA, transB, M, N, K, *(const float*)alpha,
+                               A, lda, B, ldb, *(const float*)beta, C, ldc);
+        else if (routine == ROUTINE_DGEMM)
+            ((CblasDgemm)next)(order, transA, transB, M, N, K, *(const double*)alpha,
+                               A, lda, B, ldb, *(const double*)beta, C, ldc);
+        else
+            ((CblasComplexGemm)next)(order, transA, transB, M, N, K, alpha,
+                                     A, lda, B, ldb, beta, C, ldc);
+    } else {
+        int opA = cblasOp(transA), opB = cblasOp(transB);
+        if (opA < 0 || opB < 0 || (order != CBLAS_ROW_MAJOR && order != CBLAS_COL_MAJOR)) {
+            fprintf(stderr, "blas: cblas_%s called with invalid order or transpose\n",
+                    routineNames[routine]);
+            return;
+        }
+        if (order == CBLAS_ROW_MAJOR)
+            rowMajorGemm(routine, opA, opB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+        else
+            rowMajorGemm(routine, opB, opA, N, M, K, alpha, B, ldb, A, lda, beta, C, ldc);
+    }
+
+    countCall(routine, API_CBLAS, start, M, N, K);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Exported symbols
+////////////////////////////////////////////////////////////////////////////////
+
+#define BLAS_EXPORT extern "C" __attribute__((visibility("default")))
+
+BLAS_EXPORT void sgemm_(const char* transa, const char* transb, const int* m, const int* n,
+                        const int* k, const float* alpha, const float* A, const int* lda,
+                        const float* B, const int* ldb, const float* beta, float* C,
+                        const int* ldc)
+{
+    fortranGemm(ROUTINE_SGEMM, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+BLAS_EXPORT void dgemm_(const char* transa, const char* transb, const int* m, const int* n,
+                        const int* k, const double* alpha, const double* A, const int* lda,
+                        const double* B, const int* ldb, const double* beta, double* C,
+                        const int* ldc)
+{
+    fortranGemm(ROUTINE_DGEMM, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+BLAS_EXPORT void cgemm_(const char* transa, const char* transb, const int* m, const int* n,
+                        const int* k, const void* alpha, const void* A, const int* lda,
+                        const void* B, const int* ldb, const void* beta, void* C,
+                        const int* ldc)
+{
+    fortranGemm(ROUTINE_CGEMM, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+BLAS_EXPORT void zgemm_(const char* transa, const char* transb, const int* m, const int* n,
+                        const int* k, const void* alpha, const void* A, const int* lda,
+                        const void* B, const int* ldb, const void* beta, void* C,
+                        const int* ldc)
+{
+    fortranGemm(ROUTINE_ZGEMM, transa, transb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+BLAS_EXPORT void cblas_sgemm(int order, int transA, int transB, int M, int N, int K,
+                             float alpha, const float* A, int lda, const float* B, int ldb,
+                             float beta, float* C, int ldc)
+{
+    cblasGemm(ROUTINE_SGEMM, order, transA, transB, M, N, K, &alpha, A, lda, B, ldb, &beta, C, ldc);
+}
+
+BLAS_EXPORT void cblas_dgemm(int order, int transA, int transB, int M, int N, int K,
+                             double alpha, const double* A, int lda, const double* B, int ldb,
+                             double beta, double* C, int ldc)
+{
+    cblasGemm(ROUTINE_DGEMM, order, transA, transB, M, N, K, &alpha, A, lda, B, ldb, &beta, C, ldc);
+}
+
+BLAS_EXPORT void cblas_cgemm(int order, int transA, int transB, int M, int N, int K,
+                             const void* alpha, const void* A, int lda, const void* B, int ldb,
+                             const void* beta, void* C, int ldc)
+{
+    cblasGemm(ROUTINE_CGEMM, order, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+BLAS_EXPORT void cblas_zgemm(int order, int transA, int transB, int M, int N, int K,
+                             const void* alpha, const void* A, int lda, const void* B, int ldb,
+                             const void* beta, void* C, int ldc)
+{
+    cblasGemm(ROUTINE_ZGEMM, order, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
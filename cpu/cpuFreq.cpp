@@ -0,0 +1,185 @@
+// Effective CPU clock over timed regions.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "cpuFreq.h"
+
+static double freqTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static const char* sourceNames[] = { "auto", "perf", "sysfs", "probe" };
+
+const char* cpuFreqSourceName(int source)
+{
+    return (source >= CPUFREQ_AUTO && source <= CPUFREQ_PROBE) ? sourceNames[source] : "?";
+}
+
+int cpuFreqParseSource(const char* name)
+{
+    for (int i = CPUFREQ_AUTO; i <= CPUFREQ_PROBE; ++i)
+        if (strcmp(name, sourceNames[i]) == 0) return i;
+    return -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sources
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef __linux__
+static int openCounter(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+// The count, scaled up if the counter was multiplexed
+static double readCounter(int fd)
+{
+    uint64_t v[3];
+    if (read(fd, v, sizeof(v)) != (ssize_t)sizeof(v) || v[2] == 0) return 0;
+    return (double)v[0] * ((double)v[1] / (double)v[2]);
+}
+
+// Mean scaling_cur_freq over the CPUs, or 0 if there is none
+static double sysfsGHz(int cpus)
+{
+    double sum = 0;
+    int count = 0;
+    for (int c = 0; c < cpus; ++c) {
+        char path[96];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", c);
+        FILE* fp = fopen(path, "r");
+        if (!fp) continue;
+        long khz;
+        if (fscanf(fp, "%ld", &khz) == 1 && khz > 0) {
+            sum += khz * 1.0e-6;
+            ++count;
+        }
+        fclose(fp);
+    }
+    return count ? sum / count : 0;
+}
+
+// Clock of the calling thread from dependent adds; the best of a few tries,
+// so a preemption does not count. 0 where there is no probe.
+static double probeGHz()
+{
+#if defined(__x86_64__)
+    // a register operand: recent cores fold chains of immediate adds when
+    // renaming, and run them faster than one per cycle
+    const long iterations = 100000;    // 8 cycles each
+    double best = 0;
+    for (int t = 0; t < 3; ++t) {
+        long x = 0, n = iterations, one = 1;
+        double start = freqTime();
+        __asm__ volatile(
+            "1:\n\t"
+            "addq %2, %0\n\taddq %2, %0\n\taddq %2, %0\n\taddq %2, %0\n\t"
+            "addq %2, %0\n\taddq %2, %0\n\taddq %2, %0\n\taddq %2, %0\n\t"
+            "decq %1\n\t"
+            "jnz 1b"
+            : "+r"(x), "+r"(n)
+            : "r"(one));
+        double sec = freqTime() - start;
+        if (sec > 0 && 8.0 * iterations / sec * 1.0e-9 > best)
+            best = 8.0 * iterations / sec * 1.0e-9;
+    }
+    return best;
+#else
+    return 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Measuring
+////////////////////////////////////////////////////////////////////////////////
+
+bool cpuFreqOpen(CpuFreq* f, int source)
+{
+    memset(f, 0, sizeof(*f));
+    f->fdCycles = f->fdTask = -1;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    f->cpus = (cpus > 0) ? (int)cpus : 1;
+
+#ifdef __linux__
+    if (source == CPUFREQ_AUTO || source == CPUFREQ_PERF) {
+        f->fdCycles = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        f->fdTask = openCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+        if (f->fdCycles >= 0 && f->fdTask >= 0) {
+            f->source = CPUFREQ_PERF;
+            return true;
+        }
+        cpuFreqClose(f);
+    }
+#endif
+    if ((source == CPUFREQ_AUTO || source == CPUFREQ_SYSFS) && sysfsGHz(f->cpus) > 0) {
+        f->source = CPUFREQ_SYSFS;
+        return true;
+    }
+    if ((source == CPUFREQ_AUTO || source == CPUFREQ_PROBE) && probeGHz() > 0) {
+        f->source = CPUFREQ_PROBE;
+        return true;
+    }
+    fprintf(stderr, "cpuFreq: cannot measure the clock with %s\n", cpuFreqSourceName(source));
+    return false;
+}
+
+void cpuFreqClose(CpuFreq* f)
+{
+    if (f->fdCycles >= 0) close(f->fdCycles);
+    if (f->fdTask >= 0) close(f->fdTask);
+    f->fdCycles = f->fdTask = -1;
+}
+
+void cpuFreqStart(CpuFreq* f)
+{
+    if (f->source == CPUFREQ_SYSFS) f->startGHz = sysfsGHz(f->cpus);
+    else if (f->source == CPUFREQ_PROBE) f->startGHz = probeGHz();
+    f->startTime = freqTime();
+    if (f->source == CPUFREQ_PERF) {
+        f->startCycles = readCounter(f->fdCycles);
+        f->startTask = readCounter(f->fdTask);
+    }
+}
+
+void cpuFreqStop(CpuFreq* f, int threads, CpuFreqSample* out)
+{
+    double cycles = 0, task = 0;
+    if (f->source == CPUFREQ_PERF) {
+        cycles = readCounter(f->fdCycles) - f->startCycles;
+        task = readCounter(f->fdTask) - f->startTask;
+    }
+    out->seconds = freqTime() - f->startTime;
+
+    if (f->source == CPUFREQ_PERF) {
+        out->cycles = cycles;
+        out->ghz = (task > 0) ? cycles / task : 0;
+        return;
+    }
+    double stop = (f->source == CPUFREQ_SYSFS) ? sysfsGHz(f->cpus) : probeGHz();
+    out->ghz = 0.5 * (f->startGHz + stop);
+    // threads beyond the CPUs take turns, and add no cycles
+    int running = (threads < 1) ? 1 : (threads > f->cpus) ? f->cpus : threads;
+    out->cycles = out->ghz * 1.0e9 * out->seconds * running;
+}
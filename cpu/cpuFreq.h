@@ -0,0 +1,60 @@
+#ifndef _CPUFREQ_H_
+#define _CPUFREQ_H_
+
+// Effective CPU clock over timed regions.
+//
+// Turbo, AVX frequency offsets and thermal throttling move the clock from
+// run to run, so a rate is only comparable with another when the clocks
+// match. A CpuFreq measures the clock the program ran at between
+// cpuFreqStart() and cpuFreqStop(), from the first source that works:
+//
+//     perf    core cycles and task clock from perf_event_open, for the
+//             opening thread and every thread it starts afterwards; cycles
+//             over running time is the APERF/MPERF effective frequency
+//     sysfs   scaling_cur_freq of every CPU, averaged, read at start and stop
+//     probe   a chain of dependent adds, one cycle each, timed at start and
+//             stop (x86-64 only)
+//
+// perf counts the cycles inside the region, user mode only; the others
+// estimate them as clock x wall time x threads, at most one thread per
+// online CPU. perf needs perf_event_paranoid <= 2 and hardware counters,
+// which virtual machines often lack. Open it before the threads to be
+// measured are started, as inherited counters do not reach threads that
+// already exist.
+
+#define CPUFREQ_AUTO   0
+#define CPUFREQ_PERF   1
+#define CPUFREQ_SYSFS  2
+#define CPUFREQ_PROBE  3
+
+typedef struct {
+    int    source;          // CPUFREQ_PERF, _SYSFS or _PROBE once open
+    int    fdCycles;
+    int    fdTask;
+    int    cpus;
+    double startTime;
+    double startCycles;
+    double startTask;       // ns
+    double startGHz;
+} CpuFreq;
+
+typedef struct {
+    double seconds;         // wall time
+    double cycles;          // summed over threads
+    double ghz;             // effective clock while running
+} CpuFreqSample;
+
+// Opens source, or the first that works for CPUFREQ_AUTO; false with a
+// message if none does
+bool cpuFreqOpen(CpuFreq* f, int source);
+void cpuFreqClose(CpuFreq* f);
+
+void cpuFreqStart(CpuFreq* f);
+// threads is how many ran the region, for the sources that cannot count
+void cpuFreqStop(CpuFreq* f, int threads, CpuFreqSample* out);
+
+const char* cpuFreqSourceName(int source);
+// "auto", "perf", "sysfs" or "probe"; -1 if none
+int cpuFreqParseSource(const char* name);
+
+#endif // _CPUFREQ_H_
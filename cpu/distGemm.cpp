@@ -0,0 +1,422 @@
+// Distributed GEMM over a 2-D grid of processes: SUMMA and Cannon.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "distGemm.h"
+#include "gemm.h"
+#include "matrixIO.h"
+#include "multithreading.h"
+
+typedef struct {
+    int    peer;
+    void*  buf;
+    size_t bytes;
+} Transfer;
+
+// The transfers of one step. Sends and receives run on two threads of their
+// own, so no ordering of them between ranks can deadlock.
+typedef struct {
+    Transport* t;
+    Transfer   sends[2 * TRANSPORT_MAX_RANKS];
+    int        nSends;
+    Transfer   recvs[2];
+    int        nRecvs;
+    void     (*prepare)(void* arg);     // on the sending thread, before sending
+    void*      prepareArg;
+    bool       sendOk, recvOk;
+    double     sendSeconds, recvSeconds;
+    CUTThread  threads[2];
+    int        nThreads;
+} CommStep;
+
+// A K panel of SUMMA, inside one K-block of A and one of B
+typedef struct {
+    int k0, width;
+    int ownerCol;                       // grid column holding it in A
+    int ownerRow;                       // grid row holding it in B
+} Panel;
+
+// SUMMA packs the owner's panel of A on the sending thread
+typedef struct {
+    const void* A;
+    int         lda;
+    int         col;
+    int         rows, width;
+    size_t      elem;
+    void*       dst;
+} PackPanel;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+int distParseAlgorithm(const char* name)
+{
+    if (strcmp(name, "summa") == 0)  return DIST_SUMMA;
+    if (strcmp(name, "cannon") == 0) return DIST_CANNON;
+    return -1;
+}
+
+const char* distAlgorithmName(int algorithm)
+{
+    return (algorithm == DIST_CANNON) ? "cannon" : "summa";
+}
+
+void distBlock(int n, int parts, int index, int* offset, int* length)
+{
+    int q = n / parts, r = n % parts;
+    *offset = index * q + (index < r ? index : r);
+    *length = q + (index < r ? 1 : 0);
+}
+
+// Block holding element k when n is split as by distBlock
+static int blockOf(int n, int parts, int k)
+{
+    int q = n / parts, r = n % parts;
+    if (k < r * (q + 1)) return k / (q + 1);
+    return r + (k - r * (q + 1)) / q;
+}
+
+static void localGemm(int M, int N, int K, const float* A, int lda, const float* B, int ldb,
+                      float beta, float* C, int ldc)
+{
+    gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0f, A, lda, B, ldb, beta, C, ldc);
+}
+
+static void localGemm(int M, int N, int K, const double* A, int lda, const double* B, int ldb,
+                      double beta, double* C, int ldc)
+{
+    gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0, A, lda, B, ldb, beta, C, ldc);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Communication steps
+////////////////////////////////////////////////////////////////////////////////
+
+static void commReset(CommStep* step, Transport* t)
+{
+    step->t = t;
+    step->nSends = 0;
+    step->nRecvs = 0;
+    step->prepare = NULL;
+    step->prepareArg = NULL;
+    step->sendOk = step->recvOk = true;
+    step->sendSeconds = step->recvSeconds = 0;
+    step->nThreads = 0;
+}
+
+static void commSend(CommStep* step, int peer, const void* buf, size_t bytes)
+{
+    Transfer& x = step->sends[step->nSends++];
+    x.peer = peer;
+    x.buf = (void*)buf;
+    x.bytes = bytes;
+}
+
+static void commRecv(CommStep* step, int peer, void* buf, size_t bytes)
+{
+    Transfer& x = step->recvs[step->nRecvs++];
+    x.peer = peer;
+    x.buf = buf;
+    x.bytes = bytes;
+}
+
+static CUT_THREADPROC sendThread(void* arg)
+{
+    CommStep* step = (CommStep*)arg;
+    double start = now();
+    if (step->prepare) step->prepare(step->prepareArg);
+    for (int i = 0; i < step->nSends && step->sendOk; ++i)
+        step->sendOk = step->t->send(step->t, step->sends[i].peer, step->sends[i].buf, step->sends[i].bytes);
+    step->sendSeconds = now() - start;
+    CUT_THREADEND;
+}
+
+static CUT_THREADPROC recvThread(void* arg)
+{
+    CommStep* step = (CommStep*)arg;
+    double start = now();
+    for (int i = 0; i < step->nRecvs && step->recvOk; ++i)
+        step->recvOk = step->t->recv(step->t, step->recvs[i].peer, step->recvs[i].buf, step->recvs[i].bytes);
+    step->recvSeconds = now() - start;
+    CUT_THREADEND;
+}
+
+static void commStart(CommStep* step)
+{
+    if (step->prepare || step->nSends > 0)
+        step->threads[step->nThreads++] = cutStartThread((CUT_THREADROUTINE)sendThread, step);
+    if (step->nRecvs > 0)
+        step->threads[step->nThreads++] = cutStartThread((CUT_THREADROUTINE)recvThread, step);
+}
+
+// Waits for the step's transfers and accounts for them
+static bool commFinish(CommStep* step, DistStats* stats)
+{
+    double start = now();
+    cutWaitForThreads(step->threads, step->nThreads);
+    stats->waitSeconds += now() - start;
+    stats->commSeconds += (step->sendSeconds > step->recvSeconds) ? step->sendSeconds : step->recvSeconds;
+    for (int i = 0; i < step->nSends; ++i)
+        stats->bytesSent += step->sends[i].bytes;
+    return step->sendOk && step->recvOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// SUMMA
+////////////////////////////////////////////////////////////////////////////////
+
+static void packPanel(void* arg)
+{
+    PackPanel* p = (PackPanel*)arg;
+    for (int r = 0; r < p->rows; ++r)
+        memcpy((char*)p->dst + (size_t)r * p->width * p->elem,
+               (const char*)p->A + ((size_t)r * p->lda + p->col) * p->elem,
+               (size_t)p->width * p->elem);
+}
+
+// One rank's view of a SUMMA product
+template <typename T>
+struct Summa {
+    Transport*         t;
+    int                gridRows, gridCols;
+    int                pi, pj;
+    int                mi, nj;          // C block
+    int                aOff, ka;        // K range of the A block
+    int                bOff;            // start of the B block's K range
+    const T*           A;
+    const T*           B;
+    std::vector<Panel> panels;
+    std::vector<T>     aBuf[2], bBuf[2];
+    CommStep           steps[2];
+    PackPanel          packs[2];
+};
+
+// Sets up the transfers that bring panel p into buffer slot
+template <typename T>
+static CommStep* summaStep(Summa<T>* s, int p, int slot)
+{
+    const Panel& P = s->panels[p];
+    CommStep* step = &s->steps[slot];
+    commReset(step, s->t);
+
+    size_t aBytes = sizeof(T) * (size_t)s->mi * P.width;
+    size_t bBytes = sizeof(T) * (size_t)P.width * s->nj;
+    T* a = &s->aBuf[slot][0];
+
+    // the owner packs its panel of A into the slot too, and sends that
+    if (s->pj == P.ownerCol) {
+        PackPanel* pack = &s->packs[slot];
+        pack->A = s->A;
+        pack->lda = s->ka;
+        pack->col = P.k0 - s->aOff;
+        pack->rows = s->mi;
+        pack->width = P.width;
+        pack->elem = sizeof(T);
+        pack->dst = a;
+        step->prepare = packPanel;
+        step->prepareArg = pack;
+        for (int c = 0; c < s->gridCols; ++c)
+            if (c != s->pj) commSend(step, s->pi * s->gridCols + c, a, aBytes);
+    } else {
+        commRecv(step, s->pi * s->gridCols + P.ownerCol, a, aBytes);
+    }
+
+    // rows of B are contiguous, so the owner sends them in place
+    if (s->pi == P.ownerRow) {
+        const T* rows = s->B + (size_t)(P.k0 - s->bOff) * s->nj;
+        for (int r = 0; r < s->gridRows; ++r)
+            if (r != s->pi) commSend(step, r * s->gridCols + s->pj, rows, bBytes);
+    } else {
+        commRecv(step, P.ownerRow * s->gridCols + s->pj, &s->bBuf[slot][0], bBytes);
+    }
+    return step;
+}
+
+template <typename T>
+static bool summa(Transport* t, int gridRows, int gridCols, int M, int N, int K,
+                  const T* A, const T* B, T* C, int kblock, DistStats* stats)
+{
+    Summa<T>* s = new Summa<T>;
+    int off, kb;
+    s->t = t;
+    s->gridRows = gridRows;
+    s->gridCols = gridCols;
+    s->pi = t->rank / gridCols;
+    s->pj = t->rank % gridCols;
+    s->A = A;
+    s->B = B;
+    distBlock(M, gridRows, s->pi, &off, &s->mi);
+    distBlock(N, gridCols, s->pj, &off, &s->nj);
+    distBlock(K, gridCols, s->pj, &s->aOff, &s->ka);
+    distBlock(K, gridRows, s->pi, &s->bOff, &kb);
+
+    // Panels end at every block boundary of A and of B, and at most kblock
+    // apart
+    int maxWidth = 0;
+    for (int k = 0; k < K; ) {
+        Panel p;
+        int len;
+        p.k0 = k;
+        p.ownerCol = blockOf(K, gridCols, k);
+        p.ownerRow = blockOf(K, gridRows, k);
+        int end = k + kblock;
+        distBlock(K, gridCols, p.ownerCol, &off, &len);
+        if (off + len < end) end = off + len;
+        distBlock(K, gridRows, p.ownerRow, &off, &len);
+        if (off + len < end) end = off + len;
+        p.width = end - k;
+        if (p.width > maxWidth) maxWidth = p.width;
+        s->panels.push_back(p);
+        k = end;
+    }
+    for (int b = 0; b < 2; ++b) {
+        s->aBuf[b].resize((size_t)s->mi * maxWidth + 1);
+        s->bBuf[b].resize((size_t)maxWidth * s->nj + 1);
+    }
+    if (s->panels.empty())
+        memset(C, 0, sizeof(T) * (size_t)s->mi * s->nj);
+
+    // The transfers for panel p + 1 run while panel p is multiplied
+    bool ok = true;
+    if (!s->panels.empty()) {
+        CommStep* step = summaStep(s, 0, 0);
+        commStart(step);
+        ok = commFinish(step, stats);
+    }
+    for (size_t p = 0; p < s->panels.size() && ok; ++p) {
+        int slot = (int)(p % 2);
+        CommStep* next = NULL;
+        if (p + 1 < s->panels.size()) {
+            next = summaStep(s, (int)p + 1, 1 - slot);
+            commStart(next);
+        }
+
+        const Panel& P = s->panels[p];
+        const T* b = (s->pi == P.ownerRow) ? B + (size_t)(P.k0 - s->bOff) * s->nj : &s->bBuf[slot][0];
+        double start = now();
+        localGemm(s->mi, s->nj, P.width, &s->aBuf[slot][0], P.width, b, s->nj,
+                  p == 0 ? (T)0 : (T)1, C, s->nj);
+        stats->computeSeconds += now() - start;
+
+        if (next) ok = commFinish(next, stats);
+    }
+    delete s;
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Cannon
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static bool cannon(Transport* t, int p, int M, int N, int K,
+                   const T* A, const T* B, T* C, DistStats* stats)
+{
+    int i = t->rank / p, j = t->rank % p;
+    int mOff, mi, nOff, nj, off, len;
+    distBlock(M, p, i, &mOff, &mi);
+    distBlock(N, p, j, &nOff, &nj);
+
+    int maxK = (K + p - 1) / p;
+    std::vector<T> aBuf[2], bBuf[2];
+    for (int s = 0; s < 2; ++s) {
+        aBuf[s].resize((size_t)mi * maxK + 1);
+        bBuf[s].resize((size_t)maxK * nj + 1);
+    }
+
+    // Skew: A(i, j) goes i places left and B(i, j) j places up, so (i, j)
+    // starts with K-block (i + j) % p of both
+    CommStep step;
+    commReset(&step, t);
+    int kMine, kFirst = (i + j) % p;
+    distBlock(K, p, j, &off, &kMine);
+    size_t aMine = sizeof(T) * (size_t)mi * kMine;
+    distBlock(K, p, i, &off, &len);
+    size_t bMine = sizeof(T) * (size_t)len * nj;
+    distBlock(K, p, kFirst, &off, &len);
+    size_t aFirst = sizeof(T) * (size_t)mi * len, bFirst = sizeof(T) * (size_t)len * nj;
+
+    if (i == 0) memcpy(&aBuf[0][0], A, aMine);
+    else {
+        commSend(&step, i * p + (j - i + p) % p, A, aMine);
+        commRecv(&step, i * p + kFirst, &aBuf[0][0], aFirst);
+    }
+    if (j == 0) memcpy(&bBuf[0][0], B, bMine);
+    else {
+        commSend(&step, ((i - j + p) % p) * p + j, B, bMine);
+        commRecv(&step, kFirst * p + j, &bBuf[0][0], bFirst);
+    }
+    commStart(&step);
+    bool ok = commFinish(&step, stats);
+
+    for (int s = 0; s < p && ok; ++s) {
+        int cur = s % 2, next = 1 - cur;
+        int k = (i + j + s) % p;
+        distBlock(K, p, k, &off, &len);
+        bool more = s + 1 < p;
+
+        // shift left and up, bringing in K-block k + 1 from the right and below
+        if (more) {
+            int kNext, offNext;
+            distBlock(K, p, (k + 1) % p, &offNext, &kNext);
+            commReset(&step, t);
+            commSend(&step, i * p + (j - 1 + p) % p, &aBuf[cur][0], sizeof(T) * (size_t)mi * len);
+            commRecv(&step, i * p + (j + 1) % p, &aBuf[next][0], sizeof(T) * (size_t)mi * kNext);
+            commSend(&step, ((i - 1 + p) % p) * p + j, &bBuf[cur][0], sizeof(T) * (size_t)len * nj);
+            commRecv(&step, ((i + 1) % p) * p + j, &bBuf[next][0], sizeof(T) * (size_t)kNext * nj);
+            commStart(&step);
+        }
+
+        double start = now();
+        localGemm(mi, nj, len, &aBuf[cur][0], len, &bBuf[cur][0], nj,
+                  s == 0 ? (T)0 : (T)1, C, nj);
+        stats->computeSeconds += now() - start;
+
+        if (more) ok = commFinish(&step, stats);
+    }
+    return ok;
+}
+
+bool distGemm(Transport* t, int algorithm, int gridRows, int gridCols, int dtype,
+              int M, int N, int K, const void* A, const void* B, void* C,
+              int kblock, DistStats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (gridRows * gridCols != t->size || M < 0 || N < 0 || K < 0 || kblock <= 0) {
+        fprintf(stderr, "dist: a %dx%d grid does not fit %d ranks\n", gridRows, gridCols, t->size);
+        return false;
+    }
+    if (algorithm == DIST_CANNON && gridRows != gridCols) {
+        fprintf(stderr, "dist: Cannon needs a square grid, not %dx%d\n", gridRows, gridCols);
+        return false;
+    }
+    if (dtype != MATRIX_FLOAT32 && dtype != MATRIX_FLOAT64) {
+        fprintf(stderr, "dist: only float32 and float64 are supported\n");
+        return false;
+    }
+
+    double start = now();
+    bool ok;
+    if (dtype == MATRIX_FLOAT64) {
+        ok = (algorithm == DIST_CANNON)
+           ? cannon<double>(t, gridRows, M, N, K, (const double*)A, (const double*)B, (double*)C, stats)
+           : summa<double>(t, gridRows, gridCols, M, N, K, (const double*)A, (const double*)B,
+                           (double*)C, kblock, stats);
+    } else {
+        ok = (algorithm == DIST_CANNON)
+           ? cannon<float>(t, gridRows, M, N, K, (const float*)A, (const float*)B, (float*)C, stats)
+           : summa<float>(t, gridRows, gridCols, M, N, K, (const float*)A, (const float*)B,
+                          (float*)C, kblock, stats);
+    }
+    stats->totalSeconds = now() - start;
+    if (!ok) fprintf(stderr, "dist: rank %d lost a peer\n", t->rank);
+    return ok;
+}
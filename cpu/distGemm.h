@@ -0,0 +1,52 @@
+#ifndef _DISTGEMM_H_
+#define _DISTGEMM_H_
+
+// Distributed GEMM over a 2-D grid of processes.
+//
+// Rank r sits at row r / gridCols, column r % gridCols of the grid. With M
+// split into gridRows blocks, N into gridCols and K into gridCols for A and
+// gridRows for B (see distBlock), the rank at (i, j) holds, row-major and
+// packed:
+//
+//     A(i, j)   rows of M-block i, columns of A's K-block j
+//     B(i, j)   rows of B's K-block i, columns of N-block j
+//     C(i, j)   rows of M-block i, columns of N-block j      (output)
+//
+// SUMMA walks K in panels: the owners broadcast each panel of A along their
+// grid row and of B down their grid column. Cannon (square grids only) skews
+// A and B once, then shifts them one step left and up per block of K. Either
+// way the transfers for the next step run on communication threads while the
+// local engine multiplies the current one.
+
+#include <stdint.h>
+
+#include "transport.h"
+
+#define DIST_SUMMA  0
+#define DIST_CANNON 1
+
+typedef struct {
+    double   computeSeconds;        // in the local engine
+    double   commSeconds;           // transfers, on the communication threads
+    double   waitSeconds;           // compute stalled waiting for transfers
+    double   totalSeconds;
+    uint64_t bytesSent;
+} DistStats;
+
+// "summa" or "cannon"; returns -1 for anything else
+int distParseAlgorithm(const char* name);
+const char* distAlgorithmName(int algorithm);
+
+// Offset and length of block index when n is split into parts blocks, the
+// first n % parts of them one longer
+void distBlock(int n, int parts, int index, int* offset, int* length);
+
+// C(i, j) = A * B for this rank's blocks (dtype MATRIX_FLOAT32 or _FLOAT64).
+// Every rank calls it with the same arguments apart from the blocks. kblock
+// is the SUMMA panel width. Returns false if the arguments are invalid or a
+// peer went away.
+bool distGemm(Transport* t, int algorithm, int gridRows, int gridCols, int dtype,
+              int M, int N, int K, const void* A, const void* B, void* C,
+              int kblock, DistStats* stats);
+
+#endif // _DISTGEMM_H_
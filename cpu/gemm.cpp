@@ -0,0 +1,2410 @@
+// Blocked, packed, multithreaded CPU GEMM engine.
+//
+// The loop structure follows Goto/BLIS: for each NC-wide panel of columns and
+// each KC-deep slice of K, the panel of B is packed once and shared by every
+// thread; each thread then takes MC-high blocks of rows, packs its block of A
+// and sweeps MR x NR register tiles across the panel. The panels of B are
+// double buffered: the next one is packed by tasks spread among the current
+// panel's tiles, so only the first panel is packed in a phase of its own.
+//
+// Products from different threads run side by side. Each is a chain of
+// phases (pack a panel of B, then multiply every block of rows against it)
+// whose tasks the workers take one at a time. A worker picking its next task
+// takes the highest priority class with work ready and, within the class, the
+// product that has had the least work per unit of weight, so a long product
+// gives way to an urgent one at the next tile boundary. Products are admitted
+// only while their pack buffers fit in the memory budget.
+//
+// An asynchronous product has no caller working on it: it waits for the
+// products it depends on, is admitted as soon as it fits, and is completed by
+// whichever thread finishes its last task, which then fires its callbacks and
+// releases its dependents.
+//
+// Cancellation is cooperative: a stopped product is handed out no further
+// tasks, the tiles already running finish, and the last one retires it
+// through the usual path, so no thread is interrupted and no buffer is lost.
+// Deadlines are checked each time a task is claimed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <algorithm>
+
+#include "multithreading.h"
+#include "arena.h"
+#include "gemm.h"
+#include "gemmTrace.h"
+#include "gemmMetrics.h"
+#include "gemmJit.h"
+#include "gemmPlugin.h"
+#include "matrixIO.h"
+
+// Cache blocking: the KC x NC panel of B lives in L3, each thread's MC x KC
+// block of A in L2 and a KC x NR sliver of B in L1
+#define GEMM_KC 256
+#define GEMM_MC 128
+#define GEMM_NC 4096
+
+// Products below this many flops stay on the calling thread
+#define GEMM_SERIAL_FLOPS (2.0 * 96 * 96 * 96)
+
+#define GEMM_MAX_THREADS 256
+
+// Products admitted at once; each holds a slot of pack buffers
+#define GEMM_MAX_ACTIVE 16
+
+// Slivers of B packed by one task
+#define GEMM_PACKB_SLIVERS 8
+
+// Quantized B is stored in blocks of this many columns, and products with
+// at most GEMM_QUANT_DIRECT_M rows dequantize it in the kernel instead of
+// into packed panels
+#define GEMM_QUANT_NB       64
+#define GEMM_QUANT_DIRECT_M 16
+
+// Register tile per element type, and the element type of C. The integer
+// types accumulate in 64 bits and have no generated or plugin kernels;
+// uint32_t is for products modulo p.
+template <typename T> struct GemmTraits;
+template <> struct GemmTraits<float>    { enum { MR = 4, NR = 16, DTYPE = MATRIX_FLOAT32 }; typedef float Out; };
+template <> struct GemmTraits<double>   { enum { MR = 4, NR = 8, DTYPE = MATRIX_FLOAT64 }; typedef double Out; };
+template <> struct GemmTraits<int32_t>  { enum { MR = 4, NR = 8, DTYPE = 0 }; typedef int64_t Out; };
+template <> struct GemmTraits<int64_t>  { enum { MR = 4, NR = 8, DTYPE = 0 }; typedef int64_t Out; };
+template <> struct GemmTraits<uint32_t> { enum { MR = 4, NR = 8, DTYPE = 0 }; typedef uint32_t Out; };
+
+////////////////////////////////////////////////////////////////////////////////
+// Products and the worker pool
+////////////////////////////////////////////////////////////////////////////////
+
+struct GemmProduct;
+struct GemmFuture;
+
+// One task of the current phase; packA is the running thread's A buffer
+typedef void (*ProductTaskFn)(GemmProduct* product, int task, void* packA);
+// Sets up the next phase; false when the product is complete
+typedef bool (*ProductAdvanceFn)(GemmProduct* product);
+
+// Scheduling state of a product in flight; the typed job derives from it.
+// Everything here is guarded by schedLock.
+struct GemmProduct {
+    int              priority;
+    int              weight;
+    double           vtime;         // work received / weight
+    size_t           bytes;         // pack memory charged to the budget
+    int              slot;
+    void*            packB[2];      // the slot's buffers for B, used in turn
+    bool             serial;        // only the caller works on it
+    bool             done;
+    int              stopped;       // GEMM_STATUS_CANCELLED or _EXPIRED once
+                                    // no further tasks are handed out
+    GemmControl*     control;       // NULL when nobody watches it
+    GemmFuture*      future;        // asynchronous products only
+    void           (*destroy)(GemmProduct* product);
+
+    // current phase
+    ProductTaskFn    task;
+    ProductAdvanceFn advance;
+    int              nTasks;
+    int              nextTask;
+    int              running;       // tasks claimed but not finished
+    double           taskCost;      // flops of one task
+
+    GemmProduct*     next;          // in the active list
+};
+
+// Cancellation, deadline and progress shared by the products submitted under
+// it. The engine updates the counters with atomics, so readers need no lock.
+struct GemmControl {
+    int               cancelled;
+    int               expired;      // a product ran past the deadline
+    uint64_t          deadline;     // CLOCK_MONOTONIC ns, 0 = none
+    uint64_t          start;        // when the first product started
+    int               active;       // products submitted and not complete
+    uint64_t          tilesDone, tilesTotal;
+    uint64_t          flopsDone, flopsTotal;
+};
+
+// Completion callback; holds a reference to its future
+struct GemmCallbackNode {
+    GemmCallback      fn;
+    void*             arg;
+    GemmFuture*       future;
+    GemmCallbackNode* next;
+};
+
+// A product waiting on this one; holds a reference to it
+struct GemmDependent {
+    GemmFuture*       future;
+    GemmDependent*    next;
+};
+
+// Handle of an asynchronous product, guarded by schedLock. The engine holds
+// a reference until the product completes and the caller one until release.
+struct GemmFuture {
+    int               refs;
+    int               status;       // GEMM_STATUS_*
+    GemmProduct*      product;      // until it completes
+    int               pendingDeps;  // products it still waits for
+    bool              queued;       // waiting for admission
+    bool              admitted;
+    GemmDependent*    dependents;
+    GemmCallbackNode* callbacks;
+    GemmFuture*       nextQueued;
+    GemmControl*      control;      // own, unless the submitter attached one
+    GemmControl       own;
+    uint64_t          metricsBegin; // gemmMetricsBegin at submission
+    int               metricsOp;
+    int               M, N, K;
+};
+
+static pthread_mutex_t schedLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  schedWake = PTHREAD_COND_INITIALIZER;    // workers: work or quit
+static pthread_cond_t  schedDone = PTHREAD_COND_INITIALIZER;    // callers: progress
+
+// Pool and scheduler state, guarded by schedLock
+static struct {
+    int             nThreads;       // requested, 0 = all CPUs
+    int             affinity;
+    int             nStarted;       // threads in the running pool, caller included
+    int             startedAffinity;
+    CUTThread       workers[GEMM_MAX_THREADS];
+    bool            quit;
+    bool            restarting;     // the pool is being stopped or started
+    int             ready;          // workers that have started waiting
+
+    GemmProduct*    active;         // admitted products
+    int             nActive;
+    int             waiting[GEMM_PRIORITY_COUNT];   // products awaiting admission
+    size_t          budget;         // 0 = unlimited
+    size_t          charged;
+    GemmFuture*     queued;         // asynchronous products ready to start
+    int             nPending;       // asynchronous products not yet complete
+    GemmCallbackNode* fired;        // callbacks due, in order
+    GemmCallbackNode* firedTail;
+
+    Arena           packA[GEMM_MAX_THREADS];        // per worker
+    struct {
+        Arena       packA;          // the caller's
+        Arena       packB[2];
+        bool        used;
+        bool        helped;         // packA is lent to a waiting thread
+    } slots[GEMM_MAX_ACTIVE];
+} pool;
+
+// Scheduling class of products submitted by this thread
+static __thread int threadPriority = GEMM_PRIORITY_NORMAL;
+static __thread int threadWeight = 1;
+
+static __thread GemmControl* threadControl = NULL;
+
+// Set in the pool's own threads, which must never restart it
+static __thread bool threadIsWorker = false;
+
+static int onlineCpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static int wantedThreads()
+{
+    int n = pool.nThreads > 0 ? pool.nThreads : onlineCpus();
+    return (n > GEMM_MAX_THREADS) ? GEMM_MAX_THREADS : n;
+}
+
+// Mask of the calling thread before the engine first pinned it
+static cpu_set_t callerMask;
+static bool      callerPinned = false;
+
+static void pinThread(int thread, int nThreads, int policy)
+{
+    if (thread == 0 && !callerPinned) {
+        if (policy == GEMM_AFFINITY_NONE) return;
+        pthread_getaffinity_np(pthread_self(), sizeof(callerMask), &callerMask);
+        callerPinned = true;
+    }
+    if (policy == GEMM_AFFINITY_NONE) {
+        // only the caller can get here: give it back its own mask
+        pthread_setaffinity_np(pthread_self(), sizeof(callerMask), &callerMask);
+        callerPinned = false;
+        return;
+    }
+
+    int nCpus = onlineCpus();
+    int cpu = (policy == GEMM_AFFINITY_SCATTER && nThreads < nCpus)
+            ? (int)((long)thread * nCpus / nThreads)
+            : thread % nCpus;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static uint64_t nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// Why products under control must stop, or 0
+static int controlStop(GemmControl* control)
+{
+    if (!control) return 0;
+    if (__atomic_load_n(&control->cancelled, __ATOMIC_RELAXED)) return GEMM_STATUS_CANCELLED;
+    uint64_t deadline = __atomic_load_n(&control->deadline, __ATOMIC_RELAXED);
+    if (deadline && nowNs() >= deadline) {
+        __atomic_store_n(&control->expired, 1, __ATOMIC_RELAXED);
+        return GEMM_STATUS_EXPIRED;
+    }
+    return 0;
+}
+
+// The product a worker should help next: highest class first, then the
+// least served. Called with schedLock held.
+static GemmProduct* pickProduct()
+{
+    GemmProduct* best = NULL;
+    for (GemmProduct* p = pool.active; p; p = p->next) {
+        if (p->serial || p->nextTask >= p->nTasks) continue;
+        if (!best || p->priority < best->priority
+            || (p->priority == best->priority && p->vtime < best->vtime))
+            best = p;
+    }
+    return best;
+}
+
+static void finishFuture(GemmFuture* f, int status);
+static void runFired();
+static void admitQueued();
+
+// Marks a product complete once its last task is done. Called with schedLock
+// held; an asynchronous product is freed.
+static void completeProduct(GemmProduct* product)
+{
+    product->done = true;
+    if (product->future)
+        finishFuture(product->future, product->stopped ? product->stopped : GEMM_STATUS_DONE);
+    // the caller may be waiting for the phase to turn over
+    pthread_cond_broadcast(&schedDone);
+}
+
+// Hands out no further tasks of product; the tiles already running finish,
+// and the last of them completes it. Called with schedLock held.
+static void stopProduct(GemmProduct* product, int status)
+{
+    product->stopped = status;
+    product->nTasks = product->nextTask;
+    if (product->running == 0) completeProduct(product);
+}
+
+// Claims and runs the next task of product, advancing it when the phase is
+// complete. Called with schedLock held; drops it while the task runs.
+static void runTask(GemmProduct* product, void* packA)
+{
+    int stop = controlStop(product->control);
+    if (stop) {
+        stopProduct(product, stop);
+        runFired();
+        return;
+    }
+
+    int task = product->nextTask++;
+    product->running++;
+    product->vtime += product->taskCost / product->weight;
+    pthread_mutex_unlock(&schedLock);
+
+    product->task(product, task, packA);
+
+    pthread_mutex_lock(&schedLock);
+    if (--product->running == 0 && product->nextTask == product->nTasks) {
+        if (!product->stopped && product->advance(product)) {
+            if (!product->serial) pthread_cond_broadcast(&schedWake);
+            pthread_cond_broadcast(&schedDone);
+        } else {
+            completeProduct(product);
+            runFired();
+        }
+    }
+}
+
+static CUT_THREADPROC workerMain(void* p)
+{
+    int thread = (int)(intptr_t)p;
+    threadIsWorker = true;
+
+    pthread_mutex_lock(&schedLock);
+    pinThread(thread, pool.nStarted, pool.startedAffinity);
+    if (++pool.ready == pool.nStarted - 1)
+        pthread_cond_broadcast(&schedDone);
+    for (;;) {
+        GemmProduct* product = NULL;
+        while (!pool.quit && !(product = pickProduct()))
+            pthread_cond_wait(&schedWake, &schedLock);
+        if (pool.quit) break;
+        runTask(product, pool.packA[thread].base);
+    }
+    pthread_mutex_unlock(&schedLock);
+    CUT_THREADEND;
+}
+
+// Called without schedLock, while pool.restarting keeps products out
+static void stopPool()
+{
+    if (pool.nStarted == 0) return;
+
+    pthread_mutex_lock(&schedLock);
+    pool.quit = true;
+    pthread_cond_broadcast(&schedWake);
+    pthread_mutex_unlock(&schedLock);
+    cutWaitForThreads(pool.workers, pool.nStarted - 1);
+
+    for (int t = 1; t < pool.nStarted; ++t)
+        arenaDestroy(&pool.packA[t]);
+    pool.quit = false;
+    pool.nStarted = 0;
+    pool.ready = 0;
+}
+
+static bool startPool(int n, int affinity)
+{
+    // Pack buffers are sized for the largest element type
+    for (int t = 1; t < n; ++t) {
+        if (!arenaInit(&pool.packA[t], sizeof(double) * GEMM_MC * GEMM_KC)) {
+            fprintf(stderr, "gemm: cannot allocate pack buffers\n");
+            while (--t >= 1) arenaDestroy(&pool.packA[t]);
+            return false;
+        }
+    }
+
+    pool.nStarted = n;
+    pool.startedAffinity = affinity;
+    pinThread(0, n, affinity);
+    for (int t = 1; t < n; ++t)
+        pool.workers[t - 1] = cutStartThread((CUT_THREADROUTINE)workerMain, (void*)(intptr_t)t);
+
+    pthread_mutex_lock(&schedLock);
+    while (pool.ready < n - 1)
+        pthread_cond_wait(&schedDone, &schedLock);
+    pthread_mutex_unlock(&schedLock);
+    return true;
+}
+
+// Brings the pool in line with the configuration once no product is in
+// flight; until then products keep the running pool. Called with schedLock
+// held, which is dropped while threads start or stop.
+static bool ensurePool()
+{
+    // a completion callback submitting work cannot join its own pool
+    if (threadIsWorker) return true;
+
+    for (;;) {
+        while (pool.restarting)
+            pthread_cond_wait(&schedDone, &schedLock);
+
+        int n = wantedThreads();
+        if (pool.nStarted == n && pool.startedAffinity == pool.affinity) return true;
+        if (pool.nActive > 0) return true;
+
+        pool.restarting = true;
+        int affinity = pool.affinity;
+        pthread_mutex_unlock(&schedLock);
+        stopPool();
+        bool ok = startPool(n, affinity);
+        pthread_mutex_lock(&schedLock);
+        pool.restarting = false;
+        pthread_cond_broadcast(&schedDone);
+        if (!ok) return false;
+        admitQueued();
+    }
+}
+
+static void destroySlots()
+{
+    for (int s = 0; s < GEMM_MAX_ACTIVE; ++s) {
+        arenaDestroy(&pool.slots[s].packA);
+        arenaDestroy(&pool.slots[s].packB[0]);
+        arenaDestroy(&pool.slots[s].packB[1]);
+    }
+}
+
+#define ADMIT_FAILED (-2)
+
+// Slot for product if it may start now: a slot is free, its pack buffers fit
+// in the budget, and no product of a more urgent class is waiting. A product
+// larger than the whole budget still runs, alone. Returns -1 while it must
+// wait. Called with schedLock held.
+static int admissionSlot(const GemmProduct* product)
+{
+    bool urgentWaiting = false;
+    for (int c = 0; c < product->priority; ++c)
+        urgentWaiting |= pool.waiting[c] > 0;
+
+    int slot = -1;
+    for (int s = 0; s < GEMM_MAX_ACTIVE && slot < 0; ++s)
+        if (!pool.slots[s].used) slot = s;
+
+    bool fits = pool.budget == 0 || pool.nActive == 0
+             || pool.charged + product->bytes <= pool.budget;
+
+    if (slot < 0 || !fits || urgentWaiting || pool.restarting) return -1;
+
+    // Slot buffers are mapped on first use and kept; pages are only touched
+    // as far as products need them
+    if (!pool.slots[slot].packA.base
+        && (!arenaInit(&pool.slots[slot].packA, sizeof(double) * GEMM_MC * GEMM_KC)
+            || !arenaInit(&pool.slots[slot].packB[0], sizeof(double) * GEMM_KC * (GEMM_NC + 16))
+            || !arenaInit(&pool.slots[slot].packB[1], sizeof(double) * GEMM_KC * (GEMM_NC + 16))))
+    {
+        fprintf(stderr, "gemm: cannot allocate pack buffers\n");
+        return ADMIT_FAILED;
+    }
+    return slot;
+}
+
+// Makes product active in slot. Called with schedLock held.
+static void activate(GemmProduct* product, int slot)
+{
+    pool.slots[slot].used = true;
+    product->slot = slot;
+    product->packB[0] = pool.slots[slot].packB[0].base;
+    product->packB[1] = pool.slots[slot].packB[1].base;
+    pool.charged += product->bytes;
+
+    if (product->control) {
+        uint64_t unset = 0;
+        __atomic_compare_exchange_n(&product->control->start, &unset, nowNs(), false,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    }
+
+    // Start level with the least served product of the class, so a new
+    // arrival gets its share without being able to starve the others
+    double vtime = -1;
+    for (GemmProduct* p = pool.active; p; p = p->next)
+        if (p->priority == product->priority && (vtime < 0 || p->vtime < vtime))
+            vtime = p->vtime;
+    product->vtime = (vtime < 0) ? 0 : vtime;
+
+    product->next = pool.active;
+    pool.active = product;
+    pool.nActive++;
+}
+
+// Waits on schedDone, but no later than the deadline of control
+static void waitDone(GemmControl* control)
+{
+    uint64_t deadline = control ? __atomic_load_n(&control->deadline, __ATOMIC_RELAXED) : 0;
+    if (!deadline) {
+        pthread_cond_wait(&schedDone, &schedLock);
+        return;
+    }
+
+    uint64_t now = nowNs();
+    if (now >= deadline) return;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t at = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec + (deadline - now);
+    ts.tv_sec = (time_t)(at / 1000000000ull);
+    ts.tv_nsec = (long)(at % 1000000000ull);
+    pthread_cond_timedwait(&schedDone, &schedLock, &ts);
+}
+
+// Waits until product may start and activates it; false if it failed or was
+// stopped first. Called with schedLock held.
+static bool admit(GemmProduct* product)
+{
+    int cls = product->priority;
+    pool.waiting[cls]++;
+    for (;;) {
+        if (controlStop(product->control)) {
+            pool.waiting[cls]--;
+            return false;
+        }
+        int slot = ensurePool() ? admissionSlot(product) : ADMIT_FAILED;
+        if (slot == ADMIT_FAILED) {
+            pool.waiting[cls]--;
+            return false;
+        }
+        if (slot >= 0) {
+            pool.waiting[cls]--;
+            activate(product, slot);
+            return true;
+        }
+        waitDone(product->control);
+    }
+}
+
+// Removes a finished product. Called with schedLock held.
+static void retire(GemmProduct* product)
+{
+    GemmProduct** link = &pool.active;
+    while (*link != product) link = &(*link)->next;
+    *link = product->next;
+
+    pool.nActive--;
+    pool.charged -= product->bytes;
+    pool.slots[product->slot].used = false;
+    admitQueued();
+    pthread_cond_broadcast(&schedDone);
+}
+
+// Counts product against control's totals
+static void watch(GemmProduct* product, GemmControl* control, uint64_t tiles, uint64_t flops)
+{
+    product->control = control;
+    if (!control) return;
+    __atomic_add_fetch(&control->active, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&control->tilesTotal, tiles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&control->flopsTotal, flops, __ATOMIC_RELAXED);
+}
+
+static void unwatch(GemmProduct* product)
+{
+    if (product->control)
+        __atomic_sub_fetch(&product->control->active, 1, __ATOMIC_RELEASE);
+}
+
+// Admits product, works on it from the calling thread alongside the pool,
+// and returns once it is complete
+static void runProduct(GemmProduct* product)
+{
+    pthread_mutex_lock(&schedLock);
+    if (!admit(product)) {
+        unwatch(product);
+        pthread_mutex_unlock(&schedLock);
+        return;
+    }
+    if (!product->serial) pthread_cond_broadcast(&schedWake);
+    gemmMetricsCount(product->serial ? GEMM_METRIC_SERIAL : GEMM_METRIC_PARALLEL, 1);
+
+    void* packA = pool.slots[product->slot].packA.base;
+    while (!product->done) {
+        if (product->nextTask < product->nTasks)
+            runTask(product, packA);
+        else
+            pthread_cond_wait(&schedDone, &schedLock);
+    }
+
+    retire(product);
+    unwatch(product);
+    runFired();
+    pthread_mutex_unlock(&schedLock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Asynchronous products
+////////////////////////////////////////////////////////////////////////////////
+
+// Called with schedLock held
+static void releaseFuture(GemmFuture* f)
+{
+    if (--f->refs > 0) return;
+    free(f);
+}
+
+// Admits whatever queued products may start now, oldest first. Called with
+// schedLock held.
+static void admitQueued()
+{
+    GemmFuture** link = &pool.queued;
+    while (*link) {
+        GemmFuture* f = *link;
+        int stop = controlStop(f->product->control);
+        int slot = stop ? ADMIT_FAILED : admissionSlot(f->product);
+        if (slot == -1) {
+            link = &f->nextQueued;
+            continue;
+        }
+
+        *link = f->nextQueued;
+        f->queued = false;
+        pool.waiting[f->product->priority]--;
+        if (slot == ADMIT_FAILED) {
+            finishFuture(f, stop ? stop : GEMM_STATUS_FAILED);
+        } else {
+            activate(f->product, slot);
+            f->admitted = true;
+            pthread_cond_broadcast(&schedWake);
+        }
+    }
+}
+
+// Queues a product whose dependencies are complete. Called with schedLock held.
+static void enqueue(GemmFuture* f)
+{
+    GemmFuture** link = &pool.queued;
+    while (*link) link = &(*link)->nextQueued;
+    *link = f;
+    f->nextQueued = NULL;
+    f->queued = true;
+    pool.waiting[f->product->priority]++;
+    admitQueued();
+}
+
+// Completes f: retires and frees its product, queues its callbacks and
+// starts (or, unless it succeeded, cancels) the products waiting on it.
+// Called with schedLock held.
+static void finishFuture(GemmFuture* f, int status)
+{
+    GemmProduct* product = f->product;
+    f->product = NULL;
+    f->status = status;
+    pool.nPending--;
+    if (status == GEMM_STATUS_DONE)
+        gemmMetricsCall(f->metricsBegin, f->metricsOp, f->M, f->N, f->K);
+
+    if (f->admitted) retire(product);
+    unwatch(product);
+    product->destroy(product);
+
+    GemmDependent* d = f->dependents;
+    f->dependents = NULL;
+    while (d) {
+        GemmDependent* next = d->next;
+        if (d->future->status == GEMM_STATUS_PENDING) {
+            if (status != GEMM_STATUS_DONE)
+                finishFuture(d->future, GEMM_STATUS_CANCELLED);
+            else if (--d->future->pendingDeps == 0)
+                enqueue(d->future);
+        }
+        releaseFuture(d->future);
+        free(d);
+        d = next;
+    }
+
+    if (f->callbacks) {
+        if (pool.firedTail) pool.firedTail->next = f->callbacks;
+        else pool.fired = f->callbacks;
+        GemmCallbackNode* last = f->callbacks;
+        while (last->next) last = last->next;
+        pool.firedTail = last;
+        f->callbacks = NULL;
+    }
+
+    pthread_cond_broadcast(&schedDone);
+    releaseFuture(f);
+}
+
+// Runs the callbacks due. Called with schedLock held, which is dropped while
+// each one runs.
+static void runFired()
+{
+    while (pool.fired) {
+        GemmCallbackNode* cb = pool.fired;
+        pool.fired = cb->next;
+        if (!pool.fired) pool.firedTail = NULL;
+
+        pthread_mutex_unlock(&schedLock);
+        cb->fn(cb->future, cb->arg);
+        pthread_mutex_lock(&schedLock);
+
+        releaseFuture(cb->future);
+        free(cb);
+    }
+}
+
+// Runs one task of an asynchronous product on a waiting thread, with the
+// product's own A buffer; false when there is none to take. Called with
+// schedLock held.
+static bool helpOnce()
+{
+    GemmProduct* best = NULL;
+    for (GemmProduct* p = pool.active; p; p = p->next) {
+        if (!p->future || pool.slots[p->slot].helped || p->nextTask >= p->nTasks) continue;
+        if (!best || p->priority < best->priority
+            || (p->priority == best->priority && p->vtime < best->vtime))
+            best = p;
+    }
+    if (!best) return false;
+
+    // the product may complete and be freed inside runTask; the slot stays
+    int slot = best->slot;
+    pool.slots[slot].helped = true;
+    runTask(best, pool.slots[slot].packA.base);
+    pool.slots[slot].helped = false;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Packing and micro-kernel
+////////////////////////////////////////////////////////////////////////////////
+
+#define PHASE_PACK_B  0             // the first panel of B, on its own
+#define PHASE_COMPUTE 1             // tiles, and the next panel of B among them
+
+// Weights quantized with one scale per group of rows in each column. Codes
+// are stored block by block, GEMM_QUANT_NB columns wide, so a block streams
+// from memory row after row. An int4 row packs column c in the low nibble of
+// byte c and column c + NB/2 in the high one, so both halves unpack with
+// shifts.
+struct GemmQuantB {
+    int      bits;                  // 8 or 4
+    int      group;                 // rows per scale
+    int      K, N;
+    int      nBlocks, nGroups;
+    int      rowBytes;              // codes of one row of a block
+    double   error;                 // ||dequantized - B||_F / ||B||_F
+    int8_t*  codes;                 // [block][K][rowBytes]
+    float*   scales;                // [block][group][GEMM_QUANT_NB]
+    Arena    arena;
+};
+
+// B packed once for many products: every NC x KC panel, laid out as the pack
+// phase would leave it in a slot
+struct GemmPackedB {
+    int      dtype;                 // MATRIX_FLOAT32 or MATRIX_FLOAT64
+    int      K, N;
+    int      nPc;                   // K slices per panel column
+    size_t*  offsets;               // of each panel in elements, [jc][pc]
+    Arena    arena;
+};
+
+// What an integer or modular product needs besides the operands
+struct GemmExact {
+    int      chunk;             // products summed before they are folded or reduced
+    int64_t* high;              // upper halves of C as 128-bit sums, or NULL
+    int      ldh;
+    uint64_t p, mu;             // modulus and floor((2^64 - 1) / p)
+};
+
+template <typename T>
+struct GemmJob : GemmProduct {
+    typedef typename GemmTraits<T>::Out Out;
+
+    int      transA, transB;
+    int      M, N, K;
+    T        alpha, beta;
+    const T* A; int lda;
+    const T* B; int ldb;
+    Out*     C; int ldc;
+    const GemmExact* exact;     // integer and modular products only
+
+    // current phase and panel
+    int      phase;
+    int      jc, nc;
+    int      pc, kc;
+    int      mc;
+    int      nSlivers;
+    int      nBlocks;
+    T        betaPanel;         // beta for the first K slice, 1 afterwards
+    const GemmPackedB* packed;  // resident B, which skips the pack phase
+    const GemmQuantB* quant;    // quantized B, dequantized as it is packed
+    int      buffer;            // packB[buffer] holds the current panel
+
+    // The panel after this one, packed into the other buffer during the
+    // compute phase by nAhead tasks, one at every every'th position
+    int      aheadJc, aheadNc;
+    int      aheadPc, aheadKc;
+    int      aheadSlivers;
+    int      nAhead;
+    int      every;
+    bool     packedAhead;       // the current panel was packed that way
+
+    // From plugins (see gemmPlugin.h), or NULL for the compiled code
+    const GemmPluginKernel* plugin;
+    GemmPluginPackFn pluginPackA, pluginPackB;
+};
+
+// The packed panel of B at (jc, pc)
+template <typename T>
+static const T* panelB(const GemmJob<T>* job)
+{
+    if (!job->packed) return (const T*)job->packB[job->buffer];
+    const GemmPackedB* p = job->packed;
+    return (const T*)p->arena.base + p->offsets[(job->jc / GEMM_NC) * p->nPc + job->pc / GEMM_KC];
+}
+
+// Packs rows ic..ic+mc of op(A), columns pc..pc+kc, into MR-row slivers
+// (zero padded), each stored column by column
+template <typename T>
+static void packA(const GemmJob<T>* job, int ic, int mc, T* dst)
+{
+    const int MR = GemmTraits<T>::MR;
+    const int kc = job->kc, pc = job->pc, lda = job->lda;
+
+    if (job->pluginPackA) {
+        if (job->transA) job->pluginPackA(mc, kc, job->A + (size_t)pc * lda + ic, 1, lda, dst);
+        else job->pluginPackA(mc, kc, job->A + (size_t)ic * lda + pc, lda, 1, dst);
+        return;
+    }
+    for (int ir = 0; ir < mc; ir += MR) {
+        int m = (mc - ir < MR) ? mc - ir : MR;
+        for (int p = 0; p < kc; ++p) {
+            for (int i = 0; i < m; ++i) {
+                int row = ic + ir + i, col = pc + p;
+                dst[i] = job->transA ? job->A[(size_t)col * lda + row]
+                                     : job->A[(size_t)row * lda + col];
+            }
+            for (int i = m; i < MR; ++i)
+                dst[i] = 0;
+            dst += MR;
+        }
+    }
+}
+
+// Columns c0..c0+n of row k of quantized block jb, scaled back. The columns
+// lie within one half of the block, so int4 codes come from one nibble.
+template <typename T>
+static inline void dequantize(const GemmQuantB* q, int jb, int k, int c0, int n, T* out)
+{
+    const int half = GEMM_QUANT_NB / 2;
+    const float* scale = q->scales + ((size_t)jb * q->nGroups + k / q->group) * GEMM_QUANT_NB + c0;
+    const int8_t* row = q->codes + ((size_t)jb * q->K + k) * q->rowBytes;
+
+    if (q->bits == 8) {
+        #pragma omp simd
+        for (int j = 0; j < n; ++j)
+            out[j] = (T)(scale[j] * row[c0 + j]);
+    } else if (c0 < half) {
+        #pragma omp simd
+        for (int j = 0; j < n; ++j)
+            out[j] = (T)(scale[j] * (float)((int8_t)(row[c0 + j] << 4) >> 4));
+    } else {
+        #pragma omp simd
+        for (int j = 0; j < n; ++j)
+            out[j] = (T)(scale[j] * (float)(row[c0 - half + j] >> 4));
+    }
+}
+
+// Packs NR-column sliver s of the panel of op(B) at columns jc..jc+nc,
+// rows pc..pc+kc, stored row by row
+template <typename T>
+static void packBSliver(const GemmJob<T>* job, int jc, int nc, int pc, int kc, int s, T* dst)
+{
+    const int NR = GemmTraits<T>::NR;
+    const int ldb = job->ldb;
+    int j0 = jc + s * NR;
+    int n = (jc + nc - j0 < NR) ? jc + nc - j0 : NR;
+
+    dst += (size_t)s * NR * kc;
+    if (job->quant) {
+        for (int p = 0; p < kc; ++p) {
+            dequantize(job->quant, j0 / GEMM_QUANT_NB, pc + p, j0 % GEMM_QUANT_NB, n, dst);
+            for (int j = n; j < NR; ++j)
+                dst[j] = 0;
+            dst += NR;
+        }
+        return;
+    }
+    if (job->pluginPackB) {
+        if (job->transB) job->pluginPackB(kc, n, job->B + (size_t)j0 * ldb + pc, 1, ldb, dst);
+        else job->pluginPackB(kc, n, job->B + (size_t)pc * ldb + j0, ldb, 1, dst);
+        return;
+    }
+    for (int p = 0; p < kc; ++p) {
+        if (!job->transB) {
+            const T* src = job->B + (size_t)(pc + p) * ldb + j0;
+            for (int j = 0; j < n; ++j)
+                dst[j] = src[j];
+        } else {
+            for (int j = 0; j < n; ++j)
+                dst[j] = job->B[(size_t)(j0 + j) * ldb + pc + p];
+        }
+        for (int j = n; j < NR; ++j)
+            dst[j] = 0;
+        dst += NR;
+    }
+}
+
+// C[0..m, 0..n] = beta * C + alpha * (a * b) for one MR x NR tile.
+// The accumulator is one flat array with NR innermost so the compiler keeps
+// it in vector registers; a 2-D array gets vectorized along the wrong loop.
+// Tiles run here only when neither a plugin nor gemmJit has a kernel for them.
+template <typename T>
+static void microKernel(int kc, const T* a, const T* b, T* C, int ldc,
+                        int m, int n, T alpha, T beta)
+{
+    const int MR = GemmTraits<T>::MR, NR = GemmTraits<T>::NR;
+    T c[MR * NR];
+
+    for (int ij = 0; ij < MR * NR; ++ij)
+        c[ij] = 0;
+
+    for (int p = 0; p < kc; ++p) {
+        #pragma GCC unroll 8
+        for (int i = 0; i < MR; ++i) {
+            T ai = a[i];
+            #pragma omp simd
+            for (int j = 0; j < NR; ++j)
+                c[i * NR + j] += ai * b[j];
+        }
+        a += MR;
+        b += NR;
+    }
+
+    for (int i = 0; i < m; ++i) {
+        T* crow = C + (size_t)i * ldc;
+        const T* ci = c + i * NR;
+        if (beta == 0) {
+            for (int j = 0; j < n; ++j)
+                crow[j] = alpha * ci[j];
+        } else {
+            for (int j = 0; j < n; ++j)
+                crow[j] = beta * crow[j] + alpha * ci[j];
+        }
+    }
+}
+
+// A group of GEMM_PACKB_SLIVERS slivers of the current panel of B
+template <typename T>
+static void packBTask(GemmProduct* product, int task, void*)
+{
+    GemmJob<T>* job = (GemmJob<T>*)product;
+    int first = task * GEMM_PACKB_SLIVERS;
+    int last = (first + GEMM_PACKB_SLIVERS < job->nSlivers) ? first + GEMM_PACKB_SLIVERS : job->nSlivers;
+    for (int s = first; s < last; ++s)
+        packBSliver(job, job->jc, job->nc, job->pc, job->kc, s, (T*)job->packB[job->buffer]);
+    gemmMetricsCount(GEMM_METRIC_PACKED_B, sizeof(T) * GemmTraits<T>::NR * job->kc * (last - first));
+}
+
+// The same for the next panel, into the other buffer
+template <typename T>
+static void packAhead(GemmJob<T>* job, int group)
+{
+    int first = group * GEMM_PACKB_SLIVERS;
+    int last = (first + GEMM_PACKB_SLIVERS < job->aheadSlivers) ? first + GEMM_PACKB_SLIVERS : job->aheadSlivers;
+    for (int s = first; s < last; ++s)
+        packBSliver(job, job->aheadJc, job->aheadNc, job->aheadPc, job->aheadKc, s,
+                    (T*)job->packB[job->buffer ^ 1]);
+    gemmMetricsCount(GEMM_METRIC_PACKED_B, sizeof(T) * GemmTraits<T>::NR * job->aheadKc * (last - first));
+}
+
+// The tiles of one block of rows against the current packed panel of B
+template <typename T>
+static void computeBlock(GemmJob<T>* job, int ic, int mc, const T* packedA)
+{
+    const int MR = GemmTraits<T>::MR, NR = GemmTraits<T>::NR;
+
+    // Generated kernels for the tiles of this block, when there are any: the
+    // full tile and the edges, each specialized for the alpha and beta at hand.
+    // A plugin kernel takes the tiles it can, ahead of them or instead of the
+    // compiled kernel by its priority.
+    T alphaBeta[2] = { job->alpha, job->betaPanel };
+    const GemmPluginKernel* plugin = job->plugin;
+    uint64_t tiles[3] = { 0, 0, 0 };    // plugin, generated, compiled
+    for (int jr = 0; jr < job->nc; jr += NR) {
+        int n = (job->nc - jr < NR) ? job->nc - jr : NR;
+        const T* b = panelB(job) + (size_t)jr * job->kc;
+        GemmJitKernel kernel = gemmJitKernel(GemmTraits<T>::DTYPE, MR, NR, MR, n, GEMM_JIT_UNROLL,
+                                             job->alpha, job->betaPanel);
+        for (int ir = 0; ir < mc; ir += MR) {
+            int m = (mc - ir < MR) ? mc - ir : MR;
+            const T* a = packedA + (size_t)ir * job->kc;
+            T* C = job->C + (size_t)(ic + ir) * job->ldc + job->jc + jr;
+            GemmJitKernel k = (m == MR) ? kernel
+                            : gemmJitKernel(GemmTraits<T>::DTYPE, MR, NR, m, n, GEMM_JIT_UNROLL,
+                                            job->alpha, job->betaPanel);
+            bool usePlugin = plugin && (plugin->priority > 0 || !k)
+                          && ((m == MR && n == NR) || (plugin->flags & GEMM_PLUGIN_EDGES));
+            if (usePlugin)
+                plugin->kernel(job->kc, a, b, C, (long)(job->ldc * sizeof(T)), alphaBeta, m, n);
+            else if (k)
+                k(job->kc, a, b, C, (long)(job->ldc * sizeof(T)), alphaBeta);
+            else
+                microKernel<T>(job->kc, a, b, C, job->ldc, m, n, job->alpha, job->betaPanel);
+            tiles[usePlugin ? 0 : k ? 1 : 2]++;
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+        if (tiles[i]) gemmMetricsCount(GEMM_METRIC_TILES_PLUGIN + i, tiles[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Integer and modular kernels
+////////////////////////////////////////////////////////////////////////////////
+
+// Low 64 bits of a product; exact for int32 operands. Both forms vectorize
+// (vpmuldq, vpmullq).
+static inline uint64_t productLow(int32_t a, int32_t b) { return (uint64_t)((int64_t)a * b); }
+static inline uint64_t productLow(int64_t a, int64_t b) { return (uint64_t)a * (uint64_t)b; }
+
+// C[0..m, 0..n] = a * b, or C += a * b when add, for one MR x NR tile of an
+// integer product. Without high, C is kept modulo 2^64. With it, C and high
+// are the low and high halves of 128-bit sums: chunk products at a time are
+// summed exactly in 64 bits, then folded in with their carry.
+template <typename T>
+static void integerKernel(int kc, const T* a, const T* b, int64_t* C, int ldc,
+                          int64_t* high, int ldh, int m, int n, bool add, int chunk)
+{
+    const int MR = GemmTraits<T>::MR, NR = GemmTraits<T>::NR;
+    uint64_t lo[MR * NR], sum[MR * NR];
+    int64_t hi[MR * NR];
+
+    for (int ij = 0; ij < MR * NR; ++ij) {
+        lo[ij] = 0;
+        hi[ij] = 0;
+    }
+    if (!high) chunk = kc;
+
+    for (int p0 = 0; p0 < kc; p0 += chunk) {
+        int steps = (kc - p0 < chunk) ? kc - p0 : chunk;
+        for (int ij = 0; ij < MR * NR; ++ij)
+            sum[ij] = 0;
+        for (int p = 0; p < steps; ++p) {
+            #pragma GCC unroll 8
+            for (int i = 0; i < MR; ++i) {
+                T ai = a[i];
+                #pragma omp simd
+                for (int j = 0; j < NR; ++j)
+                    sum[i * NR + j] += productLow(ai, b[j]);
+            }
+            a += MR;
+            b += NR;
+        }
+        for (int ij = 0; ij < MR * NR; ++ij) {
+            uint64_t l = lo[ij] + sum[ij];
+            hi[ij] += ((int64_t)sum[ij] >> 63) + (l < lo[ij]);
+            lo[ij] = l;
+        }
+    }
+
+    for (int i = 0; i < m; ++i) {
+        int64_t* crow = C + (size_t)i * ldc;
+        int64_t* hrow = high ? high + (size_t)i * ldh : NULL;
+        for (int j = 0; j < n; ++j) {
+            uint64_t c = add ? (uint64_t)crow[j] : 0, l = c + lo[i * NR + j];
+            if (hrow) hrow[j] = (add ? hrow[j] : 0) + hi[i * NR + j] + (l < c);
+            crow[j] = (int64_t)l;
+        }
+    }
+}
+
+// The same with 128-bit products, for int64 operands that need them
+static void wideKernel(int kc, const int64_t* a, const int64_t* b, int64_t* C, int ldc,
+                       int64_t* high, int ldh, int m, int n, bool add)
+{
+    const int MR = GemmTraits<int64_t>::MR, NR = GemmTraits<int64_t>::NR;
+    __int128 acc[MR * NR];
+
+    for (int ij = 0; ij < MR * NR; ++ij)
+        acc[ij] = 0;
+    for (int p = 0; p < kc; ++p) {
+        for (int i = 0; i < MR; ++i)
+            for (int j = 0; j < NR; ++j)
+                acc[i * NR + j] += (__int128)a[i] * b[j];
+        a += MR;
+        b += NR;
+    }
+
+    for (int i = 0; i < m; ++i) {
+        int64_t* crow = C + (size_t)i * ldc;
+        int64_t* hrow = high + (size_t)i * ldh;
+        for (int j = 0; j < n; ++j) {
+            unsigned __int128 v = (unsigned __int128)acc[i * NR + j];
+            if (add) v += ((unsigned __int128)(uint64_t)hrow[j] << 64) | (uint64_t)crow[j];
+            crow[j] = (int64_t)(uint64_t)v;
+            hrow[j] = (int64_t)(uint64_t)(v >> 64);
+        }
+    }
+}
+
+// floor(x * y / 2^64) from 32-bit halves, so it vectorizes
+static inline uint64_t mulHigh(uint64_t x, uint64_t y)
+{
+    uint64_t xl = (uint32_t)x, xh = x >> 32, yl = (uint32_t)y, yh = y >> 32;
+    uint64_t t = xl * yl;
+    uint64_t u = xh * yl + (t >> 32);
+    uint64_t v = xl * yh + (uint32_t)u;
+    return xh * yh + (u >> 32) + (v >> 32);
+}
+
+// x mod p by Barrett reduction; with mu = floor((2^64 - 1) / p) the quotient
+// estimate falls at most two short
+static inline uint64_t reduceMod(uint64_t x, uint64_t p, uint64_t mu)
+{
+    uint64_t r = x - mulHigh(x, mu) * p;
+    r = (r >= p) ? r - p : r;
+    return (r >= p) ? r - p : r;
+}
+
+// C[0..m, 0..n] = a * b mod p, or (C + a * b) mod p when add, for one tile
+// of a modular product. Products are 32 x 32 -> 64 bits; reduction is
+// delayed until chunk of them have been summed, as many as fit in 64 bits.
+static void modularKernel(int kc, const uint32_t* a, const uint32_t* b, uint32_t* C, int ldc,
+                          int m, int n, bool add, const GemmExact* e)
+{
+    const int MR = GemmTraits<uint32_t>::MR, NR = GemmTraits<uint32_t>::NR;
+    const uint64_t p = e->p, mu = e->mu;
+    uint64_t acc[MR * NR];
+
+    for (int ij = 0; ij < MR * NR; ++ij)
+        acc[ij] = 0;
+    for (int p0 = 0; p0 < kc; p0 += e->chunk) {
+        int steps = (kc - p0 < e->chunk) ? kc - p0 : e->chunk;
+        for (int q = 0; q < steps; ++q) {
+            #pragma GCC unroll 8
+            for (int i = 0; i < MR; ++i) {
+                uint64_t ai = a[i];
+                #pragma omp simd
+                for (int j = 0; j < NR; ++j)
+                    acc[i * NR + j] += ai * b[j];
+            }
+            a += MR;
+            b += NR;
+        }
+        #pragma omp simd
+        for (int ij = 0; ij < MR * NR; ++ij)
+            acc[ij] = reduceMod(acc[ij], p, mu);
+    }
+
+    for (int i = 0; i < m; ++i) {
+        uint32_t* crow = C + (size_t)i * ldc;
+        for (int j = 0; j < n; ++j) {
+            uint64_t v = acc[i * NR + j] + (add ? crow[j] : 0);
+            crow[j] = (uint32_t)((v >= p) ? v - p : v);
+        }
+    }
+}
+
+static void exactTile(const GemmExact* e, int kc, const int32_t* a, const int32_t* b,
+                      int64_t* C, int ldc, int64_t* high, int m, int n, bool add)
+{
+    integerKernel<int32_t>(kc, a, b, C, ldc, high, e->ldh, m, n, add, e->chunk);
+}
+
+static void exactTile(const GemmExact* e, int kc, const int64_t* a, const int64_t* b,
+                      int64_t* C, int ldc, int64_t* high, int m, int n, bool add)
+{
+    if (high) wideKernel(kc, a, b, C, ldc, high, e->ldh, m, n, add);
+    else integerKernel<int64_t>(kc, a, b, C, ldc, NULL, 0, m, n, add, kc);
+}
+
+template <typename T>
+static void integerBlock(GemmJob<T>* job, int ic, int mc, const T* packedA)
+{
+    const int MR = GemmTraits<T>::MR, NR = GemmTraits<T>::NR;
+    const GemmExact* e = job->exact;
+    bool add = job->betaPanel != 0;
+
+    for (int jr = 0; jr < job->nc; jr += NR) {
+        int n = (job->nc - jr < NR) ? job->nc - jr : NR;
+        const T* b = panelB(job) + (size_t)jr * job->kc;
+        for (int ir = 0; ir < mc; ir += MR) {
+            int m = (mc - ir < MR) ? mc - ir : MR;
+            const T* a = packedA + (size_t)ir * job->kc;
+            int64_t* C = job->C + (size_t)(ic + ir) * job->ldc + job->jc + jr;
+            int64_t* high = e->high ? e->high + (size_t)(ic + ir) * e->ldh + job->jc + jr : NULL;
+            exactTile(e, job->kc, a, b, C, job->ldc, high, m, n, add);
+        }
+    }
+    gemmMetricsCount(GEMM_METRIC_TILES_EXACT, (uint64_t)((job->nc + NR - 1) / NR) * ((mc + MR - 1) / MR));
+}
+
+static void computeBlock(GemmJob<int32_t>* job, int ic, int mc, const int32_t* packedA)
+{
+    integerBlock(job, ic, mc, packedA);
+}
+
+static void computeBlock(GemmJob<int64_t>* job, int ic, int mc, const int64_t* packedA)
+{
+    integerBlock(job, ic, mc, packedA);
+}
+
+static void computeBlock(GemmJob<uint32_t>* job, int ic, int mc, const uint32_t* packedA)
+{
+    const int MR = GemmTraits<uint32_t>::MR, NR = GemmTraits<uint32_t>::NR;
+    bool add = job->betaPanel != 0;
+
+    for (int jr = 0; jr < job->nc; jr += NR) {
+        int n = (job->nc - jr < NR) ? job->nc - jr : NR;
+        const uint32_t* b = panelB(job) + (size_t)jr * job->kc;
+        for (int ir = 0; ir < mc; ir += MR) {
+            int m = (mc - ir < MR) ? mc - ir : MR;
+            const uint32_t* a = packedA + (size_t)ir * job->kc;
+            uint32_t* C = job->C + (size_t)(ic + ir) * job->ldc + job->jc + jr;
+            modularKernel(job->kc, a, b, C, job->ldc, m, n, add, job->exact);
+        }
+    }
+    gemmMetricsCount(GEMM_METRIC_TILES_EXACT, (uint64_t)((job->nc + NR - 1) / NR) * ((mc + MR - 1) / MR));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tasks and phases
+////////////////////////////////////////////////////////////////////////////////
+
+// One MC-high block of rows against the current packed panel of B, or one
+// group of the next panel's slivers
+template <typename T>
+static void computeTask(GemmProduct* product, int task, void* bufA)
+{
+    GemmJob<T>* job = (GemmJob<T>*)product;
+
+    if (job->nAhead > 0) {
+        int groups = task / job->every;
+        if (task % job->every == job->every - 1 && groups < job->nAhead) {
+            packAhead(job, groups);
+            return;
+        }
+        task -= (groups < job->nAhead) ? groups : job->nAhead;
+    }
+
+    int ic = task * job->mc;
+    int mc = (job->M - ic < job->mc) ? job->M - ic : job->mc;
+    T* packedA = (T*)bufA;
+    packA(job, ic, mc, packedA);
+    gemmMetricsCount(GEMM_METRIC_PACKED_A, sizeof(T) * job->kc * GemmTraits<T>::MR
+                                           * ((mc + GemmTraits<T>::MR - 1) / GemmTraits<T>::MR));
+    computeBlock(job, ic, mc, (const T*)packedA);
+
+    if (job->control) {
+        __atomic_add_fetch(&job->control->tilesDone, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&job->control->flopsDone, 2ull * mc * job->nc * job->kc, __ATOMIC_RELAXED);
+    }
+}
+
+// Starts the compute phase of the current panel. Unless B is resident, the
+// tasks that pack the following panel are spread evenly among its tiles.
+template <typename T>
+static void startCompute(GemmJob<T>* job)
+{
+    const int NR = GemmTraits<T>::NR;
+
+    job->phase = PHASE_COMPUTE;
+    job->task = computeTask<T>;
+    job->nextTask = 0;
+    job->nAhead = 0;
+
+    // next K slice of this panel, then the next panel
+    job->aheadJc = job->jc;
+    job->aheadPc = job->pc + GEMM_KC;
+    if (job->aheadPc >= job->K) {
+        job->aheadPc = 0;
+        job->aheadJc += GEMM_NC;
+    }
+    if (!job->packed && job->aheadJc < job->N) {
+        job->aheadNc = (job->N - job->aheadJc < GEMM_NC) ? job->N - job->aheadJc : GEMM_NC;
+        job->aheadKc = (job->K - job->aheadPc < GEMM_KC) ? job->K - job->aheadPc : GEMM_KC;
+        job->aheadSlivers = (job->aheadNc + NR - 1) / NR;
+        job->nAhead = (job->aheadSlivers + GEMM_PACKB_SLIVERS - 1) / GEMM_PACKB_SLIVERS;
+        job->every = (job->nBlocks + job->nAhead) / job->nAhead;
+    }
+
+    double compute = 2.0 * job->mc * job->nc * job->kc;
+    double pack = job->nAhead ? (double)GEMM_PACKB_SLIVERS * NR * job->aheadKc : 0;
+    job->nTasks = job->nBlocks + job->nAhead;
+    job->taskCost = (job->nBlocks * compute + job->nAhead * pack) / job->nTasks;
+}
+
+// Starts the pack phase of the panel at (jc, pc), or goes straight to the
+// compute phase when B is resident or the panel was packed ahead
+template <typename T>
+static void startPanel(GemmJob<T>* job)
+{
+    const int NR = GemmTraits<T>::NR;
+
+    job->nc = (job->N - job->jc < GEMM_NC) ? job->N - job->jc : GEMM_NC;
+    job->kc = (job->K - job->pc < GEMM_KC) ? job->K - job->pc : GEMM_KC;
+    job->betaPanel = (job->pc == 0) ? job->beta : (T)1;
+    job->nSlivers = (job->nc + NR - 1) / NR;
+
+    if (job->packed || job->packedAhead) {
+        startCompute(job);
+        return;
+    }
+    job->phase = PHASE_PACK_B;
+    job->task = packBTask<T>;
+    job->nTasks = (job->nSlivers + GEMM_PACKB_SLIVERS - 1) / GEMM_PACKB_SLIVERS;
+    job->nextTask = 0;
+    job->taskCost = (double)GEMM_PACKB_SLIVERS * NR * job->kc;
+}
+
+template <typename T>
+static bool advanceJob(GemmProduct* product)
+{
+    GemmJob<T>* job = (GemmJob<T>*)product;
+
+    if (job->phase == PHASE_PACK_B) {
+        startCompute(job);
+        return true;
+    }
+
+    // the panel packed during this phase becomes the current one
+    if (job->aheadJc >= job->N) return false;
+    job->jc = job->aheadJc;
+    job->pc = job->aheadPc;
+    job->packedAhead = job->nAhead > 0;
+    if (job->packedAhead) job->buffer ^= 1;
+    startPanel(job);
+    return true;
+}
+
+// C = beta * C, for the degenerate cases where op(A) * op(B) contributes nothing
+template <typename T>
+static void scaleC(int M, int N, T beta, T* C, int ldc)
+{
+    for (int i = 0; i < M; ++i) {
+        T* crow = C + (size_t)i * ldc;
+        for (int j = 0; j < N; ++j)
+            crow[j] = (beta == 0) ? 0 : beta * crow[j];
+    }
+}
+
+
+// The whole product when op(A) * op(B) contributes nothing
+template <typename T>
+static void scaleTask(GemmProduct* product, int, void*)
+{
+    GemmJob<T>* job = (GemmJob<T>*)product;
+    scaleC(job->M, job->N, job->beta, job->C, job->ldc);
+}
+
+template <typename T>
+static bool advanceNone(GemmProduct*)
+{
+    return false;
+}
+
+template <typename T>
+static void destroyJob(GemmProduct* product)
+{
+    delete (GemmJob<T>*)product;
+}
+
+// Compute tasks over all panels
+template <typename T>
+static uint64_t jobTiles(const GemmJob<T>* job)
+{
+    uint64_t panels = (uint64_t)((job->N + GEMM_NC - 1) / GEMM_NC) * ((job->K + GEMM_KC - 1) / GEMM_KC);
+    return panels * job->nBlocks;
+}
+
+// Fills in job and sets up its first phase, sharing the blocks of rows
+// among nThreads
+template <typename T>
+static void initJob(GemmJob<T>* job, int transA, int transB, int M, int N, int K,
+                    T alpha, const T* A, int lda, const T* B, int ldb,
+                    T beta, typename GemmTraits<T>::Out* C, int ldc,
+                    const GemmPackedB* packed, int nThreads)
+{
+    const int MR = GemmTraits<T>::MR, NR = GemmTraits<T>::NR;
+
+    job->transA = transA; job->transB = transB;
+    job->M = M; job->N = N; job->K = K;
+    job->alpha = alpha; job->beta = beta;
+    job->A = A; job->lda = lda;
+    job->B = B; job->ldb = ldb;
+    job->C = C; job->ldc = ldc;
+    job->packed = packed;
+    job->quant = NULL;
+    job->exact = NULL;
+    job->plugin = gemmPluginFindKernel(GemmTraits<T>::DTYPE, MR, NR);
+    job->pluginPackA = gemmPluginFindPack(GemmTraits<T>::DTYPE, 'A', MR);
+    job->pluginPackB = gemmPluginFindPack(GemmTraits<T>::DTYPE, 'B', NR);
+
+    job->priority = threadPriority;
+    job->weight = threadWeight;
+    job->done = false;
+    job->stopped = 0;
+    job->control = NULL;
+    job->future = NULL;
+    job->destroy = destroyJob<T>;
+    job->running = 0;
+    job->advance = advanceJob<T>;
+
+    // Shrink MC so every thread gets at least one block of rows
+    int mc = (M + nThreads - 1) / nThreads;
+    mc = (mc + MR - 1) / MR * MR;
+    job->mc = (mc < GEMM_MC) ? mc : GEMM_MC;
+    job->nBlocks = (M + job->mc - 1) / job->mc;
+
+    // Charged against the memory budget: the packed panels of B (two when
+    // there is a next one to pack ahead), unless B is resident, and the
+    // caller's block of A
+    int nc = (N < GEMM_NC) ? N : GEMM_NC;
+    int kc = (K < GEMM_KC) ? K : GEMM_KC;
+    int panels = (N > GEMM_NC || K > GEMM_KC) ? 2 : 1;
+    size_t panel = packed ? 0 : (size_t)panels * kc * ((nc + NR - 1) / NR * NR);
+    job->bytes = sizeof(T) * (panel + (size_t)job->mc * kc);
+
+    job->jc = 0;
+    job->pc = 0;
+    job->buffer = 0;
+    job->packedAhead = false;
+    startPanel(job);
+}
+
+template <typename T>
+static void gemmDriver(int transA, int transB, int M, int N, int K,
+                       T alpha, const T* A, int lda, const T* B, int ldb,
+                       T beta, T* C, int ldc)
+{
+    if (M <= 0 || N <= 0) return;
+    if (K <= 0 || alpha == 0) {
+        scaleC(M, N, beta, C, ldc);
+        return;
+    }
+
+    GemmJob<T> job;
+    bool serial = 2.0 * M * N * K < GEMM_SERIAL_FLOPS;
+    initJob(&job, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc,
+            (const GemmPackedB*)NULL, serial ? 1 : gemmGetNumThreads());
+    job.serial = serial;
+    watch(&job, threadControl, jobTiles(&job), 2ull * M * N * K);
+
+    runProduct(&job);
+}
+
+// Starts an asynchronous product once every product in after has completed.
+// Workers run all of it, however small, since no caller is there to.
+template <typename T>
+static GemmFuture* gemmDriverAsync(int transA, int transB, int M, int N, int K,
+                                   T alpha, const T* A, int lda, const T* B, int ldb,
+                                   T beta, T* C, int ldc, GemmFuture* const* after, int nAfter)
+{
+    GemmJob<T>* job = new GemmJob<T>;
+    initJob(job, transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc,
+            (const GemmPackedB*)NULL, gemmGetNumThreads());
+    job->serial = false;
+    bool degenerate = M <= 0 || N <= 0 || K <= 0 || alpha == 0;
+    if (degenerate) {
+        // a single task, still ordered after the dependencies
+        job->task = scaleTask<T>;
+        job->advance = advanceNone<T>;
+        job->nTasks = 1;
+        job->taskCost = (M > 0 && N > 0) ? (double)M * N : 1;
+        job->bytes = 0;
+    }
+
+    GemmFuture* f = (GemmFuture*)calloc(1, sizeof(GemmFuture));
+    f->refs = 2;
+    f->status = GEMM_STATUS_PENDING;
+    f->product = job;
+    f->control = threadControl ? threadControl : &f->own;
+    f->metricsBegin = gemmMetricsBegin();
+    f->metricsOp = (sizeof(T) == sizeof(double)) ? GEMM_OP_DGEMM : GEMM_OP_SGEMM;
+    f->M = M; f->N = N; f->K = K;
+    job->future = f;
+    gemmMetricsCount(GEMM_METRIC_ASYNC, 1);
+    if (degenerate) watch(job, f->control, 0, 0);
+    else watch(job, f->control, jobTiles(job), 2ull * M * N * K);
+
+    pthread_mutex_lock(&schedLock);
+    pool.nPending++;
+
+    bool failed = false;
+    for (int i = 0; i < nAfter; ++i) {
+        GemmFuture* dep = after[i];
+        if (!dep || dep->status == GEMM_STATUS_DONE) continue;
+        if (dep->status != GEMM_STATUS_PENDING) {
+            failed = true;
+            continue;
+        }
+        GemmDependent* d = (GemmDependent*)malloc(sizeof(GemmDependent));
+        d->future = f;
+        d->next = dep->dependents;
+        dep->dependents = d;
+        f->refs++;
+        f->pendingDeps++;
+    }
+
+    if (failed)
+        finishFuture(f, GEMM_STATUS_CANCELLED);
+    else if (f->pendingDeps == 0 && !ensurePool())
+        finishFuture(f, GEMM_STATUS_FAILED);
+    else if (f->pendingDeps == 0)
+        enqueue(f);
+    runFired();
+    pthread_mutex_unlock(&schedLock);
+    return f;
+}
+
+// Packs every panel of op(B) once, in the layout the compute phase reads
+template <typename T>
+static GemmPackedB* packWhole(int dtype, int transB, int K, int N, const T* B, int ldb)
+{
+    const int NR = GemmTraits<T>::NR;
+    if (K <= 0 || N <= 0) return NULL;
+
+    GemmPackedB* p = (GemmPackedB*)calloc(1, sizeof(GemmPackedB));
+    int nJc = (N + GEMM_NC - 1) / GEMM_NC;
+    p->dtype = dtype;
+    p->K = K;
+    p->N = N;
+    p->nPc = (K + GEMM_KC - 1) / GEMM_KC;
+    p->offsets = (size_t*)malloc(sizeof(size_t) * nJc * p->nPc);
+
+    size_t total = 0;
+    for (int jc = 0; jc < N; jc += GEMM_NC) {
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for (int pc = 0; pc < K; pc += GEMM_KC) {
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            p->offsets[(jc / GEMM_NC) * p->nPc + pc / GEMM_KC] = total;
+            total += (size_t)kc * ((nc + NR - 1) / NR * NR);
+        }
+    }
+    if (!arenaInit(&p->arena, total * sizeof(T))) {
+        fprintf(stderr, "gemm: cannot allocate %zu bytes for packed B\n", total * sizeof(T));
+        free(p->offsets);
+        free(p);
+        return NULL;
+    }
+
+    // the sliver packer only looks at B; the rest stays zero, quant included
+    GemmJob<T> job = GemmJob<T>();
+    job.transB = transB;
+    job.B = B;
+    job.ldb = ldb;
+    job.pluginPackB = gemmPluginFindPack(dtype, 'B', NR);
+    for (int jc = 0; jc < N; jc += GEMM_NC) {
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for (int pc = 0; pc < K; pc += GEMM_KC) {
+            int kc = (K - pc < GEMM_KC) ? K - pc : GEMM_KC;
+            T* dst = (T*)p->arena.base + p->offsets[(jc / GEMM_NC) * p->nPc + pc / GEMM_KC];
+            for (int s = 0; s < (nc + NR - 1) / NR; ++s)
+                packBSliver(&job, jc, nc, pc, kc, s, dst);
+            gemmMetricsCount(GEMM_METRIC_PACKED_B, sizeof(T) * NR * kc * ((nc + NR - 1) / NR));
+        }
+    }
+    return p;
+}
+
+template <typename T>
+static void gemmDriverPacked(int transA, int M, T alpha, const T* A, int lda,
+                             const GemmPackedB* B, T beta, T* C, int ldc)
+{
+    int N = B->N, K = B->K;
+    if (M <= 0) return;
+    if (alpha == 0) {
+        scaleC(M, N, beta, C, ldc);
+        return;
+    }
+
+    GemmJob<T> job;
+    bool serial = 2.0 * M * N * K < GEMM_SERIAL_FLOPS;
+    initJob(&job, transA, GEMM_NO_TRANS, M, N, K, alpha, A, lda, (const T*)NULL, 0, beta, C, ldc,
+            B, serial ? 1 : gemmGetNumThreads());
+    job.serial = serial;
+    watch(&job, threadControl, jobTiles(&job), 2ull * M * N * K);
+
+    runProduct(&job);
+}
+
+// A = alpha * A * op(B) for square B, one panel of rows at a time. Row i of
+// the result depends only on row i of A, so each panel is multiplied into W
+// and copied back over itself. B is packed again for every panel and its
+// panels stream through the cache once per panel rather than once, so the
+// default gives each thread several MC blocks of rows to amortise that.
+template <typename T>
+static bool gemmDriverInPlace(int transB, int M, int N, T alpha, T* A, int lda,
+                              const T* B, int ldb, int rowBlock)
+{
+    if (M <= 0 || N <= 0) return true;
+    if (rowBlock <= 0) rowBlock = 4 * GEMM_MC * gemmGetNumThreads();
+    if (rowBlock > M) rowBlock = M;
+
+    T* W = (T*)malloc(sizeof(T) * rowBlock * N);
+    if (!W) {
+        fprintf(stderr, "gemm: cannot allocate %zu bytes of in-place workspace\n",
+                sizeof(T) * rowBlock * N);
+        return false;
+    }
+    for (int i = 0; i < M; i += rowBlock) {
+        int rows = (M - i < rowBlock) ? M - i : rowBlock;
+        T* panel = A + (size_t)i * lda;
+        gemmDriver(GEMM_NO_TRANS, transB, rows, N, N, alpha, (const T*)panel, lda, B, ldb,
+                   (T)0, W, N);
+
+        // a stopped product leaves W partial, so the panel keeps its old rows
+        if (controlStop(threadControl)) break;
+        for (int r = 0; r < rows; ++r)
+            memcpy(panel + (size_t)r * lda, W + (size_t)r * N, sizeof(T) * N);
+    }
+    free(W);
+    return true;
+}
+
+// A product with few rows against quantized B: each task takes one block of
+// columns and streams its codes once, dequantizing a row at a time straight
+// into the accumulators of every row of A
+struct GemmQuantJob : GemmProduct {
+    int      transA, M;
+    float    alpha, beta;
+    const float* A; int lda;
+    const GemmQuantB* B;
+    float*   C; int ldc;
+};
+
+static void quantTask(GemmProduct* product, int task, void*)
+{
+    const int NB = GEMM_QUANT_NB;
+    GemmQuantJob* job = (GemmQuantJob*)product;
+    const GemmQuantB* q = job->B;
+    int c0 = task * NB;
+    int n = (q->N - c0 < NB) ? q->N - c0 : NB;
+
+    float acc[GEMM_QUANT_DIRECT_M][NB];
+    float row[NB];
+    for (int i = 0; i < job->M; ++i)
+        for (int j = 0; j < NB; ++j)
+            acc[i][j] = 0;
+
+    for (int k = 0; k < q->K; ++k) {
+        dequantize(q, task, k, 0, NB / 2, row);
+        dequantize(q, task, k, NB / 2, NB / 2, row + NB / 2);
+        for (int i = 0; i < job->M; ++i) {
+            float a = job->transA ? job->A[(size_t)k * job->lda + i] : job->A[(size_t)i * job->lda + k];
+            #pragma omp simd
+            for (int j = 0; j < NB; ++j)
+                acc[i][j] += a * row[j];
+        }
+    }
+
+    for (int i = 0; i < job->M; ++i) {
+        float* crow = job->C + (size_t)i * job->ldc + c0;
+        for (int j = 0; j < n; ++j)
+            crow[j] = (job->beta == 0) ? job->alpha * acc[i][j]
+                                       : job->beta * crow[j] + job->alpha * acc[i][j];
+    }
+
+    if (job->control) {
+        __atomic_add_fetch(&job->control->tilesDone, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&job->control->flopsDone, 2ull * job->M * n * q->K, __ATOMIC_RELAXED);
+    }
+}
+
+static bool quantAdvance(GemmProduct*)
+{
+    return false;
+}
+
+static void gemmDriverQuant(int transA, int M, float alpha, const float* A, int lda,
+                            const GemmQuantB* B, float beta, float* C, int ldc)
+{
+    int N = B->N, K = B->K;
+    if (M <= 0) return;
+    if (alpha == 0) {
+        scaleC(M, N, beta, C, ldc);
+        return;
+    }
+    bool serial = 2.0 * M * N * K < GEMM_SERIAL_FLOPS;
+
+    if (M > GEMM_QUANT_DIRECT_M) {
+        GemmJob<float> job;
+        initJob(&job, transA, GEMM_NO_TRANS, M, N, K, alpha, A, lda, (const float*)NULL, 0,
+                beta, C, ldc, (const GemmPackedB*)NULL, serial ? 1 : gemmGetNumThreads());
+        job.quant = B;
+        job.serial = serial;
+        watch(&job, threadControl, jobTiles(&job), 2ull * M * N * K);
+        runProduct(&job);
+        return;
+    }
+
+    gemmMetricsCount(GEMM_METRIC_QUANT_DIRECT, 1);
+    GemmQuantJob job;
+    job.transA = transA; job.M = M;
+    job.alpha = alpha; job.beta = beta;
+    job.A = A; job.lda = lda;
+    job.B = B;
+    job.C = C; job.ldc = ldc;
+
+    job.priority = threadPriority;
+    job.weight = threadWeight;
+    job.done = false;
+    job.stopped = 0;
+    job.control = NULL;
+    job.future = NULL;
+    job.destroy = NULL;
+    job.running = 0;
+    job.bytes = 0;
+    job.serial = serial;
+    job.task = quantTask;
+    job.advance = quantAdvance;
+    job.nTasks = B->nBlocks;
+    job.nextTask = 0;
+    job.taskCost = 2.0 * M * GEMM_QUANT_NB * K;
+    watch(&job, threadControl, (uint64_t)B->nBlocks, 2ull * M * N * K);
+    runProduct(&job);
+}
+
+// An integer or modular product on the engine: C = op(A) * op(B), or C plus
+// it when accumulate, with the arithmetic exact describes
+template <typename T>
+static void exactDriver(int transA, int transB, int M, int N, int K, const T* A, int lda,
+                        const T* B, int ldb, bool accumulate, typename GemmTraits<T>::Out* C,
+                        int ldc, const GemmExact* exact)
+{
+    GemmJob<T> job;
+    bool serial = 2.0 * M * N * K < GEMM_SERIAL_FLOPS;
+    initJob(&job, transA, transB, M, N, K, (T)1, A, lda, B, ldb, (T)(accumulate ? 1 : 0),
+            C, ldc, (const GemmPackedB*)NULL, serial ? 1 : gemmGetNumThreads());
+    job.exact = exact;
+    job.serial = serial;
+    watch(&job, threadControl, jobTiles(&job), 2ull * M * N * K);
+
+    runProduct(&job);
+}
+
+// Largest magnitude in op(X), rows x cols; |INT64_MIN| fits
+template <typename T>
+static uint64_t maxMagnitude(int trans, int rows, int cols, const T* X, int ld)
+{
+    int r = trans ? cols : rows, c = trans ? rows : cols;
+    uint64_t most = 0;
+    for (int i = 0; i < r; ++i) {
+        const T* row = X + (size_t)i * ld;
+        for (int j = 0; j < c; ++j) {
+            uint64_t v = (row[j] < 0) ? 0 - (uint64_t)row[j] : (uint64_t)row[j];
+            most = (v > most) ? v : most;
+        }
+    }
+    return most;
+}
+
+template <typename T>
+static void clearC(int M, int N, typename GemmTraits<T>::Out* C, int ldc)
+{
+    for (int i = 0; i < M; ++i)
+        memset(C + (size_t)i * ldc, 0, sizeof(*C) * N);
+}
+
+// Exact integer product. When the operands bound every sum below 2^63, the
+// arithmetic modulo 2^64 is exact and that is all it does; otherwise the sums
+// are carried to 128 bits and checked to fit at the end.
+template <typename T>
+static bool integerDriver(int transA, int transB, int M, int N, int K, const T* A, int lda,
+                          const T* B, int ldb, bool accumulate, int64_t* C, int ldc, int mode)
+{
+    if (M <= 0 || N <= 0) return true;
+    if (K <= 0) {
+        if (!accumulate) clearC<T>(M, N, C, ldc);
+        return true;
+    }
+    GemmExact exact = { GEMM_KC, NULL, 0, 0, 0 };
+    if (mode == GEMM_INT_WRAP) {
+        exactDriver<T>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, &exact);
+        return true;
+    }
+
+    uint64_t a = maxMagnitude(transA, M, K, A, lda), b = maxMagnitude(transB, K, N, B, ldb);
+    // a zero operand makes every sum zero, whatever C holds
+    if (a == 0 || b == 0) {
+        if (!accumulate) clearC<T>(M, N, C, ldc);
+        return true;
+    }
+    uint64_t c = accumulate ? maxMagnitude(GEMM_NO_TRANS, M, N, C, ldc) : 0;
+    long double bound = (long double)K * a * b + c;
+    // a little short of the limits, so rounding cannot matter
+    if (bound < 0x1p63L * (1 - 0x1p-40L)) {
+        exactDriver<T>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, &exact);
+        return true;
+    }
+    if (bound >= 0x1p127L * (1 - 0x1p-40L)) {
+        fprintf(stderr, "gemm: integer product may need more than 128 bits; split K\n");
+        return false;
+    }
+
+    // int32 products are below 2^62, so a chunk holds at least two
+    exact.chunk = (sizeof(T) == sizeof(int32_t)) ? (int)std::min<uint64_t>(INT64_MAX / (a * b), GEMM_KC)
+                                                 : GEMM_KC;
+    exact.ldh = N;
+    gemmMetricsCount(GEMM_METRIC_WIDE, 1);
+    exact.high = (int64_t*)malloc(sizeof(int64_t) * M * N);
+    if (!exact.high) {
+        fprintf(stderr, "gemm: cannot allocate %zu bytes for 128-bit sums\n", sizeof(int64_t) * M * N);
+        return false;
+    }
+    if (accumulate)
+        for (int i = 0; i < M; ++i)
+            for (int j = 0; j < N; ++j)
+                exact.high[(size_t)i * N + j] = (C[(size_t)i * ldc + j] < 0) ? -1 : 0;
+
+    exactDriver<T>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, &exact);
+
+    // it fits when the high half is only the sign of the low one
+    bool fits = true;
+    for (int i = 0; i < M && fits; ++i)
+        for (int j = 0; j < N; ++j)
+            fits = fits && exact.high[(size_t)i * N + j] == (C[(size_t)i * ldc + j] < 0 ? -1 : 0);
+    free(exact.high);
+    return fits;
+}
+
+// op(X) with every element reduced below p: X itself if it already is,
+// otherwise a copy in *copy with its leading dimension in *ld
+static const uint32_t* reducedOperand(int trans, int rows, int cols, const uint32_t* X, int* ld,
+                                      uint32_t p, uint32_t** copy)
+{
+    int r = trans ? cols : rows, c = trans ? rows : cols;
+    *copy = NULL;
+    bool reduced = true;
+    for (int i = 0; i < r && reduced; ++i)
+        for (int j = 0; j < c; ++j)
+            reduced = reduced && X[(size_t)i * *ld + j] < p;
+    if (reduced) return X;
+
+    *copy = (uint32_t*)malloc(sizeof(uint32_t) * r * c);
+    if (!*copy) {
+        fprintf(stderr, "gemm: cannot allocate %zu bytes to reduce an operand\n",
+                sizeof(uint32_t) * r * c);
+        return NULL;
+    }
+    for (int i = 0; i < r; ++i)
+        for (int j = 0; j < c; ++j)
+            (*copy)[(size_t)i * c + j] = X[(size_t)i * *ld + j] % p;
+    *ld = c;
+    return *copy;
+}
+
+// C = op(A) * op(B) mod p, or C plus it when accumulate
+static bool modularDriver(int transA, int transB, int M, int N, int K, uint32_t p,
+                          const uint32_t* A, int lda, const uint32_t* B, int ldb,
+                          bool accumulate, uint32_t* C, int ldc)
+{
+    if (p < 2) {
+        fprintf(stderr, "gemm: modulus %u is below 2\n", p);
+        return false;
+    }
+    if (M <= 0 || N <= 0) return true;
+    if (accumulate) {
+        for (int i = 0; i < M; ++i)
+            for (int j = 0; j < N; ++j)
+                C[(size_t)i * ldc + j] %= p;
+    }
+    if (K <= 0) {
+        if (!accumulate) clearC<uint32_t>(M, N, C, ldc);
+        return true;
+    }
+
+    uint32_t *copyA, *copyB = NULL;
+    A = reducedOperand(transA, M, K, A, &lda, p, &copyA);
+    if (A) B = reducedOperand(transB, K, N, B, &ldb, p, &copyB);
+    if (!A || !B) {
+        free(copyA);
+        return false;
+    }
+
+    // after a reduction a sum is below p, and each product at most (p-1)^2
+    uint64_t top = (uint64_t)(p - 1) * (p - 1);
+    GemmExact exact = { GEMM_KC, NULL, 0, p, UINT64_MAX / p };
+    exact.chunk = (int)std::min<uint64_t>((UINT64_MAX - (p - 1)) / top, GEMM_KC);
+    exactDriver<uint32_t>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, &exact);
+    free(copyA);
+    free(copyB);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public interface
+////////////////////////////////////////////////////////////////////////////////
+
+void gemmSgemm(int transA, int transB, int M, int N, int K,
+               float alpha, const float* A, int lda, const float* B, int ldb,
+               float beta, float* C, int ldc)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmDriver<float>(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_SGEMM, M, N, K);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT32, transA, transB, M, N, K,
+                        alpha, A, lda, B, ldb, beta, C, ldc, 0);
+}
+
+void gemmDgemm(int transA, int transB, int M, int N, int K,
+               double alpha, const double* A, int lda, const double* B, int ldb,
+               double beta, double* C, int ldc)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmDriver<double>(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_DGEMM, M, N, K);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT64, transA, transB, M, N, K,
+                        alpha, A, lda, B, ldb, beta, C, ldc, 0);
+}
+
+bool gemmIgemm32(int transA, int transB, int M, int N, int K, const int32_t* A, int lda,
+                 const int32_t* B, int ldb, bool accumulate, int64_t* C, int ldc, int mode)
+{
+    uint64_t began = gemmMetricsBegin();
+    bool ok = integerDriver<int32_t>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, mode);
+    gemmMetricsCall(began, GEMM_OP_IGEMM32, M, N, K);
+    return ok;
+}
+
+bool gemmIgemm64(int transA, int transB, int M, int N, int K, const int64_t* A, int lda,
+                 const int64_t* B, int ldb, bool accumulate, int64_t* C, int ldc, int mode)
+{
+    uint64_t began = gemmMetricsBegin();
+    bool ok = integerDriver<int64_t>(transA, transB, M, N, K, A, lda, B, ldb, accumulate, C, ldc, mode);
+    gemmMetricsCall(began, GEMM_OP_IGEMM64, M, N, K);
+    return ok;
+}
+
+bool gemmModgemm(int transA, int transB, int M, int N, int K, uint32_t p,
+                 const uint32_t* A, int lda, const uint32_t* B, int ldb,
+                 bool accumulate, uint32_t* C, int ldc)
+{
+    uint64_t began = gemmMetricsBegin();
+    bool ok = modularDriver(transA, transB, M, N, K, p, A, lda, B, ldb, accumulate, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_MODGEMM, M, N, K);
+    return ok;
+}
+
+GemmQuantB* gemmQuantizeB(int transB, int K, int N, const float* B, int ldb, int bits, int groupSize)
+{
+    const int NB = GEMM_QUANT_NB;
+    if (bits != 8 && bits != 4) {
+        fprintf(stderr, "gemm: weights quantize to 8 or 4 bits, not %d\n", bits);
+        return NULL;
+    }
+    if (K <= 0 || N <= 0) return NULL;
+    if (groupSize <= 0 || groupSize > K) groupSize = (groupSize <= 0 && K > 128) ? 128 : K;
+
+    GemmQuantB* q = (GemmQuantB*)calloc(1, sizeof(GemmQuantB));
+    q->bits = bits;
+    q->group = groupSize;
+    q->K = K;
+    q->N = N;
+    q->nBlocks = (N + NB - 1) / NB;
+    q->nGroups = (K + groupSize - 1) / groupSize;
+    q->rowBytes = (bits == 8) ? NB : NB / 2;
+
+    size_t codeBytes = (size_t)q->nBlocks * K * q->rowBytes;
+    size_t scaleBytes = sizeof(float) * q->nBlocks * q->nGroups * NB;
+    if (!arenaInit(&q->arena, codeBytes + scaleBytes + 2 * ARENA_ALIGN)) {
+        fprintf(stderr, "gemm: cannot allocate %zu bytes for quantized B\n", codeBytes + scaleBytes);
+        free(q);
+        return NULL;
+    }
+    q->codes = (int8_t*)arenaAlloc(&q->arena, codeBytes, 0);
+    q->scales = (float*)arenaAlloc(&q->arena, scaleBytes, 0);
+    memset(q->codes, 0, codeBytes);
+    memset(q->scales, 0, scaleBytes);
+
+    // Symmetric codes. The scale maps the largest magnitude in a group, or a
+    // little less when clipping the outliers loses less than the finer steps
+    // gain; on typical weights that takes a tenth off the int4 error.
+    static const float clips[] = { 1.0f, 0.95f, 0.9f, 0.85f, 0.8f, 0.75f, 0.7f };
+    const int top = (bits == 8) ? 127 : 7;
+    double diff = 0, norm = 0;
+    for (int col = 0; col < N; ++col) {
+        int jb = col / NB, c = col % NB;
+        for (int g = 0; g < q->nGroups; ++g) {
+            int k0 = g * groupSize, k1 = (k0 + groupSize < K) ? k0 + groupSize : K;
+            float most = 0;
+            for (int k = k0; k < k1; ++k) {
+                float v = transB ? B[(size_t)col * ldb + k] : B[(size_t)k * ldb + col];
+                most = (fabsf(v) > most) ? fabsf(v) : most;
+            }
+            float scale = most / top;
+            double best = -1;
+            for (size_t t = 0; t < sizeof(clips) / sizeof(clips[0]) && most > 0; ++t) {
+                float trial = most * clips[t] / top;
+                double err = 0;
+                for (int k = k0; k < k1; ++k) {
+                    float v = transB ? B[(size_t)col * ldb + k] : B[(size_t)k * ldb + col];
+                    float code = fminf(fmaxf(rintf(v / trial), -top), top);
+                    err += (double)(code * trial - v) * (code * trial - v);
+                }
+                if (best < 0 || err < best) {
+                    best = err;
+                    scale = trial;
+                }
+            }
+            q->scales[((size_t)jb * q->nGroups + g) * NB + c] = scale;
+
+            for (int k = k0; k < k1; ++k) {
+                float v = transB ? B[(size_t)col * ldb + k] : B[(size_t)k * ldb + col];
+                int code = (scale > 0) ? (int)lrintf(v / scale) : 0;
+                code = (code > top) ? top : (code < -top) ? -top : code;
+                int8_t* row = q->codes + ((size_t)jb * K + k) * q->rowBytes;
+                if (bits == 8) row[c] = (int8_t)code;
+                else if (c < NB / 2) row[c] = (int8_t)((row[c] & 0xf0) | (code & 0x0f));
+                else row[c - NB / 2] = (int8_t)((row[c - NB / 2] & 0x0f) | (code << 4));
+
+                double e = (double)scale * code - v;
+                diff += e * e;
+                norm += (double)v * v;
+            }
+        }
+    }
+    q->error = (norm > 0) ? sqrt(diff / norm) : 0;
+    return q;
+}
+
+void gemmQuantInfo(const GemmQuantB* B, GemmQuantInfo* info)
+{
+    info->bits = B->bits;
+    info->groupSize = B->group;
+    info->bytes = (size_t)B->nBlocks * B->K * B->rowBytes
+                + sizeof(float) * B->nBlocks * B->nGroups * GEMM_QUANT_NB;
+    info->weightError = B->error;
+}
+
+void gemmFreeQuantB(GemmQuantB* B)
+{
+    if (!B) return;
+    arenaDestroy(&B->arena);
+    free(B);
+}
+
+void gemmSgemmQuant(int transA, int M, float alpha, const float* A, int lda,
+                    const GemmQuantB* B, float beta, float* C, int ldc)
+{
+    uint64_t began = gemmMetricsBegin();
+    gemmDriverQuant(transA, M, alpha, A, lda, B, beta, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_SGEMM_QUANT, M, B->N, B->K);
+}
+
+GemmPackedB* gemmSpackB(int transB, int K, int N, const float* B, int ldb)
+{
+    return packWhole<float>(MATRIX_FLOAT32, transB, K, N, B, ldb);
+}
+
+GemmPackedB* gemmDpackB(int transB, int K, int N, const double* B, int ldb)
+{
+    return packWhole<double>(MATRIX_FLOAT64, transB, K, N, B, ldb);
+}
+
+void gemmFreePackedB(GemmPackedB* B)
+{
+    if (!B) return;
+    arenaDestroy(&B->arena);
+    free(B->offsets);
+    free(B);
+}
+
+void gemmSgemmPacked(int transA, int M, float alpha, const float* A, int lda,
+                     const GemmPackedB* B, float beta, float* C, int ldc)
+{
+    if (B->dtype != MATRIX_FLOAT32) {
+        fprintf(stderr, "gemm: B was packed as double\n");
+        return;
+    }
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmMetricsCount(GEMM_METRIC_RESIDENT_B, 1);
+    gemmDriverPacked<float>(transA, M, alpha, A, lda, B, beta, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_SGEMM, M, B->N, B->K);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT32, transA, GEMM_NO_TRANS, M, B->N, B->K,
+                        alpha, A, lda, B, B->N, beta, C, ldc, TRACE_PACKED_B);
+}
+
+void gemmDgemmPacked(int transA, int M, double alpha, const double* A, int lda,
+                     const GemmPackedB* B, double beta, double* C, int ldc)
+{
+    if (B->dtype != MATRIX_FLOAT64) {
+        fprintf(stderr, "gemm: B was packed as float\n");
+        return;
+    }
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmMetricsCount(GEMM_METRIC_RESIDENT_B, 1);
+    gemmDriverPacked<double>(transA, M, alpha, A, lda, B, beta, C, ldc);
+    gemmMetricsCall(began, GEMM_OP_DGEMM, M, B->N, B->K);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT64, transA, GEMM_NO_TRANS, M, B->N, B->K,
+                        alpha, A, lda, B, B->N, beta, C, ldc, TRACE_PACKED_B);
+}
+
+bool gemmSgemmInPlace(int transB, int M, int N, float alpha, float* A, int lda,
+                      const float* B, int ldb, int rowBlock)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmMetricsCount(GEMM_METRIC_IN_PLACE, 1);
+    bool ok = gemmDriverInPlace<float>(transB, M, N, alpha, A, lda, B, ldb, rowBlock);
+    gemmMetricsCall(began, GEMM_OP_SGEMM, M, N, N);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT32, GEMM_NO_TRANS, transB, M, N, N,
+                        alpha, A, lda, B, ldb, 0, A, lda, TRACE_IN_PLACE);
+    return ok;
+}
+
+bool gemmDgemmInPlace(int transB, int M, int N, double alpha, double* A, int lda,
+                      const double* B, int ldb, int rowBlock)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    uint64_t began = gemmMetricsBegin();
+    gemmMetricsCount(GEMM_METRIC_IN_PLACE, 1);
+    bool ok = gemmDriverInPlace<double>(transB, M, N, alpha, A, lda, B, ldb, rowBlock);
+    gemmMetricsCall(began, GEMM_OP_DGEMM, M, N, N);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT64, GEMM_NO_TRANS, transB, M, N, N,
+                        alpha, A, lda, B, ldb, 0, A, lda, TRACE_IN_PLACE);
+    return ok;
+}
+
+GemmFuture* gemmSgemmAsync(int transA, int transB, int M, int N, int K,
+                           float alpha, const float* A, int lda, const float* B, int ldb,
+                           float beta, float* C, int ldc, GemmFuture* const* after, int nAfter)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    GemmFuture* f = gemmDriverAsync<float>(transA, transB, M, N, K, alpha, A, lda, B, ldb,
+                                           beta, C, ldc, after, nAfter);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT32, transA, transB, M, N, K,
+                        alpha, A, lda, B, ldb, beta, C, ldc, TRACE_ASYNC);
+    return f;
+}
+
+GemmFuture* gemmDgemmAsync(int transA, int transB, int M, int N, int K,
+                           double alpha, const double* A, int lda, const double* B, int ldb,
+                           double beta, double* C, int ldc, GemmFuture* const* after, int nAfter)
+{
+    uint64_t start = gemmTraceActive() ? gemmTraceNow() : 0;
+    GemmFuture* f = gemmDriverAsync<double>(transA, transB, M, N, K, alpha, A, lda, B, ldb,
+                                            beta, C, ldc, after, nAfter);
+    if (start)
+        gemmTraceRecord(start, MATRIX_FLOAT64, transA, transB, M, N, K,
+                        alpha, A, lda, B, ldb, beta, C, ldc, TRACE_ASYNC);
+    return f;
+}
+
+int gemmFutureStatus(GemmFuture* f)
+{
+    pthread_mutex_lock(&schedLock);
+    int status = f->status;
+    pthread_mutex_unlock(&schedLock);
+    return status;
+}
+
+int gemmFutureWait(GemmFuture* f)
+{
+    pthread_mutex_lock(&schedLock);
+    while (f->status == GEMM_STATUS_PENDING)
+        if (!helpOnce())
+            pthread_cond_wait(&schedDone, &schedLock);
+    int status = f->status;
+    pthread_mutex_unlock(&schedLock);
+    return status;
+}
+
+void gemmFutureThen(GemmFuture* f, GemmCallback fn, void* arg)
+{
+    pthread_mutex_lock(&schedLock);
+    if (f->status != GEMM_STATUS_PENDING) {
+        pthread_mutex_unlock(&schedLock);
+        fn(f, arg);
+        return;
+    }
+
+    GemmCallbackNode* cb = (GemmCallbackNode*)malloc(sizeof(GemmCallbackNode));
+    cb->fn = fn;
+    cb->arg = arg;
+    cb->future = f;
+    cb->next = NULL;
+    f->refs++;
+
+    GemmCallbackNode** link = &f->callbacks;
+    while (*link) link = &(*link)->next;
+    *link = cb;
+    pthread_mutex_unlock(&schedLock);
+}
+
+bool gemmFutureCancel(GemmFuture* f)
+{
+    pthread_mutex_lock(&schedLock);
+    bool pending = f->status == GEMM_STATUS_PENDING;
+    if (pending && !f->admitted) {
+        if (f->queued) {
+            GemmFuture** link = &pool.queued;
+            while (*link != f) link = &(*link)->nextQueued;
+            *link = f->nextQueued;
+            f->queued = false;
+            pool.waiting[f->product->priority]--;
+        }
+        finishFuture(f, GEMM_STATUS_CANCELLED);
+    } else if (pending) {
+        stopProduct(f->product, GEMM_STATUS_CANCELLED);
+    }
+    if (pending && f->control == &f->own)
+        __atomic_store_n(&f->own.cancelled, 1, __ATOMIC_RELAXED);
+    runFired();
+    pthread_mutex_unlock(&schedLock);
+    return pending;
+}
+
+GemmControl* gemmFutureControl(GemmFuture* f)
+{
+    return f->control;
+}
+
+void gemmFutureRelease(GemmFuture* f)
+{
+    if (!f) return;
+    pthread_mutex_lock(&schedLock);
+    releaseFuture(f);
+    pthread_mutex_unlock(&schedLock);
+}
+
+GemmControl* gemmControlCreate()
+{
+    return (GemmControl*)calloc(1, sizeof(GemmControl));
+}
+
+void gemmControlDestroy(GemmControl* control)
+{
+    free(control);
+}
+
+void gemmControlSetDeadline(GemmControl* control, double seconds)
+{
+    uint64_t deadline = (seconds > 0) ? nowNs() + (uint64_t)(seconds * 1.0e9) : 0;
+    __atomic_store_n(&control->deadline, deadline, __ATOMIC_RELAXED);
+
+    // admission waits sleep no longer than the deadline they saw
+    pthread_mutex_lock(&schedLock);
+    pthread_cond_broadcast(&schedDone);
+    pthread_mutex_unlock(&schedLock);
+}
+
+void gemmControlCancel(GemmControl* control)
+{
+    __atomic_store_n(&control->cancelled, 1, __ATOMIC_RELAXED);
+
+    // Products that are waiting stop now; running ones at their next tile,
+    // which the sweep below brings forward for products no thread is
+    // claiming from. Stopping may complete a product and change the lists,
+    // so each sweep starts over.
+    pthread_mutex_lock(&schedLock);
+    for (bool found = true; found; ) {
+        found = false;
+        for (GemmProduct* p = pool.active; p && !found; p = p->next) {
+            if (p->control == control && !p->stopped) {
+                stopProduct(p, GEMM_STATUS_CANCELLED);
+                found = true;
+            }
+        }
+    }
+    admitQueued();
+    runFired();
+    pthread_cond_broadcast(&schedDone);
+    pthread_mutex_unlock(&schedLock);
+}
+
+void gemmControlProgress(GemmControl* control, GemmProgress* progress)
+{
+    uint64_t flopsDone  = __atomic_load_n(&control->flopsDone, __ATOMIC_RELAXED);
+    uint64_t flopsTotal = __atomic_load_n(&control->flopsTotal, __ATOMIC_RELAXED);
+    uint64_t start      = __atomic_load_n(&control->start, __ATOMIC_RELAXED);
+
+    progress->tilesDone  = __atomic_load_n(&control->tilesDone, __ATOMIC_RELAXED);
+    progress->tilesTotal = __atomic_load_n(&control->tilesTotal, __ATOMIC_RELAXED);
+    progress->flopsDone  = (double)flopsDone;
+    progress->flopsTotal = (double)flopsTotal;
+    progress->seconds    = start ? (nowNs() - start) * 1.0e-9 : 0;
+    progress->eta        = (flopsDone > 0 && flopsTotal >= flopsDone)
+                         ? progress->seconds * (flopsTotal - flopsDone) / flopsDone : -1;
+
+    if (__atomic_load_n(&control->cancelled, __ATOMIC_RELAXED))
+        progress->status = GEMM_STATUS_CANCELLED;
+    else if (__atomic_load_n(&control->expired, __ATOMIC_RELAXED))
+        progress->status = GEMM_STATUS_EXPIRED;
+    else if (__atomic_load_n(&control->active, __ATOMIC_ACQUIRE) > 0)
+        progress->status = GEMM_STATUS_PENDING;
+    else
+        progress->status = GEMM_STATUS_DONE;
+}
+
+void gemmSetControl(GemmControl* control)
+{
+    threadControl = control;
+}
+
+GemmControl* gemmGetControl()
+{
+    return threadControl;
+}
+
+void gemmSetNumThreads(int n)
+{
+    pthread_mutex_lock(&schedLock);
+    pool.nThreads = (n < 0) ? 0 : n;
+    pthread_mutex_unlock(&schedLock);
+}
+
+int gemmGetNumThreads()
+{
+    return wantedThreads();
+}
+
+void gemmSetAffinity(int policy)
+{
+    // workers pin themselves at startup, so the pool restarts when idle
+    pthread_mutex_lock(&schedLock);
+    pool.affinity = policy;
+    pthread_mutex_unlock(&schedLock);
+}
+
+int gemmGetAffinity()
+{
+    return pool.affinity;
+}
+
+int gemmParseAffinity(const char* name)
+{
+    if (strcmp(name, "none") == 0)    return GEMM_AFFINITY_NONE;
+    if (strcmp(name, "compact") == 0) return GEMM_AFFINITY_COMPACT;
+    if (strcmp(name, "scatter") == 0) return GEMM_AFFINITY_SCATTER;
+    return -1;
+}
+
+const char* gemmAffinityName(int policy)
+{
+    switch (policy) {
+        case GEMM_AFFINITY_COMPACT: return "compact";
+        case GEMM_AFFINITY_SCATTER: return "scatter";
+    }
+    return "none";
+}
+
+void gemmSetPriority(int priority, int weight)
+{
+    if (priority < 0) priority = 0;
+    if (priority >= GEMM_PRIORITY_COUNT) priority = GEMM_PRIORITY_COUNT - 1;
+    threadPriority = priority;
+    threadWeight = (weight > 0) ? weight : 1;
+}
+
+void gemmGetPriority(int* priority, int* weight)
+{
+    if (priority) *priority = threadPriority;
+    if (weight) *weight = threadWeight;
+}
+
+void gemmSetMemoryBudget(size_t bytes)
+{
+    pthread_mutex_lock(&schedLock);
+    pool.budget = bytes;
+    // a larger budget may admit products that are waiting
+    admitQueued();
+    runFired();
+    pthread_cond_broadcast(&schedDone);
+    pthread_mutex_unlock(&schedLock);
+}
+
+void gemmTileSize(int dtype, int* mr, int* nr)
+{
+    bool dbl = dtype == MATRIX_FLOAT64;
+    if (mr) *mr = dbl ? (int)GemmTraits<double>::MR : (int)GemmTraits<float>::MR;
+    if (nr) *nr = dbl ? (int)GemmTraits<double>::NR : (int)GemmTraits<float>::NR;
+}
+
+void gemmShutdown()
+{
+    gemmMetricsStopExport();
+    pthread_mutex_lock(&schedLock);
+    while (pool.restarting || pool.nActive > 0 || pool.nPending > 0)
+        if (!helpOnce())
+            pthread_cond_wait(&schedDone, &schedLock);
+    pool.restarting = true;
+    pthread_mutex_unlock(&schedLock);
+
+    stopPool();
+    destroySlots();
+
+    pthread_mutex_lock(&schedLock);
+    pool.restarting = false;
+    pthread_cond_broadcast(&schedDone);
+    pthread_mutex_unlock(&schedLock);
+}
@@ -0,0 +1,260 @@
+#ifndef _GEMM_H_
+#define _GEMM_H_
+
+// Blocked, packed, multithreaded CPU GEMM engine.
+//
+// All matrices are row-major. op(A) is M x K, op(B) is K x N and C is M x N:
+//
+//     C = alpha * op(A) * op(B) + beta * C
+//
+// As in BLAS, C is not read when beta is 0. Products from several threads
+// run concurrently and share the engine's worker pool by priority class and
+// weight (see gemmSetPriority); within a product, workers can move to a more
+// urgent one at every tile.
+//
+// The *Async forms return at once with a future. The product starts when the
+// products it is chained after have completed and runs entirely on the
+// engine's workers; completion is signalled by callback, so no thread has to
+// block on it. With a single thread (gemmSetNumThreads(1)) there are no
+// workers, and asynchronous products only progress while a thread waits.
+//
+// A GemmControl cancels, bounds and reports on the products submitted under
+// it. Stopping is cooperative and takes effect at the next tile: tiles already
+// running finish, then the product is retired as usual. Progress can be read
+// from any thread without taking a lock.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GEMM_NO_TRANS 0
+#define GEMM_TRANS    1
+
+#define GEMM_AFFINITY_NONE    0     // leave placement to the OS
+#define GEMM_AFFINITY_COMPACT 1     // thread t on CPU t
+#define GEMM_AFFINITY_SCATTER 2     // threads spread evenly over the CPUs
+
+// Priority classes, most urgent first. A class only gets workers that no
+// more urgent product can use.
+#define GEMM_PRIORITY_HIGH    0     // latency critical
+#define GEMM_PRIORITY_NORMAL  1
+#define GEMM_PRIORITY_BATCH   2     // throughput work
+#define GEMM_PRIORITY_COUNT   3
+
+// Future status
+#define GEMM_STATUS_PENDING   0
+#define GEMM_STATUS_DONE      1
+#define GEMM_STATUS_CANCELLED 2     // C is partly updated
+#define GEMM_STATUS_FAILED    3     // pack buffers could not be allocated
+#define GEMM_STATUS_EXPIRED   4     // stopped at the deadline; C is partly updated
+
+typedef struct GemmFuture GemmFuture;
+typedef struct GemmControl GemmControl;
+typedef struct GemmPackedB GemmPackedB;
+
+typedef struct {
+    int      status;                // GEMM_STATUS_*; PENDING while any product runs
+    uint64_t tilesDone, tilesTotal; // MC x NC blocks of C, per K slice
+    double   flopsDone, flopsTotal;
+    double   seconds;               // since the first product started
+    double   eta;                   // seconds left at the rate so far; -1 until known
+} GemmProgress;
+
+// Runs on the thread that completes the product, or at once on the caller's
+// if it already has. It may submit products but must not wait on them.
+typedef void (*GemmCallback)(GemmFuture* future, void* arg);
+
+void gemmSgemm(int transA, int transB, int M, int N, int K,
+               float alpha, const float* A, int lda, const float* B, int ldb,
+               float beta, float* C, int ldc);
+
+void gemmDgemm(int transA, int transB, int M, int N, int K,
+               double alpha, const double* A, int lda, const double* B, int ldb,
+               double beta, double* C, int ldc);
+
+// Exact integer products: C = op(A) * op(B), or C += op(A) * op(B) when
+// accumulate, with C in int64.
+//   - GEMM_INT_WRAP keeps C modulo 2^64, as unsigned arithmetic would; this
+//     is exact whenever the true result fits.
+//   - GEMM_INT_EXACT returns false if any element does not fit in int64.
+//     C then holds it modulo 2^64. When the magnitudes in A, B and C cannot
+//     reach 2^63, it costs only a pass over the operands. Otherwise the sums
+//     are carried to 128 bits, in an M x N workspace. When even 128 bits
+//     might not hold them (int64 operands near 2^63 with a long K), it
+//     returns false with a message and leaves C alone.
+// Products of int32 operands are exact 64-bit multiplies in the vector
+// units. int64 operands in exact mode need 128-bit products, which are not
+// vectorized.
+#define GEMM_INT_WRAP  0
+#define GEMM_INT_EXACT 1
+
+bool gemmIgemm32(int transA, int transB, int M, int N, int K, const int32_t* A, int lda,
+                 const int32_t* B, int ldb, bool accumulate, int64_t* C, int ldc, int mode);
+bool gemmIgemm64(int transA, int transB, int M, int N, int K, const int64_t* A, int lda,
+                 const int64_t* B, int ldb, bool accumulate, int64_t* C, int ldc, int mode);
+
+// C = op(A) * op(B) mod p, or (C + op(A) * op(B)) mod p, for 2 <= p < 2^32.
+// Elements of A and B at or above p are reduced first, into copies; those
+// of C are reduced in place when accumulating. Products are 32 x 32 -> 64
+// bits. They are summed unreduced for as long as the sum cannot overflow,
+// up to a whole K slice of the blocking for p below 2^28 and a few steps
+// near 2^32, then reduced by Barrett's method. False only for a bad
+// modulus or no memory.
+bool gemmModgemm(int transA, int transB, int M, int N, int K, uint32_t p,
+                 const uint32_t* A, int lda, const uint32_t* B, int ldb,
+                 bool accumulate, uint32_t* C, int ldc);
+
+// Packs op(B) (K x N) once, for products that all multiply by it. NULL if
+// K or N is 0 or memory runs out. B itself is no longer needed afterwards.
+GemmPackedB* gemmSpackB(int transB, int K, int N, const float* B, int ldb);
+GemmPackedB* gemmDpackB(int transB, int K, int N, const double* B, int ldb);
+void gemmFreePackedB(GemmPackedB* B);
+
+// C = alpha * op(A) * B + beta * C with B packed beforehand; op(A) is M x K
+void gemmSgemmPacked(int transA, int M, float alpha, const float* A, int lda,
+                     const GemmPackedB* B, float beta, float* C, int ldc);
+void gemmDgemmPacked(int transA, int M, double alpha, const double* A, int lda,
+                     const GemmPackedB* B, double beta, double* C, int ldc);
+
+// Weight-only quantization: op(B) (K x N) stored as int8 codes, or int4
+// codes two to a byte, with an fp32 scale for every groupSize rows of each
+// column (0 picks 128), for products whose time goes to streaming weights.
+// A and C stay fp32. Products of more than a few rows dequantize B as its
+// panels are packed and run the usual kernels. Those of a few rows, the
+// memory-bound case, read each code once and dequantize it straight into
+// the accumulators. NULL for bits other than 8 or 4, an empty B, or no
+// memory.
+typedef struct GemmQuantB GemmQuantB;
+
+typedef struct {
+    int    bits, groupSize;
+    size_t bytes;                   // codes and scales; fp32 B takes 4 * K * N
+    double weightError;             // ||dequantized B - B||_F / ||B||_F
+} GemmQuantInfo;
+
+GemmQuantB* gemmQuantizeB(int transB, int K, int N, const float* B, int ldb, int bits, int groupSize);
+void gemmQuantInfo(const GemmQuantB* B, GemmQuantInfo* info);
+void gemmFreeQuantB(GemmQuantB* B);
+
+// C = alpha * op(A) * dequantized B + beta * C; op(A) is M x K
+void gemmSgemmQuant(int transA, int M, float alpha, const float* A, int lda,
+                    const GemmQuantB* B, float beta, float* C, int ldc);
+
+// A = alpha * A * op(B) in place, for op(B) N x N and A M x N. Works through
+// rowBlock rows at a time (0 picks a few blocks per thread) with a rowBlock x N
+// workspace instead of a second M x N matrix. B must not overlap A. If the
+// product is stopped by its control, A is left with whole panels of rows
+// done and the rest untouched. False if the workspace cannot be allocated.
+bool gemmSgemmInPlace(int transB, int M, int N, float alpha, float* A, int lda,
+                      const float* B, int ldb, int rowBlock);
+bool gemmDgemmInPlace(int transB, int M, int N, double alpha, double* A, int lda,
+                      const double* B, int ldb, int rowBlock);
+
+// Start once every future in after[0..nAfter) is done; if one of them is
+// cancelled or fails, so is this. The caller owns one reference to the
+// result and keeps A, B and C alive until it completes.
+GemmFuture* gemmSgemmAsync(int transA, int transB, int M, int N, int K,
+                           float alpha, const float* A, int lda, const float* B, int ldb,
+                           float beta, float* C, int ldc, GemmFuture* const* after, int nAfter);
+
+GemmFuture* gemmDgemmAsync(int transA, int transB, int M, int N, int K,
+                           double alpha, const double* A, int lda, const double* B, int ldb,
+                           double beta, double* C, int ldc, GemmFuture* const* after, int nAfter);
+
+// GEMM_STATUS_*, without blocking
+int  gemmFutureStatus(GemmFuture* future);
+
+// Blocks until the product completes, running its tasks (or those of other
+// asynchronous products) meanwhile; returns the final status
+int  gemmFutureWait(GemmFuture* future);
+
+// Calls fn(future, arg) once the product completes; callbacks run in the
+// order they were added
+void gemmFutureThen(GemmFuture* future, GemmCallback fn, void* arg);
+
+// Stops handing out the product's tiles; those already running finish. Its
+// dependents are cancelled too. False if it had already completed.
+bool gemmFutureCancel(GemmFuture* future);
+
+// The control the product runs under: the one attached when it was submitted,
+// or its own. Valid while the future is.
+GemmControl* gemmFutureControl(GemmFuture* future);
+
+void gemmFutureRelease(GemmFuture* future);
+
+// Controls are owned by the caller and must outlive the products under them
+GemmControl* gemmControlCreate();
+void gemmControlDestroy(GemmControl* control);
+
+// Stops products under control that run past now + seconds; 0 clears it
+void gemmControlSetDeadline(GemmControl* control, double seconds);
+
+// Stops every product under control, now and from now on
+void gemmControlCancel(GemmControl* control);
+
+// Lock-free snapshot of the products under control so far
+void gemmControlProgress(GemmControl* control, GemmProgress* progress);
+
+// Products this thread submits from now on run under control; NULL detaches.
+// A blocking call that was stopped returns early; its status is in the
+// control's progress.
+void gemmSetControl(GemmControl* control);
+GemmControl* gemmGetControl();
+
+// Worker pool configuration; takes effect on the next product started while
+// no other is in flight. n = 0 uses every online CPU. The calling thread
+// counts as one of the n.
+void gemmSetNumThreads(int n);
+int  gemmGetNumThreads();
+
+// GEMM_AFFINITY_*; pinning applies to the workers and the calling thread
+void gemmSetAffinity(int policy);
+int  gemmGetAffinity();
+
+// "none", "compact" or "scatter"; returns -1 for anything else
+int  gemmParseAffinity(const char* name);
+const char* gemmAffinityName(int policy);
+
+// Class and weight of the products this thread submits from now on. Within a
+// class, workers are shared in proportion to weight. Default NORMAL, 1.
+void gemmSetPriority(int priority, int weight);
+void gemmGetPriority(int* priority, int* weight);
+
+// Pack buffer memory that products in flight may hold together; 0 (the
+// default) means no limit. Products that would exceed it wait to start, more
+// urgent classes first. A product larger than the budget runs alone.
+void gemmSetMemoryBudget(size_t bytes);
+
+// Register tile of the micro-kernel for MATRIX_FLOAT32 or MATRIX_FLOAT64;
+// plugin kernels (see gemmPlugin.h) must compute the same
+void gemmTileSize(int dtype, int* mr, int* nr);
+
+// Waits for products in flight (asynchronous ones included), then joins the worker threads; the next
+// product starts them again
+void gemmShutdown();
+
+#if __cplusplus >= 202002L
+#include <coroutine>
+
+// co_await gemmAwait(future) suspends a coroutine until the product completes
+// and resumes it on the completing thread, yielding the status
+struct GemmAwaiter {
+    GemmFuture* future;
+
+    bool await_ready() const { return gemmFutureStatus(future) != GEMM_STATUS_PENDING; }
+    void await_suspend(std::coroutine_handle<> h) { gemmFutureThen(future, resume, h.address()); }
+    int  await_resume() const { return gemmFutureStatus(future); }
+
+    static void resume(GemmFuture*, void* address)
+    {
+        std::coroutine_handle<>::from_address(address).resume();
+    }
+};
+
+inline GemmAwaiter gemmAwait(GemmFuture* future)
+{
+    GemmAwaiter awaiter = { future };
+    return awaiter;
+}
+#endif
+
+#endif // _GEMM_H_
@@ -0,0 +1,316 @@
+// Batched products of very small matrices in an interleaved layout.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gemmBatch.h"
+#include "matrixIO.h"
+
+// Below this many groups, entering an OpenMP region costs more than it saves,
+// even one with a false if clause, so the kernels skip it altogether
+#define BATCH_PARALLEL_GROUPS 64
+
+// Accumulator vectors a kernel may keep in registers: AVX-512 has 32 vector
+// registers even at 32 bytes, AVX2 has 16
+#ifdef __AVX512VL__
+#define BATCH_ACC_VECTORS 24
+#else
+#define BATCH_ACC_VECTORS 12
+#endif
+
+template <typename T> struct BatchTraits;
+// Kernels work through a group CHUNK lanes (32 bytes) at a time, which keeps
+// the accumulators within the register file whether or not the compiler
+// chooses 64-byte vectors
+template <> struct BatchTraits<float>  { enum { LANES = GEMM_BATCH_LANES_F32, CHUNK = 8 }; };
+template <> struct BatchTraits<double> { enum { LANES = GEMM_BATCH_LANES_F64, CHUNK = 4 }; };
+
+size_t gemmBatchElements(int dtype, int rows, int cols, int count)
+{
+    int lanes = (dtype == MATRIX_FLOAT64) ? GEMM_BATCH_LANES_F64 : GEMM_BATCH_LANES_F32;
+    size_t groups = ((size_t)count + lanes - 1) / lanes;
+    return groups * rows * cols * lanes;
+}
+
+template <typename T>
+static void interleave(int rows, int cols, int count, const T* src, T* dst)
+{
+    const int W = BatchTraits<T>::LANES;
+    size_t elems = (size_t)rows * cols;
+    int groups = (count + W - 1) / W;
+
+    #pragma omp parallel for schedule(static) if (groups >= BATCH_PARALLEL_GROUPS)
+    for (int g = 0; g < groups; ++g) {
+        T* out = dst + (size_t)g * elems * W;
+        int n = (count - g * W < W) ? count - g * W : W;
+        if (n < W) memset(out, 0, sizeof(T) * elems * W);
+        for (int l = 0; l < n; ++l) {
+            const T* m = src + ((size_t)g * W + l) * elems;
+            for (size_t e = 0; e < elems; ++e)
+                out[e * W + l] = m[e];
+        }
+    }
+}
+
+template <typename T>
+static void deinterleave(int rows, int cols, int count, const T* src, T* dst)
+{
+    const int W = BatchTraits<T>::LANES;
+    size_t elems = (size_t)rows * cols;
+    int groups = (count + W - 1) / W;
+
+    #pragma omp parallel for schedule(static) if (groups >= BATCH_PARALLEL_GROUPS)
+    for (int g = 0; g < groups; ++g) {
+        const T* in = src + (size_t)g * elems * W;
+        int n = (count - g * W < W) ? count - g * W : W;
+        for (int l = 0; l < n; ++l) {
+            T* m = dst + ((size_t)g * W + l) * elems;
+            for (size_t e = 0; e < elems; ++e)
+                m[e] = in[e * W + l];
+        }
+    }
+}
+
+// Rows i0 .. i0 + R - 1 and columns j0 .. j0 + NB - 1 of C for one group,
+// CHUNK lanes at a time. The accumulator holds that tile for the chunk's lanes,
+// R * NB vectors, and each step over k adds R elements of A times NB of a row
+// of B, so every vector of B loaded serves R multiply-adds. R and NB are
+// constants and the loops over them fully unrolled, or the accumulator would
+// not be kept in registers.
+template <typename T, int R, int N, int NB = N>
+static inline __attribute__((always_inline))
+void batchRows(int i0, int j0, int K, T alpha, const T* a, const T* b, T beta, T* c)
+{
+    const int W = BatchTraits<T>::LANES, V = BatchTraits<T>::CHUNK;
+
+    for (int h = 0; h < W; h += V) {
+        T acc[R * NB * V];
+        #pragma GCC unroll 128
+        for (int x = 0; x < R * NB * V; ++x)
+            acc[x] = 0;
+
+        for (int k = 0; k < K; ++k) {
+            const T* bk = b + (size_t)k * N * W + h;
+            #pragma GCC unroll 16
+            for (int r = 0; r < R; ++r) {
+                const T* aik = a + ((size_t)(i0 + r) * K + k) * W + h;
+                #pragma GCC unroll 16
+                for (int j = 0; j < NB; ++j) {
+                    #pragma omp simd
+                    for (int l = 0; l < V; ++l)
+                        acc[(r * NB + j) * V + l] += aik[l] * bk[(j0 + j) * W + l];
+                }
+            }
+        }
+
+        #pragma GCC unroll 16
+        for (int r = 0; r < R; ++r) {
+            #pragma GCC unroll 16
+            for (int j = 0; j < NB; ++j) {
+                T* cij = c + ((size_t)(i0 + r) * N + j0 + j) * W + h;
+                if (beta == 0) {
+                    #pragma omp simd
+                    for (int l = 0; l < V; ++l)
+                        cij[l] = alpha * acc[(r * NB + j) * V + l];
+                } else {
+                    #pragma omp simd
+                    for (int l = 0; l < V; ++l)
+                        cij[l] = beta * cij[l] + alpha * acc[(r * NB + j) * V + l];
+                }
+            }
+        }
+    }
+}
+
+// Rows i .. M - 1, R at a time and the rest in tiles of 4, 2 and 1
+template <typename T, int R, int N>
+static inline __attribute__((always_inline))
+void batchTiles(int M, int K, T alpha, const T* a, const T* b, T beta, T* c)
+{
+    int i = 0;
+    for (; i + R <= M; i += R)
+        batchRows<T, R, N>(i, 0, K, alpha, a, b, beta, c);
+    if (R > 4)
+        for (; i + 4 <= M; i += 4)
+            batchRows<T, (R > 4 ? 4 : R), N>(i, 0, K, alpha, a, b, beta, c);
+    if (R > 2)
+        for (; i + 2 <= M; i += 2)
+            batchRows<T, (R > 2 ? 2 : R), N>(i, 0, K, alpha, a, b, beta, c);
+    if (R > 1)
+        for (; i < M; ++i)
+            batchRows<T, 1, N>(i, 0, K, alpha, a, b, beta, c);
+}
+
+// Rows of C per tile: as many as keep the accumulator in BATCH_ACC_VECTORS
+#define BATCH_TILE_ROWS(N) \
+    ((BATCH_ACC_VECTORS / (N) < 1) ? 1 : (BATCH_ACC_VECTORS / (N) > 8) ? 8 : BATCH_ACC_VECTORS / (N))
+
+// M x N products with K known only at run time
+template <typename T, int N>
+static void batchKernel(int M, int K, int groups, T alpha, const T* A, const T* B, T beta, T* C)
+{
+    const int W = BatchTraits<T>::LANES;
+    size_t stepA = (size_t)M * K * W, stepB = (size_t)K * N * W, stepC = (size_t)M * N * W;
+
+    if (groups < BATCH_PARALLEL_GROUPS) {
+        for (int g = 0; g < groups; ++g)
+            batchTiles<T, BATCH_TILE_ROWS(N), N>(M, K, alpha, A + g * stepA, B + g * stepB,
+                                                  beta, C + g * stepC);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (int g = 0; g < groups; ++g)
+        batchTiles<T, BATCH_TILE_ROWS(N), N>(M, K, alpha, A + g * stepA, B + g * stepB,
+                                              beta, C + g * stepC);
+}
+
+// Every lane of one D x D group at once. For a product as short as 2 x 2 the
+// passes per chunk and the tile bookkeeping cost more than the arithmetic.
+// All of C is summed before any of it is stored, since a store could alias A
+// or B and would make every element reload them.
+template <typename T, int D>
+static inline __attribute__((always_inline))
+void wholeGroup(T alpha, const T* a, const T* b, T beta, T* c)
+{
+    const int W = BatchTraits<T>::LANES;
+
+    T acc[D * D * W];
+    #pragma GCC unroll 16
+    for (int i = 0; i < D; ++i) {
+        #pragma GCC unroll 16
+        for (int j = 0; j < D; ++j) {
+            T* sum = acc + (i * D + j) * W;
+            #pragma omp simd
+            for (int l = 0; l < W; ++l)
+                sum[l] = 0;
+            #pragma GCC unroll 16
+            for (int k = 0; k < D; ++k) {
+                #pragma omp simd
+                for (int l = 0; l < W; ++l)
+                    sum[l] += a[(i * D + k) * W + l] * b[(k * D + j) * W + l];
+            }
+        }
+    }
+
+    if (beta == 0) {
+        #pragma omp simd
+        for (int x = 0; x < D * D * W; ++x)
+            c[x] = alpha * acc[x];
+    } else {
+        #pragma omp simd
+        for (int x = 0; x < D * D * W; ++x)
+            c[x] = beta * c[x] + alpha * acc[x];
+    }
+}
+
+// One D x D group. 8 x 8 goes in four 4 x 4 tiles: tiles of whole rows (3, 3
+// and 2 of them) load more of B per multiply-add than the registers can hide.
+template <typename T, int D>
+static inline __attribute__((always_inline))
+void squareGroup(T alpha, const T* a, const T* b, T beta, T* c)
+{
+    if (D <= 2) {
+        wholeGroup<T, D>(alpha, a, b, beta, c);
+    } else if (D == 8) {
+        batchRows<T, 4, D, 4>(0, 0, D, alpha, a, b, beta, c);
+        batchRows<T, 4, D, 4>(0, 4, D, alpha, a, b, beta, c);
+        batchRows<T, 4, D, 4>(4, 0, D, alpha, a, b, beta, c);
+        batchRows<T, 4, D, 4>(4, 4, D, alpha, a, b, beta, c);
+    } else {
+        batchTiles<T, BATCH_TILE_ROWS(D), D>(D, D, alpha, a, b, beta, c);
+    }
+}
+
+// D x D products; with every bound a constant the loop over k unrolls too,
+// leaving straight-line code per group
+template <typename T, int D>
+static void batchSquare(int groups, T alpha, const T* A, const T* B, T beta, T* C)
+{
+    const int W = BatchTraits<T>::LANES;
+    const size_t step = (size_t)D * D * W;
+
+    if (groups < BATCH_PARALLEL_GROUPS) {
+        for (int g = 0; g < groups; ++g)
+            squareGroup<T, D>(alpha, A + g * step, B + g * step, beta, C + g * step);
+        return;
+    }
+    #pragma omp parallel for schedule(static)
+    for (int g = 0; g < groups; ++g)
+        squareGroup<T, D>(alpha, A + g * step, B + g * step, beta, C + g * step);
+}
+
+template <typename T>
+static bool batchGemm(int M, int N, int K, int count, T alpha, const T* A, const T* B,
+                      T beta, T* C)
+{
+    const int W = BatchTraits<T>::LANES;
+    if (M > GEMM_BATCH_MAX_DIM || N > GEMM_BATCH_MAX_DIM || K > GEMM_BATCH_MAX_DIM) {
+        fprintf(stderr, "gemmBatch: %dx%dx%d is larger than %d\n", M, N, K, GEMM_BATCH_MAX_DIM);
+        return false;
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || count <= 0) return true;
+
+    int groups = (count + W - 1) / W;
+    if (M == N && N == K) {
+        switch (M) {
+        case 2: batchSquare<T, 2>(groups, alpha, A, B, beta, C); return true;
+        case 3: batchSquare<T, 3>(groups, alpha, A, B, beta, C); return true;
+        case 4: batchSquare<T, 4>(groups, alpha, A, B, beta, C); return true;
+        case 5: batchSquare<T, 5>(groups, alpha, A, B, beta, C); return true;
+        case 6: batchSquare<T, 6>(groups, alpha, A, B, beta, C); return true;
+        case 7: batchSquare<T, 7>(groups, alpha, A, B, beta, C); return true;
+        case 8: batchSquare<T, 8>(groups, alpha, A, B, beta, C); return true;
+        }
+    }
+    switch (N) {
+    case 1:  batchKernel<T, 1>(M, K, groups, alpha, A, B, beta, C); break;
+    case 2:  batchKernel<T, 2>(M, K, groups, alpha, A, B, beta, C); break;
+    case 3:  batchKernel<T, 3>(M, K, groups, alpha, A, B, beta, C); break;
+    case 4:  batchKernel<T, 4>(M, K, groups, alpha, A, B, beta, C); break;
+    case 5:  batchKernel<T, 5>(M, K, groups, alpha, A, B, beta, C); break;
+    case 6:  batchKernel<T, 6>(M, K, groups, alpha, A, B, beta, C); break;
+    case 7:  batchKernel<T, 7>(M, K, groups, alpha, A, B, beta, C); break;
+    case 8:  batchKernel<T, 8>(M, K, groups, alpha, A, B, beta, C); break;
+    case 9:  batchKernel<T, 9>(M, K, groups, alpha, A, B, beta, C); break;
+    case 10: batchKernel<T, 10>(M, K, groups, alpha, A, B, beta, C); break;
+    case 11: batchKernel<T, 11>(M, K, groups, alpha, A, B, beta, C); break;
+    case 12: batchKernel<T, 12>(M, K, groups, alpha, A, B, beta, C); break;
+    case 13: batchKernel<T, 13>(M, K, groups, alpha, A, B, beta, C); break;
+    case 14: batchKernel<T, 14>(M, K, groups, alpha, A, B, beta, C); break;
+    case 15: batchKernel<T, 15>(M, K, groups, alpha, A, B, beta, C); break;
+    case 16: batchKernel<T, 16>(M, K, groups, alpha, A, B, beta, C); break;
+    }
+    return true;
+}
+
+void gemmBatchInterleaveS(int rows, int cols, int count, const float* src, float* dst)
+{
+    interleave<float>(rows, cols, count, src, dst);
+}
+
+void gemmBatchInterleaveD(int rows, int cols, int count, const double* src, double* dst)
+{
+    interleave<double>(rows, cols, count, src, dst);
+}
+
+void gemmBatchDeinterleaveS(int rows, int cols, int count, const float* src, float* dst)
+{
+    deinterleave<float>(rows, cols, count, src, dst);
+}
+
+void gemmBatchDeinterleaveD(int rows, int cols, int count, const double* src, double* dst)
+{
+    deinterleave<double>(rows, cols, count, src, dst);
+}
+
+bool gemmBatchSgemm(int M, int N, int K, int count, float alpha, const float* A,
+                    const float* B, float beta, float* C)
+{
+    return batchGemm<float>(M, N, K, count, alpha, A, B, beta, C);
+}
+
+bool gemmBatchDgemm(int M, int N, int K, int count, double alpha, const double* A,
+                    const double* B, double beta, double* C)
+{
+    return batchGemm<double>(M, N, K, count, alpha, A, B, beta, C);
+}
@@ -0,0 +1,48 @@
+#ifndef _GEMMBATCH_H_
+#define _GEMMBATCH_H_
+
+// Batched products of very small matrices in an interleaved layout.
+//
+// A single 4x4 product cannot fill a vector register, so a batch is stored
+// lane-interleaved instead: matrices are taken in groups of GEMM_BATCH_LANES
+// (16 floats or 8 doubles, one 64-byte vector), and element (i, j) of every
+// matrix in a group sits in consecutive lanes:
+//
+//     group g, element (i, j), matrix l of the group:
+//         data[(g * rows * cols + i * cols + j) * lanes + l]
+//
+// Every instruction of the kernels then works on the same element of a whole
+// group, so they run lanes independent products at once with no shuffles.
+// The last group is padded with zero matrices. Kernels are unrolled for each
+// N up to GEMM_BATCH_MAX_DIM, and square sizes 2 to 8 for K too. Large batches
+// are shared among the OpenMP threads when built with -fopenmp.
+//
+// The conversion helpers move batches to and from the plain layout the
+// drivers use: count row-major matrices one after another.
+
+#include <stddef.h>
+
+#define GEMM_BATCH_LANES_F32 16
+#define GEMM_BATCH_LANES_F64 8
+#define GEMM_BATCH_MAX_DIM   16
+
+// Elements an interleaved batch of count rows x cols matrices of dtype
+// (MATRIX_FLOAT32 or MATRIX_FLOAT64) takes, the padding included
+size_t gemmBatchElements(int dtype, int rows, int cols, int count);
+
+// Plain to interleaved and back; dst must hold gemmBatchElements elements
+// (interleaving) or count * rows * cols (deinterleaving)
+void gemmBatchInterleaveS(int rows, int cols, int count, const float* src, float* dst);
+void gemmBatchInterleaveD(int rows, int cols, int count, const double* src, double* dst);
+void gemmBatchDeinterleaveS(int rows, int cols, int count, const float* src, float* dst);
+void gemmBatchDeinterleaveD(int rows, int cols, int count, const double* src, double* dst);
+
+// C[b] = alpha * A[b] * B[b] + beta * C[b] for the count products, with A
+// M x K, B K x N and C M x N, all interleaved. C is not read when beta is 0.
+// False (with a message) if a dimension exceeds GEMM_BATCH_MAX_DIM.
+bool gemmBatchSgemm(int M, int N, int K, int count, float alpha, const float* A,
+                    const float* B, float beta, float* C);
+bool gemmBatchDgemm(int M, int N, int K, int count, double alpha, const double* A,
+                    const double* B, double beta, double* C);
+
+#endif // _GEMMBATCH_H_
@@ -0,0 +1,483 @@
+// Micro-kernels generated at run time for the exact tile at hand.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "gemmJit.h"
+#include "gemmMetrics.h"
+#include "matrixIO.h"
+
+// Signatures the cache holds; open addressing, so kept well below full
+#define JIT_CACHE_SLOTS 4096
+#define JIT_MAX_ENTRIES (JIT_CACHE_SLOTS / 2)
+
+// Emit buffer; the largest kernel (8-way unroll, 4 x 16 floats) takes ~1.5 KB
+#define JIT_MAX_CODE 8192
+
+#define BETA_ZERO    0
+#define BETA_ONE     1
+#define BETA_GENERAL 2
+
+struct JitEntry {
+    uint32_t      key;              // 0 while the slot is free
+    GemmJitKernel kernel;
+};
+
+static JitEntry        jitCache[JIT_CACHE_SLOTS];
+static pthread_mutex_t jitLock = PTHREAD_MUTEX_INITIALIZER;
+static int             jitEntries = 0;
+static int             jitKernels = 0;
+static size_t          jitCodeBytes = 0;
+static int             jitState = -1;       // -1 not yet read, 0 off, 1 on
+
+#if defined(__x86_64__)
+
+////////////////////////////////////////////////////////////////////////////////
+// x86-64 encoder: the handful of VEX and integer instructions the kernels use
+////////////////////////////////////////////////////////////////////////////////
+
+// General purpose registers, in encoding order
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+#define R8  8
+#define R9  9
+
+// VEX pp and map fields
+#define PP_NONE 0
+#define PP_66   1
+#define MAP_0F   1
+#define MAP_0F38 2
+
+struct JitBuf {
+    unsigned char code[JIT_MAX_CODE];
+    int  len;
+    bool overflow;
+};
+
+static void emit(JitBuf* buf, int byte)
+{
+    if (buf->len >= JIT_MAX_CODE) { buf->overflow = true; return; }
+    buf->code[buf->len++] = (unsigned char)byte;
+}
+
+static void emit32(JitBuf* buf, int32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        emit(buf, (value >> (8 * i)) & 0xff);
+}
+
+static void patch32(JitBuf* buf, int at, int32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        buf->code[at + i] = (unsigned char)((value >> (8 * i)) & 0xff);
+}
+
+// Three-byte VEX prefix, 256-bit; reg and rm are the registers whose high
+// bits go into R and B, vvvv the extra source
+static void vex(JitBuf* buf, int pp, int map, int w, int reg, int vvvv, int rm)
+{
+    emit(buf, 0xc4);
+    emit(buf, ((reg & 8) ? 0 : 0x80) | 0x40 | ((rm & 8) ? 0 : 0x20) | map);
+    emit(buf, (w << 7) | ((~vvvv & 15) << 3) | 0x04 | pp);
+}
+
+// ModRM (and SIB and displacement) for [base + disp]
+static void memOperand(JitBuf* buf, int reg, int base, int disp)
+{
+    int mod = (disp == 0 && (base & 7) != 5) ? 0 : (disp >= -128 && disp < 128) ? 1 : 2;
+    emit(buf, (mod << 6) | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == 4) emit(buf, 0x24);
+    if (mod == 1) emit(buf, disp & 0xff);
+    else if (mod == 2) emit32(buf, disp);
+}
+
+// op ymm(reg), ymm(vvvv), ymm(rm)
+static void vexRR(JitBuf* buf, int pp, int map, int w, int op, int reg, int vvvv, int rm)
+{
+    vex(buf, pp, map, w, reg, vvvv, rm);
+    emit(buf, op);
+    emit(buf, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// op ymm(reg), ymm(vvvv), [base + disp]
+static void vexRM(JitBuf* buf, int pp, int map, int w, int op, int reg, int vvvv, int base, int disp)
+{
+    vex(buf, pp, map, w, reg, vvvv, base);
+    emit(buf, op);
+    memOperand(buf, reg, base, disp);
+}
+
+// op ymm(reg), [rip + disp32]; returns where the displacement goes
+static int vexRip(JitBuf* buf, int pp, int map, int w, int op, int reg, int vvvv)
+{
+    vex(buf, pp, map, w, reg, vvvv, 0);
+    emit(buf, op);
+    emit(buf, ((reg & 7) << 3) | 5);
+    int at = buf->len;
+    emit32(buf, 0);
+    return at;
+}
+
+// REX.W prefix for a 64-bit operation on reg and rm
+static void rexW(JitBuf* buf, int reg, int rm)
+{
+    emit(buf, 0x48 | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0));
+}
+
+static void movRR(JitBuf* buf, int dst, int src)
+{
+    rexW(buf, src, dst);
+    emit(buf, 0x89);
+    emit(buf, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void addRR(JitBuf* buf, int dst, int src)
+{
+    rexW(buf, src, dst);
+    emit(buf, 0x01);
+    emit(buf, 0xc0 | ((src & 7) << 3) | (dst & 7));
+}
+
+static void addImm(JitBuf* buf, int dst, int32_t imm)
+{
+    rexW(buf, 0, dst);
+    emit(buf, 0x81);
+    emit(buf, 0xc0 | (dst & 7));
+    emit32(buf, imm);
+}
+
+static void shrImm(JitBuf* buf, int dst, int imm)
+{
+    rexW(buf, 0, dst);
+    emit(buf, 0xc1);
+    emit(buf, 0xe8 | (dst & 7));
+    emit(buf, imm);
+}
+
+static void andImm(JitBuf* buf, int dst, int imm)
+{
+    rexW(buf, 0, dst);
+    emit(buf, 0x83);
+    emit(buf, 0xe0 | (dst & 7));
+    emit(buf, imm);
+}
+
+static void decR(JitBuf* buf, int dst)
+{
+    rexW(buf, 0, dst);
+    emit(buf, 0xff);
+    emit(buf, 0xc8 | (dst & 7));
+}
+
+// jz / jnz rel32; returns where the displacement goes
+static int jcc(JitBuf* buf, bool zero)
+{
+    emit(buf, 0x0f);
+    emit(buf, zero ? 0x84 : 0x85);
+    int at = buf->len;
+    emit32(buf, 0);
+    return at;
+}
+
+// Points the rel32 at "at" to the current position, or to target
+static void land(JitBuf* buf, int at)              { patch32(buf, at, buf->len - (at + 4)); }
+static void landAt(JitBuf* buf, int at, int target) { patch32(buf, at, target - (at + 4)); }
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernel generation
+////////////////////////////////////////////////////////////////////////////////
+
+struct JitSignature {
+    int dtype;
+    int mr, nr, m, n;
+    int unroll;
+    bool alphaOne;
+    int betaKind;
+};
+
+// Vector registers: the accumulators first, then the slivers of b and two
+// for alternating broadcasts of a; the epilogue has 12 to 15
+#define VREG_ALPHA 12
+#define VREG_BETA  13
+#define VREG_TMP   14
+#define VREG_MASK  15
+
+struct JitLayout {
+    bool dbl;
+    int  size;                      // bytes per element
+    int  lanes;                     // per 32-byte vector
+    int  nv;                        // vectors per row of the tile written
+    int  rem;                       // elements in the last of them
+};
+
+static int accReg(const JitLayout* l, int i, int v)                       { return i * l->nv + v; }
+static int bReg(const JitSignature* sig, const JitLayout* l, int v)         { return sig->m * l->nv + v; }
+static int aReg(const JitSignature* sig, const JitLayout* l, int i)         { return sig->m * l->nv + l->nv + (i & 1); }
+
+// unroll steps of the k loop: the row of b, then each element of a broadcast
+// and multiplied into its row of the accumulator
+static void emitSteps(JitBuf* buf, const JitSignature* sig, const JitLayout* l, int unroll)
+{
+    int fma = l->dbl ? 1 : 0;
+    for (int u = 0; u < unroll; ++u) {
+        for (int v = 0; v < l->nv; ++v)
+            vexRM(buf, PP_NONE, MAP_0F, 0, 0x10, bReg(sig, l, v), 0, RDX,
+                  (u * sig->nr + v * l->lanes) * l->size);
+        for (int i = 0; i < sig->m; ++i) {
+            int a = aReg(sig, l, i);
+            vexRM(buf, PP_66, MAP_0F38, 0, l->dbl ? 0x19 : 0x18, a, 0, RSI,
+                  (u * sig->mr + i) * l->size);
+            for (int v = 0; v < l->nv; ++v)
+                vexRR(buf, PP_66, MAP_0F38, fma, 0xb8, accReg(l, i, v), bReg(sig, l, v), a);
+        }
+    }
+}
+
+// A loop over the k steps, unroll at a time; the count is in rax
+static void emitLoop(JitBuf* buf, const JitSignature* sig, const JitLayout* l, int unroll)
+{
+    int top = buf->len;
+    emitSteps(buf, sig, l, unroll);
+    addImm(buf, RSI, unroll * sig->mr * l->size);
+    addImm(buf, RDX, unroll * sig->nr * l->size);
+    decR(buf, RAX);
+    landAt(buf, jcc(buf, false), top);
+}
+
+// Emits the kernel into buf; the offset of the mask constant, if any, in *maskAt
+static void emitKernel(JitBuf* buf, const JitSignature* sig, const JitLayout* l, int* maskAt)
+{
+    int pp = l->dbl ? PP_66 : PP_NONE;
+    int fma = l->dbl ? 1 : 0;
+    int shift = 0;
+    while ((1 << shift) < sig->unroll) ++shift;
+    *maskAt = -1;
+
+    // Arguments: rdi kc, rsi a, rdx b, rcx C, r8 ldc in bytes, r9 alpha/beta
+    for (int i = 0; i < sig->m; ++i)
+        for (int v = 0; v < l->nv; ++v) {
+            int r = accReg(l, i, v);
+            vexRR(buf, PP_NONE, MAP_0F, 0, 0x57, r, r, r);
+        }
+
+    movRR(buf, RAX, RDI);
+    int skipMain = -1;
+    if (shift > 0) {
+        shrImm(buf, RAX, shift);
+        skipMain = jcc(buf, true);
+        emitLoop(buf, sig, l, sig->unroll);
+        land(buf, skipMain);
+        movRR(buf, RAX, RDI);
+        andImm(buf, RAX, sig->unroll - 1);
+    } else {
+        // kc may be 0, leaving C = beta * C
+        emit(buf, 0x48); emit(buf, 0x85); emit(buf, 0xc0);     // test rax, rax
+    }
+    int skipTail = jcc(buf, true);
+    emitLoop(buf, sig, l, 1);
+    land(buf, skipTail);
+
+    // Epilogue, row by row
+    if (!sig->alphaOne)
+        vexRM(buf, PP_66, MAP_0F38, 0, l->dbl ? 0x19 : 0x18, VREG_ALPHA, 0, R9, 0);
+    if (sig->betaKind == BETA_GENERAL)
+        vexRM(buf, PP_66, MAP_0F38, 0, l->dbl ? 0x19 : 0x18, VREG_BETA, 0, R9, l->size);
+    bool partial = l->rem < l->lanes;
+    if (partial)
+        *maskAt = vexRip(buf, PP_NONE, MAP_0F, 0, 0x10, VREG_MASK, 0);
+
+    for (int i = 0; i < sig->m; ++i) {
+        for (int v = 0; v < l->nv; ++v) {
+            int acc = accReg(l, i, v);
+            int disp = v * l->lanes * l->size;
+            bool masked = partial && v == l->nv - 1;
+            if (!sig->alphaOne)
+                vexRR(buf, pp, MAP_0F, 0, 0x59, acc, acc, VREG_ALPHA);
+            if (sig->betaKind != BETA_ZERO) {
+                if (masked)
+                    vexRM(buf, PP_66, MAP_0F38, 0, l->dbl ? 0x2d : 0x2c, VREG_TMP, VREG_MASK, RCX, disp);
+                else
+                    vexRM(buf, PP_NONE, MAP_0F, 0, 0x10, VREG_TMP, 0, RCX, disp);
+                if (sig->betaKind == BETA_ONE)
+                    vexRR(buf, pp, MAP_0F, 0, 0x58, acc, acc, VREG_TMP);
+                else
+                    vexRR(buf, PP_66, MAP_0F38, fma, 0xb8, acc, VREG_TMP, VREG_BETA);
+            }
+            if (masked)
+                vexRM(buf, PP_66, MAP_0F38, 0, l->dbl ? 0x2f : 0x2e, acc, VREG_MASK, RCX, disp);
+            else
+                vexRM(buf, PP_NONE, MAP_0F, 0, 0x11, acc, 0, RCX, disp);
+        }
+        if (i + 1 < sig->m)
+            addRR(buf, RCX, R8);
+    }
+
+    emit(buf, 0xc5); emit(buf, 0xf8); emit(buf, 0x77);         // vzeroupper
+    emit(buf, 0xc3);                                            // ret
+
+    // The mask: all ones in the first rem elements of the last vector
+    if (partial) {
+        while (buf->len % 32) emit(buf, 0xcc);
+        landAt(buf, *maskAt, buf->len);
+        for (int e = 0; e < l->lanes; ++e)
+            for (int b = 0; b < l->size; ++b)
+                emit(buf, e < l->rem ? 0xff : 0x00);
+    }
+}
+
+static bool cpuHasJit()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+// Emits the kernel, then copies it into pages that are made executable only
+// once written
+static GemmJitKernel generate(const JitSignature* sig, size_t* bytes)
+{
+    JitLayout l;
+    l.dbl = sig->dtype == MATRIX_FLOAT64;
+    l.size = l.dbl ? 8 : 4;
+    l.lanes = 32 / l.size;
+    l.nv = (sig->n + l.lanes - 1) / l.lanes;
+    l.rem = sig->n - (l.nv - 1) * l.lanes;
+
+    // Accumulators, slivers of b and the two broadcasts must stay clear of
+    // the epilogue registers
+    if (sig->nr % l.lanes != 0 || sig->m * l.nv + l.nv + 2 > VREG_ALPHA) return NULL;
+
+    JitBuf* buf = (JitBuf*)malloc(sizeof(JitBuf));
+    if (!buf) return NULL;
+    buf->len = 0;
+    buf->overflow = false;
+    int maskAt;
+    emitKernel(buf, sig, &l, &maskAt);
+    if (buf->overflow) {
+        fprintf(stderr, "gemmJit: kernel for %dx%d tile too large\n", sig->m, sig->n);
+        free(buf);
+        return NULL;
+    }
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)buf->len + page - 1) / page * page;
+    void* code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(buf);
+        return NULL;
+    }
+    memcpy(code, buf->code, buf->len);
+    free(buf);
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        fprintf(stderr, "gemmJit: cannot make code pages executable\n");
+        munmap(code, size);
+        return NULL;
+    }
+    *bytes = size;
+    return (GemmJitKernel)code;
+}
+
+#else
+
+static bool cpuHasJit() { return false; }
+
+#endif // __x86_64__
+
+bool gemmJitAvailable()
+{
+    static int available = -1;
+    if (available < 0) available = cpuHasJit() ? 1 : 0;
+    return available == 1;
+}
+
+bool gemmJitEnabled()
+{
+    int state = __atomic_load_n(&jitState, __ATOMIC_RELAXED);
+    if (state < 0) {
+        const char* env = getenv("MATMUL_JIT");
+        state = (gemmJitAvailable() && !(env && strcmp(env, "0") == 0)) ? 1 : 0;
+        __atomic_store_n(&jitState, state, __ATOMIC_RELAXED);
+    }
+    return state == 1;
+}
+
+void gemmJitSetEnabled(bool enabled)
+{
+    __atomic_store_n(&jitState, (enabled && gemmJitAvailable()) ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void gemmJitStats(int* kernels, size_t* codeBytes)
+{
+    pthread_mutex_lock(&jitLock);
+    if (kernels) *kernels = jitKernels;
+    if (codeBytes) *codeBytes = jitCodeBytes;
+    pthread_mutex_unlock(&jitLock);
+}
+
+// Kernels are looked up without the lock: a slot's kernel is written before
+// its key is published, and neither changes afterwards
+GemmJitKernel gemmJitKernel(int dtype, int mr, int nr, int m, int n, int unroll,
+                            double alpha, double beta)
+{
+    if (!gemmJitEnabled()) return NULL;
+    if (mr > GEMM_JIT_MAX_MR || nr > GEMM_JIT_MAX_NR || m < 1 || m > mr || n < 1 || n > nr)
+        return NULL;
+    int unrollLog = (unroll == 8) ? 3 : (unroll == 4) ? 2 : (unroll == 2) ? 1 : 0;
+    int betaKind = (beta == 0) ? BETA_ZERO : (beta == 1) ? BETA_ONE : BETA_GENERAL;
+    bool alphaOne = alpha == 1;
+
+    uint32_t key = 0x80000000u | (uint32_t)(dtype == MATRIX_FLOAT64) << 24
+                 | (uint32_t)(mr - 1) << 21 | (uint32_t)(nr - 1) << 17
+                 | (uint32_t)(m - 1) << 14 | (uint32_t)(n - 1) << 10
+                 | (uint32_t)unrollLog << 8 | (uint32_t)alphaOne << 7 | (uint32_t)betaKind;
+    uint32_t slot = (key * 2654435761u) % JIT_CACHE_SLOTS;
+
+    for (uint32_t probe = slot; ; probe = (probe + 1) % JIT_CACHE_SLOTS) {
+        uint32_t k = __atomic_load_n(&jitCache[probe].key, __ATOMIC_ACQUIRE);
+        if (k == key) {
+            gemmMetricsCount(GEMM_METRIC_JIT_HITS, 1);
+            return jitCache[probe].kernel;
+        }
+        if (k == 0) break;
+    }
+
+#if defined(__x86_64__)
+    GemmJitKernel kernel = NULL;
+    pthread_mutex_lock(&jitLock);
+    uint32_t probe = slot;
+    for (;; probe = (probe + 1) % JIT_CACHE_SLOTS) {
+        uint32_t k = jitCache[probe].key;
+        if (k == key) {
+            kernel = jitCache[probe].kernel;
+            gemmMetricsCount(GEMM_METRIC_JIT_HITS, 1);
+            break;
+        }
+        if (k == 0) {
+            if (jitEntries >= JIT_MAX_ENTRIES) break;
+            ++jitEntries;
+            JitSignature sig = { dtype, mr, nr, m, n, 1 << unrollLog, alphaOne, betaKind };
+            size_t bytes = 0;
+            // A signature that cannot be generated is cached too, as NULL,
+            // so it is not tried again on every tile
+            kernel = generate(&sig, &bytes);
+            gemmMetricsCount(GEMM_METRIC_JIT_MISSES, 1);
+            jitCache[probe].kernel = kernel;
+            __atomic_store_n(&jitCache[probe].key, key, __ATOMIC_RELEASE);
+            jitKernels += kernel ? 1 : 0;
+            jitCodeBytes += bytes;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&jitLock);
+    return kernel;
+#else
+    return NULL;
+#endif
+}
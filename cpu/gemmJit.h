@@ -0,0 +1,59 @@
+#ifndef _GEMMJIT_H_
+#define _GEMMJIT_H_
+
+// Micro-kernels generated at run time for the exact tile at hand.
+//
+// The compiled micro-kernel always computes a whole MR x NR tile and writes
+// the edge tiles back an element at a time, testing beta on every call.
+// Kernels generated here are x86-64 AVX2/FMA machine code specialized for:
+//
+//   - the tile actually written, m x n, so a tile at the edge of C does
+//     only the rows and vectors it needs and writes its last vector with a
+//     masked store
+//   - the unroll of the loop over K
+//   - alpha == 1 (no scaling) and beta == 0 (C not read), 1 (C added) or
+//     anything else
+//
+// Each kernel is emitted into a buffer, copied into pages of its own and
+// only then made executable, so no page is ever writable and executable at
+// once. Kernels are cached by signature and never freed; there are at most
+// a few hundred. Generation takes a few microseconds the first time a
+// signature is asked for.
+//
+// Set MATMUL_JIT=0 in the environment, or call gemmJitSetEnabled(false), to
+// run the compiled kernel everywhere. Elsewhere than x86-64 with AVX2 and
+// FMA, gemmJitKernel() always returns NULL.
+
+#include <stddef.h>
+
+// Largest tile a kernel is generated for
+#define GEMM_JIT_MAX_MR 8
+#define GEMM_JIT_MAX_NR 16
+
+// K unroll the engine asks for
+#define GEMM_JIT_UNROLL 4
+
+// C[0..m, 0..n] = beta * C + alpha * (a * b) for packed slivers a (kc x mr,
+// stored column by column) and b (kc x nr, row by row), as the compiled
+// micro-kernel does. ldc is in bytes; alphaBeta points at alpha and beta in
+// the element type.
+typedef void (*GemmJitKernel)(long kc, const void* a, const void* b, void* C, long ldc,
+                              const void* alphaBeta);
+
+// The kernel for dtype (MATRIX_FLOAT32 or MATRIX_FLOAT64), an mr x nr packed
+// tile of which m x n is written, a K unroll of 1, 2, 4 or 8, and the class
+// alpha and beta fall in; generated on first use. NULL if JIT is disabled
+// or unavailable, or the tile cannot be generated.
+GemmJitKernel gemmJitKernel(int dtype, int mr, int nr, int m, int n, int unroll,
+                            double alpha, double beta);
+
+// True if kernels can be generated here: x86-64 with AVX2 and FMA
+bool gemmJitAvailable();
+
+void gemmJitSetEnabled(bool enabled);
+bool gemmJitEnabled();
+
+// Kernels generated so far and the executable memory they take
+void gemmJitStats(int* kernels, size_t* codeBytes);
+
+#endif // _GEMMJIT_H_
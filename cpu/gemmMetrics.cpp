@@ -0,0 +1,523 @@
+// Operational metrics of the GEMM engine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "gemmMetrics.h"
+
+#define METRICS_ENV          "MATMUL_METRICS"
+#define METRICS_FILE_ENV     "MATMUL_METRICS_FILE"
+#define METRICS_INTERVAL_ENV "MATMUL_METRICS_INTERVAL"
+#define METRICS_SOCKET_ENV   "MATMUL_METRICS_SOCKET"
+
+// Latency buckets in ns: exact below HIST_SUB, then HIST_SUB per power of
+// two up to 2^HIST_TOP (18 minutes); longer calls land in the last one
+#define HIST_SUB      16
+#define HIST_SHIFT    4
+#define HIST_TOP      40
+#define HIST_BUCKETS  (HIST_SUB + (HIST_TOP - HIST_SHIFT) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;               // ns
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+// One thread's counters. Only the owning thread writes them; readers load
+// them relaxed. The histograms are allocated by the owner at first use.
+typedef struct Shard {
+    uint64_t      counters[GEMM_METRIC_COUNT];
+    uint64_t      calls[GEMM_OPS];
+    uint64_t      flops[GEMM_OPS];
+    Histogram*    latency[GEMM_OPS][GEMM_SHAPE_CLASSES];
+    int           owned;        // a live thread writes it
+    struct Shard* next;
+} Shard;
+
+static pthread_once_t  metricsOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t shardLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t   shardKey;
+static Shard*          shards = NULL;       // prepended under shardLock, never freed
+static __thread Shard* threadShard = NULL;
+static int             counting = 1;
+
+static const char* opNames[GEMM_OPS] = { "sgemm", "dgemm", "igemm32", "igemm64", "modgemm", "sgemm_quant" };
+
+static const char* counterNames[GEMM_METRIC_COUNT] = {
+    "A", "B", "plugin", "jit", "compiled", "exact", "hit", "miss",
+    "serial", "parallel", "async", "resident_b", "in_place", "quant_direct", "wide",
+};
+
+static const char* aspectNames[4] = { "skinny", "deep", "flat", "square" };
+static const char* sizeNames[4] = { "tiny", "small", "medium", "large" };
+
+static uint64_t metricsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// The owner's add: a plain load and store, atomic only so a reader never
+// sees a torn value
+static inline void add(uint64_t* v, uint64_t n)
+{
+    __atomic_store_n(v, __atomic_load_n(v, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t load(const uint64_t* v)
+{
+    return __atomic_load_n(v, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shards
+////////////////////////////////////////////////////////////////////////////////
+
+// A thread's counters outlive it: the next thread started takes them over
+static void releaseShard(void* p)
+{
+    __atomic_store_n(&((Shard*)p)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void metricsFromEnv();
+
+static void metricsInit()
+{
+    pthread_key_create(&shardKey, releaseShard);
+    metricsFromEnv();
+}
+
+static Shard* acquireShard()
+{
+    pthread_once(&metricsOnce, metricsInit);
+    pthread_mutex_lock(&shardLock);
+    Shard* s = shards;
+    while (s && __atomic_load_n(&s->owned, __ATOMIC_ACQUIRE)) s = s->next;
+    if (!s) {
+        s = (Shard*)calloc(1, sizeof(Shard));
+        if (s) {
+            s->next = shards;
+            __atomic_store_n(&shards, s, __ATOMIC_RELEASE);
+        }
+    }
+    if (s) {
+        s->owned = 1;
+        pthread_setspecific(shardKey, s);
+    }
+    pthread_mutex_unlock(&shardLock);
+    return s;
+}
+
+static inline Shard* myShard()
+{
+    if (!threadShard) threadShard = acquireShard();
+    return threadShard;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Counting
+////////////////////////////////////////////////////////////////////////////////
+
+void gemmMetricsSetEnabled(bool enabled)
+{
+    pthread_once(&metricsOnce, metricsInit);
+    __atomic_store_n(&counting, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+bool gemmMetricsEnabled()
+{
+    pthread_once(&metricsOnce, metricsInit);
+    return __atomic_load_n(&counting, __ATOMIC_RELAXED) != 0;
+}
+
+void gemmMetricsCount(int counter, uint64_t n)
+{
+    if (!__atomic_load_n(&counting, __ATOMIC_RELAXED)) return;
+    Shard* s = myShard();
+    if (s) add(&s->counters[counter], n);
+}
+
+uint64_t gemmMetricsBegin()
+{
+    return gemmMetricsEnabled() ? metricsNow() : 0;
+}
+
+int gemmMetricsShapeClass(int M, int N, int K)
+{
+    int low = (M < N) ? M : N, high = (M < N) ? N : M;
+    int aspect = (low <= 16) ? 0 : ((double)K >= 4.0 * high) ? 1 : (4.0 * K <= low) ? 2 : 3;
+    double flops = 2.0 * M * N * K;
+    int size = (flops < 0x1p20) ? 0 : (flops < 0x1p26) ? 1 : (flops < 0x1p32) ? 2 : 3;
+    return aspect * 4 + size;
+}
+
+const char* gemmMetricsShapeName(int shapeClass)
+{
+    return aspectNames[(shapeClass / 4) & 3];
+}
+
+const char* gemmMetricsSizeName(int shapeClass)
+{
+    return sizeNames[shapeClass & 3];
+}
+
+static int bucketOf(uint64_t ns)
+{
+    if (ns < HIST_SUB) return (int)ns;
+    int e = 63 - __builtin_clzll(ns);
+    if (e >= HIST_TOP) return HIST_BUCKETS - 1;
+    return HIST_SUB + (e - HIST_SHIFT) * HIST_SUB + (int)(ns >> (e - HIST_SHIFT)) - HIST_SUB;
+}
+
+// Middle of a bucket, in ns
+static double bucketValue(int b)
+{
+    if (b < HIST_SUB) return b;
+    int e = (b - HIST_SUB) / HIST_SUB + HIST_SHIFT;
+    uint64_t sub = (uint64_t)((b - HIST_SUB) % HIST_SUB + HIST_SUB);
+    return (double)(sub << (e - HIST_SHIFT)) + 0.5 * (double)(1ull << (e - HIST_SHIFT));
+}
+
+void gemmMetricsCall(uint64_t begin, int op, int M, int N, int K)
+{
+    if (!begin) return;
+    uint64_t ns = metricsNow() - begin;
+    Shard* s = myShard();
+    if (!s) return;
+
+    add(&s->calls[op], 1);
+    if (M > 0 && N > 0 && K > 0) add(&s->flops[op], 2ull * M * N * K);
+
+    int shape = gemmMetricsShapeClass(M > 0 ? M : 0, N > 0 ? N : 0, K > 0 ? K : 0);
+    Histogram* h = s->latency[op][shape];
+    if (!h) {
+        h = (Histogram*)calloc(1, sizeof(Histogram));
+        if (!h) return;
+        __atomic_store_n(&s->latency[op][shape], h, __ATOMIC_RELEASE);
+    }
+    add(&h->buckets[bucketOf(ns)], 1);
+    add(&h->sum, ns);
+    add(&h->count, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+static Shard* firstShard()
+{
+    pthread_once(&metricsOnce, metricsInit);
+    return __atomic_load_n(&shards, __ATOMIC_ACQUIRE);
+}
+
+uint64_t gemmMetricsValue(int counter)
+{
+    uint64_t total = 0;
+    for (Shard* s = firstShard(); s; s = s->next)
+        total += load(&s->counters[counter]);
+    return total;
+}
+
+uint64_t gemmMetricsCalls(int op)
+{
+    uint64_t total = 0;
+    for (Shard* s = firstShard(); s; s = s->next)
+        total += load(&s->calls[op]);
+    return total;
+}
+
+uint64_t gemmMetricsFlops(int op)
+{
+    uint64_t total = 0;
+    for (Shard* s = firstShard(); s; s = s->next)
+        total += load(&s->flops[op]);
+    return total;
+}
+
+// The histogram of op in a shape class over all threads; false if empty
+static bool mergeLatency(int op, int shape, Histogram* out)
+{
+    memset(out, 0, sizeof(*out));
+    for (Shard* s = firstShard(); s; s = s->next) {
+        const Histogram* h = __atomic_load_n(&s->latency[op][shape], __ATOMIC_ACQUIRE);
+        if (!h) continue;
+        out->count += load(&h->count);
+        out->sum += load(&h->sum);
+        for (int b = 0; b < HIST_BUCKETS; ++b)
+            out->buckets[b] += load(&h->buckets[b]);
+    }
+    return out->count > 0;
+}
+
+static double quantile(const Histogram* h, double q)
+{
+    // the buckets, not count, so a call counted mid-read cannot overrun
+    uint64_t total = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b)
+        total += h->buckets[b];
+    if (total == 0) return 0;
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) {
+        seen += h->buckets[b];
+        if (seen >= rank) return bucketValue(b) * 1.0e-9;
+    }
+    return bucketValue(HIST_BUCKETS - 1) * 1.0e-9;
+}
+
+double gemmMetricsLatency(int op, int shapeClass, double q)
+{
+    Histogram* h = (Histogram*)malloc(sizeof(Histogram));
+    if (!h) return 0;
+    double v = mergeLatency(op, shapeClass, h) ? quantile(h, q) : 0;
+    free(h);
+    return v;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Exposition
+////////////////////////////////////////////////////////////////////////////////
+
+static void printCounter(FILE* out, const char* name, const char* help, const char* label,
+                         int first, int last)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int c = first; c <= last; ++c)
+        fprintf(out, "%s{%s=\"%s\"} %llu\n", name, label, counterNames[c],
+                (unsigned long long)gemmMetricsValue(c));
+}
+
+void gemmMetricsPrint(FILE* out)
+{
+    fprintf(out, "# HELP gemm_calls_total Engine calls by operation\n# TYPE gemm_calls_total counter\n");
+    for (int op = 0; op < GEMM_OPS; ++op)
+        fprintf(out, "gemm_calls_total{op=\"%s\"} %llu\n", opNames[op],
+                (unsigned long long)gemmMetricsCalls(op));
+    fprintf(out, "# HELP gemm_flops_total Floating-point or integer operations by operation\n"
+                 "# TYPE gemm_flops_total counter\n");
+    for (int op = 0; op < GEMM_OPS; ++op)
+        fprintf(out, "gemm_flops_total{op=\"%s\"} %llu\n", opNames[op],
+                (unsigned long long)gemmMetricsFlops(op));
+
+    printCounter(out, "gemm_packed_bytes_total", "Bytes written packing operands", "operand",
+                 GEMM_METRIC_PACKED_A, GEMM_METRIC_PACKED_B);
+    printCounter(out, "gemm_tiles_total", "Micro-tiles by the kernel that ran them", "kernel",
+                 GEMM_METRIC_TILES_PLUGIN, GEMM_METRIC_TILES_EXACT);
+    printCounter(out, "gemm_jit_cache_lookups_total", "Generated kernel cache lookups", "result",
+                 GEMM_METRIC_JIT_HITS, GEMM_METRIC_JIT_MISSES);
+    printCounter(out, "gemm_paths_total", "Products by the path they took", "path",
+                 GEMM_METRIC_SERIAL, GEMM_METRIC_WIDE);
+
+    static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    Histogram* h = (Histogram*)malloc(sizeof(Histogram));
+    if (!h) return;
+    fprintf(out, "# HELP gemm_latency_seconds Call latency by operation and shape class\n"
+                 "# TYPE gemm_latency_seconds summary\n");
+    for (int op = 0; op < GEMM_OPS; ++op) {
+        for (int shape = 0; shape < GEMM_SHAPE_CLASSES; ++shape) {
+            if (!mergeLatency(op, shape, h)) continue;
+            char labels[128];
+            snprintf(labels, sizeof(labels), "op=\"%s\",shape=\"%s\",size=\"%s\"", opNames[op],
+                     gemmMetricsShapeName(shape), gemmMetricsSizeName(shape));
+            for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); ++q)
+                fprintf(out, "gemm_latency_seconds{%s,quantile=\"%g\"} %.9g\n", labels,
+                        quantiles[q], quantile(h, quantiles[q]));
+            fprintf(out, "gemm_latency_seconds_sum{%s} %.9g\n", labels, h->sum * 1.0e-9);
+            fprintf(out, "gemm_latency_seconds_count{%s} %llu\n", labels, (unsigned long long)h->count);
+        }
+    }
+    free(h);
+}
+
+bool gemmMetricsWriteFile(const char* path)
+{
+    char temp[4096];
+    if ((size_t)snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid()) >= sizeof(temp)) {
+        fprintf(stderr, "gemm metrics: path too long: %s\n", path);
+        return false;
+    }
+    FILE* fp = fopen(temp, "w");
+    if (!fp) {
+        fprintf(stderr, "gemm metrics: cannot open %s\n", temp);
+        return false;
+    }
+    gemmMetricsPrint(fp);
+    bool ok = fclose(fp) == 0 && rename(temp, path) == 0;
+    if (!ok) {
+        fprintf(stderr, "gemm metrics: cannot write %s: %s\n", path, strerror(errno));
+        unlink(temp);
+    }
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Export thread
+////////////////////////////////////////////////////////////////////////////////
+
+// Guarded by exportLock
+static pthread_mutex_t exportLock = PTHREAD_MUTEX_INITIALIZER;
+static bool            exporting = false;
+static pthread_t       exportThread;
+static int             wakeFds[2] = { -1, -1 };     // a byte stops the thread
+static int             listenFd = -1;
+static char            exportFile[4096];
+static char            exportSocket[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static double          exportInterval = 10;
+
+// One client: HTTP if it asks with a GET within a moment, plain text if not
+static void serveClient(int fd)
+{
+    char request[512];
+    struct pollfd p = { fd, POLLIN, 0 };
+    bool http = false;
+    if (poll(&p, 1, 100) > 0) {
+        ssize_t n = recv(fd, request, sizeof(request) - 1, 0);
+        http = n >= 4 && strncmp(request, "GET ", 4) == 0;
+    }
+
+    char* text = NULL;
+    size_t length = 0;
+    FILE* mem = open_memstream(&text, &length);
+    if (!mem) return;
+    gemmMetricsPrint(mem);
+    fclose(mem);
+
+    char header[160];
+    int headerLen = http ? snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+                                    "Content-Type: text/plain; version=0.0.4\r\n"
+                                    "Content-Length: %zu\r\n\r\n", length) : 0;
+    if (headerLen > 0) send(fd, header, headerLen, MSG_NOSIGNAL);
+    for (size_t sent = 0; sent < length; ) {
+        ssize_t n = send(fd, text + sent, length - sent, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        sent += (size_t)n;
+    }
+    free(text);
+}
+
+static void* exportMain(void*)
+{
+    uint64_t next = metricsNow() + (uint64_t)(exportInterval * 1.0e9);
+    for (;;) {
+        struct pollfd fds[2] = { { wakeFds[0], POLLIN, 0 }, { listenFd, POLLIN, 0 } };
+        int nfds = (listenFd >= 0) ? 2 : 1;
+        uint64_t now = metricsNow();
+        int timeout = !exportFile[0] ? -1 : (now >= next) ? 0 : (int)((next - now) / 1000000 + 1);
+        int ready = poll(fds, nfds, timeout);
+        if (ready < 0 && errno != EINTR) break;
+        if (ready > 0 && (fds[0].revents & POLLIN)) break;
+        if (ready > 0 && nfds == 2 && (fds[1].revents & POLLIN)) {
+            int client = accept(listenFd, NULL, NULL);
+            if (client >= 0) {
+                serveClient(client);
+                close(client);
+            }
+        }
+        if (exportFile[0] && metricsNow() >= next) {
+            gemmMetricsWriteFile(exportFile);
+            next = metricsNow() + (uint64_t)(exportInterval * 1.0e9);
+        }
+    }
+    return NULL;
+}
+
+static void stopExportLocked()
+{
+    if (!exporting) return;
+    char byte = 0;
+    if (write(wakeFds[1], &byte, 1) != 1) perror("gemm metrics");
+    pthread_join(exportThread, NULL);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+    wakeFds[0] = wakeFds[1] = -1;
+    if (listenFd >= 0) {
+        close(listenFd);
+        unlink(exportSocket);
+        listenFd = -1;
+    }
+    if (exportFile[0]) gemmMetricsWriteFile(exportFile);
+    exporting = false;
+}
+
+void gemmMetricsStopExport()
+{
+    pthread_mutex_lock(&exportLock);
+    stopExportLocked();
+    pthread_mutex_unlock(&exportLock);
+}
+
+bool gemmMetricsExport(const char* file, double interval, const char* socketPath)
+{
+    pthread_mutex_lock(&exportLock);
+    stopExportLocked();
+
+    exportFile[0] = 0;
+    exportSocket[0] = 0;
+    exportInterval = (interval > 0) ? interval : 10;
+    bool ok = true;
+    if (file && *file) {
+        ok = strlen(file) < sizeof(exportFile);
+        if (ok) strcpy(exportFile, file);
+        else fprintf(stderr, "gemm metrics: path too long: %s\n", file);
+    }
+    if (ok && socketPath && *socketPath) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        ok = strlen(socketPath) < sizeof(addr.sun_path);
+        if (ok) {
+            strcpy(addr.sun_path, socketPath);
+            // a socket left behind by a process that died is replaced
+            unlink(socketPath);
+            listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            ok = listenFd >= 0 && bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0
+              && listen(listenFd, 8) == 0;
+            if (ok) strcpy(exportSocket, socketPath);
+        }
+        if (!ok) {
+            fprintf(stderr, "gemm metrics: cannot listen on %s: %s\n", socketPath, strerror(errno));
+            if (listenFd >= 0) close(listenFd);
+            listenFd = -1;
+        }
+    }
+    if (ok && (exportFile[0] || listenFd >= 0)) {
+        ok = pipe(wakeFds) == 0 && pthread_create(&exportThread, NULL, exportMain, NULL) == 0;
+        if (ok) {
+            exporting = true;
+        } else {
+            fprintf(stderr, "gemm metrics: cannot start the export thread\n");
+            if (listenFd >= 0) close(listenFd);
+            listenFd = -1;
+        }
+    }
+    pthread_mutex_unlock(&exportLock);
+    return ok;
+}
+
+static void metricsAtExit()
+{
+    gemmMetricsStopExport();
+}
+
+static void metricsFromEnv()
+{
+    const char* on = getenv(METRICS_ENV);
+    if (on && strcmp(on, "0") == 0) counting = 0;
+
+    const char* file = getenv(METRICS_FILE_ENV);
+    const char* socketPath = getenv(METRICS_SOCKET_ENV);
+    const char* interval = getenv(METRICS_INTERVAL_ENV);
+    if (((file && *file) || (socketPath && *socketPath))
+        && gemmMetricsExport(file, interval ? atof(interval) : 10, socketPath))
+        atexit(metricsAtExit);
+}
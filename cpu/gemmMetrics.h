@@ -0,0 +1,99 @@
+#ifndef _GEMMMETRICS_H_
+#define _GEMMMETRICS_H_
+
+// Operational metrics of the GEMM engine.
+//
+// The engine counts what it does in counters private to each thread: a count
+// is a plain load and store by the only thread that writes it, with no lock
+// and no read-modify-write. A reader sums every thread's counters, which only
+// grow. The counters of a thread that exits go to the next thread started, so
+// nothing is lost and the number of sets stays at the most threads alive.
+//
+// Each call records its operation and flops, and its latency in an HDR
+// histogram (16 linear sub-buckets per power of two, so within 1/16) for its
+// shape class: an aspect (skinny when M or N is at most 16, deep when K is 4
+// times both, flat when both are 4 times K, square otherwise) and a size by
+// flops (tiny below 2^20, small below 2^26, medium below 2^32, large).
+// Asynchronous products count from submission to completion. Within products
+// the engine also counts bytes packed, tiles by the kernel that ran them, JIT
+// kernel cache lookups, and the paths products took.
+//
+// gemmMetricsPrint() writes all of it in the Prometheus text format, with the
+// histograms as summaries (quantiles 0.5, 0.9, 0.99, 0.999). In the
+// environment, read at the first engine call as MATMUL_TRACE is:
+//
+//     MATMUL_METRICS=0               no counting
+//     MATMUL_METRICS_FILE=<path>     rewritten every MATMUL_METRICS_INTERVAL
+//                                    seconds (10) and at gemmShutdown, through
+//                                    a rename so readers see whole files
+//                                    (node_exporter's textfile collector)
+//     MATMUL_METRICS_SOCKET=<path>   a Unix stream socket answering each
+//                                    connection; an HTTP GET gets an HTTP
+//                                    response, anything else the text alone
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Operations
+#define GEMM_OP_SGEMM        0      // and the packed, in-place, async forms
+#define GEMM_OP_DGEMM        1
+#define GEMM_OP_IGEMM32      2
+#define GEMM_OP_IGEMM64      3
+#define GEMM_OP_MODGEMM      4
+#define GEMM_OP_SGEMM_QUANT  5
+#define GEMM_OPS             6
+
+// Counters
+#define GEMM_METRIC_PACKED_A        0   // bytes written packing A
+#define GEMM_METRIC_PACKED_B        1   // and B, dequantized B included
+#define GEMM_METRIC_TILES_PLUGIN    2   // tiles by the kernel that ran them
+#define GEMM_METRIC_TILES_JIT       3
+#define GEMM_METRIC_TILES_COMPILED  4
+#define GEMM_METRIC_TILES_EXACT     5   // integer and modular
+#define GEMM_METRIC_JIT_HITS        6   // kernel cache lookups
+#define GEMM_METRIC_JIT_MISSES      7   // the kernel was generated
+#define GEMM_METRIC_SERIAL          8   // products only the caller worked on
+#define GEMM_METRIC_PARALLEL        9
+#define GEMM_METRIC_ASYNC           10  // submitted
+#define GEMM_METRIC_RESIDENT_B      11  // against a packed B
+#define GEMM_METRIC_IN_PLACE        12
+#define GEMM_METRIC_QUANT_DIRECT    13  // quantized B read without packing
+#define GEMM_METRIC_WIDE            14  // integer sums carried to 128 bits
+#define GEMM_METRIC_COUNT           15
+
+#define GEMM_SHAPE_CLASSES          16
+
+// Engine side. gemmMetricsBegin returns 0 when counting is off, and
+// gemmMetricsCall then does nothing.
+void     gemmMetricsCount(int counter, uint64_t n);
+uint64_t gemmMetricsBegin();
+void     gemmMetricsCall(uint64_t begin, int op, int M, int N, int K);
+
+void gemmMetricsSetEnabled(bool enabled);
+bool gemmMetricsEnabled();
+
+// Totals over all threads
+uint64_t gemmMetricsValue(int counter);
+uint64_t gemmMetricsCalls(int op);
+uint64_t gemmMetricsFlops(int op);
+
+// Shape class of a product, and its labels
+int gemmMetricsShapeClass(int M, int N, int K);
+const char* gemmMetricsShapeName(int shapeClass);
+const char* gemmMetricsSizeName(int shapeClass);
+
+// Latency at quantile q (0..1) of op's calls in a shape class, in seconds;
+// 0 if there were none
+double gemmMetricsLatency(int op, int shapeClass, double q);
+
+// Prometheus text
+void gemmMetricsPrint(FILE* out);
+bool gemmMetricsWriteFile(const char* path);
+
+// Exporting from a background thread: the file every interval seconds,
+// the socket on demand; either may be NULL. Replaces any export running.
+bool gemmMetricsExport(const char* file, double interval, const char* socketPath);
+// Writes the file a last time and stops exporting
+void gemmMetricsStopExport();
+
+#endif // _GEMMMETRICS_H_
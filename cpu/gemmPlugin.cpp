@@ -0,0 +1,456 @@
+// Micro-kernels and pack routines loaded from shared objects at run time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "gemm.h"
+#include "gemmPlugin.h"
+#include "matrixIO.h"
+
+#define PLUGIN_MAX_KERNELS 64
+#define PLUGIN_MAX_PACKS   64
+#define PLUGIN_MAX_FILES   32
+#define PLUGIN_MAX_STAGED  32       // entries one plugin may register
+
+// A plugin tried, accepted or not
+typedef struct {
+    char  path[256];
+    bool  accepted;
+    char  reason[160];              // why it was rejected
+    int   nKernels, nPacks;         // entries it added
+    int   nIncapable;               // entries left out by capable()
+    void* handle;
+} PluginFile;
+
+// What a plugin registers during its init, before the self-test
+typedef struct {
+    GemmPluginKernel kernels[PLUGIN_MAX_STAGED];
+    GemmPluginPack   packs[PLUGIN_MAX_STAGED];
+    int              nKernels, nPacks;
+    int              nIncapable;
+    bool             overflow;
+    const char*      bad;           // first malformed entry
+} PluginStaging;
+
+// Entries are written before their count is published and never change,
+// so lookups take no lock
+static pthread_mutex_t  pluginLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   pluginOnce = PTHREAD_ONCE_INIT;
+static GemmPluginKernel kernels[PLUGIN_MAX_KERNELS];
+static GemmPluginPack   packs[PLUGIN_MAX_PACKS];
+static int              nKernels, nPacks;
+static PluginFile       files[PLUGIN_MAX_FILES];
+static int              nFiles;
+static int              pluginState = -1;      // unknown, off, on
+
+////////////////////////////////////////////////////////////////////////////////
+// Registration
+////////////////////////////////////////////////////////////////////////////////
+
+static bool validDtype(int dtype)
+{
+    return dtype == GEMM_PLUGIN_FLOAT32 || dtype == GEMM_PLUGIN_FLOAT64;
+}
+
+static int addKernel(GemmPluginHost* host, const GemmPluginKernel* k)
+{
+    PluginStaging* s = (PluginStaging*)host->state;
+    if (!k || !k->name || !k->kernel || !validDtype(k->dtype) || k->mr < 1 || k->nr < 1) {
+        if (!s->bad) s->bad = (k && k->name) ? k->name : "(unnamed kernel)";
+        return 0;
+    }
+    if (k->capable && !k->capable()) {
+        s->nIncapable++;
+        return 1;
+    }
+    if (s->nKernels == PLUGIN_MAX_STAGED) {
+        s->overflow = true;
+        return 0;
+    }
+    s->kernels[s->nKernels++] = *k;
+    return 1;
+}
+
+static int addPack(GemmPluginHost* host, const GemmPluginPack* p)
+{
+    PluginStaging* s = (PluginStaging*)host->state;
+    if (!p || !p->name || !p->pack || !validDtype(p->dtype) || p->width < 1
+        || (p->operand != 'A' && p->operand != 'B')) {
+        if (!s->bad) s->bad = (p && p->name) ? p->name : "(unnamed pack)";
+        return 0;
+    }
+    if (p->capable && !p->capable()) {
+        s->nIncapable++;
+        return 1;
+    }
+    if (s->nPacks == PLUGIN_MAX_STAGED) {
+        s->overflow = true;
+        return 0;
+    }
+    s->packs[s->nPacks++] = *p;
+    return 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Self-test
+////////////////////////////////////////////////////////////////////////////////
+
+// A fixed sequence, so a failure can be reproduced
+static double testRandom(uint32_t* state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return (double)(*state >> 8) / (double)(1u << 24) - 0.5;
+}
+
+// Runs the kernel on an m x n tile placed inside a larger C, whose other
+// elements must come back unchanged. C is filled with NaN where beta is 0,
+// since it must not be read there.
+template <typename T>
+static bool testTile(const GemmPluginKernel* k, int kc, int m, int n, T alpha, T beta,
+                     const T* a, const T* b, uint32_t* seed)
+{
+    const int ldc = k->nr + 5, rows = k->mr + 2, row0 = 1, col0 = 2;
+    std::vector<T> C(rows * ldc), C0(rows * ldc);
+    for (int i = 0; i < rows * ldc; ++i)
+        C0[i] = (T)testRandom(seed);
+    if (beta == 0)
+        for (int i = 0; i < m; ++i)
+            for (int j = 0; j < n; ++j)
+                C0[(row0 + i) * ldc + col0 + j] = (T)NAN;
+    C = C0;
+
+    T alphaBeta[2] = { alpha, beta };
+    k->kernel(kc, a, b, &C[row0 * ldc + col0], (long)(ldc * sizeof(T)), alphaBeta, m, n);
+
+    const double eps = (sizeof(T) == sizeof(double)) ? DBL_EPSILON : FLT_EPSILON;
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < ldc; ++c) {
+            int i = r - row0, j = c - col0;
+            T got = C[r * ldc + c];
+            if (i < 0 || i >= m || j < 0 || j >= n) {
+                if (memcmp(&got, &C0[r * ldc + c], sizeof(T)) != 0) return false;
+                continue;
+            }
+            double sum = 0, mag = 0;
+            for (int p = 0; p < kc; ++p) {
+                sum += (double)a[p * k->mr + i] * (double)b[p * k->nr + j];
+                mag += fabs((double)a[p * k->mr + i] * (double)b[p * k->nr + j]);
+            }
+            double old = (beta == 0) ? 0 : (double)beta * (double)C0[r * ldc + c];
+            double want = (double)alpha * sum + old;
+            double tol = 4 * eps * (kc + 2) * (fabs((double)alpha) * mag + fabs(old)) + 1e-30;
+            if (!(fabs((double)got - want) <= tol)) return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+static bool testKernel(const GemmPluginKernel* k, char* why, size_t whyLen)
+{
+    static const int kcs[] = { 1, 2, 7, 64, 259 };
+    static const double alphaBetas[][2] = { { 1, 0 }, { 1, 1 }, { -0.75, 0.5 }, { 2, 0 } };
+    uint32_t seed = 12345;
+    bool edges = (k->flags & GEMM_PLUGIN_EDGES) != 0;
+
+    for (size_t t = 0; t < sizeof(kcs) / sizeof(kcs[0]); ++t) {
+        int kc = kcs[t];
+        std::vector<T> a((size_t)kc * k->mr), b((size_t)kc * k->nr);
+        for (size_t i = 0; i < a.size(); ++i) a[i] = (T)testRandom(&seed);
+        for (size_t i = 0; i < b.size(); ++i) b[i] = (T)testRandom(&seed);
+
+        for (int m = edges ? 1 : k->mr; m <= k->mr; ++m) {
+            for (int n = edges ? 1 : k->nr; n <= k->nr; ++n) {
+                for (size_t ab = 0; ab < sizeof(alphaBetas) / sizeof(alphaBetas[0]); ++ab) {
+                    T alpha = (T)alphaBetas[ab][0], beta = (T)alphaBetas[ab][1];
+                    if (!testTile<T>(k, kc, m, n, alpha, beta, &a[0], &b[0], &seed)) {
+                        snprintf(why, whyLen, "kernel %s wrong for kc %d, %d x %d, alpha %g, beta %g",
+                                 k->name, kc, m, n, (double)alpha, (double)beta);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// The layout the engine packs into, element by element
+template <typename T>
+static void referencePack(char operand, int width, int rows, int cols, const T* src,
+                          long rs, long cs, T* dst)
+{
+    if (operand == 'A') {
+        for (int ir = 0; ir < rows; ir += width)
+            for (int c = 0; c < cols; ++c)
+                for (int i = 0; i < width; ++i)
+                    *dst++ = (ir + i < rows) ? src[(ir + i) * rs + c * cs] : (T)0;
+    } else {
+        for (int r = 0; r < rows; ++r)
+            for (int j = 0; j < width; ++j)
+                *dst++ = (j < cols) ? src[r * rs + j * cs] : (T)0;
+    }
+}
+
+template <typename T>
+static bool testPack(const GemmPluginPack* p, char* why, size_t whyLen)
+{
+    const int w = p->width;
+    std::vector<int> blocks, depths;
+    depths.push_back(1); depths.push_back(5); depths.push_back(64);
+    if (p->operand == 'A') {
+        int sizes[] = { 1, w - 1, w, w + 1, 3 * w + 2 };
+        for (int i = 0; i < 5; ++i) if (sizes[i] >= 1) blocks.push_back(sizes[i]);
+    } else {
+        for (int n = 1; n <= w; ++n) blocks.push_back(n);
+    }
+    uint32_t seed = 54321;
+
+    for (size_t bi = 0; bi < blocks.size(); ++bi) {
+        for (size_t di = 0; di < depths.size(); ++di) {
+            // A: a block of rows by kc; B: kc by a sliver of columns
+            int rows = (p->operand == 'A') ? blocks[bi] : depths[di];
+            int cols = (p->operand == 'A') ? depths[di] : blocks[bi];
+            for (int transposed = 0; transposed < 2; ++transposed) {
+                long rs = transposed ? 1 : cols + 3, cs = transposed ? rows + 2 : 1;
+                std::vector<T> src((size_t)(rows + 2) * (cols + 3));
+                for (size_t i = 0; i < src.size(); ++i) src[i] = (T)testRandom(&seed);
+
+                size_t packed = (p->operand == 'A') ? (size_t)(rows + w - 1) / w * w * cols
+                                                    : (size_t)rows * w;
+                std::vector<T> want(packed), got(packed + 16, (T)7);
+                referencePack<T>(p->operand, w, rows, cols, &src[0], rs, cs, &want[0]);
+                p->pack(rows, cols, &src[0], rs, cs, &got[0]);
+
+                bool ok = memcmp(&want[0], &got[0], packed * sizeof(T)) == 0;
+                for (size_t i = packed; i < got.size(); ++i) ok = ok && got[i] == (T)7;
+                if (!ok) {
+                    snprintf(why, whyLen, "pack %s wrong for %d x %d, %s source",
+                             p->name, rows, cols, transposed ? "column-major" : "row-major");
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Loading
+////////////////////////////////////////////////////////////////////////////////
+
+typedef int (*PluginInit)(GemmPluginHost* host);
+
+// Called with pluginLock held; fills in f
+static bool loadFile(const char* path, PluginFile* f)
+{
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        snprintf(f->reason, sizeof(f->reason), "cannot load: %s", dlerror());
+        return false;
+    }
+    PluginInit init = (PluginInit)dlsym(handle, GEMM_PLUGIN_ENTRY);
+    if (!init) {
+        snprintf(f->reason, sizeof(f->reason), "no %s", GEMM_PLUGIN_ENTRY);
+        dlclose(handle);
+        return false;
+    }
+
+    PluginStaging* s = (PluginStaging*)calloc(1, sizeof(PluginStaging));
+    GemmPluginHost host;
+    memset(&host, 0, sizeof(host));
+    host.abiVersion = GEMM_PLUGIN_ABI_VERSION;
+    gemmTileSize(MATRIX_FLOAT32, &host.floatMR, &host.floatNR);
+    gemmTileSize(MATRIX_FLOAT64, &host.doubleMR, &host.doubleNR);
+    host.addKernel = addKernel;
+    host.addPack = addPack;
+    host.state = s;
+
+    int version = init(&host);
+    bool ok = true;
+    if (version == 0) {
+        snprintf(f->reason, sizeof(f->reason), "declined this host");
+        ok = false;
+    } else if (version != GEMM_PLUGIN_ABI_VERSION) {
+        snprintf(f->reason, sizeof(f->reason), "built for ABI version %d, this is %d",
+                 version, GEMM_PLUGIN_ABI_VERSION);
+        ok = false;
+    } else if (s->bad) {
+        snprintf(f->reason, sizeof(f->reason), "malformed entry %s", s->bad);
+        ok = false;
+    } else if (s->overflow) {
+        snprintf(f->reason, sizeof(f->reason), "more than %d entries of a kind", PLUGIN_MAX_STAGED);
+        ok = false;
+    } else if (s->nKernels + s->nPacks == 0) {
+        snprintf(f->reason, sizeof(f->reason), "nothing usable on this host (%d entries incapable)",
+                 s->nIncapable);
+        ok = false;
+    } else if (nKernels + s->nKernels > PLUGIN_MAX_KERNELS || nPacks + s->nPacks > PLUGIN_MAX_PACKS) {
+        snprintf(f->reason, sizeof(f->reason), "too many entries loaded already");
+        ok = false;
+    }
+
+    for (int i = 0; ok && i < s->nKernels; ++i)
+        ok = (s->kernels[i].dtype == GEMM_PLUGIN_FLOAT64)
+           ? testKernel<double>(&s->kernels[i], f->reason, sizeof(f->reason))
+           : testKernel<float>(&s->kernels[i], f->reason, sizeof(f->reason));
+    for (int i = 0; ok && i < s->nPacks; ++i)
+        ok = (s->packs[i].dtype == GEMM_PLUGIN_FLOAT64)
+           ? testPack<double>(&s->packs[i], f->reason, sizeof(f->reason))
+           : testPack<float>(&s->packs[i], f->reason, sizeof(f->reason));
+
+    if (!ok) {
+        free(s);
+        dlclose(handle);
+        return false;
+    }
+
+    // publish: entries first, then the counts lookups read
+    for (int i = 0; i < s->nKernels; ++i) kernels[nKernels + i] = s->kernels[i];
+    for (int i = 0; i < s->nPacks; ++i) packs[nPacks + i] = s->packs[i];
+    __atomic_store_n(&nKernels, nKernels + s->nKernels, __ATOMIC_RELEASE);
+    __atomic_store_n(&nPacks, nPacks + s->nPacks, __ATOMIC_RELEASE);
+
+    f->accepted = true;
+    f->handle = handle;
+    f->nKernels = s->nKernels;
+    f->nPacks = s->nPacks;
+    f->nIncapable = s->nIncapable;
+    free(s);
+    return true;
+}
+
+bool gemmPluginLoad(const char* path)
+{
+    pthread_mutex_lock(&pluginLock);
+    if (nFiles == PLUGIN_MAX_FILES) {
+        pthread_mutex_unlock(&pluginLock);
+        fprintf(stderr, "plugin: %s: more than %d plugins\n", path, PLUGIN_MAX_FILES);
+        return false;
+    }
+    PluginFile* f = &files[nFiles++];
+    memset(f, 0, sizeof(*f));
+    bool ok = loadFile(path, f);
+    pthread_mutex_unlock(&pluginLock);
+    if (!ok) fprintf(stderr, "plugin: %s rejected: %s\n", path, f->reason);
+    return ok;
+}
+
+bool gemmPluginLoadDir(const char* dir)
+{
+    DIR* d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "plugin: cannot open directory %s\n", dir);
+        return false;
+    }
+    // in name order, so priorities tie the same way every time
+    std::vector<std::string> names;
+    while (struct dirent* e = readdir(d)) {
+        size_t len = strlen(e->d_name);
+        if (len > 3 && strcmp(e->d_name + len - 3, ".so") == 0) names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+
+    bool any = false;
+    for (size_t i = 0; i < names.size(); ++i)
+        any = gemmPluginLoad((std::string(dir) + "/" + names[i]).c_str()) || any;
+    return any;
+}
+
+static void loadOnce()
+{
+    const char* dir = getenv("MATMUL_PLUGIN_DIR");
+    if (dir && *dir) gemmPluginLoadDir(dir);
+}
+
+bool gemmPluginEnabled()
+{
+    int state = __atomic_load_n(&pluginState, __ATOMIC_RELAXED);
+    if (state < 0) {
+        const char* env = getenv("MATMUL_PLUGINS");
+        state = (env && strcmp(env, "0") == 0) ? 0 : 1;
+        __atomic_store_n(&pluginState, state, __ATOMIC_RELAXED);
+    }
+    return state == 1;
+}
+
+void gemmPluginSetEnabled(bool enabled)
+{
+    __atomic_store_n(&pluginState, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+////////////////////////////////////////////////////////////////////////////////
+
+const GemmPluginKernel* gemmPluginFindKernel(int dtype, int mr, int nr)
+{
+    if (!gemmPluginEnabled()) return NULL;
+    pthread_once(&pluginOnce, loadOnce);
+
+    const GemmPluginKernel* best = NULL;
+    int n = __atomic_load_n(&nKernels, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; ++i) {
+        const GemmPluginKernel* k = &kernels[i];
+        if (k->dtype == dtype && k->mr == mr && k->nr == nr && (!best || k->priority > best->priority))
+            best = k;
+    }
+    return best;
+}
+
+GemmPluginPackFn gemmPluginFindPack(int dtype, char operand, int width)
+{
+    if (!gemmPluginEnabled()) return NULL;
+    pthread_once(&pluginOnce, loadOnce);
+
+    const GemmPluginPack* best = NULL;
+    int n = __atomic_load_n(&nPacks, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; ++i) {
+        const GemmPluginPack* p = &packs[i];
+        if (p->dtype == dtype && p->operand == operand && p->width == width
+            && (!best || p->priority > best->priority))
+            best = p;
+    }
+    return best ? best->pack : NULL;
+}
+
+void gemmPluginPrint(FILE* out)
+{
+    pthread_mutex_lock(&pluginLock);
+    if (nFiles == 0) fprintf(out, "no plugins\n");
+    int kernel = 0, pack = 0;
+    for (int i = 0; i < nFiles; ++i) {
+        const PluginFile* f = &files[i];
+        if (!f->accepted) {
+            fprintf(out, "%s: rejected, %s\n", f->path, f->reason);
+            continue;
+        }
+        fprintf(out, "%s: %d kernels, %d packs", f->path, f->nKernels, f->nPacks);
+        if (f->nIncapable) fprintf(out, ", %d not for this host", f->nIncapable);
+        fprintf(out, "\n");
+        for (int j = 0; j < f->nKernels; ++j, ++kernel) {
+            const GemmPluginKernel* k = &kernels[kernel];
+            fprintf(out, "  kernel %-24s %s %d x %d%s, priority %d\n", k->name,
+                    k->dtype == GEMM_PLUGIN_FLOAT64 ? "f64" : "f32", k->mr, k->nr,
+                    (k->flags & GEMM_PLUGIN_EDGES) ? " with edges" : "", k->priority);
+        }
+        for (int j = 0; j < f->nPacks; ++j, ++pack) {
+            const GemmPluginPack* p = &packs[pack];
+            fprintf(out, "  pack   %-24s %s %c, width %d, priority %d\n", p->name,
+                    p->dtype == GEMM_PLUGIN_FLOAT64 ? "f64" : "f32", p->operand, p->width,
+                    p->priority);
+        }
+    }
+    pthread_mutex_unlock(&pluginLock);
+}
@@ -0,0 +1,128 @@
+#ifndef _GEMMPLUGIN_H_
+#define _GEMMPLUGIN_H_
+
+// Micro-kernels and pack routines loaded from shared objects at run time.
+//
+// A plugin lets a host get kernels tuned for its processor without a new
+// build of the engine. A plugin is a shared object that exports
+//
+//     extern "C" int gemmPluginInit(GemmPluginHost* host);
+//
+// The host passes its ABI version and its register tiles. The plugin
+// registers what it offers through host->addKernel and host->addPack and
+// returns GEMM_PLUGIN_ABI_VERSION as it was compiled. A plugin that finds
+// nothing useful on this host returns 0.
+//
+// Loading a plugin proceeds as follows:
+//   - A plugin built for another ABI version is rejected.
+//   - An entry whose capable() predicate fails is left out.
+//   - Every remaining entry is run against the reference on random data: all
+//     tile edges it claims, and alpha and beta with and without the special
+//     values. Packs are compared bit for bit, including the zero padding.
+//   - If any entry fails, the whole plugin is rejected and unloaded.
+//   - Otherwise its entries join the engine's dispatch.
+//
+// Dispatch works as follows:
+//   - Among the plugin kernels for the engine's tile, the highest priority
+//     one is considered. A priority above 0 puts it ahead of the generated
+//     kernels of gemmJit.h; 0 or below, it only replaces the compiled
+//     kernel.
+//   - Tiles at the edges of C go to the plugin only if the kernel has
+//     GEMM_PLUGIN_EDGES.
+//   - A pack routine of the engine's width replaces the compiled one.
+//
+// Plugins are looked for in $MATMUL_PLUGIN_DIR when the engine starts its
+// first product. Every file in it that ends in .so is tried. Programs can
+// also call gemmPluginLoad() or gemmPluginLoadDir() themselves. Set
+// MATMUL_PLUGINS=0, or call gemmPluginSetEnabled(false), to ignore every
+// plugin.
+//
+// A plugin runs in the process. The self-test catches wrong results but not
+// a kernel that crashes, so only load plugins that are trusted.
+
+#include <stdio.h>
+
+// Bumped whenever any type below changes
+#define GEMM_PLUGIN_ABI_VERSION 1
+
+// The symbol every plugin exports
+#define GEMM_PLUGIN_ENTRY "gemmPluginInit"
+
+// dtype values, the same as MATRIX_FLOAT32 and MATRIX_FLOAT64
+#define GEMM_PLUGIN_FLOAT32 1
+#define GEMM_PLUGIN_FLOAT64 2
+
+// Kernel flags
+#define GEMM_PLUGIN_EDGES 1         // also computes partial tiles, m < mr or n < nr
+
+// C[0..m, 0..n] = beta * C + alpha * (a * b) for packed slivers a (kc x mr,
+// stored column by column) and b (kc x nr, row by row). This is the contract
+// of GemmJitKernel plus the size of the tile written. ldc is in bytes, and
+// alphaBeta points at alpha and beta in the element type. C is not read when
+// beta is 0.
+typedef void (*GemmPluginKernelFn)(long kc, const void* a, const void* b, void* C, long ldc,
+                                   const void* alphaBeta, int m, int n);
+
+// Packs rows x cols of a source matrix whose element (r, c) is at
+// src[r * rowStride + c * colStride]; strides are in elements.
+//   - For A, rows is a block of mc rows and cols is kc. The block is packed
+//     into width-row slivers, each stored column by column and padded with
+//     zero rows.
+//   - For B, rows is kc and cols is one sliver of at most width columns. The
+//     sliver is stored row by row and padded with zero columns.
+typedef void (*GemmPluginPackFn)(int rows, int cols, const void* src, long rowStride,
+                                 long colStride, void* dst);
+
+typedef struct {
+    const char*        name;
+    int                dtype;       // GEMM_PLUGIN_FLOAT32 or GEMM_PLUGIN_FLOAT64
+    int                mr, nr;
+    int                flags;       // GEMM_PLUGIN_*
+    int                priority;    // see above
+    int              (*capable)();  // NULL if it runs everywhere the plugin loads
+    GemmPluginKernelFn kernel;
+} GemmPluginKernel;
+
+typedef struct {
+    const char*      name;
+    int              dtype;
+    char             operand;       // 'A' or 'B'
+    int              width;         // mr for A, nr for B
+    int              priority;      // among plugins
+    int            (*capable)();
+    GemmPluginPackFn pack;
+} GemmPluginPack;
+
+typedef struct GemmPluginHost GemmPluginHost;
+struct GemmPluginHost {
+    int   abiVersion;
+    int   floatMR, floatNR;         // the engine's register tiles
+    int   doubleMR, doubleNR;
+    // The entry is copied; the strings it points at must stay loaded.
+    // Nonzero on success.
+    int (*addKernel)(GemmPluginHost* host, const GemmPluginKernel* kernel);
+    int (*addPack)(GemmPluginHost* host, const GemmPluginPack* pack);
+    void* state;                    // the host's
+};
+
+// Host side
+
+// Loads one plugin, or every .so in a directory; false (with a message) if
+// it was rejected, or if nothing in the directory was accepted
+bool gemmPluginLoad(const char* path);
+bool gemmPluginLoadDir(const char* dir);
+
+void gemmPluginSetEnabled(bool enabled);
+bool gemmPluginEnabled();
+
+// The highest priority accepted kernel for dtype's mr x nr tile, or NULL.
+// The first call loads $MATMUL_PLUGIN_DIR.
+const GemmPluginKernel* gemmPluginFindKernel(int dtype, int mr, int nr);
+
+// The same for a pack routine of operand 'A' or 'B'
+GemmPluginPackFn gemmPluginFindPack(int dtype, char operand, int width);
+
+// Plugins loaded or rejected, and what each registered
+void gemmPluginPrint(FILE* out);
+
+#endif // _GEMMPLUGIN_H_
@@ -0,0 +1,163 @@
+//This is an example kernel plugin (see gemmPlugin.h): AVX2/FMA micro-kernels
+//for the engine's tiles, and pack routines for a row-major A and B. Put the
+//.so in a directory and point the engine at it:
+//     MATMUL_PLUGIN_DIR=plugins ./timePlugin
+//
+//It registers nothing on processors without AVX2 and FMA, and nothing for
+//a tile the engine does not use, so the same file serves any host.
+//
+// Build:  g++ -O3 -fPIC -shared gemmPluginExample.cpp -o plugins/gemmPluginExample.so
+
+// Utilities and system includes
+#include <string.h>
+
+#include "gemmPlugin.h"
+
+#if defined(__x86_64__)
+#define PLUGIN_TARGET __attribute__((target("avx2,fma")))
+
+// 32-byte vectors with only element alignment, so they load from anywhere
+typedef float  FloatVec  __attribute__((vector_size(32), aligned(4)));
+typedef double DoubleVec __attribute__((vector_size(32), aligned(8)));
+
+template <typename T> struct VecOf;
+template <> struct VecOf<float>  { typedef FloatVec Type; };
+template <> struct VecOf<double> { typedef DoubleVec Type; };
+
+// C[0..m, 0..n] = beta * C + alpha * (a * b) for a 4 x NV-vector tile. The
+// accumulators stay in registers; an edge tile goes through a buffer.
+template <typename T, int NV>
+PLUGIN_TARGET static void kernel(long kc, const void* pa, const void* pb, void* pC, long ldc,
+                                 const void* alphaBeta, int m, int n)
+{
+    typedef typename VecOf<T>::Type V;
+    const int MR = 4, LANES = 32 / sizeof(T), NR = NV * LANES;
+    const T* a = (const T*)pa;
+    const T* b = (const T*)pb;
+    T alpha = ((const T*)alphaBeta)[0], beta = ((const T*)alphaBeta)[1];
+
+    V c[MR][NV];
+    for (int i = 0; i < MR; ++i)
+        for (int v = 0; v < NV; ++v)
+            c[i][v] = V{} + (T)0;
+
+    for (long p = 0; p < kc; ++p) {
+        V bv[NV];
+        for (int v = 0; v < NV; ++v)
+            bv[v] = *(const V*)(b + v * LANES);
+        for (int i = 0; i < MR; ++i)
+            for (int v = 0; v < NV; ++v)
+                c[i][v] += a[i] * bv[v];
+        a += MR;
+        b += NR;
+    }
+
+    if (m == MR && n == NR) {
+        for (int i = 0; i < MR; ++i) {
+            T* row = (T*)((char*)pC + i * ldc);
+            for (int v = 0; v < NV; ++v) {
+                V* cv = (V*)(row + v * LANES);
+                *cv = (beta == 0) ? alpha * c[i][v] : beta * *cv + alpha * c[i][v];
+            }
+        }
+        return;
+    }
+    T tile[MR][NR];
+    memcpy(tile, c, sizeof(tile));
+    for (int i = 0; i < m; ++i) {
+        T* row = (T*)((char*)pC + i * ldc);
+        for (int j = 0; j < n; ++j)
+            row[j] = (beta == 0) ? alpha * tile[i][j] : beta * row[j] + alpha * tile[i][j];
+    }
+}
+
+// A block of rows into 4-row slivers, column by column
+template <typename T>
+static void packA(int rows, int cols, const void* src, long rs, long cs, void* dst)
+{
+    const T* s = (const T*)src;
+    T* d = (T*)dst;
+    for (int ir = 0; ir < rows; ir += 4) {
+        int m = (rows - ir < 4) ? rows - ir : 4;
+        const T* block = s + ir * rs;
+        for (int c = 0; c < cols; ++c) {
+            for (int i = 0; i < m; ++i)
+                d[i] = block[i * rs + c * cs];
+            for (int i = m; i < 4; ++i)
+                d[i] = 0;
+            d += 4;
+        }
+    }
+}
+
+// One sliver of B row by row; rows of a row-major B are copied whole
+template <typename T, int NR>
+static void packB(int rows, int cols, const void* src, long rs, long cs, void* dst)
+{
+    const T* s = (const T*)src;
+    T* d = (T*)dst;
+    for (int r = 0; r < rows; ++r) {
+        if (cs == 1 && cols == NR) {
+            memcpy(d, s + r * rs, sizeof(T) * NR);
+        } else {
+            for (int j = 0; j < cols; ++j)
+                d[j] = s[r * rs + j * cs];
+            for (int j = cols; j < NR; ++j)
+                d[j] = 0;
+        }
+        d += NR;
+    }
+}
+
+static int hasAvx2()
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+// The instances for the tiles the engine may ask for
+static const GemmPluginKernel kernels[] = {
+    { "avx2 4x16 f32", GEMM_PLUGIN_FLOAT32, 4, 16, GEMM_PLUGIN_EDGES, 1, hasAvx2, kernel<float, 2> },
+    { "avx2 4x8 f32",  GEMM_PLUGIN_FLOAT32, 4, 8,  GEMM_PLUGIN_EDGES, 1, hasAvx2, kernel<float, 1> },
+    { "avx2 4x8 f64",  GEMM_PLUGIN_FLOAT64, 4, 8,  GEMM_PLUGIN_EDGES, 1, hasAvx2, kernel<double, 2> },
+    { "avx2 4x4 f64",  GEMM_PLUGIN_FLOAT64, 4, 4,  GEMM_PLUGIN_EDGES, 1, hasAvx2, kernel<double, 1> },
+};
+
+static const GemmPluginPack packs[] = {
+    { "rows of 4 f32",  GEMM_PLUGIN_FLOAT32, 'A', 4,  1, NULL, packA<float> },
+    { "rows of 4 f64",  GEMM_PLUGIN_FLOAT64, 'A', 4,  1, NULL, packA<double> },
+    { "sliver of 16 f32", GEMM_PLUGIN_FLOAT32, 'B', 16, 1, NULL, packB<float, 16> },
+    { "sliver of 8 f64",  GEMM_PLUGIN_FLOAT64, 'B', 8,  1, NULL, packB<double, 8> },
+};
+
+extern "C" int gemmPluginInit(GemmPluginHost* host)
+{
+    if (host->abiVersion != GEMM_PLUGIN_ABI_VERSION) return 0;
+
+    int added = 0;
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        const GemmPluginKernel* k = &kernels[i];
+        bool f64 = k->dtype == GEMM_PLUGIN_FLOAT64;
+        if (k->mr == (f64 ? host->doubleMR : host->floatMR)
+            && k->nr == (f64 ? host->doubleNR : host->floatNR))
+            added += host->addKernel(host, k);
+    }
+    for (size_t i = 0; i < sizeof(packs) / sizeof(packs[0]); ++i) {
+        const GemmPluginPack* p = &packs[i];
+        bool f64 = p->dtype == GEMM_PLUGIN_FLOAT64;
+        int width = (p->operand == 'A') ? (f64 ? host->doubleMR : host->floatMR)
+                                        : (f64 ? host->doubleNR : host->floatNR);
+        if (p->width == width)
+            added += host->addPack(host, p);
+    }
+    return added ? GEMM_PLUGIN_ABI_VERSION : 0;
+}
+
+#else
+
+extern "C" int gemmPluginInit(GemmPluginHost*)
+{
+    return 0;
+}
+
+#endif // __x86_64__
@@ -0,0 +1,334 @@
+// Node-local GEMM service: protocol helpers and the client side.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+
+#include "gemm.h"
+#include "gemmService.h"
+#include "matrixIO.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Protocol
+////////////////////////////////////////////////////////////////////////////////
+
+bool gemmdSendMessage(int sock, const GemmdMessage* msg, int fd)
+{
+    struct iovec iov;
+    iov.iov_base = (void*)msg;
+    iov.iov_len = sizeof(*msg);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    if (fd >= 0) {
+        memset(control, 0, sizeof(control));
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t n;
+    while ((n = sendmsg(sock, &hdr, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+        ;
+    return n == (ssize_t)sizeof(*msg);
+}
+
+int gemmdReceiveMessage(int sock, GemmdMessage* msg, int* fd, bool wait)
+{
+    struct iovec iov;
+    iov.iov_base = msg;
+    iov.iov_len = sizeof(*msg);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(sock, &hdr, wait ? 0 : MSG_DONTWAIT)) < 0 && errno == EINTR)
+        ;
+
+    *fd = -1;
+    if (n > 0) {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    return (int)n;
+}
+
+void gemmdFutexWait(uint32_t* word, uint32_t expected, int timeoutMs)
+{
+    struct timespec ts;
+    ts.tv_sec = timeoutMs / 1000;
+    ts.tv_nsec = (long)(timeoutMs % 1000) * 1000000;
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, timeoutMs >= 0 ? &ts : NULL, NULL, 0);
+}
+
+void gemmdFutexWake(uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Client
+////////////////////////////////////////////////////////////////////////////////
+
+// A shared memfd segment of at least bytes, mapped; -1 on failure. It is
+// sealed so it cannot shrink under the daemon's mapping.
+static int createSegment(const char* name, size_t bytes, void** base)
+{
+    int fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)bytes) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+        close(fd);
+        return -1;
+    }
+    *base = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (*base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Waits for the daemon to confirm it has mapped a segment
+static bool acknowledged(GemmdClient* client, const GemmdMessage* sent)
+{
+    GemmdMessage ack;
+    int fd;
+    if (gemmdReceiveMessage(client->sock, &ack, &fd, true) != (int)sizeof(ack)) return false;
+    if (fd >= 0) close(fd);
+    return ack.type == sent->type && ack.segment == sent->segment && ack.size == 1;
+}
+
+bool gemmdConnect(GemmdClient* client, const char* path)
+{
+    memset(client, 0, sizeof(*client));
+    client->sock = -1;
+    client->ringFd = -1;
+    client->nextJob = 1;
+    client->nextSegment = 1;
+
+    if (!path) path = getenv("MATMUL_GEMMD");
+    if (!path || !*path) path = GEMMD_SOCKET;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (client->sock < 0 || connect(client->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "gemmd: cannot connect to %s\n", path);
+        gemmdDisconnect(client);
+        return false;
+    }
+
+    void* ring;
+    client->ringFd = createSegment("gemmd-ring", sizeof(GemmdRing), &ring);
+    if (client->ringFd < 0) {
+        fprintf(stderr, "gemmd: cannot create the ring segment\n");
+        gemmdDisconnect(client);
+        return false;
+    }
+    client->ring = (GemmdRing*)ring;
+
+    GemmdMessage msg = { GEMMD_MSG_RING, 0, sizeof(GemmdRing) };
+    if (!gemmdSendMessage(client->sock, &msg, client->ringFd) || !acknowledged(client, &msg)) {
+        fprintf(stderr, "gemmd: the daemon on %s did not take the ring\n", path);
+        gemmdDisconnect(client);
+        return false;
+    }
+    return true;
+}
+
+void gemmdDisconnect(GemmdClient* client)
+{
+    for (int i = 0; i < client->nSegments; ++i) {
+        munmap(client->segments[i].base, client->segments[i].size);
+        close(client->segments[i].fd);
+    }
+    client->nSegments = 0;
+
+    if (client->ring) munmap(client->ring, sizeof(GemmdRing));
+    if (client->ringFd >= 0) close(client->ringFd);
+    if (client->sock >= 0) close(client->sock);
+    client->ring = NULL;
+    client->ringFd = -1;
+    client->sock = -1;
+}
+
+void* gemmdAlloc(GemmdClient* client, size_t bytes)
+{
+    if (client->nSegments == GEMMD_MAX_SEGMENTS) {
+        fprintf(stderr, "gemmd: too many shared segments\n");
+        return NULL;
+    }
+
+    void* base;
+    int fd = createSegment("gemmd-operand", bytes, &base);
+    if (fd < 0) {
+        fprintf(stderr, "gemmd: cannot create a %zu byte segment\n", bytes);
+        return NULL;
+    }
+
+    GemmdSegment* seg = &client->segments[client->nSegments];
+    seg->id = client->nextSegment++;
+    seg->fd = fd;
+    seg->base = base;
+    seg->size = bytes;
+
+    GemmdMessage msg = { GEMMD_MSG_SEGMENT, seg->id, bytes };
+    if (!gemmdSendMessage(client->sock, &msg, fd) || !acknowledged(client, &msg)) {
+        fprintf(stderr, "gemmd: the daemon did not map a %zu byte segment\n", bytes);
+        munmap(base, bytes);
+        close(fd);
+        return NULL;
+    }
+    client->nSegments++;
+    return base;
+}
+
+void gemmdFree(GemmdClient* client, void* base)
+{
+    for (int i = 0; i < client->nSegments; ++i) {
+        GemmdSegment* seg = &client->segments[i];
+        if (seg->base != base) continue;
+
+        GemmdMessage msg = { GEMMD_MSG_RELEASE, seg->id, 0 };
+        gemmdSendMessage(client->sock, &msg, -1);
+        munmap(seg->base, seg->size);
+        close(seg->fd);
+        *seg = client->segments[--client->nSegments];
+        return;
+    }
+}
+
+// Segment and offset of a pointer into shared memory
+static bool locate(const GemmdClient* client, const void* p, uint32_t* segment, uint64_t* offset)
+{
+    for (int i = 0; i < client->nSegments; ++i) {
+        const GemmdSegment* seg = &client->segments[i];
+        const char* base = (const char*)seg->base;
+        if ((const char*)p >= base && (const char*)p < base + seg->size) {
+            *segment = seg->id;
+            *offset = (uint64_t)((const char*)p - base);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves finished jobs from the CQ into the client
+static void reap(GemmdClient* client)
+{
+    GemmdRing* ring = client->ring;
+    uint32_t head = ring->cqHead;
+    uint32_t tail = __atomic_load_n(&ring->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; ++head) {
+        const GemmdCompletion* c = &ring->cq[head % GEMMD_RING_ENTRIES];
+        client->status[c->job % GEMMD_RING_ENTRIES] = c->status;
+        client->seconds[c->job % GEMMD_RING_ENTRIES] = c->seconds;
+        client->completed = c->job;
+    }
+    __atomic_store_n(&ring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// Waits until job has completed; false if the daemon went away first
+static bool waitFor(GemmdClient* client, uint64_t job)
+{
+    GemmdRing* ring = client->ring;
+    for (;;) {
+        reap(client);
+        if (client->completed >= job) return true;
+
+        uint32_t tail = __atomic_load_n(&ring->cqTail, __ATOMIC_ACQUIRE);
+        if (tail != ring->cqHead) continue;
+        gemmdFutexWait(&ring->cqTail, tail, 1000);
+
+        // the daemon closing the socket is the only sign that it died
+        char byte;
+        if (recv(client->sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+            fprintf(stderr, "gemmd: the daemon closed the connection\n");
+            return false;
+        }
+    }
+}
+
+uint64_t gemmdSubmit(GemmdClient* client, int dtype, int transA, int transB,
+                     int M, int N, int K, double alpha, const void* A, int lda,
+                     const void* B, int ldb, double beta, void* C, int ldc)
+{
+    GemmdRequest r;
+    memset(&r, 0, sizeof(r));
+    if (!locate(client, A, &r.segment[0], &r.offset[0])
+        || !locate(client, B, &r.segment[1], &r.offset[1])
+        || !locate(client, C, &r.segment[2], &r.offset[2]))
+    {
+        fprintf(stderr, "gemmd: operands must be allocated with gemmdAlloc\n");
+        return 0;
+    }
+
+    // At most one ring of jobs in flight, so the CQ cannot overflow
+    uint64_t job = client->nextJob;
+    if (job - client->completed > GEMMD_RING_ENTRIES
+        && !waitFor(client, job - GEMMD_RING_ENTRIES))
+        return 0;
+
+    r.job = job;
+    r.M = M; r.N = N; r.K = K;
+    r.lda = lda; r.ldb = ldb; r.ldc = ldc;
+    r.alpha = alpha;
+    r.beta = beta;
+    r.dtype = (uint8_t)dtype;
+    r.transA = (uint8_t)(transA == GEMM_TRANS);
+    r.transB = (uint8_t)(transB == GEMM_TRANS);
+
+    GemmdRing* ring = client->ring;
+    uint32_t tail = ring->sqTail;
+    ring->sq[tail % GEMMD_RING_ENTRIES] = r;
+    __atomic_store_n(&ring->sqTail, tail + 1, __ATOMIC_SEQ_CST);
+
+    // Pairs with the daemon setting sqSleeping before its last look at the SQ
+    if (__atomic_load_n(&ring->sqSleeping, __ATOMIC_SEQ_CST)) {
+        GemmdMessage msg = { GEMMD_MSG_DOORBELL, 0, 0 };
+        gemmdSendMessage(client->sock, &msg, -1);
+    }
+
+    client->nextJob++;
+    return job;
+}
+
+int gemmdWait(GemmdClient* client, uint64_t job, double* seconds)
+{
+    if (!waitFor(client, job)) return GEMMD_DISCONNECTED;
+    if (seconds) *seconds = client->seconds[job % GEMMD_RING_ENTRIES];
+    return client->status[job % GEMMD_RING_ENTRIES];
+}
@@ -0,0 +1,134 @@
+#ifndef _GEMMSERVICE_H_
+#define _GEMMSERVICE_H_
+
+// Node-local GEMM service.
+//
+// gemmd owns the engine's worker pool for the whole node, so processes that
+// would each start their own threads share one pool instead. Clients connect
+// over a Unix socket ($MATMUL_GEMMD, default GEMMD_SOCKET) and:
+//
+//   - allocate operands in memfd segments whose descriptors are passed to
+//     the daemon, which maps them too; no operand is ever copied. Segments
+//     are sealed against shrinking, and the daemon refuses one that is not
+//     or that is smaller than its client says
+//   - post requests to a submission ring (SQ) in a shared segment
+//   - collect completions from a completion ring (CQ) in the same segment
+//
+// The socket carries only control messages: segment registration, which
+// the daemon acknowledges once the segment is mapped, and a doorbell, sent
+// when the daemon has gone to sleep on an empty SQ.
+// Completions wake waiting clients through a futex on the CQ tail.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define GEMMD_SOCKET        "/tmp/matmul-gemmd.sock"
+#define GEMMD_RING_ENTRIES  256     // power of two
+#define GEMMD_MAX_SEGMENTS  64
+
+// GemmdCompletion::status
+#define GEMMD_OK            0
+#define GEMMD_BAD_OPERAND   1       // operand outside its segment
+#define GEMMD_BAD_REQUEST   2
+#define GEMMD_DISCONNECTED  3       // the daemon went away
+
+// Control messages
+#define GEMMD_MSG_RING      1       // fd of the ring segment; acknowledged
+#define GEMMD_MSG_SEGMENT   2       // fd of an operand segment; acknowledged
+#define GEMMD_MSG_RELEASE   3       // operand segment no longer used
+#define GEMMD_MSG_DOORBELL  4       // the SQ has entries
+
+typedef struct {
+    uint32_t type;
+    uint32_t segment;
+    uint64_t size;                  // in an acknowledgement, 1 if mapped
+} GemmdMessage;
+
+typedef struct {
+    uint64_t job;
+    uint32_t segment[3];            // A, B, C
+    uint64_t offset[3];
+    int32_t  M, N, K;
+    int32_t  lda, ldb, ldc;
+    double   alpha, beta;
+    uint8_t  dtype;                 // MATRIX_FLOAT32 / MATRIX_FLOAT64
+    uint8_t  transA, transB;
+} GemmdRequest;
+
+typedef struct {
+    uint64_t job;
+    int32_t  status;
+    float    seconds;               // time in the engine
+} GemmdCompletion;
+
+// Head and tail are free-running; the producer owns the tail, the consumer
+// the head
+typedef struct {
+    uint32_t        sqHead;
+    uint32_t        sqTail;
+    uint32_t        sqSleeping;     // daemon waits for a doorbell
+    uint32_t        cqHead;
+    uint32_t        cqTail;         // futex word
+    uint32_t        reserved[11];
+    GemmdRequest    sq[GEMMD_RING_ENTRIES];
+    GemmdCompletion cq[GEMMD_RING_ENTRIES];
+} GemmdRing;
+
+// Shared by the daemon and the client: one control message, with an
+// optional descriptor attached (-1 for none)
+bool gemmdSendMessage(int sock, const GemmdMessage* msg, int fd);
+// Returns the message length (0 at end of stream, -1 on error); *fd gets an
+// attached descriptor or -1
+int  gemmdReceiveMessage(int sock, GemmdMessage* msg, int* fd, bool wait);
+
+// Cross-process futex on a word in shared memory; timeoutMs < 0 waits forever
+void gemmdFutexWait(uint32_t* word, uint32_t expected, int timeoutMs);
+void gemmdFutexWake(uint32_t* word);
+
+////////////////////////////////////////////////////////////////////////////////
+// Client
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    uint32_t id;
+    int      fd;
+    void*    base;
+    size_t   size;
+} GemmdSegment;
+
+// A connection; use it from one thread at a time
+typedef struct {
+    int          sock;
+    int          ringFd;
+    GemmdRing*   ring;
+    uint64_t     nextJob;
+    uint64_t     completed;         // every job up to this one has finished
+    int32_t      status[GEMMD_RING_ENTRIES];     // by job % GEMMD_RING_ENTRIES
+    float        seconds[GEMMD_RING_ENTRIES];
+    GemmdSegment segments[GEMMD_MAX_SEGMENTS];
+    int          nSegments;
+    uint32_t     nextSegment;
+} GemmdClient;
+
+// Connects to the daemon at path (NULL: $MATMUL_GEMMD or GEMMD_SOCKET)
+bool gemmdConnect(GemmdClient* client, const char* path);
+void gemmdDisconnect(GemmdClient* client);
+
+// Shared memory for operands; NULL on failure. Free a segment only once the
+// jobs that use it have completed.
+void* gemmdAlloc(GemmdClient* client, size_t bytes);
+void  gemmdFree(GemmdClient* client, void* base);
+
+// Posts C = alpha * op(A) * op(B) + beta * C, row-major as in gemm.h, with
+// every operand inside memory from gemmdAlloc. Returns the job id, or 0 if
+// an operand is not in a shared segment or the daemon has gone. Blocks
+// while the rings are full.
+uint64_t gemmdSubmit(GemmdClient* client, int dtype, int transA, int transB,
+                     int M, int N, int K, double alpha, const void* A, int lda,
+                     const void* B, int ldb, double beta, void* C, int ldc);
+
+// Waits for a job; returns its GEMMD_* status. Jobs complete in the order
+// they were submitted.
+int gemmdWait(GemmdClient* client, uint64_t job, double* seconds);
+
+#endif // _GEMMSERVICE_H_
@@ -0,0 +1,180 @@
+// Streaming GEMM over row blocks of A.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+#include "gemm.h"
+#include "gemmStream.h"
+#include "matrixIO.h"
+#include "multithreading.h"
+
+typedef struct {
+    char* A;
+    char* C;
+    int   row0;
+    int   rows;
+} StreamSlot;
+
+struct GemmStream {
+    int                dtype;
+    size_t             elem;
+    int                K, N;
+    int                maxRows;
+    GemmPackedB*       B;
+    GemmStreamConsumer consumer;
+    void*              arg;
+
+    Arena              buffers;     // every slot's A and C
+    StreamSlot*        slots;
+    int                depth;
+
+    // Slots fill at tail and are taken at head, both counting up; guarded
+    // by lock
+    pthread_mutex_t    lock;
+    pthread_cond_t     filled;      // the stream thread: a block or the end
+    pthread_cond_t     drained;     // producers: a slot is free
+    long               head, tail;
+    int                nextRow;
+    bool               finishing;
+    bool               finished;
+    CUTThread          thread;
+};
+
+static CUT_THREADPROC streamMain(void* p)
+{
+    GemmStream* s = (GemmStream*)p;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (s->head == s->tail && !s->finishing)
+            pthread_cond_wait(&s->filled, &s->lock);
+        if (s->head == s->tail) break;
+
+        StreamSlot* slot = &s->slots[s->head % s->depth];
+        pthread_mutex_unlock(&s->lock);
+
+        if (s->dtype == MATRIX_FLOAT64)
+            gemmDgemmPacked(GEMM_NO_TRANS, slot->rows, 1.0, (const double*)slot->A, s->K,
+                            s->B, 0.0, (double*)slot->C, s->N);
+        else
+            gemmSgemmPacked(GEMM_NO_TRANS, slot->rows, 1.0f, (const float*)slot->A, s->K,
+                            s->B, 0.0f, (float*)slot->C, s->N);
+        s->consumer(slot->row0, slot->rows, slot->C, s->N, s->arg);
+
+        pthread_mutex_lock(&s->lock);
+        s->head++;
+        pthread_cond_broadcast(&s->drained);
+    }
+    pthread_mutex_unlock(&s->lock);
+    CUT_THREADEND;
+}
+
+GemmStream* gemmStreamCreate(int dtype, int transB, int K, int N, const void* B, int ldb,
+                             int maxRows, int depth, GemmStreamConsumer consumer, void* arg)
+{
+    if ((dtype != MATRIX_FLOAT32 && dtype != MATRIX_FLOAT64) || K <= 0 || N <= 0
+        || maxRows <= 0 || depth <= 0 || !consumer)
+    {
+        fprintf(stderr, "gemmStream: invalid arguments\n");
+        return NULL;
+    }
+
+    GemmStream* s = (GemmStream*)calloc(1, sizeof(GemmStream));
+    s->dtype = dtype;
+    s->elem = matrixTypeSize(dtype);
+    s->K = K;
+    s->N = N;
+    s->maxRows = maxRows;
+    s->depth = depth;
+    s->consumer = consumer;
+    s->arg = arg;
+
+    s->B = (dtype == MATRIX_FLOAT64) ? gemmDpackB(transB, K, N, (const double*)B, ldb)
+                                     : gemmSpackB(transB, K, N, (const float*)B, ldb);
+
+    size_t aBytes = ((size_t)maxRows * K * s->elem + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    size_t cBytes = ((size_t)maxRows * N * s->elem + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+    if (!s->B || !arenaInit(&s->buffers, (aBytes + cBytes) * depth)) {
+        fprintf(stderr, "gemmStream: cannot allocate the queue\n");
+        gemmFreePackedB(s->B);
+        free(s);
+        return NULL;
+    }
+    s->slots = (StreamSlot*)calloc(depth, sizeof(StreamSlot));
+    for (int i = 0; i < depth; ++i) {
+        s->slots[i].A = (char*)arenaAlloc(&s->buffers, aBytes, 0);
+        s->slots[i].C = (char*)arenaAlloc(&s->buffers, cBytes, 0);
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->filled, NULL);
+    pthread_cond_init(&s->drained, NULL);
+    s->thread = cutStartThread((CUT_THREADROUTINE)streamMain, s);
+    return s;
+}
+
+bool gemmStreamPush(GemmStream* s, const void* A, int rows, int lda)
+{
+    const char* src = (const char*)A;
+    while (rows > 0) {
+        int n = (rows < s->maxRows) ? rows : s->maxRows;
+
+        pthread_mutex_lock(&s->lock);
+        while (s->tail - s->head == s->depth && !s->finishing)
+            pthread_cond_wait(&s->drained, &s->lock);
+        if (s->finishing) {
+            pthread_mutex_unlock(&s->lock);
+            return false;
+        }
+        StreamSlot* slot = &s->slots[s->tail % s->depth];
+        slot->row0 = s->nextRow;
+        slot->rows = n;
+        s->nextRow += n;
+        pthread_mutex_unlock(&s->lock);
+
+        // only this producer touches the slot until it is published
+        for (int r = 0; r < n; ++r)
+            memcpy(slot->A + (size_t)r * s->K * s->elem, src + (size_t)r * lda * s->elem,
+                   (size_t)s->K * s->elem);
+
+        pthread_mutex_lock(&s->lock);
+        s->tail++;
+        pthread_cond_signal(&s->filled);
+        pthread_mutex_unlock(&s->lock);
+
+        src += (size_t)n * lda * s->elem;
+        rows -= n;
+    }
+    return true;
+}
+
+void gemmStreamFinish(GemmStream* s)
+{
+    pthread_mutex_lock(&s->lock);
+    bool join = !s->finishing;
+    s->finishing = true;
+    pthread_cond_broadcast(&s->filled);
+    pthread_cond_broadcast(&s->drained);
+    pthread_mutex_unlock(&s->lock);
+
+    if (join) {
+        cutEndThread(s->thread);
+        s->finished = true;
+    }
+}
+
+void gemmStreamDestroy(GemmStream* s)
+{
+    if (!s) return;
+    if (!s->finished) gemmStreamFinish(s);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->filled);
+    pthread_cond_destroy(&s->drained);
+    arenaDestroy(&s->buffers);
+    gemmFreePackedB(s->B);
+    free(s->slots);
+    free(s);
+}
@@ -0,0 +1,39 @@
+#ifndef _GEMMSTREAM_H_
+#define _GEMMSTREAM_H_
+
+// Streaming GEMM over row blocks of A.
+//
+// B is packed once when the stream is created and stays resident. The
+// producer pushes row blocks of A as they become available; each is copied
+// into one of depth queue slots, multiplied by B on the stream's thread with
+// the engine, and handed to the consumer as the matching rows of C = A * B.
+// Blocks reach the consumer in the order they were pushed, and pushes come
+// from one thread at a time. A push waits while every slot is taken, so the
+// memory in use is bounded by
+//
+//     packed B + depth * maxRows * (K + N) elements
+//
+// whatever the total number of rows.
+
+// Gets rows row0 .. row0 + rows - 1 of C, valid only during the call
+typedef void (*GemmStreamConsumer)(int row0, int rows, const void* C, int ldc, void* arg);
+
+typedef struct GemmStream GemmStream;
+
+// dtype is MATRIX_FLOAT32 or MATRIX_FLOAT64; op(B) is K x N. Returns NULL
+// (with a message on stderr) if the arguments are invalid or memory runs out.
+GemmStream* gemmStreamCreate(int dtype, int transB, int K, int N, const void* B, int ldb,
+                             int maxRows, int depth, GemmStreamConsumer consumer, void* arg);
+
+// Queues rows (row-major, K columns, leading dimension lda) as the next rows
+// of A. Blocks taller than maxRows are split. False once the stream is
+// finished.
+bool gemmStreamPush(GemmStream* stream, const void* A, int rows, int lda);
+
+// Waits until every pushed block has been delivered; no more pushes after it
+void gemmStreamFinish(GemmStream* stream);
+
+// Finishes the stream if need be and frees it
+void gemmStreamDestroy(GemmStream* stream);
+
+#endif // _GEMMSTREAM_H_
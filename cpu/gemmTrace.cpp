@@ -0,0 +1,190 @@
+// Call tracing for the GEMM engine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <map>
+
+#include "gemmTrace.h"
+
+#define TRACE_ENV "MATMUL_TRACE"
+
+static pthread_once_t  traceOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Guarded by traceLock
+static FILE*    traceFile = NULL;
+static uint64_t traceStart = 0;
+static std::map<const void*, uint32_t>* operandIds = NULL;
+static std::map<pthread_t, uint16_t>*   threadIds = NULL;
+
+// Read without the lock on every engine call
+static volatile int tracing = 0;
+
+uint64_t gemmTraceNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void closeTrace()
+{
+    if (!traceFile) return;
+    tracing = 0;
+    fclose(traceFile);
+    traceFile = NULL;
+    delete operandIds;
+    delete threadIds;
+    operandIds = NULL;
+    threadIds = NULL;
+}
+
+static void traceAtExit()
+{
+    gemmTraceStop();
+}
+
+static void traceFromEnv()
+{
+    const char* path = getenv(TRACE_ENV);
+    if (path && *path && gemmTraceStart(path))
+        atexit(traceAtExit);
+}
+
+bool gemmTraceStart(const char* path)
+{
+    pthread_mutex_lock(&traceLock);
+    closeTrace();
+
+    traceFile = fopen(path, "wb");
+    if (!traceFile) {
+        pthread_mutex_unlock(&traceLock);
+        fprintf(stderr, "gemm trace: cannot open %s\n", path);
+        return false;
+    }
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.startTime = (uint64_t)wall.tv_sec * 1000000000ull + (uint64_t)wall.tv_nsec;
+    fwrite(&header, sizeof(header), 1, traceFile);
+
+    operandIds = new std::map<const void*, uint32_t>();
+    threadIds = new std::map<pthread_t, uint16_t>();
+    traceStart = gemmTraceNow();
+    tracing = 1;
+    pthread_mutex_unlock(&traceLock);
+    return true;
+}
+
+void gemmTraceStop()
+{
+    pthread_mutex_lock(&traceLock);
+    closeTrace();
+    pthread_mutex_unlock(&traceLock);
+}
+
+bool gemmTraceActive()
+{
+    pthread_once(&traceOnce, traceFromEnv);
+    return tracing != 0;
+}
+
+// Id of an operand, and whether it was seen before. Called with traceLock held.
+static uint32_t operandId(const void* p, bool* reused)
+{
+    std::map<const void*, uint32_t>::iterator it = operandIds->find(p);
+    *reused = (it != operandIds->end());
+    if (*reused) return it->second;
+
+    uint32_t id = (uint32_t)operandIds->size();
+    (*operandIds)[p] = id;
+    return id;
+}
+
+void gemmTraceRecord(uint64_t start, int dtype, int transA, int transB,
+                     int M, int N, int K, double alpha, const void* A, int lda,
+                     const void* B, int ldb, double beta, const void* C, int ldc, int entry)
+{
+    uint64_t end = gemmTraceNow();
+
+    pthread_mutex_lock(&traceLock);
+    if (!traceFile) {
+        pthread_mutex_unlock(&traceLock);
+        return;
+    }
+
+    TraceRecord r;
+    memset(&r, 0, sizeof(r));
+    r.start = (start > traceStart) ? start - traceStart : 0;
+    r.duration = end - start;
+    r.M = M; r.N = N; r.K = K;
+    r.lda = lda; r.ldb = ldb; r.ldc = ldc;
+    r.alpha = (float)alpha;
+    r.beta = (float)beta;
+    r.dtype = (uint8_t)dtype;
+    r.flags = (uint8_t)entry;
+
+    bool reused;
+    r.a = operandId(A, &reused);
+    if (reused) r.flags |= TRACE_REUSE_A;
+    r.b = operandId(B, &reused);
+    if (reused) r.flags |= TRACE_REUSE_B;
+    r.c = operandId(C, &reused);
+    if (reused) r.flags |= TRACE_REUSE_C;
+    if (transA) r.flags |= TRACE_TRANS_A;
+    if (transB) r.flags |= TRACE_TRANS_B;
+
+    pthread_t self = pthread_self();
+    std::map<pthread_t, uint16_t>::iterator it = threadIds->find(self);
+    if (it == threadIds->end()) {
+        r.thread = (uint16_t)threadIds->size();
+        (*threadIds)[self] = r.thread;
+    } else {
+        r.thread = it->second;
+    }
+
+    fwrite(&r, sizeof(r), 1, traceFile);
+    pthread_mutex_unlock(&traceLock);
+}
+
+bool readTrace(const char* path, TraceHeader* header, TraceRecord** records, size_t* count)
+{
+    *records = NULL;
+    *count = 0;
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "trace: cannot open %s\n", path);
+        return false;
+    }
+
+    if (fread(header, sizeof(*header), 1, fp) != 1
+        || strncmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != TRACE_VERSION
+        || header->recordSize != sizeof(TraceRecord))
+    {
+        fprintf(stderr, "trace: %s is not a version %d trace\n", path, TRACE_VERSION);
+        fclose(fp);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long bytes = ftell(fp) - (long)sizeof(*header);
+    fseek(fp, sizeof(*header), SEEK_SET);
+
+    // a trailing partial record (writer killed mid-write) is dropped
+    size_t n = (size_t)bytes / sizeof(TraceRecord);
+    *records = (TraceRecord*)malloc(n * sizeof(TraceRecord) + 1);
+    *count = fread(*records, sizeof(TraceRecord), n, fp);
+    fclose(fp);
+    return true;
+}
@@ -0,0 +1,75 @@
+#ifndef _GEMMTRACE_H_
+#define _GEMMTRACE_H_
+
+// Call tracing for the GEMM engine.
+//
+// With MATMUL_TRACE=<file> in the environment (or after gemmTraceStart), every
+// gemmSgemm/gemmDgemm call is appended to a trace: shape, transposes, leading
+// dimensions, alpha/beta, element type, start time and duration, the calling
+// thread, and operand ids. Operands are numbered by address in order of first
+// use, so a replay can tell which calls reuse the same A, B or C.
+//
+// The other floating-point entry points are recorded too, flagged:
+// asynchronous products when they are submitted (the duration is the
+// submission's), products against a packed B with B's id that of the
+// GemmPackedB and ldb = N, and in-place products with K = N and C = A.
+//
+// A trace is a TraceHeader followed by fixed-size TraceRecords.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_MAGIC   "MMULTRC"
+#define TRACE_VERSION 1
+
+// TraceRecord::flags
+#define TRACE_TRANS_A 0x01
+#define TRACE_TRANS_B 0x02
+#define TRACE_REUSE_A 0x04      // A was an operand of an earlier call
+#define TRACE_REUSE_B 0x08
+#define TRACE_REUSE_C 0x10
+#define TRACE_ASYNC    0x20     // gemmSgemmAsync/gemmDgemmAsync
+#define TRACE_PACKED_B 0x40     // gemmSgemmPacked/gemmDgemmPacked
+#define TRACE_IN_PLACE 0x80     // gemmSgemmInPlace/gemmDgemmInPlace
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t recordSize;        // sizeof(TraceRecord)
+    uint64_t startTime;         // CLOCK_REALTIME ns when recording began
+} TraceHeader;
+
+typedef struct {
+    uint64_t start;             // ns since recording began
+    uint64_t duration;          // ns spent in the call
+    uint32_t M, N, K;
+    uint32_t lda, ldb, ldc;
+    uint32_t a, b, c;           // operand ids
+    float    alpha, beta;
+    uint8_t  dtype;             // MATRIX_FLOAT32 / MATRIX_FLOAT64
+    uint8_t  flags;             // TRACE_*
+    uint16_t thread;            // caller, numbered in order of first call
+} TraceRecord;
+
+// Starts recording to path, replacing any trace in progress
+bool gemmTraceStart(const char* path);
+
+// Flushes and closes the trace
+void gemmTraceStop();
+
+// Monotonic clock in ns, for timing a call before it is recorded
+uint64_t gemmTraceNow();
+
+// True while a trace is being recorded; the first call checks MATMUL_TRACE
+bool gemmTraceActive();
+
+// Appends one call; start is a gemmTraceNow() value taken before the call,
+// entry 0 or the TRACE_ flag of the entry point
+void gemmTraceRecord(uint64_t start, int dtype, int transA, int transB,
+                     int M, int N, int K, double alpha, const void* A, int lda,
+                     const void* B, int ldb, double beta, const void* C, int ldc, int entry);
+
+// Loads a whole trace; free *records when done
+bool readTrace(const char* path, TraceHeader* header, TraceRecord** records, size_t* count);
+
+#endif // _GEMMTRACE_H_
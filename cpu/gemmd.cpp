@@ -0,0 +1,315 @@
+//This runs the node-local GEMM service (see gemmService.h):
+//     ./gemmd [socket=/tmp/matmul-gemmd.sock] [threads=0] [affinity=compact]
+//
+//Only one daemon runs per socket; a second one finds the first answering
+//and exits. Each client is served by its own thread, and every product goes
+//through the one engine, so clients share its workers and pack buffers.
+//
+// Build:  g++ -O3 -march=native -fopenmp gemmd.cpp gemmService.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o gemmd
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+
+#include "gemm.h"
+#include "gemmService.h"
+#include "matrixIO.h"
+#include "multithreading.h"
+
+typedef struct {
+    char*  base;
+    size_t size;
+} Mapping;
+
+typedef struct {
+    int                          sock;
+    GemmdRing*                   ring;
+    std::map<uint32_t, Mapping>* segments;
+} Client;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void onSignal(int)
+{
+    stopping = 1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+// Address of a rows x cols operand at (segment, offset), or NULL unless it
+// lies entirely inside the segment
+static char* operand(Client* client, uint32_t segment, uint64_t offset,
+                     int rows, int cols, int ld, int dtype)
+{
+    std::map<uint32_t, Mapping>::iterator it = client->segments->find(segment);
+    if (it == client->segments->end()) return NULL;
+
+    const Mapping& m = it->second;
+    size_t extent;
+    if (__builtin_mul_overflow((size_t)(rows - 1), (size_t)ld, &extent)
+        || __builtin_add_overflow(extent, (size_t)cols, &extent)
+        || __builtin_mul_overflow(extent, matrixTypeSize(dtype), &extent))
+        return NULL;
+    if (offset > m.size || extent > m.size - offset) return NULL;
+    if (offset % matrixTypeSize(dtype) != 0) return NULL;
+    return m.base + offset;
+}
+
+static int execute(Client* client, const GemmdRequest* r, double* seconds)
+{
+    *seconds = 0;
+    if ((r->dtype != MATRIX_FLOAT32 && r->dtype != MATRIX_FLOAT64)
+        || r->M <= 0 || r->N <= 0 || r->K <= 0)
+        return GEMMD_BAD_REQUEST;
+
+    int aRows = r->transA ? r->K : r->M, aCols = r->transA ? r->M : r->K;
+    int bRows = r->transB ? r->N : r->K, bCols = r->transB ? r->K : r->N;
+    if (r->lda < aCols || r->ldb < bCols || r->ldc < r->N)
+        return GEMMD_BAD_REQUEST;
+
+    char* A = operand(client, r->segment[0], r->offset[0], aRows, aCols, r->lda, r->dtype);
+    char* B = operand(client, r->segment[1], r->offset[1], bRows, bCols, r->ldb, r->dtype);
+    char* C = operand(client, r->segment[2], r->offset[2], r->M, r->N, r->ldc, r->dtype);
+    if (!A || !B || !C) return GEMMD_BAD_OPERAND;
+
+    int transA = r->transA ? GEMM_TRANS : GEMM_NO_TRANS;
+    int transB = r->transB ? GEMM_TRANS : GEMM_NO_TRANS;
+
+    double start = now();
+    if (r->dtype == MATRIX_FLOAT64) {
+        gemmDgemm(transA, transB, r->M, r->N, r->K, r->alpha, (const double*)A, r->lda,
+                  (const double*)B, r->ldb, r->beta, (double*)C, r->ldc);
+    } else {
+        gemmSgemm(transA, transB, r->M, r->N, r->K, (float)r->alpha, (const float*)A, r->lda,
+                  (const float*)B, r->ldb, (float)r->beta, (float*)C, r->ldc);
+    }
+    *seconds = now() - start;
+    return GEMMD_OK;
+}
+
+// Runs every request in the SQ, posting each completion as it finishes
+static void drain(Client* client)
+{
+    GemmdRing* ring = client->ring;
+    uint32_t head = ring->sqHead;
+
+    while (head != __atomic_load_n(&ring->sqTail, __ATOMIC_ACQUIRE)) {
+        GemmdRequest r = ring->sq[head % GEMMD_RING_ENTRIES];
+        __atomic_store_n(&ring->sqHead, ++head, __ATOMIC_RELEASE);
+
+        GemmdCompletion c;
+        double seconds;
+        c.job = r.job;
+        c.status = execute(client, &r, &seconds);
+        c.seconds = (float)seconds;
+
+        // the client keeps at most a ring of jobs in flight, so there is room
+        uint32_t tail = ring->cqTail;
+        ring->cq[tail % GEMMD_RING_ENTRIES] = c;
+        __atomic_store_n(&ring->cqTail, tail + 1, __ATOMIC_RELEASE);
+        gemmdFutexWake(&ring->cqTail);
+    }
+}
+
+// Whether fd holds at least size bytes and is sealed so it stays that way;
+// mapping past the end of a memfd would fault the daemon when touched
+static bool segmentHolds(int fd, size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < 0 || (size_t)st.st_size < size) return false;
+    int seals = fcntl(fd, F_GET_SEALS);
+    return seals >= 0 && (seals & F_SEAL_SHRINK);
+}
+
+// Handles one control message; false when the client is gone
+static bool control(Client* client, const GemmdMessage* msg, int fd)
+{
+    switch (msg->type) {
+        case GEMMD_MSG_RING:
+        case GEMMD_MSG_SEGMENT: {
+            if (fd < 0) return false;
+            size_t size = (msg->type == GEMMD_MSG_RING) ? sizeof(GemmdRing) : msg->size;
+            bool holds = segmentHolds(fd, size);
+            void* base = holds ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+
+            // The client waits for this before using the segment, so a
+            // request can never reach the ring ahead of its operands
+            GemmdMessage ack = { msg->type, msg->segment, base != MAP_FAILED };
+            if (!gemmdSendMessage(client->sock, &ack, -1)) return false;
+            if (!holds) {
+                fprintf(stderr, "gemmd: refused a %zu byte segment that is smaller or not sealed\n", size);
+                return true;
+            }
+            if (base == MAP_FAILED) {
+                fprintf(stderr, "gemmd: cannot map a %zu byte segment\n", size);
+                return true;
+            }
+            if (msg->type == GEMMD_MSG_RING) {
+                if (client->ring) munmap(client->ring, sizeof(GemmdRing));
+                client->ring = (GemmdRing*)base;
+            } else {
+                Mapping& m = (*client->segments)[msg->segment];
+                if (m.base) munmap(m.base, m.size);
+                m.base = (char*)base;
+                m.size = size;
+            }
+            return true;
+        }
+        case GEMMD_MSG_RELEASE: {
+            std::map<uint32_t, Mapping>::iterator it = client->segments->find(msg->segment);
+            if (it != client->segments->end()) {
+                munmap(it->second.base, it->second.size);
+                client->segments->erase(it);
+            }
+            return true;
+        }
+        case GEMMD_MSG_DOORBELL:
+            return true;
+    }
+    if (fd >= 0) close(fd);
+    return false;
+}
+
+static CUT_THREADPROC serveClient(void* arg)
+{
+    Client* client = (Client*)arg;
+
+    bool alive = true;
+    while (alive) {
+        if (client->ring) {
+            drain(client);
+
+            // Announce the sleep, then look once more: a submission after
+            // this point sees sqSleeping and rings the doorbell
+            __atomic_store_n(&client->ring->sqSleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&client->ring->sqTail, __ATOMIC_SEQ_CST) != client->ring->sqHead) {
+                __atomic_store_n(&client->ring->sqSleeping, 0, __ATOMIC_SEQ_CST);
+                continue;
+            }
+        }
+
+        GemmdMessage msg;
+        int fd;
+        int n = gemmdReceiveMessage(client->sock, &msg, &fd, true);
+        if (client->ring)
+            __atomic_store_n(&client->ring->sqSleeping, 0, __ATOMIC_SEQ_CST);
+        alive = (n == (int)sizeof(msg)) && control(client, &msg, fd);
+
+        // take everything else already queued before going back to the ring
+        while (alive && (n = gemmdReceiveMessage(client->sock, &msg, &fd, false)) == (int)sizeof(msg))
+            alive = control(client, &msg, fd);
+        if (n == 0) alive = false;
+    }
+
+    for (std::map<uint32_t, Mapping>::iterator it = client->segments->begin();
+         it != client->segments->end(); ++it)
+        munmap(it->second.base, it->second.size);
+    if (client->ring) munmap(client->ring, sizeof(GemmdRing));
+    close(client->sock);
+    delete client->segments;
+    delete client;
+    CUT_THREADEND;
+}
+
+// Binds the service socket, unless another daemon is already answering on it
+static int listenOn(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int probe = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "gemmd: a daemon is already running on %s\n", path);
+        close(probe);
+        return -1;
+    }
+    close(probe);
+    unlink(path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, 64) != 0) {
+        fprintf(stderr, "gemmd: cannot listen on %s: %s\n", path, strerror(errno));
+        if (sock >= 0) close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    const char* path = getenv("MATMUL_GEMMD");
+    if (!path || !*path) path = GEMMD_SOCKET;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "socket=", 7) == 0) {
+            path = arg + 7;
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            gemmSetNumThreads(atoi(arg + 8));
+        } else if (strncmp(arg, "affinity=", 9) == 0 && gemmParseAffinity(arg + 9) >= 0) {
+            gemmSetAffinity(gemmParseAffinity(arg + 9));
+        } else {
+            fprintf(stderr, "gemmd: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+
+    int sock = listenOn(path);
+    if (sock < 0) return 1;
+
+    // No SA_RESTART, so accept returns on a signal
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("gemmd: serving on %s with %d threads\n", path, gemmGetNumThreads());
+    fflush(stdout);
+
+    while (!stopping) {
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR) perror("gemmd: accept");
+            continue;
+        }
+        Client* client = new Client;
+        client->sock = fd;
+        client->ring = NULL;
+        client->segments = new std::map<uint32_t, Mapping>();
+
+        // Client threads run detached until their client goes away
+        CUTThread thread = cutStartThread((CUT_THREADROUTINE)serveClient, client);
+        pthread_detach(thread);
+    }
+
+    printf("gemmd: stopping\n");
+    close(sock);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,491 @@
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+
+#include "gpuModel.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Access analysis
+////////////////////////////////////////////////////////////////////////////////
+
+static void sortKeys(long* keys, int n)
+{
+    for (int i = 1; i < n; ++i) {
+        long v = keys[i];
+        int j = i;
+        for (; j > 0 && keys[j - 1] > v; --j)
+            keys[j] = keys[j - 1];
+        keys[j] = v;
+    }
+}
+
+// Distinct bytes-sized pieces of memory a warp's byte addresses fall in
+static int transactions(const long* addr, int n, int bytes)
+{
+    long keys[GPU_WARP_SIZE];
+    for (int i = 0; i < n; ++i)
+        keys[i] = addr[i] / bytes;
+    sortKeys(keys, n);
+    int count = 0;
+    for (int i = 0; i < n; ++i)
+        count += (i == 0 || keys[i] != keys[i - 1]);
+    return count;
+}
+
+// Passes a warp's access to these shared words takes: the most distinct
+// words any one bank holds
+static int wavefronts(const long* word, int n)
+{
+    long keys[GPU_WARP_SIZE];
+    memcpy(keys, word, sizeof(long) * n);
+    sortKeys(keys, n);
+    int perBank[GPU_BANKS] = { 0 };
+    int most = 0;
+    for (int i = 0; i < n; ++i) {
+        if (i > 0 && keys[i] == keys[i - 1]) continue;
+        int bank = (int)(keys[i] % GPU_BANKS);
+        if (++perBank[bank] > most) most = perBank[bank];
+    }
+    return most;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulation
+////////////////////////////////////////////////////////////////////////////////
+
+// One block of matrixMul<BLOCK_SIZE>, as in matrixMulSquare.cu. Threads are
+// numbered tx fastest, 32 to a warp; each phase between barriers runs for
+// every warp before the next starts. Shared memory holds As, then Bs.
+template <int BLOCK_SIZE>
+static void runBlock(int bx, int by, float* C, const float* A, const float* B, int wA, int wB,
+                     GpuBlockStats* s)
+{
+    const int threads = BLOCK_SIZE * BLOCK_SIZE;
+    const int warps = (threads + GPU_WARP_SIZE - 1) / GPU_WARP_SIZE;
+    const long bsWords = (long)BLOCK_SIZE * BLOCK_SIZE;
+
+    float As[BLOCK_SIZE][BLOCK_SIZE];
+    float Bs[BLOCK_SIZE][BLOCK_SIZE];
+    float Csub[BLOCK_SIZE][BLOCK_SIZE];
+    long addrA[GPU_WARP_SIZE], addrB[GPU_WARP_SIZE], wordA[GPU_WARP_SIZE], wordB[GPU_WARP_SIZE];
+
+    memset(s, 0, sizeof(*s));
+    memset(Csub, 0, sizeof(Csub));
+
+    // block and thread indices, the loop bounds and each thread's load
+    // offsets wA * ty + tx and wB * ty + tx
+    s->iops += 10 * warps;
+
+    int aBegin = wA * BLOCK_SIZE * by;
+    int aEnd   = aBegin + wA - 1;
+    int aStep  = BLOCK_SIZE;
+    int bBegin = BLOCK_SIZE * bx;
+    int bStep  = BLOCK_SIZE * wB;
+
+    // the unrolled inner loop addresses the same shared words every tile
+    long innerWavefronts = -1;
+
+    for (int a = aBegin, b = bBegin; a <= aEnd; a += aStep, b += bStep) {
+        // As[ty][tx] = A[a + wA * ty + tx]; Bs[ty][tx] = B[b + wB * ty + tx];
+        for (int w = 0; w < warps; ++w) {
+            int n = 0;
+            for (int t = w * GPU_WARP_SIZE; t < threads && n < GPU_WARP_SIZE; ++t, ++n) {
+                int tx = t % BLOCK_SIZE, ty = t / BLOCK_SIZE;
+                long ia = a + (long)wA * ty + tx, ib = b + (long)wB * ty + tx;
+                As[ty][tx] = A[ia];
+                Bs[ty][tx] = B[ib];
+                addrA[n] = ia * (long)sizeof(float);
+                addrB[n] = ib * (long)sizeof(float);
+                wordA[n] = (long)ty * BLOCK_SIZE + tx;
+                wordB[n] = bsWords + wordA[n];
+            }
+            s->iops += 2;
+            s->ldg += 2;
+            s->sts += 2;
+            s->ldgSectors += transactions(addrA, n, GPU_SECTOR) + transactions(addrB, n, GPU_SECTOR);
+            s->ldgLines += transactions(addrA, n, GPU_LINE) + transactions(addrB, n, GPU_LINE);
+            s->wavefronts += wavefronts(wordA, n) + wavefronts(wordB, n);
+        }
+        s->bar += warps;
+
+        // Csub += As[ty][k] * Bs[k][tx], k unrolled
+        for (int k = 0; k < BLOCK_SIZE; ++k)
+            for (int ty = 0; ty < BLOCK_SIZE; ++ty)
+                for (int tx = 0; tx < BLOCK_SIZE; ++tx)
+                    Csub[ty][tx] = fmaf(As[ty][k], Bs[k][tx], Csub[ty][tx]);
+        if (innerWavefronts < 0) {
+            innerWavefronts = 0;
+            for (int k = 0; k < BLOCK_SIZE; ++k) {
+                for (int w = 0; w < warps; ++w) {
+                    int n = 0;
+                    for (int t = w * GPU_WARP_SIZE; t < threads && n < GPU_WARP_SIZE; ++t, ++n) {
+                        int tx = t % BLOCK_SIZE, ty = t / BLOCK_SIZE;
+                        wordA[n] = (long)ty * BLOCK_SIZE + k;
+                        wordB[n] = bsWords + (long)k * BLOCK_SIZE + tx;
+                    }
+                    innerWavefronts += wavefronts(wordA, n) + wavefronts(wordB, n);
+                }
+            }
+        }
+        s->ffma += (long)BLOCK_SIZE * warps;
+        s->lds += 2L * BLOCK_SIZE * warps;
+        s->wavefronts += innerWavefronts;
+        s->bar += warps;
+
+        // a += aStep, b += bStep, a <= aEnd
+        s->iops += 3 * warps;
+        s->branch += warps;
+    }
+
+    // C[c + wB * ty + tx] = Csub
+    int c = wB * BLOCK_SIZE * by + BLOCK_SIZE * bx;
+    for (int w = 0; w < warps; ++w) {
+        int n = 0;
+        for (int t = w * GPU_WARP_SIZE; t < threads && n < GPU_WARP_SIZE; ++t, ++n) {
+            int tx = t % BLOCK_SIZE, ty = t / BLOCK_SIZE;
+            long ic = c + (long)wB * ty + tx;
+            C[ic] = Csub[ty][tx];
+            addrA[n] = ic * (long)sizeof(float);
+        }
+        s->iops += 2;
+        s->stg += 1;
+        s->stgSectors += transactions(addrA, n, GPU_SECTOR);
+    }
+}
+
+int gpuSampledBlocks(int blocks, int sample)
+{
+    return (sample <= 0 || sample >= blocks) ? blocks : sample;
+}
+
+bool gpuEmulateMatrixMul(int blockSize, int M, int N, int K, const float* A, const float* B,
+                         float* C, int sample, GpuKernelProfile* profile, GpuBlockStats* perBlock)
+{
+    if (blockSize != 8 && blockSize != 16 && blockSize != 32) {
+        fprintf(stderr, "gpuModel: block size %d is not 8, 16 or 32\n", blockSize);
+        return false;
+    }
+    if (M <= 0 || N <= 0 || K <= 0 || M % blockSize || N % blockSize || K % blockSize) {
+        fprintf(stderr, "gpuModel: %d x %d x %d is not a multiple of the block size %d\n",
+                M, N, K, blockSize);
+        return false;
+    }
+
+    GpuKernelProfile* p = profile;
+    memset(p, 0, sizeof(*p));
+    p->blockSize = blockSize;
+    p->M = M;
+    p->N = N;
+    p->K = K;
+    p->gridX = N / blockSize;
+    p->gridY = M / blockSize;
+    p->threads = blockSize * blockSize;
+    p->warps = (p->threads + GPU_WARP_SIZE - 1) / GPU_WARP_SIZE;
+    p->sharedBytes = 2 * blockSize * blockSize * (int)sizeof(float);
+    p->iterations = K / blockSize;
+    p->blocks = p->gridX * p->gridY;
+    p->sampled = gpuSampledBlocks(p->blocks, sample);
+
+    GpuBlockStats* stats = perBlock ? perBlock : (GpuBlockStats*)malloc(sizeof(GpuBlockStats) * p->sampled);
+    if (!stats) {
+        fprintf(stderr, "gpuModel: out of memory\n");
+        return false;
+    }
+
+    // blocks are independent, so they can run in any order
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < p->sampled; ++i) {
+        int g = (int)((long)i * p->blocks / p->sampled);
+        int bx = g % p->gridX, by = g / p->gridX;
+        if (blockSize == 8)
+            runBlock<8>(bx, by, C, A, B, K, N, &stats[i]);
+        else if (blockSize == 16)
+            runBlock<16>(bx, by, C, A, B, K, N, &stats[i]);
+        else
+            runBlock<32>(bx, by, C, A, B, K, N, &stats[i]);
+    }
+
+    const size_t fields = sizeof(GpuBlockStats) / sizeof(long);
+    long sum[sizeof(GpuBlockStats) / sizeof(long)] = { 0 };
+    p->uniform = true;
+    for (int i = 0; i < p->sampled; ++i) {
+        const long* f = (const long*)&stats[i];
+        for (size_t j = 0; j < fields; ++j)
+            sum[j] += f[j];
+        p->uniform = p->uniform && memcmp(&stats[i], &stats[0], sizeof(GpuBlockStats)) == 0;
+    }
+    long* mean = (long*)&p->block;
+    for (size_t j = 0; j < fields; ++j)
+        mean[j] = (sum[j] + p->sampled / 2) / p->sampled;
+
+    if (!perBlock) free(stats);
+    return true;
+}
+
+void gpuPrintProfile(const GpuKernelProfile* p, FILE* out)
+{
+    const GpuBlockStats* b = &p->block;
+    fprintf(out, "matrixMul<%d> %d x %d x %d: grid %d x %d, %d threads, %d B shared, %d tiles, "
+            "%d of %d blocks executed%s\n", p->blockSize, p->M, p->N, p->K, p->gridX, p->gridY,
+            p->threads, p->sharedBytes, p->iterations, p->sampled, p->blocks,
+            p->uniform ? ", all alike" : "");
+    long total = b->ffma + b->iops + b->branch + b->bar + b->ldg + b->stg + b->lds + b->sts;
+    fprintf(out, "  per block, warp instructions: %ld, ffma %.1f%%, int %.1f%%, branch %.1f%%, bar %.1f%%, "
+            "ldg %.1f%%, stg %.1f%%, lds %.1f%%, sts %.1f%%\n", total,
+            100.0 * b->ffma / total, 100.0 * b->iops / total, 100.0 * b->branch / total,
+            100.0 * b->bar / total, 100.0 * b->ldg / total, 100.0 * b->stg / total,
+            100.0 * b->lds / total, 100.0 * b->sts / total);
+    fprintf(out, "  ldg: %.2f sectors, %.2f lines each; stg: %.2f sectors each; "
+            "shared: %.2f wavefronts per access\n",
+            b->ldg ? (double)b->ldgSectors / b->ldg : 0, b->ldg ? (double)b->ldgLines / b->ldg : 0,
+            b->stg ? (double)b->stgSectors / b->stg : 0,
+            (b->lds + b->sts) ? (double)b->wavefronts / (b->lds + b->sts) : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Prediction
+////////////////////////////////////////////////////////////////////////////////
+
+bool gpuPredict(const GpuTarget* t, const GpuKernelProfile* p, int regsPerThread, GpuPrediction* out)
+{
+    memset(out, 0, sizeof(*out));
+    if (p->threads > t->maxThreads || p->sharedBytes > t->sharedPerBlock) {
+        fprintf(stderr, "gpuModel: a block of matrixMul<%d> does not fit on %s\n", p->blockSize, t->name);
+        return false;
+    }
+
+    // occupancy
+    int unit = (t->regUnit > 0) ? t->regUnit : 1;
+    int regsPerWarp = (regsPerThread * GPU_WARP_SIZE + unit - 1) / unit * unit;
+    int limits[4] = { t->maxWarps / p->warps, t->maxBlocks,
+                      regsPerWarp > 0 ? t->regs / (regsPerWarp * p->warps) : t->maxBlocks,
+                      t->shared / p->sharedBytes };
+    static const char* names[4] = { "warps", "blocks", "regs", "shared" };
+    out->blocksPerSM = limits[0];
+    out->limit = names[0];
+    for (int i = 1; i < 4; ++i) {
+        if (limits[i] < out->blocksPerSM) {
+            out->blocksPerSM = limits[i];
+            out->limit = names[i];
+        }
+    }
+    if (out->blocksPerSM <= 0) {
+        fprintf(stderr, "gpuModel: matrixMul<%d> with %d registers per thread does not fit on %s (%s)\n",
+                p->blockSize, regsPerThread, t->name, out->limit);
+        return false;
+    }
+    out->occupancy = (double)out->blocksPerSM * p->warps / t->maxWarps;
+
+    // the busiest SM, in cycles
+    const GpuBlockStats* b = &p->block;
+    long perSM = (p->blocks + t->sms - 1) / t->sms;
+    out->waves = (int)((perSM + out->blocksPerSM - 1) / out->blocksPerSM);
+    double instructions = (double)(b->ffma + b->iops + b->branch + b->bar + b->ldg + b->stg + b->lds + b->sts);
+    double issue = instructions / t->issue;
+    double fp32 = (double)b->ffma * GPU_WARP_SIZE / t->fp32Lanes;
+    double shared = (double)b->wavefronts;
+    double l2Bytes = (t->loadBytes == GPU_LINE ? (double)b->ldgLines * GPU_LINE
+                                               : (double)b->ldgSectors * GPU_SECTOR)
+                   + (double)b->stgSectors * GPU_SECTOR;
+    double l2 = l2Bytes / (t->l2GBs / (t->clockGHz * t->sms));
+
+    // one block on its own, then waiting out each tile's loads
+    double alone = fmax(fmax(issue, fp32), fmax(shared, l2));
+    double latency = out->waves * ((double)p->iterations * t->latency + alone);
+
+    // DRAM
+    double footprint = (double)sizeof(float) * ((double)p->M * p->K + (double)p->K * p->N + (double)p->M * p->N);
+    double dram = footprint;
+    if (footprint > t->l2Bytes) {
+        long concurrent = (long)out->blocksPerSM * t->sms;
+        if (concurrent > p->blocks) concurrent = p->blocks;
+        long rounds = (p->blocks + concurrent - 1) / concurrent;
+        long rows = (concurrent + p->gridX - 1) / p->gridX;
+        long cols = (concurrent < p->gridX) ? concurrent : p->gridX;
+        if (rows > p->gridY) rows = p->gridY;
+        double panels = (double)sizeof(float) * p->K * p->blockSize * (rows + cols);
+        dram = fmax(footprint, rounds * panels + (double)sizeof(float) * p->M * p->N);
+    }
+
+    double usPerCycle = 1.0e-3 / t->clockGHz;
+    out->issueUs = perSM * issue * usPerCycle;
+    out->fp32Us = perSM * fp32 * usPerCycle;
+    out->sharedUs = perSM * shared * usPerCycle;
+    out->l2Us = perSM * l2 * usPerCycle;
+    out->latencyUs = latency * usPerCycle;
+    out->dramUs = dram / (t->dramGBs * 1.0e3);
+
+    double parts[6] = { out->issueUs, out->fp32Us, out->sharedUs, out->l2Us, out->latencyUs, out->dramUs };
+    static const char* bounds[6] = { "issue", "fp32", "shared", "l2", "latency", "dram" };
+    int worst = 0;
+    for (int i = 1; i < 6; ++i)
+        if (parts[i] > parts[worst]) worst = i;
+    out->bound = bounds[worst];
+    out->totalUs = parts[worst] + t->launchUs;
+    out->gflops = 2.0 * p->M * p->N * p->K / (out->totalUs * 1.0e3);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Targets
+////////////////////////////////////////////////////////////////////////////////
+
+static const struct {
+    const char* name;
+    const char* text;
+} builtins[] = {
+    { "fermi",  "name=fermi sms=14 clockGHz=1.15 fp32Lanes=32 issue=1 maxWarps=48 maxBlocks=8 "
+                "maxThreads=1024 regs=32768 regUnit=64 shared=49152 sharedPerBlock=49152 "
+                "loadBytes=128 l2GBs=230 dramGBs=144 l2Bytes=786432 latency=600 launchUs=5" },
+    { "kepler", "name=kepler sms=13 clockGHz=0.706 fp32Lanes=192 issue=4 maxWarps=64 maxBlocks=16 "
+                "maxThreads=1024 regs=65536 regUnit=256 shared=49152 sharedPerBlock=49152 "
+                "loadBytes=32 l2GBs=500 dramGBs=208 l2Bytes=1310720 latency=400 launchUs=5" },
+    { "volta",  "name=volta sms=80 clockGHz=1.53 fp32Lanes=64 issue=4 maxWarps=64 maxBlocks=32 "
+                "maxThreads=1024 regs=65536 regUnit=256 shared=98304 sharedPerBlock=98304 "
+                "loadBytes=32 l2GBs=2500 dramGBs=900 l2Bytes=6291456 latency=400 launchUs=4" },
+    { "ampere", "name=ampere sms=108 clockGHz=1.41 fp32Lanes=64 issue=4 maxWarps=64 maxBlocks=32 "
+                "maxThreads=1024 regs=65536 regUnit=256 shared=167936 sharedPerBlock=166912 "
+                "loadBytes=32 l2GBs=4000 dramGBs=1555 l2Bytes=41943040 latency=450 launchUs=4" },
+};
+
+#define FIELD(f, kind) { #f, kind, offsetof(GpuTarget, f) }
+
+static const struct {
+    const char* key;
+    char        kind;       // i int, l long, d double
+    size_t      offset;
+} fields[] = {
+    FIELD(sms, 'i'), FIELD(clockGHz, 'd'), FIELD(fp32Lanes, 'i'), FIELD(issue, 'i'),
+    FIELD(maxWarps, 'i'), FIELD(maxBlocks, 'i'), FIELD(maxThreads, 'i'), FIELD(regs, 'i'),
+    FIELD(regUnit, 'i'), FIELD(shared, 'i'), FIELD(sharedPerBlock, 'i'), FIELD(loadBytes, 'i'),
+    FIELD(l2GBs, 'd'), FIELD(dramGBs, 'd'), FIELD(l2Bytes, 'l'), FIELD(latency, 'i'),
+    FIELD(launchUs, 'd'),
+};
+
+#define FIELD_COUNT (sizeof(fields) / sizeof(fields[0]))
+
+const char* gpuTargetNames()
+{
+    return "fermi, kepler, volta, ampere";
+}
+
+bool gpuFindTarget(const char* name, GpuTarget* target)
+{
+    for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); ++i)
+        if (strcmp(builtins[i].name, name) == 0)
+            return gpuParseTarget(builtins[i].text, target);
+    fprintf(stderr, "gpuModel: unknown target '%s' (built in: %s)\n", name, gpuTargetNames());
+    return false;
+}
+
+bool gpuParseTarget(const char* text, GpuTarget* target)
+{
+    GpuTarget t;
+    memset(&t, 0, sizeof(t));
+    bool given[FIELD_COUNT] = { false };
+    bool based = false, named = false;
+
+    // base= first, wherever it is, so the other pairs override it
+    const char* base = strstr(text, "base=");
+    if (base && (base == text || base[-1] == ' ' || base[-1] == '\t')) {
+        char name[32];
+        size_t n = strcspn(base + 5, " \t\r\n");
+        if (n >= sizeof(name)) n = sizeof(name) - 1;
+        memcpy(name, base + 5, n);
+        name[n] = 0;
+        if (!gpuFindTarget(name, &t)) return false;
+        based = true;
+    }
+
+    for (const char* s = text; *s; ) {
+        s += strspn(s, " \t\r\n");
+        if (!*s) break;
+        size_t len = strcspn(s, " \t\r\n");
+        const char* eq = (const char*)memchr(s, '=', len);
+        if (!eq) {
+            fprintf(stderr, "gpuModel: expected key=value, got '%.*s'\n", (int)len, s);
+            return false;
+        }
+        size_t keyLen = eq - s;
+        char value[64];
+        size_t valueLen = len - keyLen - 1;
+        if (valueLen >= sizeof(value)) valueLen = sizeof(value) - 1;
+        memcpy(value, eq + 1, valueLen);
+        value[valueLen] = 0;
+
+        if (keyLen == 4 && strncmp(s, "base", 4) == 0) {
+            // already applied
+        } else if (keyLen == 4 && strncmp(s, "name", 4) == 0) {
+            snprintf(t.name, sizeof(t.name), "%.31s", value);
+            named = true;
+        } else {
+            size_t f = 0;
+            while (f < FIELD_COUNT && !(strlen(fields[f].key) == keyLen && strncmp(s, fields[f].key, keyLen) == 0))
+                ++f;
+            if (f == FIELD_COUNT) {
+                fprintf(stderr, "gpuModel: unknown target key '%.*s'\n", (int)keyLen, s);
+                return false;
+            }
+            char* end;
+            double v = strtod(value, &end);
+            if (end == value || *end || v <= 0) {
+                fprintf(stderr, "gpuModel: invalid value for %s: '%s'\n", fields[f].key, value);
+                return false;
+            }
+            char* field = (char*)&t + fields[f].offset;
+            if (fields[f].kind == 'i') *(int*)field = (int)v;
+            else if (fields[f].kind == 'l') *(long*)field = (long)v;
+            else *(double*)field = v;
+            given[f] = true;
+        }
+        s += len;
+    }
+
+    if (!based) {
+        for (size_t f = 0; f < FIELD_COUNT; ++f) {
+            if (!given[f]) {
+                fprintf(stderr, "gpuModel: target %s has no %s (or base=)\n", named ? t.name : "", fields[f].key);
+                return false;
+            }
+        }
+    }
+    if (!named && !based) {
+        fprintf(stderr, "gpuModel: target has no name\n");
+        return false;
+    }
+    if (t.loadBytes != GPU_SECTOR && t.loadBytes != GPU_LINE) {
+        fprintf(stderr, "gpuModel: loadBytes of %s must be %d or %d\n", t.name, GPU_SECTOR, GPU_LINE);
+        return false;
+    }
+    *target = t;
+    return true;
+}
+
+bool gpuLoadTargets(const char* path, GpuTarget* targets, int capacity, int* count)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "gpuModel: cannot open target file %s\n", path);
+        return false;
+    }
+
+    char line[1024];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+        if (*count >= capacity) {
+            fprintf(stderr, "gpuModel: more than %d targets\n", capacity);
+            ok = false;
+            break;
+        }
+        ok = gpuParseTarget(line, &targets[*count]);
+        if (ok) ++*count;
+    }
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,137 @@
+#ifndef _GPUMODEL_H_
+#define _GPUMODEL_H_
+
+// Performance model of the matrixMul<BLOCK_SIZE> kernel, fed by running the
+// kernel on the CPU.
+//
+// gpuEmulateMatrixMul() executes the kernel of matrixMulSquare.cu block by
+// block, thread by thread, with each __syncthreads() phase run for all the
+// warps of the block in turn. C comes out as the GPU would write it. As the
+// warps execute, it counts per block:
+//
+//     the instructions each warp issues, by class; index arithmetic the
+//         compiler hoists out of the loop is counted once, and the unrolled
+//         inner loop has no loop overhead
+//     global memory: the 32-byte sectors and 128-byte lines each warp-wide
+//         load or store touches, so uncoalesced access shows up directly
+//     shared memory: the wavefronts each warp-wide access takes on 32 banks
+//         of 4 bytes, so bank conflicts show up as replays; threads reading
+//         the same word are served together
+//
+// Every target since Fermi has 32-thread warps, 32 banks and 32-byte
+// sectors, so the counts do not depend on the target. With sample > 0 only
+// that many blocks, spread evenly over the grid, are executed; the rest of
+// C is left alone and the kernel totals are scaled up from the sample.
+//
+// gpuPredict() turns the counts into a run time on a described GPU: the
+// occupancy its limits allow, then the busiest SM's time in cycles as the
+// largest of its instruction issue, FP32, shared-memory and L2 demands,
+// against the time the blocks need when each waits out its global loads
+// with only the resident blocks to cover the latency, and the time DRAM
+// needs for the kernel's traffic. DRAM traffic is the footprint of A, B and
+// C when that fits in L2; otherwise each wave of blocks, launched in raster
+// order, reads the row and column panels it covers. The absolute numbers
+// are rough; what the model is for is ranking block sizes on one target.
+
+#include <stdio.h>
+
+#define GPU_WARP_SIZE   32
+#define GPU_BANKS       32      // 4-byte shared-memory banks
+#define GPU_SECTOR      32      // bytes per global transaction
+#define GPU_LINE        128     // bytes per L1 line
+
+// Per block, in warp instructions or transactions
+typedef struct {
+    long ffma;          // fused multiply-adds
+    long iops;          // integer and address arithmetic
+    long branch;
+    long bar;           // __syncthreads
+    long ldg, stg;      // global loads and stores
+    long lds, sts;      // shared loads and stores
+    long ldgSectors;    // global sectors read by ldg
+    long ldgLines;      // global lines touched by ldg
+    long stgSectors;    // global sectors written by stg
+    long wavefronts;    // shared-memory passes of lds and sts
+} GpuBlockStats;
+
+typedef struct {
+    int           blockSize;
+    int           M, N, K;          // C is M x N, A M x K, B K x N
+    int           gridX, gridY;
+    int           threads;          // per block
+    int           warps;
+    int           sharedBytes;      // per block
+    int           iterations;       // tiles of K each block steps through
+    int           blocks;           // in the grid
+    int           sampled;          // blocks executed
+    bool          uniform;          // all sampled blocks counted the same
+    GpuBlockStats block;            // mean over the sampled blocks
+} GpuKernelProfile;
+
+// A target GPU; gpuParseTarget() reads one from key=value text
+typedef struct {
+    char   name[32];
+    int    sms;             // streaming multiprocessors
+    double clockGHz;
+    int    fp32Lanes;       // FP32 FMA lanes per SM
+    int    issue;           // warp instructions issued per cycle per SM
+    int    maxWarps;        // resident warps per SM
+    int    maxBlocks;       // resident blocks per SM
+    int    maxThreads;      // threads per block
+    int    regs;            // 32-bit registers per SM
+    int    regUnit;         // registers are allocated per warp in these units
+    int    shared;          // shared memory per SM, bytes
+    int    sharedPerBlock;
+    int    loadBytes;       // L2 bytes per ldg transaction: 32 (sectors) or 128 (lines)
+    double l2GBs;
+    double dramGBs;
+    long   l2Bytes;
+    int    latency;         // global load latency, cycles
+    double launchUs;
+} GpuTarget;
+
+typedef struct {
+    int         blocksPerSM;
+    double      occupancy;      // resident warps over maxWarps
+    const char* limit;          // what bounds blocksPerSM: warps, blocks, regs or shared
+    int         waves;          // rounds of resident blocks on the busiest SM
+    double      issueUs;
+    double      fp32Us;
+    double      sharedUs;
+    double      l2Us;
+    double      latencyUs;
+    double      dramUs;
+    double      totalUs;        // the largest of the above, plus the launch
+    const char* bound;          // which one it was
+    double      gflops;
+} GpuPrediction;
+
+// Runs matrixMul<blockSize> for C = A * B (row-major; blockSize is 8, 16 or
+// 32 and divides M, N and K). sample <= 0 executes every block. perBlock,
+// if not NULL, receives the counts of each block executed, in grid order.
+bool gpuEmulateMatrixMul(int blockSize, int M, int N, int K, const float* A, const float* B,
+                         float* C, int sample, GpuKernelProfile* profile, GpuBlockStats* perBlock);
+
+// Blocks gpuEmulateMatrixMul executes for a grid of blocks and a sample
+int gpuSampledBlocks(int blocks, int sample);
+
+// regsPerThread is the register count the compiler reports for the kernel
+bool gpuPredict(const GpuTarget* target, const GpuKernelProfile* profile, int regsPerThread,
+                GpuPrediction* out);
+
+// Built-in targets: fermi (Tesla C2050), kepler (K20), volta (V100) and
+// ampere (A100), from published figures
+bool gpuFindTarget(const char* name, GpuTarget* target);
+const char* gpuTargetNames();
+
+// Whitespace-separated key=value pairs, named as the GpuTarget fields
+// (name=, sms=, clockGHz=, ...). base=<built-in> starts from a built-in
+// target and the other pairs override it; without it every field is needed.
+bool gpuParseTarget(const char* text, GpuTarget* target);
+
+// One target per line of a file; '#' starts a comment
+bool gpuLoadTargets(const char* path, GpuTarget* targets, int capacity, int* count);
+
+void gpuPrintProfile(const GpuKernelProfile* profile, FILE* out);
+
+#endif // _GPUMODEL_H_
@@ -0,0 +1,459 @@
+// Matrix functions built from chains of engine products.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "matrixFunctions.h"
+#include "gemm.h"
+#include "arena.h"
+
+#define MATFN_MAX_ITER 100
+
+struct MatrixWorkspace {
+    Arena arena;
+};
+
+MatrixWorkspace* matrixWorkspaceCreate()
+{
+    MatrixWorkspace* work = (MatrixWorkspace*)calloc(1, sizeof(MatrixWorkspace));
+    if (work) arenaInit(&work->arena, 0);
+    return work;
+}
+
+void matrixWorkspaceDestroy(MatrixWorkspace* work)
+{
+    if (!work) return;
+    arenaDestroy(&work->arena);
+    free(work);
+}
+
+size_t matrixWorkspaceBytes(const MatrixWorkspace* work)
+{
+    return work ? work->arena.size : 0;
+}
+
+// Rewinds the workspace and makes room for count matrices of elems elements.
+// The arena only grows, so calls on same-sized matrices map memory once.
+template <typename T>
+static bool workBegin(MatrixWorkspace* work, int count, size_t elems)
+{
+    arenaReset(&work->arena);
+    size_t bytes = (size_t)count * (elems * sizeof(T) + ARENA_ALIGN);
+    if (arenaReserve(&work->arena, bytes)) return true;
+    fprintf(stderr, "matrixFunctions: cannot map a %zu-byte workspace\n", bytes);
+    return false;
+}
+
+template <typename T>
+static T* workMatrix(MatrixWorkspace* work, size_t elems)
+{
+    return (T*)arenaAlloc(&work->arena, elems * sizeof(T), 0);
+}
+
+static void product(int transA, int M, int N, int K, float alpha, const float* A, int lda,
+                    const float* B, int ldb, float beta, float* C, int ldc)
+{
+    gemmSgemm(transA, GEMM_NO_TRANS, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+static void product(int transA, int M, int N, int K, double alpha, const double* A, int lda,
+                    const double* B, int ldb, double beta, double* C, int ldc)
+{
+    gemmDgemm(transA, GEMM_NO_TRANS, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+template <typename T>
+static double norm1(int n, const T* A, int lda)
+{
+    double* sums = (double*)calloc(n, sizeof(double));
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            sums[j] += fabs((double)A[(size_t)i * lda + j]);
+    double norm = 0;
+    for (int j = 0; j < n; ++j)
+        if (sums[j] > norm) norm = sums[j];
+    free(sums);
+    return norm;
+}
+
+template <typename T>
+static double normF(int m, int n, const T* A, int lda)
+{
+    double sum = 0;
+    for (int i = 0; i < m; ++i)
+        for (int j = 0; j < n; ++j) {
+            double a = A[(size_t)i * lda + j];
+            sum += a * a;
+        }
+    return sqrt(sum);
+}
+
+// D = diag * I + sum of coeffs[t] * X[t], one pass over D however many terms
+template <typename T>
+static void combine(int n, T* D, int ldd, T diag, int terms, const T* coeffs,
+                    const T* const* X, const int* ldx)
+{
+    for (int i = 0; i < n; ++i) {
+        T* d = D + (size_t)i * ldd;
+        for (int j = 0; j < n; ++j) d[j] = 0;
+        for (int t = 0; t < terms; ++t) {
+            const T* x = X[t] + (size_t)i * ldx[t];
+            T c = coeffs[t];
+            for (int j = 0; j < n; ++j) d[j] += c * x[j];
+        }
+        d[i] += diag;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Exponential
+////////////////////////////////////////////////////////////////////////////////
+
+// Taylor degree and Paterson-Stockmeyer block size once ||X||_1 <= 1/2: the
+// remainder is below 0.5^(m+1) / (m+1)!, under an ulp for m = 8 in float and
+// m = 15 in double. Both degrees fill their last block, so the evaluation
+// takes q - 1 products for the powers and m / q for Horner's rule, 4 and 6.
+template <typename T> struct ExpTraits;
+template <> struct ExpTraits<float>  { enum { DEGREE = 8,  BLOCK = 3 }; };
+template <> struct ExpTraits<double> { enum { DEGREE = 15, BLOCK = 4 }; };
+
+template <typename T>
+static bool expm(MatrixWorkspace* work, int n, const T* A, int lda, T* E, int lde,
+                 MatrixFnStats* stats)
+{
+    const int m = ExpTraits<T>::DEGREE, q = ExpTraits<T>::BLOCK;
+    MatrixFnStats local;
+    memset(&local, 0, sizeof(local));
+    local.degree = m;
+    local.converged = true;
+    if (n <= 0) { if (stats) *stats = local; return true; }
+
+    // X = A / 2^s with ||X||_1 <= 1/2. X itself is never formed: the scale
+    // goes into the alpha of each power and the coefficients of A.
+    int s = 0;
+    double norm = norm1(n, A, lda);
+    if (norm > 0.5) {
+        frexp(norm / 0.5, &s);
+        if (ldexp(0.5, s - 1) >= norm) --s;
+    }
+    T scale = (T)ldexp(1.0, -s);
+
+    // Powers X^2 .. X^q, then one buffer for the Horner and squaring chain,
+    // which alternates with E so the last product of the chain lands in E
+    size_t elems = (size_t)n * n;
+    if (!workBegin<T>(work, q, elems)) return false;
+    const T* power[ExpTraits<T>::BLOCK + 1];
+    int ldp[ExpTraits<T>::BLOCK + 1];
+    power[1] = A;
+    ldp[1] = lda;
+    for (int k = 2; k <= q; ++k) {
+        T* P = workMatrix<T>(work, elems);
+        T alpha = (k == 2) ? scale * scale : scale;
+        product(GEMM_NO_TRANS, n, n, n, alpha, power[k - 1], ldp[k - 1], A, lda, (T)0, P, n);
+        ++local.products;
+        power[k] = P;
+        ldp[k] = n;
+    }
+    T* W = workMatrix<T>(work, elems);
+
+    // Coefficients 1/k!, with the scale of A folded into those of X^1 terms
+    T coeff[ExpTraits<T>::DEGREE + 1];
+    double f = 1;
+    for (int k = 0; k <= m; ++k) {
+        if (k > 0) f *= k;
+        coeff[k] = (T)(1.0 / f);
+    }
+
+    int blocks = m / q + 1;
+    int writes = (blocks - 1) + s;
+    T* buf[2] = { E, W };
+    int ldb[2] = { lde, n };
+    // Write w of the chain (0 for the top block) goes to E when it has the
+    // same parity as the last one
+    int cur = (writes % 2 == 0) ? 0 : 1;
+
+    // Block j is sum of c_(jq+i) X^i over i < q, X^0 being I
+    T terms[ExpTraits<T>::BLOCK];
+    const T* mats[ExpTraits<T>::BLOCK];
+    int lds[ExpTraits<T>::BLOCK];
+    for (int j = blocks - 1; j >= 0; --j) {
+        int count = 0;
+        for (int i = 1; i < q && j * q + i <= m; ++i, ++count) {
+            terms[count] = coeff[j * q + i] * (i == 1 ? scale : (T)1);
+            mats[count] = power[i];
+            lds[count] = ldp[i];
+        }
+        int next = (j == blocks - 1) ? cur : 1 - cur;
+        combine(n, buf[next], ldb[next], coeff[j * q], count, terms, mats, lds);
+        if (j < blocks - 1) {
+            // The block just written is the epilogue: P * X^q is added onto it
+            product(GEMM_NO_TRANS, n, n, n, (T)1, buf[cur], ldb[cur], power[q], ldp[q], (T)1,
+                    buf[next], ldb[next]);
+            ++local.products;
+        }
+        cur = next;
+    }
+
+    for (int k = 0; k < s; ++k) {
+        int next = 1 - cur;
+        product(GEMM_NO_TRANS, n, n, n, (T)1, buf[cur], ldb[cur], buf[cur], ldb[cur], (T)0,
+                buf[next], ldb[next]);
+        ++local.products;
+        cur = next;
+    }
+    local.iterations = s;
+    if (stats) *stats = local;
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Newton-Schulz iterations
+////////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static double defaultTol(int n, double tol)
+{
+    if (tol > 0) return tol;
+    double eps = (sizeof(T) == sizeof(float)) ? FLT_EPSILON : DBL_EPSILON;
+    return 256.0 * eps * sqrt((double)n);
+}
+
+// After T = 3/2 I - 1/2 P for a product P that should approach I, returns
+// ||P - I||_F = 2 ||T - I||_F
+template <typename T>
+static double residual(int n, const T* M, int ldm)
+{
+    double sum = 0;
+    for (int i = 0; i < n; ++i) {
+        const T* t = M + (size_t)i * ldm;
+        for (int j = 0; j < n; ++j) {
+            double d = (double)t[j] - (i == j ? 1.0 : 0.0);
+            sum += d * d;
+        }
+    }
+    return 2.0 * sqrt(sum);
+}
+
+static void addDiagonal(int n, float* M, int ldm, float v)    { for (int i = 0; i < n; ++i) M[(size_t)i * ldm + i] += v; }
+static void addDiagonal(int n, double* M, int ldm, double v)  { for (int i = 0; i < n; ++i) M[(size_t)i * ldm + i] += v; }
+
+// Decides whether the step about to be taken is the last: the residual has
+// reached tol, stopped improving, or run out of iterations. Sets converged.
+static bool lastStep(double res, double* previous, double tol, int it, int maxIter,
+                     MatrixFnStats* stats)
+{
+    stats->residual = res;
+    stats->converged = res <= tol;
+    bool last = stats->converged || it + 1 >= maxIter || res >= *previous;
+    *previous = res;
+    return last;
+}
+
+// Coupled iteration Y <- Y T, Z <- T Z with T = (3I - Z Y) / 2, starting from
+// Y = A / c and Z = I, so that Y -> (A / c)^(1/2) and Z -> (A / c)^(-1/2).
+// c = ||A||_F puts the eigenvalues in (0, 1], where the iteration converges.
+template <typename T>
+static bool invSqrt(MatrixWorkspace* work, int n, const T* A, int lda, T* Y, int ldy, T* S,
+                    int lds, double tol, int maxIter, MatrixFnStats* stats)
+{
+    MatrixFnStats local;
+    memset(&local, 0, sizeof(local));
+    if (n <= 0) { local.converged = true; if (stats) *stats = local; return true; }
+    tol = defaultTol<T>(n, tol);
+    if (maxIter <= 0) maxIter = MATFN_MAX_ITER;
+
+    double c = normF(n, n, A, lda);
+    if (c == 0) {
+        fprintf(stderr, "matrixFunctions: inverse square root of a zero matrix\n");
+        return false;
+    }
+
+    size_t elems = (size_t)n * n;
+    if (!workBegin<T>(work, 5, elems)) return false;
+    T* Yb[2] = { workMatrix<T>(work, elems), workMatrix<T>(work, elems) };
+    T* Zb[2] = { workMatrix<T>(work, elems), workMatrix<T>(work, elems) };
+    T* M = workMatrix<T>(work, elems);
+    T rootC = (T)sqrt(c);
+
+    // With Z = I the first T is 3/2 I - A / 2c and needs no product, and the
+    // 1 / c of Y goes into the alpha of Y T
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            M[(size_t)i * n + j] = (T)(-0.5 / c) * A[(size_t)i * lda + j];
+    addDiagonal(n, M, n, (T)1.5);
+    const T* y = A;
+    int ldyCur = lda;
+    T yScale = (T)(1.0 / c);
+    const T* z = NULL;              // I
+    double previous = 1e300;
+    int cur = 0;
+
+    for (int it = 0; ; ++it) {
+        if (it > 0) {
+            product(GEMM_NO_TRANS, n, n, n, (T)-0.5, z, n, y, n, (T)0, M, n);
+            ++local.products;
+            addDiagonal(n, M, n, (T)1.5);
+        }
+        double res = residual(n, M, n);
+        if (res != res || (it > 2 && res > 1.0 && res > previous)) {
+            fprintf(stderr, "matrixFunctions: inverse square root diverged; is A positive definite?\n");
+            local.residual = res;
+            local.iterations = it;
+            if (stats) *stats = local;
+            return false;
+        }
+        bool last = lastStep(res, &previous, tol, it, maxIter, &local);
+
+        // The final step writes the outputs with sqrt(c) folded into alpha
+        T* yOut = last ? S : Yb[1 - cur];
+        int ldyOut = last ? lds : n;
+        T* zOut = last ? Y : Zb[1 - cur];
+        int ldzOut = last ? ldy : n;
+        T post = last ? rootC : (T)1;
+        if (yOut) {
+            product(GEMM_NO_TRANS, n, n, n, yScale * post, y, ldyCur, M, n, (T)0, yOut, ldyOut);
+            ++local.products;
+        }
+        if (z) {
+            product(GEMM_NO_TRANS, n, n, n, (T)1 / post, M, n, z, n, (T)0, zOut, ldzOut);
+            ++local.products;
+        } else {
+            for (int i = 0; i < n; ++i)
+                for (int j = 0; j < n; ++j)
+                    zOut[(size_t)i * ldzOut + j] = M[(size_t)i * n + j] / post;
+        }
+        local.iterations = it + 1;
+        if (last) break;
+
+        cur = 1 - cur;
+        y = Yb[cur];
+        ldyCur = n;
+        yScale = 1;
+        z = Zb[cur];
+    }
+    if (stats) *stats = local;
+    if (!local.converged)
+        fprintf(stderr, "matrixFunctions: inverse square root stopped at residual %.3g after %d steps\n",
+                local.residual, local.iterations);
+    return local.converged;
+}
+
+// X <- X T with T = (3I - op(X) X) / 2, starting from X = A / ||A||_F. With
+// op the transpose, X is m x n and converges to the polar factor; with op
+// the identity, X is square and converges to the sign.
+template <typename T>
+static bool newtonSchulz(MatrixWorkspace* work, int trans, int m, int n, const T* A, int lda,
+                         T* U, int ldu, double tol, int maxIter, MatrixFnStats* stats,
+                         const char* what)
+{
+    MatrixFnStats local;
+    memset(&local, 0, sizeof(local));
+    if (m <= 0 || n <= 0) { local.converged = true; if (stats) *stats = local; return true; }
+    tol = defaultTol<T>(n, tol);
+    if (maxIter <= 0) maxIter = MATFN_MAX_ITER;
+
+    double c = normF(m, n, A, lda);
+    if (c == 0) {
+        fprintf(stderr, "matrixFunctions: %s of a zero matrix\n", what);
+        return false;
+    }
+
+    size_t elems = (size_t)m * n;
+    if (!workBegin<T>(work, 3, elems > (size_t)n * n ? elems : (size_t)n * n)) return false;
+    T* Xb[2] = { workMatrix<T>(work, elems), workMatrix<T>(work, elems) };
+    T* M = workMatrix<T>(work, (size_t)n * n);
+
+    // The first step reads A itself, with 1 / c folded into both alphas
+    const T* x = A;
+    int ldx = lda;
+    T xScale = (T)(1.0 / c);
+    double previous = 1e300;
+    int cur = 0;
+
+    for (int it = 0; ; ++it) {
+        product(trans, n, n, m, (T)-0.5 * xScale * xScale, x, ldx, x, ldx, (T)0, M, n);
+        ++local.products;
+        addDiagonal(n, M, n, (T)1.5);
+        double res = residual(n, M, n);
+        if (res != res || (it > 2 && res > 1.0 && res > previous)) {
+            fprintf(stderr, "matrixFunctions: %s iteration diverged\n", what);
+            local.residual = res;
+            local.iterations = it;
+            if (stats) *stats = local;
+            return false;
+        }
+        bool last = lastStep(res, &previous, tol, it, maxIter, &local);
+
+        T* out = last ? U : Xb[1 - cur];
+        int ldo = last ? ldu : n;
+        product(GEMM_NO_TRANS, m, n, n, xScale, x, ldx, M, n, (T)0, out, ldo);
+        ++local.products;
+        local.iterations = it + 1;
+        if (last) break;
+
+        cur = 1 - cur;
+        x = Xb[cur];
+        ldx = n;
+        xScale = 1;
+    }
+    if (stats) *stats = local;
+    if (!local.converged)
+        fprintf(stderr, "matrixFunctions: %s stopped at residual %.3g after %d steps\n",
+                what, local.residual, local.iterations);
+    return local.converged;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Public entry points
+////////////////////////////////////////////////////////////////////////////////
+
+bool matrixExpS(MatrixWorkspace* work, int n, const float* A, int lda, float* E, int lde,
+                MatrixFnStats* stats)
+{
+    return expm<float>(work, n, A, lda, E, lde, stats);
+}
+
+bool matrixExpD(MatrixWorkspace* work, int n, const double* A, int lda, double* E, int lde,
+                MatrixFnStats* stats)
+{
+    return expm<double>(work, n, A, lda, E, lde, stats);
+}
+
+bool matrixInvSqrtS(MatrixWorkspace* work, int n, const float* A, int lda, float* Y, int ldy,
+                    float* S, int lds, double tol, int maxIter, MatrixFnStats* stats)
+{
+    return invSqrt<float>(work, n, A, lda, Y, ldy, S, lds, tol, maxIter, stats);
+}
+
+bool matrixInvSqrtD(MatrixWorkspace* work, int n, const double* A, int lda, double* Y, int ldy,
+                    double* S, int lds, double tol, int maxIter, MatrixFnStats* stats)
+{
+    return invSqrt<double>(work, n, A, lda, Y, ldy, S, lds, tol, maxIter, stats);
+}
+
+bool matrixPolarS(MatrixWorkspace* work, int m, int n, const float* A, int lda, float* U, int ldu,
+                  double tol, int maxIter, MatrixFnStats* stats)
+{
+    return newtonSchulz<float>(work, GEMM_TRANS, m, n, A, lda, U, ldu, tol, maxIter, stats, "polar factor");
+}
+
+bool matrixPolarD(MatrixWorkspace* work, int m, int n, const double* A, int lda, double* U, int ldu,
+                  double tol, int maxIter, MatrixFnStats* stats)
+{
+    return newtonSchulz<double>(work, GEMM_TRANS, m, n, A, lda, U, ldu, tol, maxIter, stats, "polar factor");
+}
+
+bool matrixSignS(MatrixWorkspace* work, int n, const float* A, int lda, float* S, int lds,
+                 double tol, int maxIter, MatrixFnStats* stats)
+{
+    return newtonSchulz<float>(work, GEMM_NO_TRANS, n, n, A, lda, S, lds, tol, maxIter, stats, "sign");
+}
+
+bool matrixSignD(MatrixWorkspace* work, int n, const double* A, int lda, double* S, int lds,
+                 double tol, int maxIter, MatrixFnStats* stats)
+{
+    return newtonSchulz<double>(work, GEMM_NO_TRANS, n, n, A, lda, S, lds, tol, maxIter, stats, "sign");
+}
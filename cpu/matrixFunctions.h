@@ -0,0 +1,72 @@
+#ifndef _MATRIXFUNCTIONS_H_
+#define _MATRIXFUNCTIONS_H_
+
+// Matrix functions built from chains of engine products.
+//
+//   exp(A)        scaling and squaring: A is scaled by 2^-s until its 1-norm
+//                 is at most 1/2, a Taylor polynomial of the scaled matrix is
+//                 evaluated by Paterson-Stockmeyer (about 2 sqrt(m) products
+//                 for degree m rather than m), and the result squared s times
+//   A^(-1/2)      coupled Newton-Schulz iteration for symmetric positive
+//                 definite A, which also yields A^(1/2)
+//   polar(A)      Newton-Schulz iteration for the orthogonal factor U of
+//                 A = U H, A m x n with m >= n and full column rank
+//   sign(A)       Newton-Schulz iteration for A with no imaginary-axis
+//                 eigenvalues
+//
+// Every temporary comes from a MatrixWorkspace, which keeps its memory from
+// one call to the next, so a loop of calls on same-sized matrices allocates
+// once. Scalings, shifts by multiples of I and the additions between
+// products are folded into the alpha and beta of the products wherever the
+// algebra allows, so few extra passes over memory remain. The iterations stop
+// once the residual (||Z Y - I||, ||X^T X - I|| or ||X^2 - I||, Frobenius
+// norm) falls to tol or stops decreasing.
+//
+// Matrices are row-major with leading dimensions, as for the engine. The
+// results must not overlap the inputs.
+
+#include <stddef.h>
+
+typedef struct MatrixWorkspace MatrixWorkspace;
+
+typedef struct {
+    int    products;                // engine products issued
+    int    iterations;              // Newton-Schulz steps, or squarings for exp
+    int    degree;                  // Taylor degree (exp only)
+    double residual;                // final residual (iterations only)
+    bool   converged;
+} MatrixFnStats;
+
+MatrixWorkspace* matrixWorkspaceCreate();
+void matrixWorkspaceDestroy(MatrixWorkspace* work);
+
+// Bytes the workspace holds now
+size_t matrixWorkspaceBytes(const MatrixWorkspace* work);
+
+// E = exp(A), n x n. stats may be NULL; false if memory runs out.
+bool matrixExpS(MatrixWorkspace* work, int n, const float* A, int lda, float* E, int lde,
+                MatrixFnStats* stats);
+bool matrixExpD(MatrixWorkspace* work, int n, const double* A, int lda, double* E, int lde,
+                MatrixFnStats* stats);
+
+// Y = A^(-1/2) for symmetric positive definite A, and also S = A^(1/2) unless
+// S is NULL. tol <= 0 picks a few hundred ulps; false if it did not converge
+// in maxIter steps or memory runs out.
+bool matrixInvSqrtS(MatrixWorkspace* work, int n, const float* A, int lda, float* Y, int ldy,
+                    float* S, int lds, double tol, int maxIter, MatrixFnStats* stats);
+bool matrixInvSqrtD(MatrixWorkspace* work, int n, const double* A, int lda, double* Y, int ldy,
+                    double* S, int lds, double tol, int maxIter, MatrixFnStats* stats);
+
+// U = the orthogonal polar factor of A (m x n, m >= n)
+bool matrixPolarS(MatrixWorkspace* work, int m, int n, const float* A, int lda, float* U, int ldu,
+                  double tol, int maxIter, MatrixFnStats* stats);
+bool matrixPolarD(MatrixWorkspace* work, int m, int n, const double* A, int lda, double* U, int ldu,
+                  double tol, int maxIter, MatrixFnStats* stats);
+
+// S = sign(A), n x n
+bool matrixSignS(MatrixWorkspace* work, int n, const float* A, int lda, float* S, int lds,
+                 double tol, int maxIter, MatrixFnStats* stats);
+bool matrixSignD(MatrixWorkspace* work, int n, const double* A, int lda, double* S, int lds,
+                 double tol, int maxIter, MatrixFnStats* stats);
+
+#endif // _MATRIXFUNCTIONS_H_
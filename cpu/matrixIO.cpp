@@ -0,0 +1,125 @@
+// Binary matrix file format: write, map and unmap.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "matrixIO.h"
+
+size_t matrixTypeSize(uint32_t dtype)
+{
+    switch (dtype) {
+        case MATRIX_FLOAT32: return 4;
+        case MATRIX_FLOAT64: return 8;
+        case MATRIX_INT32:   return 4;
+        case MATRIX_INT64:   return 8;
+    }
+    return 0;
+}
+
+// rows * cols * elemSize, false if it does not fit in 64 bits
+static bool dataBytes(uint64_t rows, uint64_t cols, size_t elemSize, uint64_t* bytes)
+{
+    return !__builtin_mul_overflow(rows, cols, bytes)
+        && !__builtin_mul_overflow(*bytes, (uint64_t)elemSize, bytes);
+}
+
+// write() until everything is out or an error occurs
+static bool writeAll(int fd, const void* buf, size_t len)
+{
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+bool writeMatrixFile(const char* path, const void* data, uint64_t rows, uint64_t cols,
+                     uint32_t dtype, const void* tag, size_t tagBytes)
+{
+    size_t elemSize = matrixTypeSize(dtype);
+    uint64_t bytes;
+    if (elemSize == 0 || tagBytes > sizeof(((MatrixFileHeader*)0)->tag)
+        || !dataBytes(rows, cols, elemSize, &bytes) || bytes > SIZE_MAX)
+        return false;
+
+    MatrixFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, MATRIX_FILE_MAGIC, sizeof(header.magic));
+    header.version = MATRIX_FILE_VERSION;
+    header.dtype = dtype;
+    header.rows = rows;
+    header.cols = cols;
+    if (tag) memcpy(header.tag, tag, tagBytes);
+
+    size_t tmpLen = strlen(path) + 32;
+    char* tmpPath = (char*)malloc(tmpLen);
+    snprintf(tmpPath, tmpLen, "%s.tmp.%d", path, (int)getpid());
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmpPath);
+        return false;
+    }
+
+    bool ok = writeAll(fd, &header, sizeof(header))
+           && writeAll(fd, data, (size_t)bytes)
+           && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    ok = ok && rename(tmpPath, path) == 0;
+    if (!ok) unlink(tmpPath);
+
+    free(tmpPath);
+    return ok;
+}
+
+bool mapMatrixFile(const char* path, MatrixMapping* map)
+{
+    memset(map, 0, sizeof(*map));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(MatrixFileHeader)) {
+        close(fd);
+        return false;
+    }
+
+    void* base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    const MatrixFileHeader* header = (const MatrixFileHeader*)base;
+    size_t elemSize = matrixTypeSize(header->dtype);
+    uint64_t bytes;
+    // the header is not trusted: a product that wraps could match the size
+    if (strncmp(header->magic, MATRIX_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != MATRIX_FILE_VERSION
+        || elemSize == 0
+        || !dataBytes(header->rows, header->cols, elemSize, &bytes)
+        || bytes != (uint64_t)st.st_size - sizeof(MatrixFileHeader))
+    {
+        munmap(base, (size_t)st.st_size);
+        return false;
+    }
+
+    map->base = base;
+    map->length = (size_t)st.st_size;
+    map->header = header;
+    map->data = (const char*)base + sizeof(MatrixFileHeader);
+    return true;
+}
+
+void unmapMatrixFile(MatrixMapping* map)
+{
+    if (map->base) munmap(map->base, map->length);
+    memset(map, 0, sizeof(*map));
+}
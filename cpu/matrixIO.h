@@ -0,0 +1,53 @@
+#ifndef _MATRIXIO_H_
+#define _MATRIXIO_H_
+
+// Binary matrix file format.
+//
+// A file is a 64-byte header followed by rows * cols elements in row-major
+// order, so the data starts 64-byte aligned when the file is mapped. The
+// 32-byte tag is free for the writer (the gold cache stores its key there).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MATRIX_FILE_MAGIC   "MMULMAT"
+#define MATRIX_FILE_VERSION 1
+
+// Element types
+#define MATRIX_FLOAT32 1
+#define MATRIX_FLOAT64 2
+#define MATRIX_INT32   3
+#define MATRIX_INT64   4
+
+typedef struct {
+    char     magic[8];      // MATRIX_FILE_MAGIC, NUL padded
+    uint32_t version;       // MATRIX_FILE_VERSION
+    uint32_t dtype;         // MATRIX_FLOAT32, ...
+    uint64_t rows;
+    uint64_t cols;
+    uint8_t  tag[32];       // writer-defined
+} MatrixFileHeader;
+
+// A read-only mapping of a matrix file
+typedef struct {
+    void*                   base;
+    size_t                  length;
+    const MatrixFileHeader* header;
+    const void*             data;
+} MatrixMapping;
+
+// Size in bytes of one element of dtype, 0 if unknown
+size_t matrixTypeSize(uint32_t dtype);
+
+// Writes a matrix file. The data goes to a temporary file which is fsync'd
+// and renamed over path, so readers never see a partial file.
+bool writeMatrixFile(const char* path, const void* data, uint64_t rows, uint64_t cols,
+                     uint32_t dtype, const void* tag, size_t tagBytes);
+
+// Maps a matrix file read-only and validates its header and length.
+// Returns false (and leaves map zeroed) if the file is missing or malformed.
+bool mapMatrixFile(const char* path, MatrixMapping* map);
+
+void unmapMatrixFile(MatrixMapping* map);
+
+#endif // _MATRIXIO_H_
@@ -3,6 +3,8 @@
 //This takes command line arguements for:
 //     number of runs
 //     matrix side length
+//
+// Build:  nvcc -O2 -Xcompiler -fopenmp matrixMulSquare.cu matrixMul_gold.cpp -o matrixMulSquare -lgomp
 
 // Utilities and system includes
 #include <stdio.h>
@@ -10,6 +12,7 @@
 #include <sys/time.h>
 
 #include "matrixMul.h"
+#include "matrixMul_gold.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //! Matrix multiplication on the device: C = A * B
@@ -94,11 +97,6 @@ struct timeval tp;
 double getTime_sec();
 void runTest(int argc, char** argv);
 void randomInit(float*, int);
-void printDiff(float*, float*, int, int, int, float);
-bool check(float*, float*, int, float);
-
-extern "C"
-void computeGold(float*, const float*, const float*, unsigned int, unsigned int, unsigned int);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -240,55 +238,3 @@ void randomInit(float* data, int size)
     for (int i = 0; i < size; ++i)
         data[i] = rand() / (float)RAND_MAX;
 }
-
-void computeGold(float* C, const float* A, const float* B, unsigned int hA, unsigned int wA, unsigned int wB)
-{
-    for (unsigned int i = 0; i < hA; ++i)
-        for (unsigned int j = 0; j < wB; ++j) {
-            double sum = 0;
-            for (unsigned int k = 0; k < wA; ++k) {
-                double a = A[i * wA + k];
-                double b = B[k * wB + j];
-                sum += a * b;
-            }
-            C[i * wB + j] = (float)sum;
-        }
-}
-
-bool check(float *data1, float *data2, int size, float fListTol)
-{
-    int k;
-    for (k = 0; k < size; k++){ 
-        float fDiff = fabs(data1[k] - data2[k]);
-        if (fDiff > fListTol) return false;
-    }
-    return true;
-}
-
-void printDiff(float *data1, float *data2, int width, int height, int iListLength, float fListTol)
-{
-    //printf("Listing first %d Differences > %.6f...\n", iListLength, fListTol);
-    int i,j,k;
-    int error_count=0;
-    for (j = 0; j < height; j++) 
-    {
-        if (error_count < iListLength)
-        {
-            //printf("\n  Row %d:\n", j);
-        }
-        for (i = 0; i < width; i++) 
-        {
-            k = j * width + i;
-            float fDiff = fabs(data1[k] - data2[k]);
-            if (fDiff > fListTol) 
-            {                
-                if (error_count < iListLength)
-                {
-                    //printf("    Loc(%d,%d)\tCPU=%.5f\tGPU=%.5f\tDiff=%.6f\n", i, j, data1[k], data2[k], fDiff);
-                }
-                error_count++;
-            }
-        }
-    }
-    printf(" \n  Total Errors = %d  with tolerance of %.6f\n\n", error_count, fListTol);
-}
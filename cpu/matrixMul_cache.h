@@ -0,0 +1,54 @@
+#ifndef _MATRIXMUL_CACHE_H_
+#define _MATRIXMUL_CACHE_H_
+
+// On-disk cache of computeGold results.
+//
+// The drivers' inputs are fully determined by the generator, its seed and the
+// shape, so the reference product is too. Results are stored as matrix files
+// (see matrixIO.h) under $MATMUL_GOLD_CACHE (default ./gold_cache) and
+// memory-mapped on lookup instead of being recomputed.
+
+#include <stdint.h>
+
+#include "matrixIO.h"
+
+// Input generators
+#define GOLD_GEN_LIBC_RAND 1    // rand() / (float)RAND_MAX, as in randomInit
+
+// Op flags
+#define GOLD_A_TIMES_A  0x1     // C = A x A (B is A)
+#define GOLD_A_THEN_B   0x2     // A then B drawn from one generator stream
+
+typedef struct {
+    uint32_t generator;
+    uint32_t seed;
+    uint32_t hA;
+    uint32_t wA;
+    uint32_t wB;
+    uint32_t dtype;             // MATRIX_FLOAT32
+    uint32_t flags;
+} GoldKey;
+
+// A reference result, either mapped from the cache or computed in memory
+typedef struct {
+    const float*  data;
+    bool          hit;          // true if served from the cache
+    MatrixMapping map;
+    float*        owned;
+} GoldRef;
+
+// Fills in a key for the float32 products the drivers run
+void makeGoldKey(GoldKey* key, uint32_t seed, unsigned int hA, unsigned int wA,
+                 unsigned int wB, uint32_t flags);
+
+// Path of the cache file for key; buf must hold at least 512 bytes
+void goldCachePath(const GoldKey* key, char* buf, size_t bufLen);
+
+// Returns the reference product for key. On a hit the cache file is mapped;
+// on a miss computeGold runs on A and B and the result is stored for next
+// time (a failed store only costs the next run a recomputation).
+const float* computeGoldCached(GoldRef* ref, const GoldKey* key, const float* A, const float* B);
+
+void releaseGold(GoldRef* ref);
+
+#endif // _MATRIXMUL_CACHE_H_
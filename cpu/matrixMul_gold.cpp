@@ -0,0 +1,106 @@
+// Host reference and comparison routines shared by the CPU drivers.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+#include "matrixMul_gold.h"
+
+// Columns of C accumulated per pass, sized so GOLD_ROWS rows of double
+// partial sums stay resident in L1/L2 while a strip of B streams through.
+#define GOLD_COLS 512
+// Rows of C sharing each load of B
+#define GOLD_ROWS 4
+// Elements scanned per work item in the comparison routines
+#define CHECK_CHUNK 4096
+
+////////////////////////////////////////////////////////////////////////////////
+//! Compute reference data set
+//! C = A * B
+//! Every C[i][j] is still accumulated in double over k = 0..wA-1 in order,
+//! so the result is bit-identical to the naive loop; the speedup comes from
+//! splitting rows across threads and running independent columns in SIMD
+//! lanes instead of reassociating the sum.
+////////////////////////////////////////////////////////////////////////////////
+void
+computeGold(float* C, const float* A, const float* B, unsigned int hA, unsigned int wA, unsigned int wB)
+{
+    int nPanels = (int)((hA + GOLD_ROWS - 1) / GOLD_ROWS);
+
+    #pragma omp parallel
+    {
+        double sum[GOLD_ROWS][GOLD_COLS];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int p = 0; p < nPanels; ++p) {
+            unsigned int i0 = (unsigned int)p * GOLD_ROWS;
+            unsigned int rows = (hA - i0 < GOLD_ROWS) ? hA - i0 : GOLD_ROWS;
+
+            for (unsigned int j0 = 0; j0 < wB; j0 += GOLD_COLS) {
+                unsigned int cols = (wB - j0 < GOLD_COLS) ? wB - j0 : GOLD_COLS;
+
+                for (unsigned int r = 0; r < rows; ++r)
+                    for (unsigned int j = 0; j < cols; ++j)
+                        sum[r][j] = 0;
+
+                for (unsigned int k = 0; k < wA; ++k) {
+                    const float* b = B + (size_t)k * wB + j0;
+                    for (unsigned int r = 0; r < rows; ++r) {
+                        double a = A[(size_t)(i0 + r) * wA + k];
+                        double* s = sum[r];
+                        #pragma omp simd
+                        for (unsigned int j = 0; j < cols; ++j)
+                            s[j] += a * (double)b[j];
+                    }
+                }
+
+                for (unsigned int r = 0; r < rows; ++r) {
+                    float* c = C + (size_t)(i0 + r) * wB + j0;
+                    for (unsigned int j = 0; j < cols; ++j)
+                        c[j] = (float)sum[r][j];
+                }
+            }
+        }
+    }
+}
+
+bool check(float *data1, float *data2, int size, float fListTol)
+{
+    int nChunks = (size + CHECK_CHUNK - 1) / CHECK_CHUNK;
+    // set once by whichever thread finds a mismatch, so relaxed atomics suffice
+    int failed = 0;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int c = 0; c < nChunks; ++c) {
+        // another thread already found a mismatch: skip the rest
+        if (__atomic_load_n(&failed, __ATOMIC_RELAXED)) continue;
+
+        int begin = c * CHECK_CHUNK;
+        int end = (begin + CHECK_CHUNK < size) ? begin + CHECK_CHUNK : size;
+        int bad = 0;
+        #pragma omp simd reduction(|:bad)
+        for (int k = begin; k < end; k++)
+            bad |= (fabsf(data1[k] - data2[k]) > fListTol);
+        if (bad) __atomic_store_n(&failed, 1, __ATOMIC_RELAXED);
+    }
+    return !__atomic_load_n(&failed, __ATOMIC_RELAXED);
+}
+
+void printDiff(float *data1, float *data2, int width, int height, int iListLength, float fListTol)
+{
+    //printf("Listing first %d Differences > %.6f...\n", iListLength, fListTol);
+    int error_count=0;
+
+    #pragma omp parallel for schedule(static) reduction(+:error_count)
+    for (int j = 0; j < height; j++)
+    {
+        const float* row1 = data1 + (size_t)j * width;
+        const float* row2 = data2 + (size_t)j * width;
+        int row_errors = 0;
+        #pragma omp simd reduction(+:row_errors)
+        for (int i = 0; i < width; i++)
+            row_errors += (fabsf(row1[i] - row2[i]) > fListTol);
+        error_count += row_errors;
+    }
+    printf(" \n  Total Errors = %d  with tolerance of %.6f\n\n", error_count, fListTol);
+}
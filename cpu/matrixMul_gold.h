@@ -0,0 +1,33 @@
+#ifndef _MATRIXMUL_GOLD_H_
+#define _MATRIXMUL_GOLD_H_
+
+// Host reference and comparison routines shared by the CPU drivers.
+// Build with OpenMP (-fopenmp, or -Xcompiler -fopenmp under nvcc) to run
+// them on all cores; without it the pragmas are ignored and they run serially
+// with identical results.
+
+////////////////////////////////////////////////////////////////////////////////
+//! Compute reference data set, C = A * B, accumulating in double.
+//! Results are bit-identical to the serial i/j/k loop.
+//! @param C          reference data, computed but preallocated
+//! @param A          matrix A
+//! @param B          matrix B
+//! @param hA         height of matrix A
+//! @param wA         width of matrix A (height of matrix B)
+//! @param wB         width of matrix B
+////////////////////////////////////////////////////////////////////////////////
+extern "C"
+void computeGold(float*, const float*, const float*, unsigned int, unsigned int, unsigned int);
+
+////////////////////////////////////////////////////////////////////////////////
+//! Returns true if every |data1[k] - data2[k]| <= fListTol.
+//! Stops scanning as soon as any thread finds a mismatch.
+////////////////////////////////////////////////////////////////////////////////
+bool check(float *data1, float *data2, int size, float fListTol);
+
+////////////////////////////////////////////////////////////////////////////////
+//! Prints the number of elements differing by more than fListTol.
+////////////////////////////////////////////////////////////////////////////////
+void printDiff(float *data1, float *data2, int width, int height, int iListLength, float fListTol);
+
+#endif // _MATRIXMUL_GOLD_H_
@@ -0,0 +1,187 @@
+//This runs the matrixMul<BLOCK_SIZE> kernel on the CPU (see gpuModel.h) and
+//predicts its run time on target GPUs for each block size:
+//     ./modelGpu sizes=256,1024,4096 blocks=8,16,32 targets=fermi,volta sample=64
+//     ./modelGpu sizes=2048 targets=file:targets.txt regs=20
+//
+//targets= takes built-in names (fermi, kepler, volta, ampere) and
+//file:<path> for a file of target lines; a target line is key=value pairs,
+//e.g. "name=mygpu base=volta sms=40 dramGBs=450". regs is the kernel's
+//register count per thread, as ptxas -v reports it. At most sample= blocks
+//of each kernel are executed (0 runs all of them); the blocks that ran are
+//checked against computeGold up to check= (512 by default).
+//
+// Build:  g++ -O3 -march=native -fopenmp modelGpu.cpp gpuModel.cpp matrixMul_gold.cpp -o modelGpu
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "gpuModel.h"
+#include "matrixMul_gold.h"
+
+#define MAX_TARGETS 16
+
+static std::vector<int> parseList(const char* p)
+{
+    std::vector<int> values;
+    while (*p) {
+        values.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (!p) break;
+        ++p;
+    }
+    return values;
+}
+
+// Built-in names and file:<path>, comma separated
+static bool parseTargets(const char* list, GpuTarget* targets, int* count)
+{
+    char item[256];
+    while (*list) {
+        size_t n = strcspn(list, ",");
+        if (n >= sizeof(item)) n = sizeof(item) - 1;
+        memcpy(item, list, n);
+        item[n] = 0;
+        list += n + (list[n] == ',');
+        if (strncmp(item, "file:", 5) == 0) {
+            if (!gpuLoadTargets(item + 5, targets, MAX_TARGETS, count)) return false;
+        } else if (*count >= MAX_TARGETS) {
+            fprintf(stderr, "modelGpu: more than %d targets\n", MAX_TARGETS);
+            return false;
+        } else {
+            if (!gpuFindTarget(item, &targets[*count])) return false;
+            ++*count;
+        }
+    }
+    return true;
+}
+
+// Compares the elements the sampled blocks wrote (the rest are still NaN)
+static bool checkSampled(const float* C, const float* gold, size_t elems, size_t expect)
+{
+    size_t written = 0;
+    double err = 0, ref = 0;
+    for (size_t i = 0; i < elems; ++i) {
+        if (isnan(C[i])) continue;
+        ++written;
+        err = fmax(err, fabs((double)C[i] - gold[i]));
+        ref = fmax(ref, fabs((double)gold[i]));
+    }
+    return written == expect && err <= 1.0e-5 * ref;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes, blocks;
+    GpuTarget targets[MAX_TARGETS];
+    int targetCount = 0;
+    int sample = 64, regs = 24, check = 512;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "sizes=", 6) == 0) {
+            sizes = parseList(arg + 6);
+        } else if (strncmp(arg, "blocks=", 7) == 0) {
+            blocks = parseList(arg + 7);
+        } else if (strncmp(arg, "targets=", 8) == 0) {
+            if (!parseTargets(arg + 8, targets, &targetCount)) return 1;
+        } else if (strncmp(arg, "sample=", 7) == 0) {
+            sample = atoi(arg + 7);
+        } else if (strncmp(arg, "regs=", 5) == 0) {
+            regs = atoi(arg + 5);
+        } else if (strncmp(arg, "check=", 6) == 0) {
+            check = atoi(arg + 6);
+        } else {
+            fprintf(stderr, "modelGpu: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (sizes.empty()) {
+        int defaults[] = { 256, 1024, 4096 };
+        sizes.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+    if (blocks.empty()) {
+        int defaults[] = { 8, 16, 32 };
+        blocks.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+    if (targetCount == 0 && !parseTargets("fermi,kepler,volta,ampere", targets, &targetCount))
+        return 1;
+    if (regs <= 0) {
+        fprintf(stderr, "modelGpu: regs must be positive\n");
+        return 1;
+    }
+
+    // emulate every size and block size once; the profiles serve all targets
+    std::vector<GpuKernelProfile> profiles;
+    bool ok = true;
+    srand(2006);
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        int n = sizes[s];
+        size_t elems = (size_t)n * n;
+        std::vector<float> A(elems), B(elems), C(elems), gold;
+        for (size_t i = 0; i < elems; ++i) {
+            A[i] = rand() / (float)RAND_MAX;
+            B[i] = rand() / (float)RAND_MAX;
+        }
+        if (n <= check) {
+            gold.resize(elems);
+            computeGold(&gold[0], &A[0], &B[0], n, n, n);
+        }
+
+        for (size_t b = 0; b < blocks.size(); ++b) {
+            std::fill(C.begin(), C.end(), NAN);
+            GpuKernelProfile profile;
+            if (!gpuEmulateMatrixMul(blocks[b], n, n, n, &A[0], &B[0], &C[0], sample, &profile, NULL)) {
+                ok = false;
+                continue;
+            }
+            gpuPrintProfile(&profile, stdout);
+            if (!gold.empty()) {
+                size_t expect = (size_t)profile.sampled * profile.threads;
+                bool good = checkSampled(&C[0], &gold[0], elems, expect);
+                printf("  check: %s\n", good ? "ok" : "MISMATCH");
+                ok = ok && good;
+            }
+            profiles.push_back(profile);
+        }
+    }
+
+    for (int t = 0; t < targetCount; ++t) {
+        const GpuTarget* g = &targets[t];
+        printf("\ntarget %s: %d SMs at %.2f GHz, %d FP32 lanes each, %.0f GB/s DRAM, %ld KB L2, "
+               "%d registers per thread\n", g->name, g->sms, g->clockGHz, g->fp32Lanes, g->dramGBs,
+               g->l2Bytes / 1024, regs);
+        printf("  size block  blocks/SM occupancy  limit   bound      time_us      GF/s  relative\n");
+        for (size_t i = 0; i < profiles.size(); ) {
+            // the block sizes of one problem size, ranked against the fastest
+            size_t end = i;
+            while (end < profiles.size() && profiles[end].M == profiles[i].M) ++end;
+            std::vector<GpuPrediction> predictions(end - i);
+            std::vector<bool> fits(end - i);
+            double best = 1e30;
+            for (size_t j = i; j < end; ++j) {
+                fits[j - i] = gpuPredict(g, &profiles[j], regs, &predictions[j - i]);
+                if (fits[j - i]) best = fmin(best, predictions[j - i].totalUs);
+            }
+            for (size_t j = i; j < end; ++j) {
+                const GpuPrediction* p = &predictions[j - i];
+                if (!fits[j - i]) {
+                    printf("%6d %5d  does not fit\n", profiles[j].M, profiles[j].blockSize);
+                    continue;
+                }
+                printf("%6d %5d %10d %9.0f%%  %-7s %-8s %10.1f %9.1f %8.2fx\n", profiles[j].M,
+                       profiles[j].blockSize, p->blocksPerSM, 100.0 * p->occupancy, p->limit,
+                       p->bound, p->totalUs, p->gflops, p->totalUs / best);
+            }
+            i = end;
+        }
+    }
+    return ok ? 0 : 1;
+}
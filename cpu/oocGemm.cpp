@@ -0,0 +1,99 @@
+//This multiplies matrix files too large for memory, C = A * B:
+//     ./oocGemm a=A.mat b=B.mat c=C.mat [tile=2048] [kblock=2048]
+//               [checkpoint=60] [threads=0] [affinity=compact]
+//
+//checkpoint= is the number of seconds between checkpoints (0 = only when
+//stopped). SIGTERM or SIGINT makes it checkpoint at the next step and exit
+//with status 3; running the same command again resumes from there.
+//
+// Build:  g++ -O3 -march=native -fopenmp oocGemm.cpp outOfCore.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o oocGemm
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#include "gemm.h"
+#include "outOfCore.h"
+
+static volatile int stopping = 0;
+
+static void onSignal(int)
+{
+    stopping = 1;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    const char* pathA = NULL;
+    const char* pathB = NULL;
+    const char* pathC = NULL;
+    OocOptions options;
+    oocDefaultOptions(&options);
+    options.stop = &stopping;
+    options.verbose = true;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "a=", 2) == 0) {
+            pathA = arg + 2;
+        } else if (strncmp(arg, "b=", 2) == 0) {
+            pathB = arg + 2;
+        } else if (strncmp(arg, "c=", 2) == 0) {
+            pathC = arg + 2;
+        } else if (strncmp(arg, "tile=", 5) == 0) {
+            options.tile = atoi(arg + 5);
+        } else if (strncmp(arg, "kblock=", 7) == 0) {
+            options.kblock = atoi(arg + 7);
+        } else if (strncmp(arg, "checkpoint=", 11) == 0) {
+            options.interval = atof(arg + 11);
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            gemmSetNumThreads(atoi(arg + 8));
+        } else if (strncmp(arg, "affinity=", 9) == 0 && gemmParseAffinity(arg + 9) >= 0) {
+            gemmSetAffinity(gemmParseAffinity(arg + 9));
+        } else {
+            fprintf(stderr, "oocGemm: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (!pathA || !pathB || !pathC) {
+        fprintf(stderr, "usage: oocGemm a=A.mat b=B.mat c=C.mat [tile=2048] [kblock=2048] "
+                        "[checkpoint=60] [threads=0] [affinity=compact]\n");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    double start = now();
+    int result = oocMultiply(pathA, pathB, pathC, &options);
+    double seconds = now() - start;
+    gemmShutdown();
+
+    switch (result) {
+        case OOC_DONE:
+            printf("oocGemm: wrote %s in %.1f s\n", pathC, seconds);
+            return 0;
+        case OOC_STOPPED:
+            printf("oocGemm: stopped after %.1f s; run again to resume\n", seconds);
+            return 3;
+    }
+    return 1;
+}
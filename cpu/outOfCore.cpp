@@ -0,0 +1,387 @@
+// Out-of-core multiply of matrix files, with checkpoint/restart.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "gemm.h"
+#include "matrixIO.h"
+#include "outOfCore.h"
+
+#define CKPT_MAGIC   "MMULCKP"
+#define CKPT_VERSION 1
+
+// Checkpoint file: this header, the bitmap of finished tiles, then the
+// partial tile (tile x tile elements, row-major) if there is one
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint64_t M, N, K;
+    uint32_t tile, kblock;
+    uint64_t sizeA, mtimeA;         // the inputs must be unchanged on resume
+    uint64_t sizeB, mtimeB;
+    int64_t  partialTile;           // -1 if none
+    uint32_t partialSteps;          // K steps accumulated into it
+    uint32_t reserved;
+} CheckpointHeader;
+
+typedef struct {
+    const char*          pathC;
+    std::string          partialPath;
+    std::string          ckptPath;
+    int                  fd;        // of the partial C file
+    CheckpointHeader     header;
+    std::vector<uint8_t> done;      // bitmap of finished tiles
+    uint64_t             nDone;
+    void*                tileBuf;   // the tile in progress
+    size_t               elemSize;
+} OocState;
+
+void oocDefaultOptions(OocOptions* options)
+{
+    options->tile = 2048;
+    options->kblock = 2048;
+    options->interval = 60;
+    options->stop = NULL;
+    options->verbose = false;
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static bool writeAll(int fd, const void* buf, size_t len, off_t offset)
+{
+    const char* p = (const char*)buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool readAll(int fd, void* buf, size_t len)
+{
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Makes a rename in the directory of path durable
+static bool syncDirectory(const char* path)
+{
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    dir = (slash == std::string::npos) ? "." : (slash == 0 ? "/" : dir.substr(0, slash));
+
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool identify(const char* path, uint64_t* size, uint64_t* mtime)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    *size = (uint64_t)st.st_size;
+    *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000ull + (uint64_t)st.st_mtim.tv_nsec;
+    return true;
+}
+
+static size_t tileElems(const OocState* s)
+{
+    return (size_t)s->header.tile * s->header.tile;
+}
+
+// Writes the checkpoint. Finished tiles are synced first, so it never lists
+// a tile whose data could still be lost.
+static bool checkpoint(OocState* s)
+{
+    if (fdatasync(s->fd) != 0) {
+        fprintf(stderr, "ooc: cannot sync %s: %s\n", s->partialPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string tmpPath = s->ckptPath + ".tmp";
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "ooc: cannot write %s: %s\n", tmpPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    off_t offset = 0;
+    bool ok = writeAll(fd, &s->header, sizeof(s->header), offset);
+    offset += sizeof(s->header);
+    ok = ok && writeAll(fd, &s->done[0], s->done.size(), offset);
+    offset += s->done.size();
+    if (s->header.partialTile >= 0)
+        ok = ok && writeAll(fd, s->tileBuf, tileElems(s) * s->elemSize, offset);
+    ok = ok && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    ok = ok && rename(tmpPath.c_str(), s->ckptPath.c_str()) == 0 && syncDirectory(s->ckptPath.c_str());
+    if (!ok) {
+        fprintf(stderr, "ooc: cannot write checkpoint %s: %s\n", s->ckptPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+    }
+    return ok;
+}
+
+// Loads a checkpoint that matches the current inputs and settings; false
+// (and nothing loaded) if there is none or it belongs to something else
+static bool resume(OocState* s, bool verbose)
+{
+    int fd = open(s->ckptPath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    CheckpointHeader h;
+    bool ok = readAll(fd, &h, sizeof(h))
+           && strncmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) == 0
+           && h.version == CKPT_VERSION;
+    const CheckpointHeader& want = s->header;
+    bool same = ok && h.dtype == want.dtype && h.M == want.M && h.N == want.N && h.K == want.K
+             && h.tile == want.tile && h.kblock == want.kblock
+             && h.sizeA == want.sizeA && h.mtimeA == want.mtimeA
+             && h.sizeB == want.sizeB && h.mtimeB == want.mtimeB;
+    if (ok && !same)
+        fprintf(stderr, "ooc: %s is for other inputs or settings; starting over\n", s->ckptPath.c_str());
+
+    std::vector<uint8_t> done(s->done.size());
+    ok = same && readAll(fd, &done[0], done.size())
+      && (h.partialTile < 0 || readAll(fd, s->tileBuf, tileElems(s) * s->elemSize));
+    close(fd);
+
+    // the partial C file must still be there and the right size
+    struct stat st;
+    uint64_t bytes = sizeof(MatrixFileHeader) + want.M * want.N * s->elemSize;
+    ok = ok && stat(s->partialPath.c_str(), &st) == 0 && (uint64_t)st.st_size == bytes;
+    if (!ok) return false;
+
+    s->done = done;
+    s->nDone = 0;
+    for (size_t i = 0; i < done.size(); ++i)
+        s->nDone += __builtin_popcount(done[i]);
+    s->header.partialTile = h.partialTile;
+    s->header.partialSteps = h.partialSteps;
+    if (verbose)
+        printf("ooc: resuming with %llu tiles finished%s\n", (unsigned long long)s->nDone,
+               h.partialTile >= 0 ? " and one in progress" : "");
+    return true;
+}
+
+// Creates the partial C file at full size; the data is filled in tile by tile
+static bool createPartial(OocState* s)
+{
+    MatrixFileHeader header;
+    memset(&header, 0, sizeof(header));
+    strncpy(header.magic, MATRIX_FILE_MAGIC, sizeof(header.magic));
+    header.version = MATRIX_FILE_VERSION;
+    header.dtype = s->header.dtype;
+    header.rows = s->header.M;
+    header.cols = s->header.N;
+
+    int fd = open(s->partialPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    off_t bytes = (off_t)(sizeof(header) + s->header.M * s->header.N * s->elemSize);
+    bool ok = writeAll(fd, &header, sizeof(header), 0) && ftruncate(fd, bytes) == 0;
+    ok = (close(fd) == 0) && ok;
+    return ok;
+}
+
+static void gemmCall(int M, int N, int K, const float* A, int lda, const float* B, int ldb,
+                     float beta, float* C, int ldc)
+{
+    gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0f, A, lda, B, ldb, beta, C, ldc);
+}
+
+static void gemmCall(int M, int N, int K, const double* A, int lda, const double* B, int ldb,
+                     double beta, double* C, int ldc)
+{
+    gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0, A, lda, B, ldb, beta, C, ldc);
+}
+
+static bool stopRequested(const OocOptions* options)
+{
+    return options->stop && *options->stop;
+}
+
+template <typename T>
+static int multiplyTiles(OocState* s, const T* A, const T* B, const OocOptions* options)
+{
+    const uint64_t M = s->header.M, N = s->header.N, K = s->header.K;
+    const int tile = (int)s->header.tile, kblock = (int)s->header.kblock;
+    const uint64_t tileRows = (M + tile - 1) / tile, tileCols = (N + tile - 1) / tile;
+    const int nSteps = (int)((K + kblock - 1) / kblock);
+    T* buf = (T*)s->tileBuf;
+
+    double last = now();
+    for (uint64_t t = 0; t < tileRows * tileCols; ++t) {
+        if (s->done[t / 8] & (1u << (t % 8))) continue;
+
+        uint64_t i0 = (t / tileCols) * tile, j0 = (t % tileCols) * tile;
+        int tm = (int)((M - i0 < (uint64_t)tile) ? M - i0 : tile);
+        int tn = (int)((N - j0 < (uint64_t)tile) ? N - j0 : tile);
+
+        int first = (s->header.partialTile == (int64_t)t) ? (int)s->header.partialSteps : 0;
+        for (int step = first; step < nSteps; ++step) {
+            uint64_t k0 = (uint64_t)step * kblock;
+            int kb = (int)((K - k0 < (uint64_t)kblock) ? K - k0 : kblock);
+            gemmCall(tm, tn, kb, A + i0 * K + k0, (int)K, B + k0 * N + j0, (int)N,
+                     step == 0 ? (T)0 : (T)1, buf, tn);
+            s->header.partialTile = (int64_t)t;
+            s->header.partialSteps = step + 1;
+
+            bool stopping = stopRequested(options);
+            bool due = options->interval > 0 && now() - last >= options->interval;
+            if (step + 1 < nSteps && (stopping || due)) {
+                if (!checkpoint(s)) return OOC_ERROR;
+                last = now();
+                if (stopping) return OOC_STOPPED;
+            }
+        }
+
+        for (int r = 0; r < tm; ++r) {
+            off_t offset = (off_t)(sizeof(MatrixFileHeader) + ((i0 + r) * N + j0) * sizeof(T));
+            if (!writeAll(s->fd, buf + (size_t)r * tn, tn * sizeof(T), offset)) {
+                fprintf(stderr, "ooc: cannot write %s: %s\n", s->partialPath.c_str(), strerror(errno));
+                return OOC_ERROR;
+            }
+        }
+        s->done[t / 8] |= (uint8_t)(1u << (t % 8));
+        s->nDone++;
+        s->header.partialTile = -1;
+        s->header.partialSteps = 0;
+
+        bool stopping = stopRequested(options);
+        bool due = options->interval > 0 && now() - last >= options->interval;
+        if (s->nDone < tileRows * tileCols && (stopping || due)) {
+            if (!checkpoint(s)) return OOC_ERROR;
+            last = now();
+            if (options->verbose)
+                printf("ooc: checkpoint at %llu of %llu tiles\n", (unsigned long long)s->nDone,
+                       (unsigned long long)(tileRows * tileCols));
+            if (stopping) return OOC_STOPPED;
+        }
+    }
+    return OOC_DONE;
+}
+
+int oocMultiply(const char* pathA, const char* pathB, const char* pathC,
+                const OocOptions* options)
+{
+    MatrixMapping a, b;
+    if (!mapMatrixFile(pathA, &a) || !mapMatrixFile(pathB, &b)) {
+        fprintf(stderr, "ooc: cannot map %s\n", a.base ? pathB : pathA);
+        unmapMatrixFile(&a);
+        return OOC_ERROR;
+    }
+
+    const MatrixFileHeader* ha = a.header;
+    const MatrixFileHeader* hb = b.header;
+    int result = OOC_ERROR;
+    OocState s;
+    s.fd = -1;
+    s.tileBuf = NULL;
+
+    if (ha->dtype != hb->dtype || (ha->dtype != MATRIX_FLOAT32 && ha->dtype != MATRIX_FLOAT64)) {
+        fprintf(stderr, "ooc: A and B must both be float32 or both float64\n");
+        goto out;
+    }
+    if (ha->cols != hb->rows || ha->rows > 0x7fffffff || ha->cols > 0x7fffffff || hb->cols > 0x7fffffff) {
+        fprintf(stderr, "ooc: cannot multiply %llux%llu by %llux%llu\n",
+                (unsigned long long)ha->rows, (unsigned long long)ha->cols,
+                (unsigned long long)hb->rows, (unsigned long long)hb->cols);
+        goto out;
+    }
+    if (options->tile <= 0 || options->kblock <= 0) {
+        fprintf(stderr, "ooc: tile and kblock must be positive\n");
+        goto out;
+    }
+
+    {
+        memset(&s.header, 0, sizeof(s.header));
+        strncpy(s.header.magic, CKPT_MAGIC, sizeof(s.header.magic));
+        s.header.version = CKPT_VERSION;
+        s.header.dtype = ha->dtype;
+        s.header.M = ha->rows;
+        s.header.N = hb->cols;
+        s.header.K = ha->cols;
+        s.header.tile = (uint32_t)options->tile;
+        s.header.kblock = (uint32_t)options->kblock;
+        s.header.partialTile = -1;
+        if (!identify(pathA, &s.header.sizeA, &s.header.mtimeA)
+            || !identify(pathB, &s.header.sizeB, &s.header.mtimeB))
+            goto out;
+
+        uint64_t nTiles = ((s.header.M + options->tile - 1) / options->tile)
+                        * ((s.header.N + options->tile - 1) / options->tile);
+        s.pathC = pathC;
+        s.partialPath = std::string(pathC) + ".partial";
+        s.ckptPath = std::string(pathC) + ".ckpt";
+        s.done.assign((size_t)((nTiles + 7) / 8), 0);
+        s.nDone = 0;
+        s.elemSize = matrixTypeSize(ha->dtype);
+        s.tileBuf = malloc(tileElems(&s) * s.elemSize);
+        if (!s.tileBuf) {
+            fprintf(stderr, "ooc: cannot allocate a %d x %d tile\n", options->tile, options->tile);
+            goto out;
+        }
+
+        if (!resume(&s, options->verbose) && !createPartial(&s)) {
+            fprintf(stderr, "ooc: cannot create %s: %s\n", s.partialPath.c_str(), strerror(errno));
+            goto out;
+        }
+        s.fd = open(s.partialPath.c_str(), O_WRONLY);
+        if (s.fd < 0) {
+            fprintf(stderr, "ooc: cannot open %s: %s\n", s.partialPath.c_str(), strerror(errno));
+            goto out;
+        }
+
+        result = (ha->dtype == MATRIX_FLOAT64)
+               ? multiplyTiles<double>(&s, (const double*)a.data, (const double*)b.data, options)
+               : multiplyTiles<float>(&s, (const float*)a.data, (const float*)b.data, options);
+
+        // C is complete: publish it, then drop the checkpoint
+        if (result == OOC_DONE) {
+            bool ok = fdatasync(s.fd) == 0 && rename(s.partialPath.c_str(), pathC) == 0
+                   && syncDirectory(pathC);
+            if (!ok) {
+                fprintf(stderr, "ooc: cannot finish %s: %s\n", pathC, strerror(errno));
+                result = OOC_ERROR;
+            } else {
+                unlink(s.ckptPath.c_str());
+            }
+        }
+    }
+
+out:
+    if (s.fd >= 0) close(s.fd);
+    free(s.tileBuf);
+    unmapMatrixFile(&a);
+    unmapMatrixFile(&b);
+    return result;
+}
@@ -0,0 +1,37 @@
+#ifndef _OUTOFCORE_H_
+#define _OUTOFCORE_H_
+
+// Out-of-core multiply of matrix files, with checkpoint/restart.
+//
+// C = A * B for matrix files (see matrixIO.h) too large to hold in memory. A
+// and B are mapped read-only and C is built one tile at a time, each tile
+// accumulated over K in steps of kblock with the engine. Finished tiles go to
+// <c>.partial, which is renamed to <c> at the end.
+//
+// Every so often, and when asked to stop, the state is saved to <c>.ckpt: a
+// bitmap of finished tiles plus the tile in progress with the K steps it has
+// accumulated so far. Finished tiles are synced to <c>.partial before the
+// checkpoint that lists them is written, and the checkpoint itself is written
+// to a temporary file, synced and renamed, so after a crash the newest
+// checkpoint on disk always describes data that is on disk. Running again
+// with the same inputs resumes from it.
+
+#define OOC_DONE    0
+#define OOC_STOPPED 1               // checkpointed at a stop request
+#define OOC_ERROR   2
+
+typedef struct {
+    int           tile;             // rows and columns of a C tile
+    int           kblock;           // depth of one accumulation step
+    double        interval;         // seconds between checkpoints; 0 = only on stop
+    volatile int* stop;             // set (e.g. from a signal handler) to stop
+    bool          verbose;
+} OocOptions;
+
+void oocDefaultOptions(OocOptions* options);
+
+// Returns OOC_DONE, OOC_STOPPED or OOC_ERROR (with a message on stderr)
+int oocMultiply(const char* pathA, const char* pathB, const char* pathC,
+                const OocOptions* options);
+
+#endif // _OUTOFCORE_H_
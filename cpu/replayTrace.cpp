@@ -0,0 +1,312 @@
+//This replays a trace recorded with MATMUL_TRACE=<file> against the engine:
+//     ./replayTrace trace=app.trc timing=original threads=4 repeat=3
+//
+//     timing=asap        issue each caller's calls back to back (default)
+//     timing=original    keep the recorded start times
+//     timing=scaled:F    recorded start times multiplied by F
+//
+// Each recorded caller gets its own replay thread, and operands the trace
+// shows being reused are the same buffers in the replay, so cache and
+// contention effects of the original workload are reproduced. Calls go
+// through the entry point they were recorded from: a packed B is packed once
+// before the replay, and an asynchronous product is waited for before its
+// caller's next call, outside the time replayed.
+//
+// Build:  g++ -O3 -march=native -fopenmp replayTrace.cpp gemmTrace.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o replayTrace
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <map>
+#include <vector>
+
+#include "arena.h"
+#include "gemm.h"
+#include "gemmTrace.h"
+#include "matrixIO.h"
+#include "multithreading.h"
+
+#define TIMING_ASAP     0
+#define TIMING_ORIGINAL 1
+#define TIMING_SCALED   2
+
+typedef struct {
+    const TraceRecord* records;
+    size_t             count;
+    int                thread;      // recorded caller to replay
+    void**             operands;    // by operand id
+    GemmPackedB**      packed;      // by operand id, for TRACE_PACKED_B
+    int                timing;
+    double             scale;
+    uint64_t           origin;      // gemmTraceNow() at replay start
+    uint64_t*          replayed;    // ns per record, filled for this caller
+} ReplayThread;
+
+typedef struct {
+    int      count;
+    double   recorded;              // total ns
+    double   replayed;
+    double   flops;
+} ShapeStats;
+
+// Bytes an operand must span to satisfy one use
+static size_t operandExtent(size_t rows, size_t cols, size_t ld, int dtype)
+{
+    if (rows == 0 || cols == 0) return 0;
+    return ((rows - 1) * ld + cols) * matrixTypeSize(dtype);
+}
+
+static void sleepUntil(uint64_t when)
+{
+    uint64_t now = gemmTraceNow();
+    if (when <= now) return;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t)((when - now) / 1000000000ull);
+    ts.tv_nsec = (long)((when - now) % 1000000000ull);
+    nanosleep(&ts, NULL);
+}
+
+static CUT_THREADPROC replayMain(void* arg)
+{
+    ReplayThread* t = (ReplayThread*)arg;
+
+    GemmFuture* pending = NULL;
+    for (size_t i = 0; i < t->count; ++i) {
+        const TraceRecord* r = &t->records[i];
+        if (r->thread != t->thread) continue;
+
+        if (pending) {
+            gemmFutureWait(pending);
+            gemmFutureRelease(pending);
+            pending = NULL;
+        }
+        if (t->timing != TIMING_ASAP)
+            sleepUntil(t->origin + (uint64_t)((double)r->start * t->scale));
+
+        int transA = (r->flags & TRACE_TRANS_A) ? GEMM_TRANS : GEMM_NO_TRANS;
+        int transB = (r->flags & TRACE_TRANS_B) ? GEMM_TRANS : GEMM_NO_TRANS;
+        void* A = t->operands[r->a];
+        const void* B = t->operands[r->b];
+        void* C = t->operands[r->c];
+        bool f64 = r->dtype == MATRIX_FLOAT64;
+
+        uint64_t start = gemmTraceNow();
+        if (r->flags & TRACE_PACKED_B) {
+            if (f64) gemmDgemmPacked(transA, r->M, r->alpha, (const double*)A, r->lda,
+                                     t->packed[r->b], r->beta, (double*)C, r->ldc);
+            else gemmSgemmPacked(transA, r->M, r->alpha, (const float*)A, r->lda,
+                                 t->packed[r->b], r->beta, (float*)C, r->ldc);
+        } else if (r->flags & TRACE_IN_PLACE) {
+            if (f64) gemmDgemmInPlace(transB, r->M, r->N, r->alpha, (double*)A, r->lda,
+                                      (const double*)B, r->ldb, 0);
+            else gemmSgemmInPlace(transB, r->M, r->N, r->alpha, (float*)A, r->lda,
+                                  (const float*)B, r->ldb, 0);
+        } else if (r->flags & TRACE_ASYNC) {
+            if (f64) pending = gemmDgemmAsync(transA, transB, r->M, r->N, r->K, r->alpha,
+                                              (const double*)A, r->lda, (const double*)B, r->ldb,
+                                              r->beta, (double*)C, r->ldc, NULL, 0);
+            else pending = gemmSgemmAsync(transA, transB, r->M, r->N, r->K, r->alpha,
+                                          (const float*)A, r->lda, (const float*)B, r->ldb,
+                                          r->beta, (float*)C, r->ldc, NULL, 0);
+        } else if (f64) {
+            gemmDgemm(transA, transB, r->M, r->N, r->K, r->alpha, (const double*)A, r->lda,
+                      (const double*)B, r->ldb, r->beta, (double*)C, r->ldc);
+        } else {
+            gemmSgemm(transA, transB, r->M, r->N, r->K, r->alpha, (const float*)A, r->lda,
+                      (const float*)B, r->ldb, r->beta, (float*)C, r->ldc);
+        }
+        t->replayed[i] = gemmTraceNow() - start;
+    }
+    if (pending) {
+        gemmFutureWait(pending);
+        gemmFutureRelease(pending);
+    }
+
+    CUT_THREADEND;
+}
+
+static bool parseTiming(const char* s, int* timing, double* scale)
+{
+    *scale = 1.0;
+    if (strcmp(s, "asap") == 0)     { *timing = TIMING_ASAP;     return true; }
+    if (strcmp(s, "original") == 0) { *timing = TIMING_ORIGINAL; return true; }
+    if (strncmp(s, "scaled:", 7) == 0) {
+        *timing = TIMING_SCALED;
+        *scale = atof(s + 7);
+        return *scale > 0.0;
+    }
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    const char* path = NULL;
+    int timing = TIMING_ASAP;
+    double scale = 1.0;
+    int threads = 1;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        bool ok = true;
+        if (strncmp(arg, "trace=", 6) == 0)        path = arg + 6;
+        else if (strncmp(arg, "timing=", 7) == 0)  ok = parseTiming(arg + 7, &timing, &scale);
+        else if (strncmp(arg, "threads=", 8) == 0) threads = atoi(arg + 8);
+        else if (strncmp(arg, "repeat=", 7) == 0)  ok = (repeat = atoi(arg + 7)) > 0;
+        else ok = false;
+
+        if (!ok) {
+            fprintf(stderr, "replayTrace: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: replayTrace trace=<file> [timing=asap|original|scaled:F]"
+                        " [threads=N] [repeat=N]\n");
+        return 1;
+    }
+
+    TraceHeader header;
+    TraceRecord* records;
+    size_t count;
+    if (!readTrace(path, &header, &records, &count)) return 1;
+    if (count == 0) {
+        printf("%s: empty trace\n", path);
+        free(records);
+        return 0;
+    }
+
+    // Size every operand for its largest use and count the callers
+    std::vector<size_t> extent;
+    int nCallers = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const TraceRecord* r = &records[i];
+        bool tA = (r->flags & TRACE_TRANS_A) != 0;
+        bool tB = (r->flags & TRACE_TRANS_B) != 0;
+        size_t need[3] = {
+            operandExtent(tA ? r->K : r->M, tA ? r->M : r->K, r->lda, r->dtype),
+            operandExtent(tB ? r->N : r->K, tB ? r->K : r->N, r->ldb, r->dtype),
+            operandExtent(r->M, r->N, r->ldc, r->dtype)
+        };
+        uint32_t id[3] = { r->a, r->b, r->c };
+        for (int j = 0; j < 3; ++j) {
+            if (id[j] >= extent.size()) extent.resize(id[j] + 1, 0);
+            if (need[j] > extent[id[j]]) extent[id[j]] = need[j];
+        }
+        if (r->thread >= nCallers) nCallers = r->thread + 1;
+    }
+
+    size_t total = 0;
+    for (size_t i = 0; i < extent.size(); ++i)
+        total += (extent[i] + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    Arena arena;
+    if (!arenaInit(&arena, total + ARENA_ALIGN)) return 1;
+    arenaPrefault(&arena);
+
+    std::vector<void*> operands(extent.size(), (void*)NULL);
+    srand(2006);
+    for (size_t i = 0; i < extent.size(); ++i) {
+        operands[i] = arenaAlloc(&arena, extent[i], 0);
+        // random floats; as doubles the bit patterns are finite too
+        float* f = (float*)operands[i];
+        for (size_t j = 0; j < extent[i] / sizeof(float); ++j)
+            f[j] = rand() / (float)RAND_MAX;
+    }
+
+    // B packed once per packed operand, as the recorded program did
+    std::vector<GemmPackedB*> packed(extent.size(), (GemmPackedB*)NULL);
+    for (size_t i = 0; i < count; ++i) {
+        const TraceRecord* r = &records[i];
+        if (!(r->flags & TRACE_PACKED_B) || packed[r->b]) continue;
+        packed[r->b] = (r->dtype == MATRIX_FLOAT64)
+            ? gemmDpackB(GEMM_NO_TRANS, r->K, r->N, (const double*)operands[r->b], r->ldb)
+            : gemmSpackB(GEMM_NO_TRANS, r->K, r->N, (const float*)operands[r->b], r->ldb);
+        if (!packed[r->b]) {
+            fprintf(stderr, "replayTrace: could not pack operand %u\n", r->b);
+            arenaDestroy(&arena);
+            free(records);
+            return 1;
+        }
+    }
+
+    printf("%s: %lu calls from %d threads, %lu operands (%.1f MB)\n", path,
+           (unsigned long)count, nCallers, (unsigned long)extent.size(), total / 1048576.0);
+
+    gemmSetNumThreads(threads);
+
+    std::vector<uint64_t> replayed(count, 0);
+    std::map<std::string, ShapeStats> shapes;
+    double bestWall = 0.0;
+
+    for (int rep = 0; rep < repeat; ++rep) {
+        std::vector<ReplayThread> ctx(nCallers);
+        std::vector<CUTThread> handles(nCallers);
+        uint64_t origin = gemmTraceNow();
+
+        for (int t = 0; t < nCallers; ++t) {
+            ctx[t].records = records;
+            ctx[t].count = count;
+            ctx[t].thread = t;
+            ctx[t].operands = &operands[0];
+            ctx[t].packed = &packed[0];
+            ctx[t].timing = timing;
+            ctx[t].scale = scale;
+            ctx[t].origin = origin;
+            ctx[t].replayed = &replayed[0];
+            handles[t] = cutStartThread((CUT_THREADROUTINE)replayMain, &ctx[t]);
+        }
+        cutWaitForThreads(&handles[0], nCallers);
+
+        double wall = (gemmTraceNow() - origin) * 1.0e-9;
+        printf("pass %d: %.6f sec\n", rep + 1, wall);
+        if (rep == 0 || wall < bestWall) bestWall = wall;
+
+        for (size_t i = 0; i < count; ++i) {
+            const TraceRecord* r = &records[i];
+            char key[96];
+            sprintf(key, "%s %c%c %ux%ux%u%s", r->dtype == MATRIX_FLOAT64 ? "f64" : "f32",
+                    (r->flags & TRACE_TRANS_A) ? 'T' : 'N',
+                    (r->flags & TRACE_TRANS_B) ? 'T' : 'N', r->M, r->N, r->K,
+                    (r->flags & TRACE_ASYNC) ? " async" : (r->flags & TRACE_PACKED_B) ? " packed"
+                    : (r->flags & TRACE_IN_PLACE) ? " in-place" : "");
+            ShapeStats& s = shapes[key];
+            s.count += 1;
+            s.recorded += (double)r->duration;
+            s.replayed += (double)replayed[i];
+            s.flops += 2.0 * r->M * r->N * r->K;
+        }
+    }
+
+    uint64_t span = records[count - 1].start + records[count - 1].duration;
+    for (size_t i = 0; i < count; ++i)
+        if (records[i].start + records[i].duration > span)
+            span = records[i].start + records[i].duration;
+
+    printf("\n%-24s %8s %14s %14s %8s %10s\n",
+           "shape", "calls", "recorded_us", "replayed_us", "ratio", "GFlop/s");
+    for (std::map<std::string, ShapeStats>::iterator it = shapes.begin(); it != shapes.end(); ++it) {
+        const ShapeStats& s = it->second;
+        printf("%-24s %8d %14.2f %14.2f %8.3f %10.3f\n", it->first.c_str(), s.count / repeat,
+               s.recorded / s.count * 1.0e-3, s.replayed / s.count * 1.0e-3,
+               s.recorded > 0.0 ? s.replayed / s.recorded : 0.0,
+               s.replayed > 0.0 ? s.flops / s.replayed : 0.0);
+    }
+    printf("\nrecorded span %.6f sec, best replay %.6f sec\n", span * 1.0e-9, bestWall);
+
+    for (size_t i = 0; i < packed.size(); ++i)
+        if (packed[i]) gemmFreePackedB(packed[i]);
+    gemmShutdown();
+    arenaDestroy(&arena);
+    free(records);
+    return 0;
+}
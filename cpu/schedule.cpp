@@ -0,0 +1,690 @@
+// Loop-nest schedules for C = A * B, applied at run time.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "schedule.h"
+#include "gemmJit.h"
+#include "matrixIO.h"
+
+#define SCHED_MAX_LOOPS 16
+#define SCHED_NAME_LEN  16
+
+#define AXIS_I 0
+#define AXIS_J 1
+#define AXIS_K 2
+
+#define OPERAND_A 0
+#define OPERAND_B 1
+
+typedef struct {
+    char name[SCHED_NAME_LEN];
+    int  axis;
+    int  step;                      // elements of the axis per iteration
+    bool vectorize;
+    bool parallel;
+} ScheduleLoop;
+
+struct Schedule {
+    ScheduleLoop loops[SCHED_MAX_LOOPS];    // outermost first
+    int          nLoops;
+    char         packAt[2][SCHED_NAME_LEN]; // per operand; empty if not packed
+};
+
+static const char* axisName(int axis)
+{
+    return axis == AXIS_I ? "i" : axis == AXIS_J ? "j" : "k";
+}
+
+static int findLoop(const Schedule* s, const char* name)
+{
+    for (int l = 0; l < s->nLoops; ++l)
+        if (strcmp(s->loops[l].name, name) == 0) return l;
+    return -1;
+}
+
+static bool newName(const Schedule* s, const char* name)
+{
+    if (!name[0] || strlen(name) >= SCHED_NAME_LEN) {
+        fprintf(stderr, "schedule: bad loop name '%s'\n", name);
+        return false;
+    }
+    if (findLoop(s, name) >= 0) {
+        fprintf(stderr, "schedule: loop %s already exists\n", name);
+        return false;
+    }
+    return true;
+}
+
+static int needLoop(const Schedule* s, const char* name)
+{
+    int l = findLoop(s, name);
+    if (l < 0) fprintf(stderr, "schedule: no loop %s\n", name);
+    return l;
+}
+
+Schedule* scheduleCreate()
+{
+    Schedule* s = (Schedule*)calloc(1, sizeof(Schedule));
+    if (!s) return NULL;
+    const char* names[3] = { "i", "j", "k" };
+    for (int a = 0; a < 3; ++a) {
+        strcpy(s->loops[a].name, names[a]);
+        s->loops[a].axis = a;
+        s->loops[a].step = 1;
+    }
+    s->nLoops = 3;
+    return s;
+}
+
+void scheduleDestroy(Schedule* s)
+{
+    free(s);
+}
+
+bool scheduleSplit(Schedule* s, const char* loop, int factor, const char* outer, const char* inner)
+{
+    int l = needLoop(s, loop);
+    if (l < 0) return false;
+    if (factor < 2) {
+        fprintf(stderr, "schedule: split factor %d of %s is below 2\n", factor, loop);
+        return false;
+    }
+    if (s->nLoops >= SCHED_MAX_LOOPS) {
+        fprintf(stderr, "schedule: more than %d loops\n", SCHED_MAX_LOOPS);
+        return false;
+    }
+    ScheduleLoop old = s->loops[l];
+    // The old name may be reused by either half
+    s->loops[l].name[0] = 0;
+    if (strcmp(outer, inner) == 0 || !newName(s, outer) || !newName(s, inner)) {
+        s->loops[l] = old;
+        if (strcmp(outer, inner) == 0) fprintf(stderr, "schedule: both halves named %s\n", outer);
+        return false;
+    }
+
+    memmove(&s->loops[l + 2], &s->loops[l + 1], sizeof(ScheduleLoop) * (s->nLoops - l - 1));
+    ++s->nLoops;
+    ScheduleLoop* o = &s->loops[l];
+    ScheduleLoop* i = &s->loops[l + 1];
+    *o = old;
+    *i = old;
+    strcpy(o->name, outer);
+    strcpy(i->name, inner);
+    o->step = old.step * factor;
+    o->vectorize = false;           // stays with the inner half
+    i->parallel = false;            // stays with the outer half
+    return true;
+}
+
+bool scheduleReorder(Schedule* s, const char* const* loops, int count)
+{
+    int at[SCHED_MAX_LOOPS];
+    if (count > s->nLoops) {
+        fprintf(stderr, "schedule: reorder of more loops than there are\n");
+        return false;
+    }
+    for (int n = 0; n < count; ++n) {
+        if ((at[n] = needLoop(s, loops[n])) < 0) return false;
+        for (int m = 0; m < n; ++m)
+            if (at[m] == at[n]) {
+                fprintf(stderr, "schedule: %s listed twice in reorder\n", loops[n]);
+                return false;
+            }
+    }
+
+    // The positions they hold, in increasing order, get the loops in the
+    // order listed
+    ScheduleLoop moved[SCHED_MAX_LOOPS];
+    for (int n = 0; n < count; ++n) moved[n] = s->loops[at[n]];
+    for (int n = 1; n < count; ++n)
+        for (int m = n; m > 0 && at[m - 1] > at[m]; --m) {
+            int t = at[m]; at[m] = at[m - 1]; at[m - 1] = t;
+        }
+    for (int n = 0; n < count; ++n) s->loops[at[n]] = moved[n];
+    return true;
+}
+
+bool scheduleTile(Schedule* s, const char* x, const char* y, int fx, int fy,
+                  const char* xo, const char* yo, const char* xi, const char* yi)
+{
+    if (!scheduleSplit(s, x, fx, xo, xi) || !scheduleSplit(s, y, fy, yo, yi)) return false;
+    const char* order[4] = { xo, yo, xi, yi };
+    return scheduleReorder(s, order, 4);
+}
+
+bool scheduleVectorize(Schedule* s, const char* loop)
+{
+    int l = needLoop(s, loop);
+    if (l < 0) return false;
+    s->loops[l].vectorize = true;
+    return true;
+}
+
+bool scheduleParallel(Schedule* s, const char* loop)
+{
+    int l = needLoop(s, loop);
+    if (l < 0) return false;
+    s->loops[l].parallel = true;
+    return true;
+}
+
+bool schedulePack(Schedule* s, char operand, const char* loop)
+{
+    int op = (operand == 'A' || operand == 'a') ? OPERAND_A
+           : (operand == 'B' || operand == 'b') ? OPERAND_B : -1;
+    if (op < 0) {
+        fprintf(stderr, "schedule: only A and B can be packed, not %c\n", operand);
+        return false;
+    }
+    if (needLoop(s, loop) < 0) return false;
+    strcpy(s->packAt[op], loop);
+    return true;
+}
+
+bool scheduleCheck(const Schedule* s)
+{
+    int parallel = -1;
+    for (int l = 0; l < s->nLoops; ++l) {
+        const ScheduleLoop* loop = &s->loops[l];
+        for (int m = l + 1; m < s->nLoops; ++m)
+            if (s->loops[m].axis == loop->axis && s->loops[m].step >= loop->step) {
+                fprintf(stderr, "schedule: %s must be inside %s, which steps further over %s\n",
+                        loop->name, s->loops[m].name, axisName(loop->axis));
+                return false;
+            }
+        if (loop->vectorize && (l != s->nLoops - 1 || loop->axis != AXIS_J)) {
+            fprintf(stderr, "schedule: only the innermost loop can be vectorized, and only over j (%s)\n",
+                    loop->name);
+            return false;
+        }
+        if (loop->parallel) {
+            if (loop->axis == AXIS_K) {
+                fprintf(stderr, "schedule: %s runs over k, whose iterations all write C\n", loop->name);
+                return false;
+            }
+            if (parallel >= 0) {
+                fprintf(stderr, "schedule: %s and %s are both parallel\n",
+                        s->loops[parallel].name, loop->name);
+                return false;
+            }
+            parallel = l;
+        }
+    }
+    for (int op = 0; op < 2; ++op)
+        if (s->packAt[op][0] && findLoop(s, s->packAt[op]) < 0) {
+            fprintf(stderr, "schedule: %c is packed at %s, which no longer exists\n",
+                    op == OPERAND_A ? 'A' : 'B', s->packAt[op]);
+            return false;
+        }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Parsing
+////////////////////////////////////////////////////////////////////////////////
+
+#define SCHED_MAX_WORDS 16
+
+// One statement, already split into words
+static bool applyStatement(Schedule* s, char** w, int n)
+{
+    if (strcmp(w[0], "split") == 0 && n == 5)
+        return scheduleSplit(s, w[1], atoi(w[2]), w[3], w[4]);
+    if (strcmp(w[0], "reorder") == 0 && n >= 3)
+        return scheduleReorder(s, (const char* const*)(w + 1), n - 1);
+    if (strcmp(w[0], "tile") == 0 && n == 9)
+        return scheduleTile(s, w[1], w[2], atoi(w[3]), atoi(w[4]), w[5], w[6], w[7], w[8]);
+    if (strcmp(w[0], "vectorize") == 0 && n == 2)
+        return scheduleVectorize(s, w[1]);
+    if (strcmp(w[0], "parallel") == 0 && n == 2)
+        return scheduleParallel(s, w[1]);
+    if (strcmp(w[0], "pack") == 0 && n == 3 && strlen(w[1]) == 1)
+        return schedulePack(s, w[1][0], w[2]);
+    fprintf(stderr, "schedule: cannot read statement '%s' with %d words\n", w[0], n);
+    return false;
+}
+
+bool scheduleParse(Schedule* s, const char* text)
+{
+    char* copy = strdup(text);
+    if (!copy) return false;
+    bool ok = true;
+    char* rest = copy;
+    while (ok && rest) {
+        char* stmt = rest;
+        rest = strpbrk(rest, ";\n");
+        if (rest) *rest++ = 0;
+
+        char* words[SCHED_MAX_WORDS];
+        int n = 0;
+        for (char* p = stmt; *p && n < SCHED_MAX_WORDS; ) {
+            while (*p && (isspace((unsigned char)*p) || *p == ',')) ++p;
+            if (!*p) break;
+            words[n++] = p;
+            while (*p && !isspace((unsigned char)*p) && *p != ',') ++p;
+            if (*p) *p++ = 0;
+        }
+        if (n > 0) ok = applyStatement(s, words, n);
+    }
+    free(copy);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Lowering
+////////////////////////////////////////////////////////////////////////////////
+
+// What a schedule lowers to for one problem size
+typedef struct {
+    ScheduleLoop loops[SCHED_MAX_LOOPS];
+    int  nLoops;
+    int  dims[3];
+    int  leafStart;                 // loops from here on are the leaf
+    int  leafOrder[3];              // axes of the leaf loops, outermost first
+    bool vectorize;
+    bool micro;                     // leaf is an mr x nr register kernel
+    int  mr, nr;
+    int  pack[2];                   // loop index per operand, or -1
+    int  packRows[2], packCols[2];
+    size_t packElems[2];
+    int  parallel;                  // loop index, or -1
+} Plan;
+
+// Extent of axis within the body of loop l: the step of the innermost loop
+// over that axis at or outside l, or the whole dimension
+static int region(const Plan* p, int l, int axis)
+{
+    for (int m = l; m >= 0; --m)
+        if (p->loops[m].axis == axis) return p->loops[m].step;
+    return p->dims[axis];
+}
+
+// The step of the loop just outside the leaf loop over axis, or the whole
+// dimension: the largest span the leaf sees along it
+static int leafSpan(const Plan* p, int axis)
+{
+    return region(p, p->leafStart - 1, axis);
+}
+
+// Every loop over axis other than the leaf's steps by a multiple of tile,
+// so leaf blocks start on tile boundaries however the loops are nested
+static bool aligned(const Plan* p, int axis, int tile)
+{
+    for (int l = 0; l < p->leafStart; ++l)
+        if (p->loops[l].axis == axis && p->loops[l].step % tile != 0) return false;
+    return true;
+}
+
+static void lower(const Schedule* s, int dtype, int M, int N, int K, Plan* p)
+{
+    memset(p, 0, sizeof(*p));
+    memcpy(p->loops, s->loops, sizeof(s->loops));
+    p->nLoops = s->nLoops;
+    p->dims[AXIS_I] = M;
+    p->dims[AXIS_J] = N;
+    p->dims[AXIS_K] = K;
+    p->parallel = -1;
+    for (int l = 0; l < p->nLoops; ++l)
+        if (p->loops[l].parallel) p->parallel = l;
+
+    // The leaf: the innermost loops, while each is over a new axis. Axes it
+    // leaves out have one element left by then; they go outermost.
+    bool seen[3] = { false, false, false };
+    p->leafStart = p->nLoops;
+    while (p->leafStart > 0 && !seen[p->loops[p->leafStart - 1].axis]
+           && !p->loops[p->leafStart - 1].parallel) {
+        --p->leafStart;
+        seen[p->loops[p->leafStart].axis] = true;
+    }
+    int n = 0;
+    for (int a = 0; a < 3; ++a)
+        if (!seen[a]) p->leafOrder[n++] = a;
+    for (int l = p->leafStart; l < p->nLoops; ++l)
+        p->leafOrder[n++] = p->loops[l].axis;
+    p->vectorize = p->loops[p->nLoops - 1].vectorize;
+
+    for (int op = 0; op < 2; ++op) {
+        p->pack[op] = s->packAt[op][0] ? findLoop(s, s->packAt[op]) : -1;
+        // A pack inside the leaf would copy a single element at a time
+        if (p->pack[op] >= p->leafStart) p->pack[op] = -1;
+    }
+
+    // The register kernel needs k outermost in the leaf, a tile small enough
+    // for the registers, aligned leaf blocks and both operands in slivers
+    int lanes = 32 / matrixTypeSize(dtype);
+    p->mr = leafSpan(p, AXIS_I);
+    p->nr = leafSpan(p, AXIS_J);
+    p->micro = p->nLoops - p->leafStart == 3
+            && p->leafOrder[0] == AXIS_K && p->leafOrder[1] == AXIS_I && p->leafOrder[2] == AXIS_J
+            && p->vectorize && p->pack[OPERAND_A] >= 0 && p->pack[OPERAND_B] >= 0
+            && p->mr <= GEMM_JIT_MAX_MR && p->nr <= GEMM_JIT_MAX_NR && p->nr % lanes == 0
+            && aligned(p, AXIS_I, p->mr) && aligned(p, AXIS_J, p->nr);
+
+    for (int op = 0; op < 2; ++op) {
+        if (p->pack[op] < 0) continue;
+        int l = p->pack[op];
+        int rows = region(p, l, op == OPERAND_A ? AXIS_I : AXIS_K);
+        int cols = region(p, l, op == OPERAND_A ? AXIS_K : AXIS_J);
+        rows = rows < p->dims[op == OPERAND_A ? AXIS_I : AXIS_K] ? rows : p->dims[op == OPERAND_A ? AXIS_I : AXIS_K];
+        cols = cols < p->dims[op == OPERAND_A ? AXIS_K : AXIS_J] ? cols : p->dims[op == OPERAND_A ? AXIS_K : AXIS_J];
+        p->packRows[op] = rows;
+        p->packCols[op] = cols;
+        // Slivers are padded to whole tiles: A's rows to mr, B's columns to nr
+        if (p->micro && op == OPERAND_A)
+            p->packElems[op] = (size_t)((rows + p->mr - 1) / p->mr) * p->mr * cols;
+        else if (p->micro)
+            p->packElems[op] = (size_t)((cols + p->nr - 1) / p->nr) * p->nr * rows;
+        else
+            p->packElems[op] = (size_t)rows * cols;
+    }
+}
+
+void schedulePrint(const Schedule* s, int M, int N, int K, FILE* out)
+{
+    if (!scheduleCheck(s)) return;
+    Plan p;
+    lower(s, MATRIX_FLOAT32, M, N, K, &p);
+    fprintf(out, "schedule for %d x %d x %d:\n", M, N, K);
+    int depth = 0;
+    for (int l = 0; l < p.leafStart; ++l, ++depth) {
+        const ScheduleLoop* loop = &p.loops[l];
+        fprintf(out, "%*sfor %s in %s step %d%s\n", 2 * depth, "", loop->name,
+                axisName(loop->axis), loop->step, loop->parallel ? "  (parallel)" : "");
+        for (int op = 0; op < 2; ++op)
+            if (p.pack[op] == l)
+                fprintf(out, "%*spack %c, %d x %d%s\n", 2 * depth + 2, "", op == OPERAND_A ? 'A' : 'B',
+                        p.packRows[op], p.packCols[op], p.micro ? " in slivers" : "");
+    }
+    fprintf(out, "%*sleaf", 2 * depth, "");
+    for (int l = p.leafStart; l < p.nLoops; ++l)
+        fprintf(out, " %s", p.loops[l].name);
+    if (p.micro)
+        fprintf(out, ": %d x %d register kernel (%s)\n", p.mr, p.nr,
+                gemmJitKernel(MATRIX_FLOAT32, p.mr, p.nr, p.mr, p.nr, GEMM_JIT_UNROLL, 1, 1)
+                ? "generated" : "compiled");
+    else
+        fprintf(out, ": loops over %s, %s, %s%s\n", axisName(p.leafOrder[0]), axisName(p.leafOrder[1]),
+                axisName(p.leafOrder[2]), p.vectorize ? ", vectorized" : "");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Execution
+////////////////////////////////////////////////////////////////////////////////
+
+// Where an operand is read from: the matrix itself or its packed copy.
+// Element (r, c) of a plain view is at p[(r - r0) * ld + (c - c0)]; a view
+// in slivers keeps kext, the depth of the pack.
+template <typename T>
+struct View {
+    const T* p;
+    int      ld;
+    int      r0, c0;
+    int      kext;
+};
+
+template <typename T>
+struct Exec {
+    const Plan* plan;
+    const T*    A; int lda;
+    const T*    B; int ldb;
+    T*          C; int ldc;
+    View<T>     view[2];
+    T**         buffers;            // [thread * 2 + operand]
+    int         thread;
+};
+
+// Compiled leaf for one loop order: outermost X, then Y, innermost Z
+template <typename T, int X, int Y, int Z, bool VEC>
+static void leafLoops(const int* n, const T* a, int lda, const T* b, int ldb, T* c, int ldc)
+{
+    int idx[3];
+    for (idx[X] = 0; idx[X] < n[X]; ++idx[X])
+        for (idx[Y] = 0; idx[Y] < n[Y]; ++idx[Y]) {
+            if (Z == AXIS_J) {
+                T av = a[(size_t)idx[AXIS_I] * lda + idx[AXIS_K]];
+                const T* br = b + (size_t)idx[AXIS_K] * ldb;
+                T* cr = c + (size_t)idx[AXIS_I] * ldc;
+                if (VEC) {
+                    #pragma omp simd
+                    for (int j = 0; j < n[AXIS_J]; ++j)
+                        cr[j] += av * br[j];
+                } else {
+                    for (int j = 0; j < n[AXIS_J]; ++j)
+                        cr[j] += av * br[j];
+                }
+            } else if (Z == AXIS_K) {
+                const T* ar = a + (size_t)idx[AXIS_I] * lda;
+                const T* bc = b + idx[AXIS_J];
+                T sum = 0;
+                for (int k = 0; k < n[AXIS_K]; ++k)
+                    sum += ar[k] * bc[(size_t)k * ldb];
+                c[(size_t)idx[AXIS_I] * ldc + idx[AXIS_J]] += sum;
+            } else {
+                T bv = b[(size_t)idx[AXIS_K] * ldb + idx[AXIS_J]];
+                const T* ac = a + idx[AXIS_K];
+                T* cc = c + idx[AXIS_J];
+                for (int i = 0; i < n[AXIS_I]; ++i)
+                    cc[(size_t)i * ldc] += ac[(size_t)i * lda] * bv;
+            }
+        }
+}
+
+typedef void (*LeafFn)(const int*, const void*, int, const void*, int, void*, int);
+
+template <typename T, bool VEC>
+static LeafFn leafFor(const int* order)
+{
+    int code = order[0] * 9 + order[1] * 3 + order[2];
+    switch (code) {
+    case 0 * 9 + 1 * 3 + 2: return (LeafFn)leafLoops<T, 0, 1, 2, VEC>;
+    case 0 * 9 + 2 * 3 + 1: return (LeafFn)leafLoops<T, 0, 2, 1, VEC>;
+    case 1 * 9 + 0 * 3 + 2: return (LeafFn)leafLoops<T, 1, 0, 2, VEC>;
+    case 1 * 9 + 2 * 3 + 0: return (LeafFn)leafLoops<T, 1, 2, 0, VEC>;
+    case 2 * 9 + 0 * 3 + 1: return (LeafFn)leafLoops<T, 2, 0, 1, VEC>;
+    case 2 * 9 + 1 * 3 + 0: return (LeafFn)leafLoops<T, 2, 1, 0, VEC>;
+    }
+    return NULL;
+}
+
+// The register kernel when none is generated: C[0..m, 0..n] += a * b over
+// slivers of mr and nr
+template <typename T>
+static void microLeaf(int kc, int mr, int nr, int m, int n, const T* a, const T* b, T* C, int ldc)
+{
+    T acc[GEMM_JIT_MAX_MR * GEMM_JIT_MAX_NR];
+    for (int x = 0; x < mr * nr; ++x) acc[x] = 0;
+    for (int p = 0; p < kc; ++p) {
+        for (int i = 0; i < mr; ++i) {
+            T ai = a[i];
+            #pragma omp simd
+            for (int j = 0; j < nr; ++j)
+                acc[i * nr + j] += ai * b[j];
+        }
+        a += mr;
+        b += nr;
+    }
+    for (int i = 0; i < m; ++i)
+        for (int j = 0; j < n; ++j)
+            C[(size_t)i * ldc + j] += acc[i * nr + j];
+}
+
+template <typename T>
+static void packOperand(Exec<T>* e, int op, const int* base, const int* limit)
+{
+    const Plan* p = e->plan;
+    int ra = (op == OPERAND_A) ? AXIS_I : AXIS_K;
+    int ca = (op == OPERAND_A) ? AXIS_K : AXIS_J;
+    int r0 = base[ra], rows = limit[ra] - base[ra];
+    int c0 = base[ca], cols = limit[ca] - base[ca];
+    const T* src = (op == OPERAND_A) ? e->A : e->B;
+    int ld = (op == OPERAND_A) ? e->lda : e->ldb;
+    T* dst = e->buffers[e->thread * 2 + op];
+
+    View<T>* v = &e->view[op];
+    v->p = dst;
+    v->r0 = r0;
+    v->c0 = c0;
+    if (!p->micro) {
+        v->ld = cols;
+        for (int r = 0; r < rows; ++r)
+            memcpy(dst + (size_t)r * cols, src + (size_t)(r0 + r) * ld + c0, sizeof(T) * cols);
+    } else if (op == OPERAND_A) {
+        // Slivers of mr rows, each column by column: the k extent is cols
+        v->kext = cols;
+        for (int s = 0; s < rows; s += p->mr)
+            for (int k = 0; k < cols; ++k)
+                for (int i = 0; i < p->mr; ++i)
+                    *dst++ = (s + i < rows) ? src[(size_t)(r0 + s + i) * ld + c0 + k] : 0;
+    } else {
+        // Slivers of nr columns, each row by row: the k extent is rows
+        v->kext = rows;
+        for (int s = 0; s < cols; s += p->nr)
+            for (int k = 0; k < rows; ++k)
+                for (int j = 0; j < p->nr; ++j)
+                    *dst++ = (s + j < cols) ? src[(size_t)(r0 + k) * ld + c0 + s + j] : 0;
+    }
+}
+
+template <typename T>
+static void runLeaf(Exec<T>* e, const int* base, const int* limit)
+{
+    const Plan* p = e->plan;
+    int n[3];
+    for (int a = 0; a < 3; ++a) n[a] = limit[a] - base[a];
+    int i0 = base[AXIS_I], j0 = base[AXIS_J], k0 = base[AXIS_K];
+    T* C = e->C + (size_t)i0 * e->ldc + j0;
+    const View<T>& va = e->view[OPERAND_A];
+    const View<T>& vb = e->view[OPERAND_B];
+
+    if (p->micro) {
+        const T* a = va.p + (size_t)((i0 - va.r0) / p->mr) * p->mr * va.kext + (size_t)(k0 - va.c0) * p->mr;
+        const T* b = vb.p + (size_t)((j0 - vb.c0) / p->nr) * p->nr * vb.kext + (size_t)(k0 - vb.r0) * p->nr;
+        int dtype = sizeof(T) == sizeof(double) ? MATRIX_FLOAT64 : MATRIX_FLOAT32;
+        GemmJitKernel kernel = gemmJitKernel(dtype, p->mr, p->nr, n[AXIS_I], n[AXIS_J],
+                                             GEMM_JIT_UNROLL, 1, 1);
+        if (kernel) {
+            T alphaBeta[2] = { 1, 1 };
+            kernel(n[AXIS_K], a, b, C, (long)(e->ldc * sizeof(T)), alphaBeta);
+        } else {
+            microLeaf<T>(n[AXIS_K], p->mr, p->nr, n[AXIS_I], n[AXIS_J], a, b, C, e->ldc);
+        }
+        return;
+    }
+
+    const T* a = va.p + (size_t)(i0 - va.r0) * va.ld + (k0 - va.c0);
+    const T* b = vb.p + (size_t)(k0 - vb.r0) * vb.ld + (j0 - vb.c0);
+    LeafFn leaf = p->vectorize ? leafFor<T, true>(p->leafOrder) : leafFor<T, false>(p->leafOrder);
+    leaf(n, a, va.ld, b, vb.ld, C, e->ldc);
+}
+
+template <typename T>
+static void runLevel(Exec<T>* e, int level, const int* base, const int* limit);
+
+// One iteration of loop level over [x, x + step)
+template <typename T>
+static void runIteration(Exec<T>* e, int level, int x, const int* base, const int* limit)
+{
+    const Plan* p = e->plan;
+    int a = p->loops[level].axis;
+    int b[3] = { base[0], base[1], base[2] };
+    int l[3] = { limit[0], limit[1], limit[2] };
+    b[a] = x;
+    l[a] = (x + p->loops[level].step < limit[a]) ? x + p->loops[level].step : limit[a];
+    for (int op = 0; op < 2; ++op)
+        if (p->pack[op] == level) packOperand(e, op, b, l);
+    runLevel(e, level + 1, b, l);
+}
+
+template <typename T>
+static void runLevel(Exec<T>* e, int level, const int* base, const int* limit)
+{
+    const Plan* p = e->plan;
+    if (level == p->leafStart) {
+        runLeaf(e, base, limit);
+        return;
+    }
+    int a = p->loops[level].axis, step = p->loops[level].step;
+    if (level != p->parallel) {
+        for (int x = base[a]; x < limit[a]; x += step)
+            runIteration(e, level, x, base, limit);
+        return;
+    }
+
+    // Each thread packs into buffers of its own from here on
+    int count = (limit[a] - base[a] + step - 1) / step;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int t = 0; t < count; ++t) {
+        Exec<T> local = *e;
+#ifdef _OPENMP
+        local.thread = omp_get_thread_num();
+#endif
+        runIteration(&local, level, base[a] + t * step, base, limit);
+    }
+}
+
+template <typename T>
+static bool scheduleGemm(const Schedule* s, int M, int N, int K, const T* A, int lda,
+                         const T* B, int ldb, T* C, int ldc)
+{
+    if (!scheduleCheck(s)) return false;
+    for (int i = 0; i < M; ++i)
+        memset(C + (size_t)i * ldc, 0, sizeof(T) * N);
+    if (M <= 0 || N <= 0 || K <= 0) return true;
+
+    int dtype = sizeof(T) == sizeof(double) ? MATRIX_FLOAT64 : MATRIX_FLOAT32;
+    Plan plan;
+    lower(s, dtype, M, N, K, &plan);
+
+    int threads = 1;
+#ifdef _OPENMP
+    if (plan.parallel >= 0) threads = omp_get_max_threads();
+#endif
+    T** buffers = (T**)calloc((size_t)threads * 2, sizeof(T*));
+    bool ok = buffers != NULL;
+    for (int t = 0; ok && t < threads; ++t)
+        for (int op = 0; op < 2; ++op)
+            if (plan.pack[op] >= 0) {
+                // Packs outside the parallel loop are shared: thread 0's
+                bool perThread = plan.parallel >= 0 && plan.pack[op] >= plan.parallel;
+                if (t > 0 && !perThread) continue;
+                buffers[t * 2 + op] = (T*)aligned_alloc(64, (plan.packElems[op] * sizeof(T) + 63) / 64 * 64);
+                ok = ok && buffers[t * 2 + op];
+            }
+    if (!ok) {
+        fprintf(stderr, "schedule: cannot allocate pack buffers\n");
+    } else {
+        Exec<T> e;
+        memset(&e, 0, sizeof(e));
+        e.plan = &plan;
+        e.A = A; e.lda = lda;
+        e.B = B; e.ldb = ldb;
+        e.C = C; e.ldc = ldc;
+        e.view[OPERAND_A].p = A; e.view[OPERAND_A].ld = lda;
+        e.view[OPERAND_B].p = B; e.view[OPERAND_B].ld = ldb;
+        e.buffers = buffers;
+        int base[3] = { 0, 0, 0 };
+        runLevel(&e, 0, base, plan.dims);
+    }
+    if (buffers)
+        for (int x = 0; x < threads * 2; ++x) free(buffers[x]);
+    free(buffers);
+    return ok;
+}
+
+bool scheduleSgemm(const Schedule* s, int M, int N, int K, const float* A, int lda,
+                   const float* B, int ldb, float* C, int ldc)
+{
+    return scheduleGemm<float>(s, M, N, K, A, lda, B, ldb, C, ldc);
+}
+
+bool scheduleDgemm(const Schedule* s, int M, int N, int K, const double* A, int lda,
+                   const double* B, int ldb, double* C, int ldc)
+{
+    return scheduleGemm<double>(s, M, N, K, A, lda, B, ldb, C, ldc);
+}
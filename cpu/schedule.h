@@ -0,0 +1,67 @@
+#ifndef _SCHEDULE_H_
+#define _SCHEDULE_H_
+
+// Loop-nest schedules for C = A * B, applied at run time.
+//
+// The computation is fixed: C[i][j] += A[i][k] * B[k][j] over loops i, j and
+// k, outermost first, after C is cleared. A schedule rewrites that loop nest
+// with a few transformations, either one call at a time or from text:
+//
+//     split i 64 io ii         io steps 64 rows at a time, ii the rows within
+//     reorder jo ko io ii      these loops take the places they held among
+//                              themselves, in the order given
+//     tile i j 64 256 io jo ii ji    split both, then reorder io jo ii ji;
+//                              k stays innermost, after ji, so vectorizing
+//                              ji takes a reorder io jo k ii ji as well
+//     vectorize jii            the innermost loop, which must run over j
+//     parallel io              iterations shared among OpenMP threads; not
+//                              over k, and only one loop
+//     pack A io                at each iteration of io, copy the part of A
+//                              the body reads into a contiguous buffer
+//
+// Statements are separated by ';' or newlines. The loops over one axis must
+// stay in the order splitting left them, larger steps outside. A factor need
+// not divide anything: the last iteration of a loop simply covers less.
+//
+// Execution interprets the loops down to the leaf: the innermost loops, one
+// per axis at most, run as compiled code for their order. When the leaf is
+// (k, i, j) with j vectorized, i and j split to an mr x nr register tile
+// (mr <= 8, nr a multiple of one vector and <= 16), and both A and B packed,
+// the leaf is a register micro-kernel and the packs use its sliver layout;
+// the kernel is generated by gemmJit when it can be, and is compiled code
+// otherwise. schedulePrint() shows what a schedule lowers to.
+
+#include <stdio.h>
+
+typedef struct Schedule Schedule;
+
+// The plain i, j, k loop nest
+Schedule* scheduleCreate();
+void scheduleDestroy(Schedule* s);
+
+// Transformations; each prints a message and returns false if it does not
+// apply (unknown or duplicate loop names, a factor below 2, too many loops)
+bool scheduleSplit(Schedule* s, const char* loop, int factor, const char* outer, const char* inner);
+bool scheduleReorder(Schedule* s, const char* const* loops, int count);
+bool scheduleTile(Schedule* s, const char* x, const char* y, int fx, int fy,
+                  const char* xo, const char* yo, const char* xi, const char* yi);
+bool scheduleVectorize(Schedule* s, const char* loop);
+bool scheduleParallel(Schedule* s, const char* loop);
+bool schedulePack(Schedule* s, char operand, const char* loop);
+
+// Applies every statement of text in turn
+bool scheduleParse(Schedule* s, const char* text);
+
+// Checks the whole schedule (loop order, annotations); false with a message
+bool scheduleCheck(const Schedule* s);
+
+// The loop nest as pseudo-code, and the leaf it lowers to for M x N x K
+void schedulePrint(const Schedule* s, int M, int N, int K, FILE* out);
+
+// C = A * B under the schedule; A is M x K, B K x N, C M x N, all row-major
+bool scheduleSgemm(const Schedule* s, int M, int N, int K, const float* A, int lda,
+                   const float* B, int ldb, float* C, int ldc);
+bool scheduleDgemm(const Schedule* s, int M, int N, int K, const double* A, int lda,
+                   const double* B, int ldb, double* C, int ldc);
+
+#endif // _SCHEDULE_H_
@@ -0,0 +1,524 @@
+// In-process parameter sweep.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <set>
+#include <map>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "arena.h"
+#include "cpuFreq.h"
+#include "gemm.h"
+#include "matrixIO.h"
+#include "matrixMul_gold.h"
+#include "matrixMul_cache.h"
+#include "sweep.h"
+
+static volatile sig_atomic_t sweepInterrupted = 0;
+
+static void onInterrupt(int)
+{
+    sweepInterrupted = 1;
+}
+
+static double sweepTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Grid parsing
+////////////////////////////////////////////////////////////////////////////////
+
+static const char* shapeNames[] = { "square", "tall", "wide", "deep" };
+
+const char* sweepShapeName(int shape)
+{
+    return (shape >= 0 && shape <= SHAPE_DEEP) ? shapeNames[shape] : "?";
+}
+
+void sweepShapeDims(int shape, int n, int* M, int* N, int* K)
+{
+    *M = (shape == SHAPE_TALL) ? 4 * n : n;
+    *N = (shape == SHAPE_WIDE) ? 4 * n : n;
+    *K = (shape == SHAPE_DEEP) ? 4 * n : n;
+}
+
+static const char* dtypeName(int dtype)
+{
+    switch (dtype) {
+        case MATRIX_FLOAT32: return "f32";
+        case MATRIX_FLOAT64: return "f64";
+    }
+    return "?";
+}
+
+static int parseShape(const char* s)
+{
+    for (int i = 0; i <= SHAPE_DEEP; ++i)
+        if (strcmp(s, shapeNames[i]) == 0) return i;
+    return -1;
+}
+
+static int parseDtype(const char* s)
+{
+    if (strcmp(s, "f32") == 0) return MATRIX_FLOAT32;
+    if (strcmp(s, "f64") == 0) return MATRIX_FLOAT64;
+    return -1;
+}
+
+// Expands "first:last:xF" or "first:last:+S" into out; false if malformed
+static bool parseRange(const char* s, int* out, int* n)
+{
+    int first, last, step;
+    char op;
+    if (sscanf(s, "%d:%d:%c%d", &first, &last, &op, &step) != 4) return false;
+    if (first <= 0 || last < first || step <= 0 || (op != 'x' && op != '+')) return false;
+    if (op == 'x' && step < 2) return false;
+
+    for (long v = first; v <= last; v = (op == 'x') ? v * step : v + step) {
+        if (*n >= SWEEP_MAX_VALUES) return false;
+        out[(*n)++] = (int)v;
+    }
+    return true;
+}
+
+// Splits a comma-separated list into trimmed items; returns the count, or
+// -1 if there are too many or one is too long
+static int splitList(const char* list, char items[][SWEEP_NAME_LEN])
+{
+    char buf[1024];
+    strncpy(buf, list, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+
+    int n = 0;
+    for (char* item = strtok(buf, ","); item; item = strtok(NULL, ",")) {
+        while (*item == ' ') ++item;
+        char* end = item + strlen(item);
+        while (end > item && end[-1] == ' ') *--end = 0;
+        if (!*item) continue;
+        if (n >= SWEEP_MAX_VALUES || strlen(item) >= SWEEP_NAME_LEN) return -1;
+        strcpy(items[n++], item);
+    }
+    return n;
+}
+
+void sweepDefaults(SweepGrid* grid)
+{
+    memset(grid, 0, sizeof(*grid));
+    parseRange("64:1024:x2", grid->sizes, &grid->nSizes);
+    grid->shapes[grid->nShapes++] = SHAPE_SQUARE;
+    grid->dtypes[grid->nDtypes++] = MATRIX_FLOAT32;
+    grid->threads[grid->nThreads++] = 1;
+    grid->affinity[grid->nAffinity++] = GEMM_AFFINITY_NONE;
+    grid->iters = 3;
+    grid->warmup = 1;
+    grid->seed = 2006;
+    grid->validate = false;
+    grid->resume = true;
+    grid->freq = CPUFREQ_AUTO;
+    grid->drift = 0.05;
+    strcpy(grid->output, "sweep.csv");
+}
+
+bool sweepParseArg(SweepGrid* grid, const char* arg)
+{
+    const char* eq = strchr(arg, '=');
+    if (!eq) {
+        fprintf(stderr, "sweep: expected key=value, got '%s'\n", arg);
+        return false;
+    }
+    std::string key(arg, eq - arg);
+    const char* value = eq + 1;
+    while (!key.empty() && key[key.size() - 1] == ' ') key.erase(key.size() - 1);
+    while (*value == ' ') ++value;
+
+    char items[SWEEP_MAX_VALUES][SWEEP_NAME_LEN];
+    int nItems = splitList(value, items);
+    bool ok = nItems >= 0;
+
+    if (key == "sizes") {
+        grid->nSizes = 0;
+        for (int i = 0; ok && i < nItems; ++i) {
+            if (strchr(items[i], ':')) {
+                ok = parseRange(items[i], grid->sizes, &grid->nSizes);
+            } else {
+                int n = atoi(items[i]);
+                ok = n > 0 && grid->nSizes < SWEEP_MAX_VALUES;
+                if (ok) grid->sizes[grid->nSizes++] = n;
+            }
+        }
+    } else if (key == "shapes") {
+        for (int i = 0; ok && i < nItems; ++i)
+            ok = (grid->shapes[i] = parseShape(items[i])) >= 0;
+        grid->nShapes = nItems;
+    } else if (key == "dtypes") {
+        for (int i = 0; ok && i < nItems; ++i)
+            ok = (grid->dtypes[i] = parseDtype(items[i])) >= 0;
+        grid->nDtypes = nItems;
+    } else if (key == "kernels") {
+        for (int i = 0; ok && i < nItems; ++i)
+            strcpy(grid->kernels[i], items[i]);
+        grid->nKernels = nItems;
+    } else if (key == "baseline") {
+        ok = strlen(value) < sizeof(grid->baseline);
+        if (ok) strcpy(grid->baseline, value);
+    } else if (key == "threads") {
+        for (int i = 0; ok && i < nItems; ++i)
+            ok = (grid->threads[i] = atoi(items[i])) >= 0;
+        grid->nThreads = nItems;
+    } else if (key == "affinity") {
+        for (int i = 0; ok && i < nItems; ++i)
+            ok = (grid->affinity[i] = gemmParseAffinity(items[i])) >= 0;
+        grid->nAffinity = nItems;
+    } else if (key == "iters") {
+        grid->iters = atoi(value);
+        ok = grid->iters > 0;
+    } else if (key == "warmup") {
+        grid->warmup = atoi(value);
+        ok = grid->warmup >= 0;
+    } else if (key == "seed") {
+        grid->seed = (unsigned int)strtoul(value, NULL, 10);
+    } else if (key == "validate") {
+        grid->validate = atoi(value) != 0;
+    } else if (key == "resume") {
+        grid->resume = atoi(value) != 0;
+    } else if (key == "freq") {
+        grid->freq = (strcmp(value, "off") == 0) ? -1 : cpuFreqParseSource(value);
+        ok = strcmp(value, "off") == 0 || grid->freq >= 0;
+    } else if (key == "drift") {
+        grid->drift = atof(value);
+        ok = grid->drift > 0;
+    } else if (key == "output") {
+        ok = strlen(value) > 0 && strlen(value) < sizeof(grid->output);
+        if (ok) strcpy(grid->output, value);
+    } else {
+        fprintf(stderr, "sweep: unknown key '%s'\n", key.c_str());
+        return false;
+    }
+
+    if (!ok) fprintf(stderr, "sweep: invalid value for %s: '%s'\n", key.c_str(), value);
+    return ok;
+}
+
+bool sweepParseFile(SweepGrid* grid, const char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "sweep: cannot open grid file %s\n", path);
+        return false;
+    }
+
+    char line[1024];
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp)) {
+        char* hash = strchr(line, '#');
+        if (hash) *hash = 0;
+        char* end = line + strlen(line);
+        while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ')) *--end = 0;
+        char* start = line;
+        while (*start == ' ' || *start == '\t') ++start;
+        if (*start) ok = sweepParseArg(grid, start);
+    }
+    fclose(fp);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Running
+////////////////////////////////////////////////////////////////////////////////
+
+#define CSV_HEADER "size,shape,dtype,kernel,threads,affinity,M,N,K,iters,setup_sec,best_sec,mean_sec,gflops,valid,ratio,ghz,cycles_per_fma,clock\n"
+
+// Leading fields of a CSV line that identify its point
+static std::string pointKey(int size, int shape, int dtype, const char* kernel, int threads, int affinity)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%d,%s,%s,%s,%d,%s", size, sweepShapeName(shape), dtypeName(dtype),
+             kernel, threads, gemmAffinityName(affinity));
+    return buf;
+}
+
+// Collects the keys and rates of complete lines already in the output;
+// false if it was written with other columns
+static bool loadDone(const char* path, std::set<std::string>* done, std::map<std::string, double>* rates)
+{
+    FILE* fp = fopen(path, "r");
+    if (!fp) return true;
+
+    // rows with other columns cannot be appended to
+    char line[1024];
+    if (fgets(line, sizeof(line), fp) && strcmp(line, CSV_HEADER) != 0) {
+        fprintf(stderr, "sweep: %s has other columns than this sweep writes; "
+                "move it away or set resume=0\n", path);
+        fclose(fp);
+        return false;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        size_t len = strlen(line);
+        // a line cut short by an interruption has no newline; rerun that point
+        if (len == 0 || line[len - 1] != '\n' || strncmp(line, "size,", 5) == 0) continue;
+
+        int commas = 0;
+        std::string key;
+        for (char* p = line; *p; ++p) {
+            if (*p != ',') continue;
+            if (++commas == 6) {
+                key.assign(line, p - line);
+                done->insert(key);
+            } else if (commas == 13) {
+                (*rates)[key] = atof(p + 1);
+                break;
+            }
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+static void fillRandom(void* data, size_t count, int dtype)
+{
+    if (dtype == MATRIX_FLOAT64) {
+        for (size_t i = 0; i < count; ++i)
+            ((double*)data)[i] = rand() / (double)RAND_MAX;
+    } else {
+        for (size_t i = 0; i < count; ++i)
+            ((float*)data)[i] = rand() / (float)RAND_MAX;
+    }
+}
+
+static const SweepKernel* findKernel(const char* name, const SweepKernel* kernels, int nKernels)
+{
+    for (int i = 0; i < nKernels; ++i)
+        if (strcmp(kernels[i].name, name) == 0) return &kernels[i];
+    return NULL;
+}
+
+int sweepRun(const SweepGrid* grid, const SweepKernel* kernels, int nKernels)
+{
+    if (nKernels == 0) return -1;
+
+    // Without an explicit list, the first registered kernel runs
+    int nNames = grid->nKernels;
+    const char* names[SWEEP_MAX_VALUES];
+    for (int i = 0; i < nNames; ++i) {
+        names[i] = grid->kernels[i];
+        if (!findKernel(names[i], kernels, nKernels)) {
+            fprintf(stderr, "sweep: unknown kernel '%s'\n", names[i]);
+            return -1;
+        }
+    }
+    if (nNames == 0) names[nNames++] = kernels[0].name;
+
+    // The baseline runs first so every other kernel's point can refer to it
+    const char* baseline = grid->baseline[0] ? grid->baseline : NULL;
+    if (baseline) {
+        if (!findKernel(baseline, kernels, nKernels)) {
+            fprintf(stderr, "sweep: unknown baseline kernel '%s'\n", baseline);
+            return -1;
+        }
+        int at = 0;
+        while (at < nNames && strcmp(names[at], baseline) != 0) ++at;
+        if (at == nNames) {
+            if (nNames == SWEEP_MAX_VALUES) --at;
+            else ++nNames;
+        }
+        for (; at > 0; --at) names[at] = names[at - 1];
+        names[0] = baseline;
+    }
+
+    // One arena sized for the largest point serves every point
+    size_t maxBytes = 0;
+    for (int s = 0; s < grid->nSizes; ++s)
+        for (int h = 0; h < grid->nShapes; ++h)
+            for (int d = 0; d < grid->nDtypes; ++d) {
+                int M, N, K;
+                sweepShapeDims(grid->shapes[h], grid->sizes[s], &M, &N, &K);
+                size_t bytes = matrixTypeSize(grid->dtypes[d])
+                             * ((size_t)M * K + (size_t)K * N + (size_t)M * N) + 4 * ARENA_ALIGN;
+                if (bytes > maxBytes) maxBytes = bytes;
+            }
+
+    Arena arena;
+    if (!arenaInit(&arena, maxBytes)) {
+        fprintf(stderr, "sweep: cannot map %zu bytes\n", maxBytes);
+        return -1;
+    }
+    arenaPrefault(&arena);
+
+    std::set<std::string> done;
+    std::map<std::string, double> rates;
+    if (grid->resume && !loadDone(grid->output, &done, &rates)) {
+        arenaDestroy(&arena);
+        return -1;
+    }
+    if (!grid->resume) unlink(grid->output);
+
+    FILE* out = fopen(grid->output, "a");
+    if (!out) {
+        fprintf(stderr, "sweep: cannot open %s\n", grid->output);
+        arenaDestroy(&arena);
+        return -1;
+    }
+    if (ftell(out) == 0) fputs(CSV_HEADER, out);
+    if (!done.empty())
+        printf("Resuming: %d points already in %s\n", (int)done.size(), grid->output);
+
+    // opened before any kernel runs, so the counters follow every worker
+    // started from here on; a pool that already runs is not counted
+    CpuFreq freq;
+    bool clock = grid->freq >= 0 && cpuFreqOpen(&freq, grid->freq);
+    if (grid->freq > CPUFREQ_AUTO && !clock) {
+        fclose(out);
+        arenaDestroy(&arena);
+        return -1;
+    }
+    if (clock) printf("Clock measured by %s\n", cpuFreqSourceName(freq.source));
+    std::map<int, double> referenceGHz;     // first point's clock per thread count
+
+    void (*oldHandler)(int) = signal(SIGINT, onInterrupt);
+    sweepInterrupted = 0;
+    int failures = 0;
+
+    for (int a = 0; a < grid->nAffinity && !sweepInterrupted; ++a)
+    for (int t = 0; t < grid->nThreads && !sweepInterrupted; ++t)
+    for (int k = 0; k < nNames && !sweepInterrupted; ++k)
+    for (int d = 0; d < grid->nDtypes && !sweepInterrupted; ++d)
+    for (int h = 0; h < grid->nShapes && !sweepInterrupted; ++h)
+    for (int s = 0; s < grid->nSizes && !sweepInterrupted; ++s)
+    {
+        const SweepKernel* kernel = findKernel(names[k], kernels, nKernels);
+        int dtype = grid->dtypes[d], shape = grid->shapes[h], size = grid->sizes[s];
+        int threads = grid->threads[t], affinity = grid->affinity[a];
+
+        std::string key = pointKey(size, shape, dtype, kernel->name, threads, affinity);
+        if (done.count(key)) continue;
+        if (!(kernel->dtypes & SWEEP_DTYPE_BIT(dtype))) continue;
+
+        gemmSetNumThreads(threads);
+        gemmSetAffinity(affinity);
+#ifdef _OPENMP
+        omp_set_num_threads(threads > 0 ? threads : omp_get_num_procs());
+#endif
+
+        SweepProblem p;
+        sweepShapeDims(shape, size, &p.M, &p.N, &p.K);
+        p.dtype = dtype;
+        p.threads = gemmGetNumThreads();
+
+        // Rewinding the arena hands every point the same, already faulted pages
+        size_t elem = matrixTypeSize(dtype);
+        arenaReset(&arena);
+        double setupStart = sweepTime();
+        void* A = arenaAlloc(&arena, elem * p.M * p.K, 0);
+        void* B = arenaAlloc(&arena, elem * p.K * p.N, 0);
+        p.C = arenaAlloc(&arena, elem * p.M * p.N, 0);
+        p.A = A;
+        p.B = B;
+        srand(grid->seed);
+        fillRandom(A, (size_t)p.M * p.K, dtype);
+        fillRandom(B, (size_t)p.K * p.N, dtype);
+        if (kernel->setup && !kernel->setup(kernel->ctx, &p)) {
+            printf("%-40s skipped\n", key.c_str());
+            continue;
+        }
+        double setupSec = sweepTime() - setupStart;
+
+        for (int i = 0; i < grid->warmup; ++i)
+            kernel->run(kernel->ctx, &p);
+
+        double best = 0, total = 0;
+        double bestGHz = 0, bestCycles = 0, lowGHz = 0, highGHz = 0;
+        for (int i = 0; i < grid->iters; ++i) {
+            if (clock) cpuFreqStart(&freq);
+            double start = sweepTime();
+            kernel->run(kernel->ctx, &p);
+            double sec = sweepTime() - start;
+            CpuFreqSample sample;
+            if (clock) {
+                cpuFreqStop(&freq, p.threads, &sample);
+                lowGHz = (i == 0 || sample.ghz < lowGHz) ? sample.ghz : lowGHz;
+                highGHz = (i == 0 || sample.ghz > highGHz) ? sample.ghz : highGHz;
+            }
+            total += sec;
+            if (i == 0 || sec < best) {
+                best = sec;
+                if (clock) {
+                    bestGHz = sample.ghz;
+                    bestCycles = sample.cycles;
+                }
+            }
+        }
+        if (kernel->finish) kernel->finish(kernel->ctx, &p);
+
+        const char* valid = "-";
+        if (grid->validate && dtype == MATRIX_FLOAT32) {
+            GoldKey goldKey;
+            GoldRef gold;
+            makeGoldKey(&goldKey, grid->seed, p.M, p.K, p.N, GOLD_A_THEN_B);
+            float* reference = (float*)computeGoldCached(&gold, &goldKey, (const float*)p.A, (const float*)p.B);
+            bool ok = check(reference, (float*)p.C, p.M * p.N, 1.0e-5f * p.K);
+            releaseGold(&gold);
+            valid = ok ? "OK" : "FAIL";
+            if (!ok) ++failures;
+        }
+
+        double gflops = 1.0e-9 * 2.0 * p.M * p.N * p.K / best;
+        rates[key] = gflops;
+
+        // Ratio to the baseline at the same point, if it ran there
+        char ratio[32] = "-";
+        char vsBaseline[64] = "";
+        if (baseline && strcmp(kernel->name, baseline) != 0) {
+            std::map<std::string, double>::iterator base =
+                rates.find(pointKey(size, shape, dtype, baseline, threads, affinity));
+            if (base != rates.end() && base->second > 0.0) {
+                snprintf(ratio, sizeof(ratio), "%.4f", gflops / base->second);
+                snprintf(vsBaseline, sizeof(vsBaseline), "  %sx %s", ratio, baseline);
+            }
+        }
+
+        // The clock, and whether it held steady within the point and since
+        // the first point with these threads
+        char ghz[32] = "-", perFma[32] = "-", clockNote[64] = "";
+        const char* steady = "-";
+        if (clock && bestGHz > 0) {
+            double& reference = referenceGHz[p.threads];
+            if (reference == 0) reference = bestGHz;
+            steady = (highGHz - lowGHz > grid->drift * highGHz) ? "spread"
+                   : (fabs(bestGHz - reference) > grid->drift * reference) ? "drift" : "ok";
+            snprintf(ghz, sizeof(ghz), "%.3f", bestGHz);
+            snprintf(perFma, sizeof(perFma), "%.5f", bestCycles / ((double)p.M * p.N * p.K));
+            snprintf(clockNote, sizeof(clockNote), "  %s GHz %s cyc/fma%s%s", ghz, perFma,
+                     strcmp(steady, "ok") ? " CLOCK " : "", strcmp(steady, "ok") ? steady : "");
+        }
+
+        fprintf(out, "%s,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.4f,%s,%s,%s,%s,%s\n", key.c_str(), p.M, p.N, p.K,
+                grid->iters, setupSec, best, total / grid->iters, gflops, valid, ratio, ghz, perFma, steady);
+        fflush(out);
+        fsync(fileno(out));
+
+        printf("%-40s %10.4f GFlop/s  best %.6f s  %s%s%s\n", key.c_str(), gflops, best, valid,
+               vsBaseline, clockNote);
+        fflush(stdout);
+    }
+
+    if (sweepInterrupted)
+        printf("Interrupted; rerun with the same output to resume\n");
+    signal(SIGINT, oldHandler);
+
+    if (clock) cpuFreqClose(&freq);
+    fclose(out);
+    arenaDestroy(&arena);
+    return failures;
+}
@@ -0,0 +1,115 @@
+#ifndef _SWEEP_H_
+#define _SWEEP_H_
+
+// In-process parameter sweep.
+//
+// A grid is a set of key=value settings, given on the command line or in a
+// file (one per line, '#' starts a comment):
+//
+//     sizes    = 64:1024:x2        list, or first:last:xF / first:last:+S
+//     shapes   = square,tall       square (n,n,n)  tall (4n,n,n)
+//                                  wide (n,4n,n)   deep (n,n,4n)
+//     dtypes   = f32,f64
+//     kernels  = gold,engine       names registered by the driver
+//     baseline = blas              kernel the others are compared with
+//     threads  = 1,4               0 = all CPUs
+//     affinity = none,compact      none, compact or scatter
+//     iters    = 3                 timed runs per point
+//     warmup   = 1                 untimed runs per point
+//     seed     = 2006
+//     validate = 1                 compare f32 results with computeGold
+//     output   = sweep.csv
+//     resume   = 1                 skip points already in the output, which
+//                                  must have the same columns
+//     freq     = auto              clock source: auto, perf, sysfs, probe
+//                                  or off (see cpuFreq.h)
+//     drift    = 0.05              flag clocks that move more than this
+//
+// Every point of the cross product runs in this process with buffers carved
+// from one prefaulted arena. Each finished point is appended to the CSV
+// output and synced, so an interrupted sweep picks up where it stopped.
+// With a baseline, it runs first at every point and each other kernel's
+// rate is reported as a ratio to it.
+//
+// Each timed run also measures the clock it ran at. A point records the
+// clock of its best run, that run's cycles per multiply-add summed over its
+// threads, and a flag: "spread" when its runs' clocks differ by more than
+// drift, "drift" when it is that far from the first point measured with the
+// same number of threads, "ok" otherwise. perf counts only the threads
+// started after the sweep begins, so a system BLAS whose pool starts when
+// the library loads (OpenBLAS's does) records the calling thread's cycles
+// alone; its clock is still right, its cycles per multiply-add too low.
+
+#include <stddef.h>
+
+#define SWEEP_MAX_VALUES 64
+#define SWEEP_NAME_LEN   32
+
+#define SHAPE_SQUARE 0
+#define SHAPE_TALL   1
+#define SHAPE_WIDE   2
+#define SHAPE_DEEP   3
+
+// Bit for an element type (MATRIX_FLOAT32, ...) in SweepKernel::dtypes
+#define SWEEP_DTYPE_BIT(dtype) (1u << (dtype))
+
+// One point's product, C = A * B with A M x K, B K x N, all row-major
+typedef struct {
+    int         M, N, K;
+    int         dtype;
+    int         threads;
+    const void* A;
+    const void* B;
+    void*       C;
+} SweepProblem;
+
+typedef struct {
+    const char* name;
+    unsigned    dtypes;
+    // Untimed, once per point; returning false skips the point (may be NULL)
+    bool (*setup)(void* ctx, const SweepProblem* p);
+    // One timed product
+    void (*run)(void* ctx, const SweepProblem* p);
+    // Untimed, makes C valid on the host for validation (may be NULL)
+    void (*finish)(void* ctx, const SweepProblem* p);
+    void*       ctx;
+} SweepKernel;
+
+typedef struct {
+    int          sizes[SWEEP_MAX_VALUES];    int nSizes;
+    int          shapes[SWEEP_MAX_VALUES];   int nShapes;
+    int          dtypes[SWEEP_MAX_VALUES];   int nDtypes;
+    char         kernels[SWEEP_MAX_VALUES][SWEEP_NAME_LEN]; int nKernels;
+    char         baseline[SWEEP_NAME_LEN];   // empty for none
+    int          threads[SWEEP_MAX_VALUES];  int nThreads;
+    int          affinity[SWEEP_MAX_VALUES]; int nAffinity;
+    int          iters;
+    int          warmup;
+    unsigned int seed;
+    bool         validate;
+    bool         resume;
+    int          freq;          // CPUFREQ_* source, or -1 for none
+    double       drift;         // relative
+    char         output[256];
+} SweepGrid;
+
+// square f32 products of 64..1024 with the first registered kernel,
+// one thread, 3 iterations, written to sweep.csv
+void sweepDefaults(SweepGrid* grid);
+
+// Applies one key=value setting; prints an error and returns false if invalid
+bool sweepParseArg(SweepGrid* grid, const char* arg);
+
+// Applies every setting in a grid file
+bool sweepParseFile(SweepGrid* grid, const char* path);
+
+// Runs the grid. Returns the number of points that failed validation,
+// or -1 if the sweep could not start.
+int sweepRun(const SweepGrid* grid, const SweepKernel* kernels, int nKernels);
+
+const char* sweepShapeName(int shape);
+
+// Problem dimensions of a shape at size n
+void sweepShapeDims(int shape, int n, int* M, int* N, int* K);
+
+#endif // _SWEEP_H_
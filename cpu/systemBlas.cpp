@@ -0,0 +1,139 @@
+// A system BLAS, loaded at run time as a baseline for the engine.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+#include "gemm.h"
+#include "systemBlas.h"
+
+// CBLAS enum values
+#define CBLAS_ROW_MAJOR 101
+#define CBLAS_NO_TRANS  111
+#define CBLAS_TRANS     112
+
+typedef void (*CblasSgemm)(int, int, int, int, int, int, float, const float*, int,
+                           const float*, int, float, float*, int);
+typedef void (*CblasDgemm)(int, int, int, int, int, int, double, const double*, int,
+                           const double*, int, double, double*, int);
+// Fortran ABI; trailing hidden lengths of the character arguments
+typedef void (*FortranSgemm)(const char*, const char*, const int*, const int*, const int*,
+                             const float*, const float*, const int*, const float*, const int*,
+                             const float*, float*, const int*, size_t, size_t);
+typedef void (*FortranDgemm)(const char*, const char*, const int*, const int*, const int*,
+                             const double*, const double*, const int*, const double*, const int*,
+                             const double*, double*, const int*, size_t, size_t);
+typedef void (*SetThreads)(int);
+
+static const char* candidates[] = {
+    "libopenblas.so.0", "libopenblas.so",
+    "libblis.so.4", "libblis.so",
+    "libmkl_rt.so.2", "libmkl_rt.so",
+    "libcblas.so.3", "libblas.so.3", "libblas.so",
+};
+
+static pthread_once_t blasOnce = PTHREAD_ONCE_INIT;
+
+static struct {
+    void*        handle;
+    const char*  name;
+    CblasSgemm   cblasSgemm;
+    CblasDgemm   cblasDgemm;
+    FortranSgemm sgemm;
+    FortranDgemm dgemm;
+    SetThreads   setThreads;
+} blas;
+
+static bool tryLibrary(const char* name)
+{
+    void* handle = dlopen(name, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return false;
+
+    blas.cblasSgemm = (CblasSgemm)dlsym(handle, "cblas_sgemm");
+    blas.cblasDgemm = (CblasDgemm)dlsym(handle, "cblas_dgemm");
+    blas.sgemm = (FortranSgemm)dlsym(handle, "sgemm_");
+    blas.dgemm = (FortranDgemm)dlsym(handle, "dgemm_");
+    if (!(blas.cblasSgemm || blas.sgemm) || !(blas.cblasDgemm || blas.dgemm)) {
+        dlclose(handle);
+        return false;
+    }
+
+    // each library has its own way to set the thread count
+    blas.setThreads = (SetThreads)dlsym(handle, "openblas_set_num_threads");
+    if (!blas.setThreads) blas.setThreads = (SetThreads)dlsym(handle, "bli_thread_set_num_threads");
+    if (!blas.setThreads) blas.setThreads = (SetThreads)dlsym(handle, "MKL_Set_Num_Threads");
+
+    blas.handle = handle;
+    blas.name = name;
+    return true;
+}
+
+static void loadOnce()
+{
+    const char* env = getenv("MATMUL_BLAS");
+    if (env && *env) {
+        if (!tryLibrary(env))
+            fprintf(stderr, "blas: cannot load %s: %s\n", env, dlerror());
+        return;
+    }
+    for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i)
+        if (tryLibrary(candidates[i])) return;
+}
+
+bool blasLoad()
+{
+    pthread_once(&blasOnce, loadOnce);
+    return blas.handle != NULL;
+}
+
+const char* blasLibraryName()
+{
+    return blasLoad() ? blas.name : NULL;
+}
+
+void blasSetNumThreads(int n)
+{
+    if (!blasLoad() || !blas.setThreads) return;
+    if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    blas.setThreads(n);
+}
+
+// Row-major through the Fortran interface: C' = op(B)' op(A)', which is the
+// same memory with the operands swapped.
+
+void blasSgemm(int transA, int transB, int M, int N, int K,
+               float alpha, const float* A, int lda, const float* B, int ldb,
+               float beta, float* C, int ldc)
+{
+    if (!blasLoad()) return;
+    if (blas.cblasSgemm) {
+        blas.cblasSgemm(CBLAS_ROW_MAJOR,
+                        transA == GEMM_TRANS ? CBLAS_TRANS : CBLAS_NO_TRANS,
+                        transB == GEMM_TRANS ? CBLAS_TRANS : CBLAS_NO_TRANS,
+                        M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    } else {
+        const char* ta = (transA == GEMM_TRANS) ? "T" : "N";
+        const char* tb = (transB == GEMM_TRANS) ? "T" : "N";
+        blas.sgemm(tb, ta, &N, &M, &K, &alpha, B, &ldb, A, &lda, &beta, C, &ldc, 1, 1);
+    }
+}
+
+void blasDgemm(int transA, int transB, int M, int N, int K,
+               double alpha, const double* A, int lda, const double* B, int ldb,
+               double beta, double* C, int ldc)
+{
+    if (!blasLoad()) return;
+    if (blas.cblasDgemm) {
+        blas.cblasDgemm(CBLAS_ROW_MAJOR,
+                        transA == GEMM_TRANS ? CBLAS_TRANS : CBLAS_NO_TRANS,
+                        transB == GEMM_TRANS ? CBLAS_TRANS : CBLAS_NO_TRANS,
+                        M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+    } else {
+        const char* ta = (transA == GEMM_TRANS) ? "T" : "N";
+        const char* tb = (transB == GEMM_TRANS) ? "T" : "N";
+        blas.dgemm(tb, ta, &N, &M, &K, &alpha, B, &ldb, A, &lda, &beta, C, &ldc, 1, 1);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef _SYSTEMBLAS_H_
+#define _SYSTEMBLAS_H_
+
+// A system BLAS, loaded at run time as a baseline for the engine.
+//
+// $MATMUL_BLAS names the library to load; otherwise OpenBLAS, BLIS, MKL and
+// the reference BLAS are tried in that order. cblas_sgemm/cblas_dgemm are
+// used when the library has them, the Fortran sgemm_/dgemm_ otherwise.
+// Nothing links against a BLAS, so drivers run unchanged where none exists.
+//
+// The calls take the same row-major arguments as gemmSgemm/gemmDgemm.
+
+// Loads a BLAS on first use; false if none could be found
+bool blasLoad();
+
+// soname of the loaded library, or NULL
+const char* blasLibraryName();
+
+// Thread count for libraries that expose one (OpenBLAS, BLIS, MKL); 0 = all CPUs
+void blasSetNumThreads(int n);
+
+void blasSgemm(int transA, int transB, int M, int N, int K,
+               float alpha, const float* A, int lda, const float* B, int ldb,
+               float beta, float* C, int ldc);
+
+void blasDgemm(int transA, int transB, int M, int N, int K,
+               double alpha, const double* A, int lda, const double* B, int ldb,
+               double beta, double* C, int ldc);
+
+#endif // _SYSTEMBLAS_H_
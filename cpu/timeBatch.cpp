@@ -0,0 +1,186 @@
+//This times batches of very small products, one matrix at a time against the
+//interleaved layout of gemmBatch.h:
+//     ./timeBatch sizes=2,3,4,5,6,7,8 count=100000 dtype=f32 iters=20
+//
+//The per-matrix loop is unrolled for each size just as the interleaved kernel
+//is, so the difference is the vector lanes it leaves empty. Converting to and
+//from the interleaved layout is timed separately, and the two results are
+//compared.
+//
+//A 2 x 2 product moves 48 bytes of float for 16 flops, so at the default
+//count the smallest sizes run at the speed of memory in either layout; a
+//batch that stays in L1 shows what the kernels themselves do:
+//     ./timeBatch sizes=2,8 count=512 iters=2000
+//
+// Build:  g++ -O3 -march=native -fopenmp timeBatch.cpp gemmBatch.cpp matrixIO.cpp -o timeBatch
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "gemmBatch.h"
+#include "matrixIO.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+// C = A * B for each of count D x D matrices stored one after another
+template <typename T, int D>
+static void plainSquare(int count, const T* A, const T* B, T* C)
+{
+    for (int b = 0; b < count; ++b) {
+        const T* a = A + (size_t)b * D * D;
+        const T* m = B + (size_t)b * D * D;
+        T* c = C + (size_t)b * D * D;
+        for (int i = 0; i < D; ++i)
+            for (int j = 0; j < D; ++j) {
+                T sum = 0;
+                for (int k = 0; k < D; ++k)
+                    sum += a[i * D + k] * m[k * D + j];
+                c[i * D + j] = sum;
+            }
+    }
+}
+
+template <typename T>
+static void plain(int D, int count, const T* A, const T* B, T* C)
+{
+    switch (D) {
+    case 2: plainSquare<T, 2>(count, A, B, C); break;
+    case 3: plainSquare<T, 3>(count, A, B, C); break;
+    case 4: plainSquare<T, 4>(count, A, B, C); break;
+    case 5: plainSquare<T, 5>(count, A, B, C); break;
+    case 6: plainSquare<T, 6>(count, A, B, C); break;
+    case 7: plainSquare<T, 7>(count, A, B, C); break;
+    case 8: plainSquare<T, 8>(count, A, B, C); break;
+    }
+}
+
+static void interleave(int D, int count, const float* src, float* dst)    { gemmBatchInterleaveS(D, D, count, src, dst); }
+static void interleave(int D, int count, const double* src, double* dst)  { gemmBatchInterleaveD(D, D, count, src, dst); }
+static void deinterleave(int D, int count, const float* src, float* dst)  { gemmBatchDeinterleaveS(D, D, count, src, dst); }
+static void deinterleave(int D, int count, const double* src, double* dst){ gemmBatchDeinterleaveD(D, D, count, src, dst); }
+
+static void batch(int D, int count, const float* A, const float* B, float* C)
+{
+    gemmBatchSgemm(D, D, D, count, 1.0f, A, B, 0.0f, C);
+}
+
+static void batch(int D, int count, const double* A, const double* B, double* C)
+{
+    gemmBatchDgemm(D, D, D, count, 1.0, A, B, 0.0, C);
+}
+
+// Times one size; false if the results disagree
+template <typename T>
+static bool run(int dtype, int D, int count, int iters)
+{
+    size_t plainElems = (size_t)count * D * D;
+    size_t batchElems = gemmBatchElements(dtype, D, D, count);
+    std::vector<T> A(plainElems), B(plainElems), C(plainElems), R(plainElems);
+    std::vector<T> iA(batchElems), iB(batchElems), iC(batchElems);
+    for (size_t i = 0; i < plainElems; ++i) {
+        A[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+        B[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    }
+
+    double flops = 2.0 * D * D * D * count;
+    double best = 1e30;
+    for (int it = 0; it < iters; ++it) {
+        double start = now();
+        plain(D, count, &A[0], &B[0], &R[0]);
+        double t = now() - start;
+        if (t < best) best = t;
+    }
+    double plainRate = flops / best * 1.0e-9;
+
+    double convert = now();
+    interleave(D, count, &A[0], &iA[0]);
+    interleave(D, count, &B[0], &iB[0]);
+    convert = now() - convert;
+
+    best = 1e30;
+    for (int it = 0; it < iters; ++it) {
+        double start = now();
+        batch(D, count, &iA[0], &iB[0], &iC[0]);
+        double t = now() - start;
+        if (t < best) best = t;
+    }
+    double batchRate = flops / best * 1.0e-9;
+
+    double back = now();
+    deinterleave(D, count, &iC[0], &C[0]);
+    convert += now() - back;
+
+    double err = 0;
+    for (size_t i = 0; i < plainElems; ++i)
+        err = fmax(err, fabs((double)C[i] - (double)R[i]));
+    bool ok = err <= (sizeof(T) == sizeof(double) ? 1.0e-12 : 1.0e-5) * D;
+
+    printf("%4d %12.2f %12.2f %9.2fx %12.3f  %s\n", D, plainRate, batchRate,
+           batchRate / plainRate, convert * 1.0e3, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes;
+    int count = 100000, iters = 20;
+    int dtype = MATRIX_FLOAT32;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "sizes=", 6) == 0) {
+            for (const char* p = arg + 6; *p; ) {
+                sizes.push_back(atoi(p));
+                p = strchr(p, ',');
+                if (!p) break;
+                ++p;
+            }
+        } else if (strncmp(arg, "count=", 6) == 0) {
+            count = atoi(arg + 6);
+        } else if (strncmp(arg, "iters=", 6) == 0) {
+            iters = atoi(arg + 6);
+        } else if (strcmp(arg, "dtype=f32") == 0) {
+            dtype = MATRIX_FLOAT32;
+        } else if (strcmp(arg, "dtype=f64") == 0) {
+            dtype = MATRIX_FLOAT64;
+        } else {
+            fprintf(stderr, "timeBatch: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (sizes.empty())
+        for (int d = 2; d <= 8; ++d) sizes.push_back(d);
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (sizes[i] < 2 || sizes[i] > 8) {
+            fprintf(stderr, "timeBatch: sizes must be 2 to 8\n");
+            return 1;
+        }
+    }
+    if (count <= 0 || iters <= 0) {
+        fprintf(stderr, "timeBatch: count and iters must be positive\n");
+        return 1;
+    }
+
+    printf("timeBatch: %d products per batch, %s, best of %d\n", count,
+           dtype == MATRIX_FLOAT64 ? "f64" : "f32", iters);
+    printf("size  plain_GF/s  interl_GF/s   speedup   convert_ms\n");
+    bool ok = true;
+    for (size_t i = 0; i < sizes.size(); ++i)
+        ok = ((dtype == MATRIX_FLOAT64) ? run<double>(dtype, sizes[i], count, iters)
+                                        : run<float>(dtype, sizes[i], count, iters)) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,207 @@
+//This times a distributed product across processes forked on this machine:
+//     ./timeDist procs=4 algorithm=summa transport=shm size=2048 kblock=256
+//
+//     procs=P            processes, on a grid as square as P allows (or grid=RxC)
+//     algorithm=A        summa or cannon (square grids only)
+//     transport=T        shm or socket
+//     size=N             M = N = K = N; m=, n= and k= set them one by one
+//     dtype=f32|f64      element type (default f64)
+//     threads=T          engine threads per process (default 1)
+//     verify=0|1         check C against a single-process product on rank 0
+//
+//Every rank generates its own blocks of A and B from their global indices,
+//so nothing is scattered; the C blocks are gathered on rank 0 to verify.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeDist.cpp distGemm.cpp transport.cpp
+//             gemm.cpp gemmJit.cpp gemmPlugin.cpp gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp
+//             matrixIO.cpp -lpthread -ldl -o timeDist
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <vector>
+
+#include "distGemm.h"
+#include "gemm.h"
+#include "matrixIO.h"
+#include "transport.h"
+
+// Element (r, c) of matrix 0 (A) or 1 (B), in [-0.5, 0.5)
+static double element(int which, int r, int c)
+{
+    uint64_t x = ((uint64_t)(uint32_t)r << 32 | (uint32_t)c) * 0x9e3779b97f4a7c15ull + which;
+    x ^= x >> 31;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 29;
+    return (double)(x >> 11) / 9007199254740992.0 - 0.5;
+}
+
+template <typename T>
+static void fill(std::vector<T>& m, int which, int r0, int rows, int c0, int cols)
+{
+    m.resize((size_t)rows * cols + 1);
+    for (int r = 0; r < rows; ++r)
+        for (int c = 0; c < cols; ++c)
+            m[(size_t)r * cols + c] = (T)element(which, r0 + r, c0 + c);
+}
+
+static void localGemm(int M, int N, int K, const float* A, const float* B, float* C)
+{
+    gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0f, A, K, B, N, 0.0f, C, N);
+}
+
+static void localGemm(int M, int N, int K, const double* A, const double* B, double* C)
+{
+    gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0, A, K, B, N, 0.0, C, N);
+}
+
+// Runs this rank's part; rank 0 also gathers, reports and verifies
+template <typename T>
+static bool run(Transport* t, int algorithm, int gridRows, int gridCols, int dtype,
+                int M, int N, int K, int kblock, bool verify)
+{
+    int pi = t->rank / gridCols, pj = t->rank % gridCols;
+    int mOff, mi, nOff, nj, aOff, ka, bOff, kb;
+    distBlock(M, gridRows, pi, &mOff, &mi);
+    distBlock(N, gridCols, pj, &nOff, &nj);
+    distBlock(K, gridCols, pj, &aOff, &ka);
+    distBlock(K, gridRows, pi, &bOff, &kb);
+
+    std::vector<T> A, B, C((size_t)mi * nj + 1);
+    fill(A, 0, mOff, mi, aOff, ka);
+    fill(B, 1, bOff, kb, nOff, nj);
+
+    transportBarrier(t);
+    DistStats stats;
+    bool ok = distGemm(t, algorithm, gridRows, gridCols, dtype, M, N, K,
+                       &A[0], &B[0], &C[0], kblock, &stats);
+
+    if (t->rank != 0) {
+        return ok && t->send(t, 0, &stats, sizeof(stats))
+                  && (!verify || t->send(t, 0, &C[0], sizeof(T) * (size_t)mi * nj));
+    }
+    if (!ok) return false;
+
+    std::vector<T> full;
+    if (verify) full.resize((size_t)M * N + 1);
+
+    printf("rank  compute_s     comm_s     wait_s    total_s    MB_sent\n");
+    double slowest = 0;
+    for (int r = 0; r < t->size; ++r) {
+        DistStats s = stats;
+        if (r > 0 && !t->recv(t, r, &s, sizeof(s))) return false;
+
+        int ri = r / gridCols, rj = r % gridCols;
+        int rOff, rm, cOff, cn;
+        distBlock(M, gridRows, ri, &rOff, &rm);
+        distBlock(N, gridCols, rj, &cOff, &cn);
+        if (verify) {
+            std::vector<T> block((size_t)rm * cn + 1);
+            if (r == 0) block = C;
+            else if (!t->recv(t, r, &block[0], sizeof(T) * (size_t)rm * cn)) return false;
+            for (int i = 0; i < rm; ++i)
+                memcpy(&full[(size_t)(rOff + i) * N + cOff], &block[(size_t)i * cn], sizeof(T) * cn);
+        }
+
+        printf("%4d %10.4f %10.4f %10.4f %10.4f %10.1f\n", r, s.computeSeconds, s.commSeconds,
+               s.waitSeconds, s.totalSeconds, s.bytesSent / 1.0e6);
+        if (s.totalSeconds > slowest) slowest = s.totalSeconds;
+    }
+    printf("%.2f GFlop/s over %d processes\n", 2.0 * M * N * K / slowest * 1.0e-9, t->size);
+
+    if (verify) {
+        std::vector<T> a, b, ref((size_t)M * N + 1);
+        fill(a, 0, 0, M, 0, K);
+        fill(b, 1, 0, K, 0, N);
+        gemmSetNumThreads(0);
+        localGemm(M, N, K, &a[0], &b[0], &ref[0]);
+
+        double err = 0;
+        for (size_t i = 0; i < (size_t)M * N; ++i)
+            err = fmax(err, fabs((double)full[i] - (double)ref[i]));
+        double tol = (dtype == MATRIX_FLOAT64 ? 1.0e-12 : 1.0e-4) * (K > 0 ? K : 1);
+        printf("%s: max error %g\n", err <= tol ? "PASSED" : "FAILED", err);
+        return err <= tol;
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int procs = 4, gridRows = 0, gridCols = 0;
+    int algorithm = DIST_SUMMA, kind = TRANSPORT_SHM, dtype = MATRIX_FLOAT64;
+    int M = 2048, N = 2048, K = 2048, kblock = 256, threads = 1;
+    bool verify = true;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "procs=", 6) == 0) {
+            procs = atoi(arg + 6);
+        } else if (strncmp(arg, "grid=", 5) == 0 && sscanf(arg + 5, "%dx%d", &gridRows, &gridCols) == 2) {
+            procs = gridRows * gridCols;
+        } else if (strncmp(arg, "algorithm=", 10) == 0 && distParseAlgorithm(arg + 10) >= 0) {
+            algorithm = distParseAlgorithm(arg + 10);
+        } else if (strncmp(arg, "transport=", 10) == 0 && transportParse(arg + 10) >= 0) {
+            kind = transportParse(arg + 10);
+        } else if (strncmp(arg, "size=", 5) == 0) {
+            M = N = K = atoi(arg + 5);
+        } else if (strncmp(arg, "m=", 2) == 0) {
+            M = atoi(arg + 2);
+        } else if (strncmp(arg, "n=", 2) == 0) {
+            N = atoi(arg + 2);
+        } else if (strncmp(arg, "k=", 2) == 0) {
+            K = atoi(arg + 2);
+        } else if (strncmp(arg, "kblock=", 7) == 0) {
+            kblock = atoi(arg + 7);
+        } else if (strcmp(arg, "dtype=f32") == 0) {
+            dtype = MATRIX_FLOAT32;
+        } else if (strcmp(arg, "dtype=f64") == 0) {
+            dtype = MATRIX_FLOAT64;
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            threads = atoi(arg + 8);
+        } else if (strncmp(arg, "verify=", 7) == 0) {
+            verify = atoi(arg + 7) != 0;
+        } else {
+            fprintf(stderr, "timeDist: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+
+    // the squarest grid, with no more rows than columns
+    if (gridRows <= 0 || gridCols <= 0) {
+        for (gridRows = 1; (gridRows + 1) * (gridRows + 1) <= procs; ++gridRows) ;
+        while (procs % gridRows != 0) --gridRows;
+        gridCols = procs / gridRows;
+    }
+    // refused here, before the ranks exist, rather than once by every rank
+    if (algorithm == DIST_CANNON && gridRows != gridCols) {
+        fprintf(stderr, "timeDist: Cannon needs a square grid, not %dx%d\n", gridRows, gridCols);
+        return 1;
+    }
+
+    printf("timeDist: %s on a %dx%d grid over %s, %dx%dx%d %s, %d thread%s per process\n",
+           distAlgorithmName(algorithm), gridRows, gridCols, transportName(kind), M, N, K,
+           dtype == MATRIX_FLOAT64 ? "f64" : "f32", threads, threads == 1 ? "" : "s");
+
+    Transport* t = transportSpawn(kind, procs);
+    if (!t) return 1;
+    gemmSetNumThreads(threads);
+
+    bool ok = (dtype == MATRIX_FLOAT64)
+            ? run<double>(t, algorithm, gridRows, gridCols, dtype, M, N, K, kblock, verify)
+            : run<float>(t, algorithm, gridRows, gridCols, dtype, M, N, K, kblock, verify);
+    gemmShutdown();
+
+    int rank = t->rank;
+    ok = transportClose(t) && ok;
+    if (rank != 0) _exit(ok ? 0 : 1);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+//This times the exact integer and modular products of gemm.h and checks them
+//against a plain triple loop:
+//     ./timeExact type=i32 mode=exact bits=31 sizes=256,511 reps=3 threads=1
+//     ./timeExact type=mod p=2147483647 sizes=512
+//
+//type is i32, i64 or mod. bits bounds the magnitude of the operands (for
+//mod they are drawn below p), so bits=31 with mode=exact makes the sums
+//overflow 64 bits and takes the 128-bit path. For int64 operands the
+//reference is also kept modulo 2^64 unless mode=exact. The reference is
+//skipped above check= (512 by default). An exact product whose sums may
+//not fit even in 128 bits is refused by the engine; it is reported as
+//such, and checked to have left C alone. Every exact run also adds a zero
+//A onto a C at the ends of the int64 range, which must leave C as it was.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeExact.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timeExact
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+#include "gemm.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static uint64_t state = 88172645463325252ull;
+
+static uint64_t random64()
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Uniform in (-2^bits, 2^bits)
+static int64_t randomSigned(int bits)
+{
+    uint64_t span = (bits >= 63) ? UINT64_MAX : (1ull << bits) - 1;
+    int64_t v = (int64_t)(random64() & span);
+    return (random64() & 1) ? -v : v;
+}
+
+// Reference C = A * B for one element, modulo 2^128: exact whenever the
+// engine does not refuse the product, and right modulo 2^64 always
+template <typename T>
+static __int128 dot(int s, const T* A, const T* B, int i, int j)
+{
+    unsigned __int128 sum = 0;
+    for (int k = 0; k < s; ++k)
+        sum += (unsigned __int128)((__int128)A[(size_t)i * s + k] * B[(size_t)k * s + j]);
+    return (__int128)sum;
+}
+
+// Whether the sums may not fit even in 128 bits, by the bound the engine
+// uses to refuse an exact product (see gemm.h)
+template <typename T>
+static bool beyond128(int s, const T* A, const T* B, size_t elems)
+{
+    uint64_t a = 0, b = 0;
+    for (size_t i = 0; i < elems; ++i) {
+        uint64_t x = (A[i] < 0) ? 0 - (uint64_t)A[i] : (uint64_t)A[i];
+        uint64_t y = (B[i] < 0) ? 0 - (uint64_t)B[i] : (uint64_t)B[i];
+        a = (x > a) ? x : a;
+        b = (y > b) ? y : b;
+    }
+    return (long double)s * a * b >= 0x1p127L * (1 - 0x1p-40L);
+}
+
+#define UNTOUCHED 0x5a5a5a5a5a5a5a5all
+
+// Times one size of an integer product; false if it disagrees with the
+// reference
+template <typename T>
+static bool runInteger(int s, int bits, int mode, int reps, int check)
+{
+    size_t elems = (size_t)s * s;
+    std::vector<T> A(elems), B(elems);
+    std::vector<int64_t> C(elems, UNTOUCHED);
+    for (size_t i = 0; i < elems; ++i) {
+        A[i] = (T)randomSigned(bits);
+        B[i] = (T)randomSigned(bits);
+    }
+    // an exact product this large is refused, and must leave C alone
+    bool refused = mode == GEMM_INT_EXACT && beyond128(s, &A[0], &B[0], elems);
+
+    bool fits = true;
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        double start = now();
+        fits = (sizeof(T) == sizeof(int32_t))
+             ? gemmIgemm32(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, (const int32_t*)&A[0], s,
+                           (const int32_t*)&B[0], s, false, &C[0], s, mode)
+             : gemmIgemm64(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, (const int64_t*)&A[0], s,
+                           (const int64_t*)&B[0], s, false, &C[0], s, mode);
+        double t = now() - start;
+        if (t < best) best = t;
+    }
+
+    // the exact result, and whether it fits; WRAP is compared modulo 2^64
+    const char* verdict = "-";
+    bool ok = true;
+    if (refused) {
+        for (size_t i = 0; i < elems && ok; ++i)
+            ok = C[i] == (int64_t)UNTOUCHED;
+        ok = ok && !fits;
+        verdict = ok ? "ok" : "MISMATCH";
+    } else if (s <= check) {
+        bool allFit = true;
+        for (int i = 0; i < s && ok; ++i) {
+            for (int j = 0; j < s; ++j) {
+                __int128 want = dot<T>(s, &A[0], &B[0], i, j);
+                allFit = allFit && want == (__int128)(int64_t)want;
+                ok = ok && (uint64_t)want == (uint64_t)C[(size_t)i * s + j];
+            }
+        }
+        if (mode == GEMM_INT_EXACT) ok = ok && fits == allFit;
+        verdict = ok ? "ok" : "MISMATCH";
+    }
+    if (refused) {
+        printf("%6d %12s   %-8s %s\n", s, "-", "refused", verdict);
+        return ok;
+    }
+    printf("%6d %12.2f   %-8s %s\n", s, 2.0 * s * s * s / best * 1.0e-9,
+           (mode == GEMM_INT_EXACT) ? (fits ? "fits" : "overflow") : "wrapped", verdict);
+    return ok;
+}
+
+// A zero A accumulated onto a C at the limits: C must come back unchanged
+template <typename T>
+static bool runZero(int s)
+{
+    size_t elems = (size_t)s * s;
+    std::vector<T> A(elems, 0), B(elems);
+    std::vector<int64_t> C(elems);
+    for (size_t i = 0; i < elems; ++i) {
+        B[i] = (T)randomSigned(sizeof(T) == sizeof(int32_t) ? 31 : 63);
+        C[i] = (i & 1) ? INT64_MAX : INT64_MIN;
+    }
+    bool fits = (sizeof(T) == sizeof(int32_t))
+              ? gemmIgemm32(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, (const int32_t*)&A[0], s,
+                            (const int32_t*)&B[0], s, true, &C[0], s, GEMM_INT_EXACT)
+              : gemmIgemm64(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, (const int64_t*)&A[0], s,
+                            (const int64_t*)&B[0], s, true, &C[0], s, GEMM_INT_EXACT);
+    bool ok = fits;
+    for (size_t i = 0; i < elems && ok; ++i)
+        ok = C[i] == ((i & 1) ? INT64_MAX : INT64_MIN);
+    printf("%6d %12s   %-8s %s\n", s, "zero A", fits ? "fits" : "overflow", ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+static bool runModular(int s, uint32_t p, int reps, int check)
+{
+    size_t elems = (size_t)s * s;
+    std::vector<uint32_t> A(elems), B(elems), C(elems);
+    for (size_t i = 0; i < elems; ++i) {
+        A[i] = (uint32_t)(random64() % p);
+        B[i] = (uint32_t)(random64() % p);
+    }
+
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        double start = now();
+        gemmModgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, p, &A[0], s, &B[0], s, false, &C[0], s);
+        double t = now() - start;
+        if (t < best) best = t;
+    }
+
+    const char* verdict = "-";
+    bool ok = true;
+    if (s <= check) {
+        for (int i = 0; i < s && ok; ++i) {
+            for (int j = 0; j < s; ++j) {
+                uint64_t sum = 0;
+                for (int k = 0; k < s; ++k)
+                    sum = (sum + (uint64_t)A[(size_t)i * s + k] * B[(size_t)k * s + j] % p) % p;
+                ok = ok && sum == C[(size_t)i * s + j];
+            }
+        }
+        verdict = ok ? "ok" : "MISMATCH";
+    }
+    printf("%6d %12.2f   %-8s %s\n", s, 2.0 * s * s * s / best * 1.0e-9, "reduced", verdict);
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes;
+    const char* type = "i32";
+    int mode = GEMM_INT_EXACT;
+    int bits = 20;
+    uint32_t p = 2147483647u;
+    int reps = 3;
+    int check = 512;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "sizes=", 6) == 0) {
+            for (const char* q = arg + 6; *q; ) {
+                sizes.push_back(atoi(q));
+                q = strchr(q, ',');
+                if (!q) break;
+                ++q;
+            }
+        } else if (strncmp(arg, "type=", 5) == 0) {
+            type = arg + 5;
+        } else if (strcmp(arg, "mode=wrap") == 0) {
+            mode = GEMM_INT_WRAP;
+        } else if (strcmp(arg, "mode=exact") == 0) {
+            mode = GEMM_INT_EXACT;
+        } else if (strncmp(arg, "bits=", 5) == 0) {
+            bits = atoi(arg + 5);
+        } else if (strncmp(arg, "p=", 2) == 0) {
+            p = (uint32_t)strtoul(arg + 2, NULL, 0);
+        } else if (strncmp(arg, "reps=", 5) == 0) {
+            reps = atoi(arg + 5);
+        } else if (strncmp(arg, "check=", 6) == 0) {
+            check = atoi(arg + 6);
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            gemmSetNumThreads(atoi(arg + 8));
+        } else {
+            fprintf(stderr, "timeExact: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    bool i32 = strcmp(type, "i32") == 0, i64 = strcmp(type, "i64") == 0;
+    if (!i32 && !i64 && strcmp(type, "mod") != 0) {
+        fprintf(stderr, "timeExact: type must be i32, i64 or mod\n");
+        return 1;
+    }
+    if (bits < 1 || bits > (i32 ? 31 : 63) || reps <= 0 || p < 2) {
+        fprintf(stderr, "timeExact: bits, reps or p out of range\n");
+        return 1;
+    }
+    if (sizes.empty()) {
+        int defaults[] = { 512, 513, 250, 61 };
+        sizes.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+    if (i32 || i64)
+        printf("timeExact: %s, operands below 2^%d, %s, best of %d\n", type, bits,
+               mode == GEMM_INT_EXACT ? "exact" : "modulo 2^64", reps);
+    else
+        printf("timeExact: modulo %u, best of %d\n", p, reps);
+    printf("  size   Gops/s      result   check\n");
+    bool ok = true;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        if (i32) ok = runInteger<int32_t>(sizes[i], bits, mode, reps, check) && ok;
+        else if (i64) ok = runInteger<int64_t>(sizes[i], bits, mode, reps, check) && ok;
+        else ok = runModular(sizes[i], p, reps, check) && ok;
+    }
+    if (mode == GEMM_INT_EXACT) {
+        if (i32) ok = runZero<int32_t>(61) && ok;
+        else if (i64) ok = runZero<int64_t>(61) && ok;
+    }
+    gemmShutdown();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+//This times A = A * B in place against C = A * B into a separate C:
+//     ./timeInPlace m=8192 n=4096 rowblock=0 dtype=f32 threads=0
+//
+//Each mode runs in its own child process so its peak resident memory can be
+//read back from wait4(). A few rows of A are kept aside beforehand and their
+//products recomputed naively to check the result, so checking adds nothing
+//like a second matrix.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeInPlace.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp gemmTrace.cpp
+//             gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timeInPlace
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <vector>
+
+#include "gemm.h"
+#include "matrixIO.h"
+
+#define CHECK_ROWS 8
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static bool multiply(bool inPlace, int M, int N, float* A, const float* B, float* C, int rowBlock)
+{
+    if (inPlace) return gemmSgemmInPlace(GEMM_NO_TRANS, M, N, 1.0f, A, N, B, N, rowBlock);
+    gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, N, 1.0f, A, N, B, N, 0.0f, C, N);
+    return true;
+}
+
+static bool multiply(bool inPlace, int M, int N, double* A, const double* B, double* C, int rowBlock)
+{
+    if (inPlace) return gemmDgemmInPlace(GEMM_NO_TRANS, M, N, 1.0, A, N, B, N, rowBlock);
+    gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, N, 1.0, A, N, B, N, 0.0, C, N);
+    return true;
+}
+
+// Runs one mode in this (child) process; the exit status says if it passed
+template <typename T>
+static int run(bool inPlace, int M, int N, int rowBlock)
+{
+    T* A = (T*)malloc(sizeof(T) * M * N);
+    T* B = (T*)malloc(sizeof(T) * N * N);
+    T* C = inPlace ? A : (T*)malloc(sizeof(T) * M * N);
+    if (!A || !B || !C) {
+        fprintf(stderr, "timeInPlace: out of memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < (size_t)M * N; ++i) A[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    for (size_t i = 0; i < (size_t)N * N; ++i) B[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    if (!inPlace) memset(C, 0, sizeof(T) * M * N);
+
+    int rows[CHECK_ROWS];
+    std::vector<T> kept((size_t)CHECK_ROWS * N);
+    for (int r = 0; r < CHECK_ROWS; ++r) {
+        rows[r] = (int)((long long)r * (M - 1) / (CHECK_ROWS - 1 > 0 ? CHECK_ROWS - 1 : 1));
+        memcpy(&kept[(size_t)r * N], A + (size_t)rows[r] * N, sizeof(T) * N);
+    }
+
+    double start = now();
+    if (!multiply(inPlace, M, N, A, B, C, rowBlock)) return 1;
+    double seconds = now() - start;
+
+    double err = 0;
+    for (int r = 0; r < CHECK_ROWS; ++r)
+        for (int j = 0; j < N; ++j) {
+            double sum = 0;
+            for (int k = 0; k < N; ++k) sum += (double)kept[(size_t)r * N + k] * B[(size_t)k * N + j];
+            err = fmax(err, fabs(sum - (double)C[(size_t)rows[r] * N + j]));
+        }
+    double tol = (sizeof(T) == sizeof(double) ? 1.0e-12 : 1.0e-4) * N;
+
+    printf("%-9s %10.4f s %10.2f GFlop/s   max error %g\n", inPlace ? "in place" : "separate",
+           seconds, 2.0 * M * N * N / seconds * 1.0e-9, err);
+    gemmShutdown();
+    return err <= tol ? 0 : 1;
+}
+
+// Forks a child for one mode and reports its peak resident memory
+static bool runChild(bool inPlace, int dtype, int M, int N, int rowBlock)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("timeInPlace: fork");
+        return false;
+    }
+    if (pid == 0) {
+        int result = (dtype == MATRIX_FLOAT64) ? run<double>(inPlace, M, N, rowBlock)
+                                               : run<float>(inPlace, M, N, rowBlock);
+        fflush(stdout);
+        _exit(result);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        perror("timeInPlace: wait4");
+        return false;
+    }
+    printf("%-9s %10.1f MB peak resident\n", "", usage.ru_maxrss / 1024.0);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int M = 8192, N = 4096, rowBlock = 0;
+    int dtype = MATRIX_FLOAT32;
+    const char* mode = "both";
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "m=", 2) == 0)             M = atoi(arg + 2);
+        else if (strncmp(arg, "n=", 2) == 0)        N = atoi(arg + 2);
+        else if (strncmp(arg, "rowblock=", 9) == 0) rowBlock = atoi(arg + 9);
+        else if (strncmp(arg, "threads=", 8) == 0)  gemmSetNumThreads(atoi(arg + 8));
+        else if (strncmp(arg, "mode=", 5) == 0)     mode = arg + 5;
+        else if (strcmp(arg, "dtype=f32") == 0)     dtype = MATRIX_FLOAT32;
+        else if (strcmp(arg, "dtype=f64") == 0)     dtype = MATRIX_FLOAT64;
+        else {
+            fprintf(stderr, "timeInPlace: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    bool inPlace = strcmp(mode, "both") == 0 || strcmp(mode, "inplace") == 0;
+    bool separate = strcmp(mode, "both") == 0 || strcmp(mode, "separate") == 0;
+    if (M <= 0 || N <= 0 || (!inPlace && !separate)) {
+        fprintf(stderr, "timeInPlace: need positive sizes and mode=both, inplace or separate\n");
+        return 1;
+    }
+
+    printf("timeInPlace: A %dx%d times B %dx%d %s\n", M, N, N, N,
+           dtype == MATRIX_FLOAT64 ? "f64" : "f32");
+    bool ok = true;
+    if (separate) ok = runChild(false, dtype, M, N, rowBlock) && ok;
+    if (inPlace) ok = runChild(true, dtype, M, N, rowBlock) && ok;
+    printf("%s\n", ok ? "PASSED" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,370 @@
+//This times the matrix functions of matrixFunctions.h against the plain way
+//of writing them, a loop of products into freshly allocated matrices:
+//     ./timeMatFn fn=exp,invsqrt,polar,sign n=512 m=1024 norm=4 reps=3 dtype=f64 threads=0
+//
+//exp: Taylor series term by term after the same scaling, then squarings.
+//invsqrt, polar and sign: the same Newton-Schulz steps with every product,
+//shift and scaling in a pass of its own. Each result is checked by the
+//identity it must satisfy: exp(A) against the plain series, Y A Y = I and
+//S S = A for the inverse square root, U^T U = I for the polar factor and
+//S S = I for the sign.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeMatFn.cpp matrixFunctions.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timeMatFn
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "matrixFunctions.h"
+#include "gemm.h"
+#include "matrixIO.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static void product(int transA, int M, int N, int K, float alpha, const float* A,
+                    const float* B, float* C)
+{
+    gemmSgemm(transA, GEMM_NO_TRANS, M, N, K, alpha, A, transA ? M : K, B, N, 0.0f, C, N);
+}
+
+static void product(int transA, int M, int N, int K, double alpha, const double* A,
+                    const double* B, double* C)
+{
+    gemmDgemm(transA, GEMM_NO_TRANS, M, N, K, alpha, A, transA ? M : K, B, N, 0.0, C, N);
+}
+
+// Calls through to the S or D entry point
+struct Fns {
+    static bool exp(MatrixWorkspace* w, int n, const float* A, float* E, MatrixFnStats* s)
+    { return matrixExpS(w, n, A, n, E, n, s); }
+    static bool exp(MatrixWorkspace* w, int n, const double* A, double* E, MatrixFnStats* s)
+    { return matrixExpD(w, n, A, n, E, n, s); }
+    static bool invSqrt(MatrixWorkspace* w, int n, const float* A, float* Y, float* S, MatrixFnStats* s)
+    { return matrixInvSqrtS(w, n, A, n, Y, n, S, n, 0, 0, s); }
+    static bool invSqrt(MatrixWorkspace* w, int n, const double* A, double* Y, double* S, MatrixFnStats* s)
+    { return matrixInvSqrtD(w, n, A, n, Y, n, S, n, 0, 0, s); }
+    static bool polar(MatrixWorkspace* w, int m, int n, const float* A, float* U, MatrixFnStats* s)
+    { return matrixPolarS(w, m, n, A, n, U, n, 0, 0, s); }
+    static bool polar(MatrixWorkspace* w, int m, int n, const double* A, double* U, MatrixFnStats* s)
+    { return matrixPolarD(w, m, n, A, n, U, n, 0, 0, s); }
+    static bool sign(MatrixWorkspace* w, int n, const float* A, float* S, MatrixFnStats* s)
+    { return matrixSignS(w, n, A, n, S, n, 0, 0, s); }
+    static bool sign(MatrixWorkspace* w, int n, const double* A, double* S, MatrixFnStats* s)
+    { return matrixSignD(w, n, A, n, S, n, 0, 0, s); }
+};
+
+template <typename T>
+static T* fresh(size_t elems)
+{
+    return (T*)malloc(elems * sizeof(T));
+}
+
+// exp(A): Taylor series of A / 2^s term by term, then s squarings
+template <typename T>
+static void plainExp(int n, const T* A, int degree, T* E)
+{
+    size_t elems = (size_t)n * n;
+    double norm = 0;
+    for (int j = 0; j < n; ++j) {
+        double sum = 0;
+        for (int i = 0; i < n; ++i) sum += fabs((double)A[(size_t)i * n + j]);
+        if (sum > norm) norm = sum;
+    }
+    int s = 0;
+    while (ldexp(norm, -s) > 0.5) ++s;
+
+    T* X = fresh<T>(elems);
+    for (size_t e = 0; e < elems; ++e) X[e] = (T)ldexp((double)A[e], -s);
+    T* sum = fresh<T>(elems);
+    T* term = fresh<T>(elems);
+    memset(sum, 0, elems * sizeof(T));
+    memset(term, 0, elems * sizeof(T));
+    for (int i = 0; i < n; ++i) sum[(size_t)i * n + i] = term[(size_t)i * n + i] = 1;
+    for (int k = 1; k <= degree; ++k) {
+        T* next = fresh<T>(elems);
+        product(GEMM_NO_TRANS, n, n, n, (T)(1.0 / k), term, X, next);
+        free(term);
+        term = next;
+        for (size_t e = 0; e < elems; ++e) sum[e] += term[e];
+    }
+    for (int k = 0; k < s; ++k) {
+        T* next = fresh<T>(elems);
+        product(GEMM_NO_TRANS, n, n, n, (T)1, sum, sum, next);
+        free(sum);
+        sum = next;
+    }
+    memcpy(E, sum, elems * sizeof(T));
+    free(X);
+    free(term);
+    free(sum);
+}
+
+// T = (3I - P) / 2 in its own pass
+template <typename T>
+static T* plainShift(int n, const T* P)
+{
+    T* M = fresh<T>((size_t)n * n);
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j)
+            M[(size_t)i * n + j] = (T)0.5 * ((i == j ? (T)3 : (T)0) - P[(size_t)i * n + j]);
+    return M;
+}
+
+// The same coupled iteration as matrixInvSqrt, for the same number of steps
+template <typename T>
+static void plainInvSqrt(int n, const T* A, int steps, T* Y, T* S)
+{
+    size_t elems = (size_t)n * n;
+    double c = 0;
+    for (size_t e = 0; e < elems; ++e) c += (double)A[e] * A[e];
+    c = sqrt(c);
+    T* y = fresh<T>(elems);
+    T* z = fresh<T>(elems);
+    for (size_t e = 0; e < elems; ++e) y[e] = (T)(A[e] / c);
+    memset(z, 0, elems * sizeof(T));
+    for (int i = 0; i < n; ++i) z[(size_t)i * n + i] = 1;
+    for (int it = 0; it < steps; ++it) {
+        T* P = fresh<T>(elems);
+        product(GEMM_NO_TRANS, n, n, n, (T)1, z, y, P);
+        T* M = plainShift(n, P);
+        T* y2 = fresh<T>(elems);
+        T* z2 = fresh<T>(elems);
+        product(GEMM_NO_TRANS, n, n, n, (T)1, y, M, y2);
+        product(GEMM_NO_TRANS, n, n, n, (T)1, M, z, z2);
+        free(P); free(M); free(y); free(z);
+        y = y2;
+        z = z2;
+    }
+    for (size_t e = 0; e < elems; ++e) {
+        Y[e] = (T)(z[e] / sqrt(c));
+        S[e] = (T)(y[e] * sqrt(c));
+    }
+    free(y);
+    free(z);
+}
+
+// X <- X (3I - op(X) X) / 2 for the same number of steps as matrixPolar or
+// matrixSign
+template <typename T>
+static void plainNewtonSchulz(int trans, int m, int n, const T* A, int steps, T* U)
+{
+    size_t elems = (size_t)m * n;
+    double c = 0;
+    for (size_t e = 0; e < elems; ++e) c += (double)A[e] * A[e];
+    c = sqrt(c);
+    T* x = fresh<T>(elems);
+    for (size_t e = 0; e < elems; ++e) x[e] = (T)(A[e] / c);
+    for (int it = 0; it < steps; ++it) {
+        T* P = fresh<T>((size_t)n * n);
+        product(trans, n, n, m, (T)1, x, x, P);
+        T* M = plainShift(n, P);
+        T* x2 = fresh<T>(elems);
+        product(GEMM_NO_TRANS, m, n, n, (T)1, x, M, x2);
+        free(P); free(M); free(x);
+        x = x2;
+    }
+    memcpy(U, x, elems * sizeof(T));
+    free(x);
+}
+
+// ||op(X) Y - R||_F / ||R||_F, R the identity when NULL
+template <typename T>
+static double checkProduct(int trans, int m, int n, const T* X, const T* Y, const T* R)
+{
+    std::vector<T> P((size_t)n * n);
+    product(trans, n, n, m, (T)1, X, Y, &P[0]);
+    double err = 0, ref = 0;
+    for (int i = 0; i < n; ++i)
+        for (int j = 0; j < n; ++j) {
+            double r = R ? (double)R[(size_t)i * n + j] : (i == j ? 1.0 : 0.0);
+            double d = (double)P[(size_t)i * n + j] - r;
+            err += d * d;
+            ref += r * r;
+        }
+    return sqrt(err / ref);
+}
+
+template <typename T>
+static double relDiff(size_t elems, const T* X, const T* R)
+{
+    double err = 0, ref = 0;
+    for (size_t e = 0; e < elems; ++e) {
+        double d = (double)X[e] - (double)R[e];
+        err += d * d;
+        ref += (double)R[e] * R[e];
+    }
+    return sqrt(err / ref);
+}
+
+template <typename T>
+static void fillRandom(std::vector<T>& A, double scale)
+{
+    for (size_t e = 0; e < A.size(); ++e)
+        A[e] = (T)(scale * (2.0 * rand() / (double)RAND_MAX - 1.0));
+}
+
+static void report(const char* fn, double fast, double plain, const MatrixFnStats& stats,
+                   bool ok, double err, const char* what, double tol)
+{
+    printf("%-8s %10.2f %10.2f %8.2fx %6d %6d %10.2e  %s %.2e %s\n", fn, fast * 1.0e3,
+           plain * 1.0e3, plain / fast, stats.products, stats.iterations, stats.residual,
+           what, err, (ok && err <= tol) ? "ok" : "FAIL");
+}
+
+// Runs the requested functions; false if any check fails
+template <typename T>
+static bool run(const char* fns, int n, int m, double norm, int reps)
+{
+    const double tol = sizeof(T) == sizeof(float) ? 1.0e-3 : 1.0e-9;
+    size_t elems = (size_t)n * n;
+    MatrixWorkspace* work = matrixWorkspaceCreate();
+    MatrixFnStats stats;
+    bool allOk = true;
+
+    if (strstr(fns, "exp")) {
+        std::vector<T> A(elems), E(elems), R(elems);
+        fillRandom(A, norm / n);
+        bool ok = true;
+        double fast = 1e30, plain = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            double t = now();
+            ok = Fns::exp(work, n, &A[0], &E[0], &stats) && ok;
+            t = now() - t;
+            if (t < fast) fast = t;
+            t = now();
+            plainExp(n, &A[0], stats.degree, &R[0]);
+            t = now() - t;
+            if (t < plain) plain = t;
+        }
+        double err = relDiff(elems, &E[0], &R[0]);
+        report("exp", fast, plain, stats, ok, err, "vs series", tol);
+        allOk = allOk && ok && err <= tol;
+    }
+
+    if (strstr(fns, "invsqrt")) {
+        // A = B^T B / n + I / 10, positive definite
+        std::vector<T> B(elems), A(elems), Y(elems), S(elems), Yr(elems), Sr(elems);
+        fillRandom(B, 1.0);
+        product(GEMM_TRANS, n, n, n, (T)(1.0 / n), &B[0], &B[0], &A[0]);
+        for (int i = 0; i < n; ++i) A[(size_t)i * n + i] += (T)0.1;
+        bool ok = true;
+        double fast = 1e30, plain = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            double t = now();
+            ok = Fns::invSqrt(work, n, &A[0], &Y[0], &S[0], &stats) && ok;
+            t = now() - t;
+            if (t < fast) fast = t;
+            t = now();
+            plainInvSqrt(n, &A[0], stats.iterations, &Yr[0], &Sr[0]);
+            t = now() - t;
+            if (t < plain) plain = t;
+        }
+        std::vector<T> YA(elems);
+        product(GEMM_NO_TRANS, n, n, n, (T)1, &Y[0], &A[0], &YA[0]);
+        double err = checkProduct(GEMM_NO_TRANS, n, n, &YA[0], &Y[0], (const T*)NULL);
+        err = fmax(err, checkProduct(GEMM_NO_TRANS, n, n, &S[0], &S[0], &A[0]));
+        report("invsqrt", fast, plain, stats, ok, err, "YAY-I,SS-A", tol);
+        allOk = allOk && ok && err <= tol;
+    }
+
+    if (strstr(fns, "polar")) {
+        std::vector<T> A((size_t)m * n), U((size_t)m * n), Ur((size_t)m * n);
+        fillRandom(A, 1.0);
+        bool ok = true;
+        double fast = 1e30, plain = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            double t = now();
+            ok = Fns::polar(work, m, n, &A[0], &U[0], &stats) && ok;
+            t = now() - t;
+            if (t < fast) fast = t;
+            t = now();
+            plainNewtonSchulz(GEMM_TRANS, m, n, &A[0], stats.iterations, &Ur[0]);
+            t = now() - t;
+            if (t < plain) plain = t;
+        }
+        double err = checkProduct(GEMM_TRANS, m, n, &U[0], &U[0], (const T*)NULL);
+        report("polar", fast, plain, stats, ok, err, "UtU-I", tol);
+        allOk = allOk && ok && err <= tol;
+    }
+
+    if (strstr(fns, "sign")) {
+        // Symmetric with its eigenvalues pushed away from zero: A = C + C^T
+        // + shift * diag(+-1)
+        std::vector<T> C(elems), A(elems), S(elems), Sr(elems);
+        fillRandom(C, 1.0 / sqrt((double)n));
+        for (int i = 0; i < n; ++i)
+            for (int j = 0; j < n; ++j)
+                A[(size_t)i * n + j] = C[(size_t)i * n + j] + C[(size_t)j * n + i];
+        for (int i = 0; i < n; ++i) A[(size_t)i * n + i] += (i % 2) ? (T)-3 : (T)3;
+        bool ok = true;
+        double fast = 1e30, plain = 1e30;
+        for (int r = 0; r < reps; ++r) {
+            double t = now();
+            ok = Fns::sign(work, n, &A[0], &S[0], &stats) && ok;
+            t = now() - t;
+            if (t < fast) fast = t;
+            t = now();
+            plainNewtonSchulz(GEMM_NO_TRANS, n, n, &A[0], stats.iterations, &Sr[0]);
+            t = now() - t;
+            if (t < plain) plain = t;
+        }
+        double err = checkProduct(GEMM_NO_TRANS, n, n, &S[0], &S[0], (const T*)NULL);
+        report("sign", fast, plain, stats, ok, err, "SS-I", tol);
+        allOk = allOk && ok && err <= tol;
+    }
+
+    printf("workspace %.1f MB\n", matrixWorkspaceBytes(work) / 1048576.0);
+    matrixWorkspaceDestroy(work);
+    return allOk;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    const char* fns = "exp,invsqrt,polar,sign";
+    int n = 512, m = 0, reps = 3;
+    double norm = 4;
+    int dtype = MATRIX_FLOAT64;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "fn=", 3) == 0)               fns = arg + 3;
+        else if (strncmp(arg, "n=", 2) == 0)           n = atoi(arg + 2);
+        else if (strncmp(arg, "m=", 2) == 0)           m = atoi(arg + 2);
+        else if (strncmp(arg, "norm=", 5) == 0)        norm = atof(arg + 5);
+        else if (strncmp(arg, "reps=", 5) == 0)        reps = atoi(arg + 5);
+        else if (strncmp(arg, "threads=", 8) == 0)     gemmSetNumThreads(atoi(arg + 8));
+        else if (strcmp(arg, "dtype=f32") == 0)        dtype = MATRIX_FLOAT32;
+        else if (strcmp(arg, "dtype=f64") == 0)        dtype = MATRIX_FLOAT64;
+        else {
+            fprintf(stderr, "timeMatFn: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (m <= 0) m = 2 * n;
+    if (n <= 0 || m < n || reps <= 0) {
+        fprintf(stderr, "timeMatFn: need n > 0, m >= n and reps > 0\n");
+        return 1;
+    }
+
+    printf("timeMatFn: n=%d (polar %dx%d), %s, best of %d\n", n, m, n,
+           dtype == MATRIX_FLOAT64 ? "f64" : "f32", reps);
+    printf("fn          fast_ms   plain_ms  speedup  prods  iters   residual  check\n");
+    bool ok = (dtype == MATRIX_FLOAT64) ? run<double>(fns, n, m, norm, reps)
+                                        : run<float>(fns, n, m, norm, reps);
+    gemmShutdown();
+    return ok ? 0 : 1;
+}
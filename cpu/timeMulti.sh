@@ -1,7 +1,9 @@
-#! /bin/bash                                                                                                                                                                       
-matrixSize=64
-for i in {1..5}
-do
-    ./timeMulti 1 $matrixSize
-    matrixSize=$(expr $matrixSize + $matrixSize)
-done
+#! /bin/bash
+# Sizes 64..1024, one timed product each, all in one process, with no baseline
+# (the original scripts never ran the system BLAS).
+# Setup (allocation and initialization), which timeSetupMulti used to time
+# together with the product, is reported on its own in the setup_sec column.
+# Rerunning resumes into timeMulti.csv; remove it (or pass resume=0) to start over.
+# Each point also records the clock it ran at and flags runs where it moved
+# (see sweep.h); compare GFlop/s only between points marked ok.
+./timeSweep sizes=64:1024:x2 kernels=gold baseline= iters=1 warmup=0 output=timeMulti.csv "$@"
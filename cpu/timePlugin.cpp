@@ -0,0 +1,166 @@
+//This loads kernel plugins (see gemmPlugin.h), lists what was accepted and
+//what was rejected, and times products with the plugins against the
+//built-in kernels:
+//     ./timePlugin dir=plugins sizes=512,513,250 dtype=f32 beta=0 reps=5 threads=1
+//
+//Without dir=, plugins come from $MATMUL_PLUGIN_DIR, as in any other program
+//using the engine. jit=0 turns off the generated kernels, so a plugin kernel
+//whose priority is 0 or below is timed as well. The two results are
+//compared.
+//
+// Build:  g++ -O3 -march=native -fopenmp timePlugin.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timePlugin
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "gemm.h"
+#include "gemmJit.h"
+#include "gemmPlugin.h"
+#include "matrixIO.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static void product(int s, float alpha, const float* A, const float* B, float beta, float* C)
+{
+    gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, alpha, A, s, B, s, beta, C, s);
+}
+
+static void product(int s, double alpha, const double* A, const double* B, double beta, double* C)
+{
+    gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, s, s, s, alpha, A, s, B, s, beta, C, s);
+}
+
+// Best time of reps products with the plugins on or off; C is reset from C0
+// before each so beta sees the same matrix
+template <typename T>
+static double timeProduct(bool plugins, int s, T alpha, const T* A, const T* B, T beta,
+                          const std::vector<T>& C0, std::vector<T>& C, int reps)
+{
+    gemmPluginSetEnabled(plugins);
+    double best = 1e30;
+    for (int r = 0; r < reps; ++r) {
+        C = C0;
+        double start = now();
+        product(s, alpha, A, B, beta, &C[0]);
+        double t = now() - start;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+// Times one size; false if the results disagree
+template <typename T>
+static bool run(int s, double beta, int reps)
+{
+    size_t elems = (size_t)s * s;
+    std::vector<T> A(elems), B(elems), C0(elems), Cb(elems), Cp(elems);
+    for (size_t i = 0; i < elems; ++i) {
+        A[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+        B[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+        C0[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    }
+    T alpha = (T)1.5;
+
+    double builtin = timeProduct<T>(false, s, alpha, &A[0], &B[0], (T)beta, C0, Cb, reps);
+    double plugin = timeProduct<T>(true, s, alpha, &A[0], &B[0], (T)beta, C0, Cp, reps);
+
+    double err = 0, ref = 0;
+    for (size_t i = 0; i < elems; ++i) {
+        err = fmax(err, fabs((double)Cp[i] - (double)Cb[i]));
+        ref = fmax(ref, fabs((double)Cb[i]));
+    }
+    bool ok = err <= (sizeof(T) == sizeof(double) ? 1.0e-12 : 1.0e-5) * ref;
+
+    double flops = 2.0 * s * s * s;
+    printf("%6d %12.2f %12.2f %9.2fx  %s\n", s, flops / builtin * 1.0e-9,
+           flops / plugin * 1.0e-9, builtin / plugin, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<int> sizes;
+    int reps = 5;
+    double beta = 0;
+    int dtype = MATRIX_FLOAT32;
+    const char* dir = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "sizes=", 6) == 0) {
+            for (const char* p = arg + 6; *p; ) {
+                sizes.push_back(atoi(p));
+                p = strchr(p, ',');
+                if (!p) break;
+                ++p;
+            }
+        } else if (strncmp(arg, "dir=", 4) == 0) {
+            dir = arg + 4;
+        } else if (strncmp(arg, "reps=", 5) == 0) {
+            reps = atoi(arg + 5);
+        } else if (strncmp(arg, "beta=", 5) == 0) {
+            beta = atof(arg + 5);
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            gemmSetNumThreads(atoi(arg + 8));
+        } else if (strcmp(arg, "jit=0") == 0) {
+            gemmJitSetEnabled(false);
+        } else if (strcmp(arg, "dtype=f32") == 0) {
+            dtype = MATRIX_FLOAT32;
+        } else if (strcmp(arg, "dtype=f64") == 0) {
+            dtype = MATRIX_FLOAT64;
+        } else {
+            fprintf(stderr, "timePlugin: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (sizes.empty()) {
+        int defaults[] = { 512, 513, 250, 127, 61 };
+        sizes.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+    if (reps <= 0) {
+        fprintf(stderr, "timePlugin: reps must be positive\n");
+        return 1;
+    }
+
+    // the first lookup loads $MATMUL_PLUGIN_DIR
+    if (dir) gemmPluginLoadDir(dir);
+    int mr, nr;
+    gemmTileSize(dtype, &mr, &nr);
+    const GemmPluginKernel* kernel = gemmPluginFindKernel(dtype, mr, nr);
+    gemmPluginPrint(stdout);
+    if (kernel)
+        printf("engine tile %d x %d: kernel %s\n", mr, nr, kernel->name);
+    else
+        printf("engine tile %d x %d: no plugin kernel\n", mr, nr);
+    bool packs = gemmPluginFindPack(dtype, 'A', mr) || gemmPluginFindPack(dtype, 'B', nr);
+    if (!kernel && !packs) {
+        fprintf(stderr, "timePlugin: no plugin for %s, nothing to compare\n",
+                dtype == MATRIX_FLOAT64 ? "f64" : "f32");
+        return 1;
+    }
+
+    printf("timePlugin: %s, alpha 1.5, beta %g, best of %d, generated kernels %s\n",
+           dtype == MATRIX_FLOAT64 ? "f64" : "f32", beta, reps, gemmJitEnabled() ? "on" : "off");
+    printf("  size  builtin_GF/s  plugin_GF/s   speedup\n");
+    bool ok = true;
+    for (size_t i = 0; i < sizes.size(); ++i)
+        ok = ((dtype == MATRIX_FLOAT64) ? run<double>(sizes[i], beta, reps)
+                                        : run<float>(sizes[i], beta, reps)) && ok;
+    gemmShutdown();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,144 @@
+//This times products with weight-only quantized B (see gemmQuantizeB) against
+//the fp32 product, and reports the error the quantization costs:
+//     ./timeQuant rows=1,4,16,64 K=4096 N=4096 bits=8 group=128 reps=5 threads=1
+//
+//For each number of rows M it runs C = A * B with B in fp32 and quantized.
+//It prints the throughput of each and the rate at which the weights stream
+//(bytes of B over time). The error is the Frobenius norm of the difference
+//relative to the fp32 C, with the largest difference relative to max |C|.
+//The fp32 C is also checked against the product with B packed once
+//(gemmSpackB), which must match it.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeQuant.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timeQuant
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "gemm.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+// Roughly what trained weights look like: mostly small, a few outliers
+static float weight()
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0), v = rand() / (double)RAND_MAX;
+    return (float)(0.02 * sqrt(-2 * log(u)) * cos(2 * M_PI * v));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    std::vector<int> rows;
+    int K = 4096, N = 4096, bits = 8, group = 128, reps = 5;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "rows=", 5) == 0) {
+            for (const char* p = arg + 5; *p; ) {
+                rows.push_back(atoi(p));
+                p = strchr(p, ',');
+                if (!p) break;
+                ++p;
+            }
+        } else if (strncmp(arg, "K=", 2) == 0) {
+            K = atoi(arg + 2);
+        } else if (strncmp(arg, "N=", 2) == 0) {
+            N = atoi(arg + 2);
+        } else if (strncmp(arg, "bits=", 5) == 0) {
+            bits = atoi(arg + 5);
+        } else if (strncmp(arg, "group=", 6) == 0) {
+            group = atoi(arg + 6);
+        } else if (strncmp(arg, "reps=", 5) == 0) {
+            reps = atoi(arg + 5);
+        } else if (strncmp(arg, "threads=", 8) == 0) {
+            gemmSetNumThreads(atoi(arg + 8));
+        } else {
+            fprintf(stderr, "timeQuant: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (rows.empty()) {
+        int defaults[] = { 1, 4, 16, 17, 64, 256 };
+        rows.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+    if (K <= 0 || N <= 0 || reps <= 0) {
+        fprintf(stderr, "timeQuant: K, N and reps must be positive\n");
+        return 1;
+    }
+
+    std::vector<float> B((size_t)K * N);
+    for (size_t i = 0; i < B.size(); ++i)
+        B[i] = weight();
+    GemmQuantB* Q = gemmQuantizeB(GEMM_NO_TRANS, K, N, &B[0], N, bits, group);
+    if (!Q) return 1;
+    GemmPackedB* P = gemmSpackB(GEMM_NO_TRANS, K, N, &B[0], N);
+    if (!P) return 1;
+    GemmQuantInfo info;
+    gemmQuantInfo(Q, &info);
+    double fpBytes = 4.0 * K * N;
+    printf("timeQuant: K %d, N %d, int%d, group %d, weights %.1f MB (fp32 %.1f MB, %.2fx less), "
+           "weight error %.2e\n", K, N, info.bits, info.groupSize, info.bytes / 1048576.0,
+           fpBytes / 1048576.0, fpBytes / info.bytes, info.weightError);
+    printf("  rows   fp32_GF/s  quant_GF/s   fp32_GB/s  quant_GB/s  speedup   rel_err   max_err\n");
+
+    bool packedOk = true;
+    for (size_t r = 0; r < rows.size(); ++r) {
+        int M = rows[r];
+        std::vector<float> A((size_t)M * K), Cf((size_t)M * N), Cq((size_t)M * N), Cp((size_t)M * N);
+        for (size_t i = 0; i < A.size(); ++i)
+            A[i] = (float)(rand() / (double)RAND_MAX - 0.5);
+
+        double fp = 1e30, quant = 1e30;
+        for (int rep = 0; rep < reps; ++rep) {
+            double start = now();
+            gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0f, &A[0], K, &B[0], N, 0.0f, &Cf[0], N);
+            double t = now() - start;
+            fp = (t < fp) ? t : fp;
+
+            start = now();
+            gemmSgemmQuant(GEMM_NO_TRANS, M, 1.0f, &A[0], K, Q, 0.0f, &Cq[0], N);
+            t = now() - start;
+            quant = (t < quant) ? t : quant;
+        }
+
+        gemmSgemmPacked(GEMM_NO_TRANS, M, 1.0f, &A[0], K, P, 0.0f, &Cp[0], N);
+
+        double diff = 0, norm = 0, most = 0, top = 0, packedDiff = 0;
+        for (size_t i = 0; i < Cf.size(); ++i) {
+            double d = (double)Cq[i] - Cf[i];
+            diff += d * d;
+            norm += (double)Cf[i] * Cf[i];
+            most = fmax(most, fabs(d));
+            top = fmax(top, fabs((double)Cf[i]));
+            packedDiff = fmax(packedDiff, fabs((double)Cp[i] - Cf[i]));
+        }
+        if (packedDiff > 1.0e-5 * top) {
+            fprintf(stderr, "timeQuant: packed B differs by %.2e at %d rows\n", packedDiff, M);
+            packedOk = false;
+        }
+        double flops = 2.0 * M * N * K;
+        printf("%6d %11.2f %11.2f %11.2f %11.2f %8.2fx %9.2e %9.2e\n", M,
+               flops / fp * 1.0e-9, flops / quant * 1.0e-9,
+               fpBytes / fp * 1.0e-9, info.bytes / quant * 1.0e-9, fp / quant,
+               norm > 0 ? sqrt(diff / norm) : 0, top > 0 ? most / top : 0);
+    }
+
+    gemmFreeQuantB(Q);
+    gemmFreePackedB(P);
+    gemmShutdown();
+    return packedOk ? 0 : 1;
+}
@@ -1,7 +0,0 @@
-#! /bin/bash                                                                                                                                                                       
-matrixSize=64
-for i in {1..5}
-do
-    ./timeSetupMulti 1 $matrixSize
-    matrixSize=$(expr $matrixSize + $matrixSize)
-done
@@ -0,0 +1,145 @@
+//This compares streaming a multiply over row blocks of A with waiting for
+//all of A first, for an A that arrives block by block:
+//     ./timeStream m=8192 k=1024 n=1024 block=256 depth=4 arrival=2 dtype=f32
+//
+//arrival= is the time in milliseconds between blocks of A reaching the
+//producer. Both runs see the same arrivals; the streamed one reports the time
+//to its first rows of C and the most queue memory in use, and its C is
+//checked against the batch result.
+//
+// Build:  g++ -O3 -march=native -fopenmp timeStream.cpp gemmStream.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp
+//             gemmTrace.cpp gemmMetrics.cpp arena.cpp multithreading.cpp matrixIO.cpp -lpthread -ldl -o timeStream
+
+// Utilities and system includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "gemm.h"
+#include "gemmStream.h"
+#include "matrixIO.h"
+
+typedef struct {
+    double  start;
+    double  first;                  // when the first rows came out
+    char*   C;                      // the streamed result
+    size_t  rowBytes;
+} Sink;
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+}
+
+static void consume(int row0, int rows, const void* C, int ldc, void* arg)
+{
+    Sink* sink = (Sink*)arg;
+    if (sink->first == 0) sink->first = now() - sink->start;
+    (void)ldc;
+    memcpy(sink->C + (size_t)row0 * sink->rowBytes, C, (size_t)rows * sink->rowBytes);
+}
+
+// Waits for block b of A to "arrive"
+static void arrive(double start, int b, double arrival)
+{
+    double due = start + b * arrival;
+    double wait = due - now();
+    if (wait > 0) usleep((useconds_t)(wait * 1.0e6));
+}
+
+template <typename T>
+static int run(int dtype, int M, int K, int N, int block, int depth, double arrival)
+{
+    std::vector<T> A((size_t)M * K), B((size_t)K * N), C((size_t)M * N), S((size_t)M * N);
+    for (size_t i = 0; i < A.size(); ++i) A[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    for (size_t i = 0; i < B.size(); ++i) B[i] = (T)(rand() / (double)RAND_MAX - 0.5);
+    int nBlocks = (M + block - 1) / block;
+
+    // Batch: everything has to arrive before the multiply can start
+    double start = now();
+    arrive(start, nBlocks, arrival);
+    if (dtype == MATRIX_FLOAT64)
+        gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0, (const double*)&A[0], K,
+                  (const double*)&B[0], N, 0.0, (double*)&C[0], N);
+    else
+        gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, M, N, K, 1.0f, (const float*)&A[0], K,
+                  (const float*)&B[0], N, 0.0f, (float*)&C[0], N);
+    double batch = now() - start;
+
+    // Streamed: each block is pushed as it arrives
+    Sink sink;
+    sink.C = (char*)&S[0];
+    sink.rowBytes = sizeof(T) * N;
+    sink.first = 0;
+    sink.start = start = now();
+    GemmStream* stream = gemmStreamCreate(dtype, GEMM_NO_TRANS, K, N, &B[0], N, block, depth,
+                                          consume, &sink);
+    if (!stream) return 1;
+    for (int b = 0; b < nBlocks; ++b) {
+        arrive(start, b + 1, arrival);
+        int rows = (M - b * block < block) ? M - b * block : block;
+        gemmStreamPush(stream, &A[(size_t)b * block * K], rows, K);
+    }
+    gemmStreamFinish(stream);
+    double streamed = now() - start;
+    gemmStreamDestroy(stream);
+
+    double err = 0;
+    for (size_t i = 0; i < C.size(); ++i)
+        err = fmax(err, fabs((double)C[i] - (double)S[i]));
+
+    double queueMB = (double)depth * block * (K + N) * sizeof(T) / 1.0e6;
+    double fullMB = ((double)M * K + (double)M * N) * sizeof(T) / 1.0e6;
+    printf("batch:    %8.4f s to first rows, %8.4f s total, %8.1f MB for A and C\n",
+           batch, batch, fullMB);
+    printf("streamed: %8.4f s to first rows, %8.4f s total, %8.1f MB queued at most\n",
+           sink.first, streamed, queueMB);
+    printf("%s: max difference %g\n", err <= 1.0e-3 * K ? "PASSED" : "FAILED", err);
+    return err <= 1.0e-3 * K ? 0 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int M = 8192, K = 1024, N = 1024, block = 256, depth = 4;
+    double arrival = 2;
+    int dtype = MATRIX_FLOAT32;
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "m=", 2) == 0)            M = atoi(arg + 2);
+        else if (strncmp(arg, "k=", 2) == 0)       K = atoi(arg + 2);
+        else if (strncmp(arg, "n=", 2) == 0)       N = atoi(arg + 2);
+        else if (strncmp(arg, "block=", 6) == 0)   block = atoi(arg + 6);
+        else if (strncmp(arg, "depth=", 6) == 0)   depth = atoi(arg + 6);
+        else if (strncmp(arg, "arrival=", 8) == 0) arrival = atof(arg + 8);
+        else if (strncmp(arg, "threads=", 8) == 0) gemmSetNumThreads(atoi(arg + 8));
+        else if (strcmp(arg, "dtype=f32") == 0)    dtype = MATRIX_FLOAT32;
+        else if (strcmp(arg, "dtype=f64") == 0)    dtype = MATRIX_FLOAT64;
+        else {
+            fprintf(stderr, "timeStream: bad argument %s\n", arg);
+            return 1;
+        }
+    }
+    if (M <= 0 || K <= 0 || N <= 0 || block <= 0 || depth <= 0) {
+        fprintf(stderr, "timeStream: sizes must be positive\n");
+        return 1;
+    }
+
+    printf("timeStream: %dx%dx%d %s, blocks of %d rows every %.1f ms, queue depth %d\n",
+           M, K, N, dtype == MATRIX_FLOAT64 ? "f64" : "f32", block, arrival, depth);
+    int result = (dtype == MATRIX_FLOAT64)
+               ? run<double>(dtype, M, K, N, block, depth, arrival * 1.0e-3)
+               : run<float>(dtype, M, K, N, block, depth, arrival * 1.0e-3);
+    gemmShutdown();
+    return result;
+}
@@ -0,0 +1,223 @@
+//This takes command line arguements of the form key=value (see sweep.h),
+//or grid=<file> to read them from a file:
+//     ./timeSweep sizes=64:1024:x2 kernels=gold,engine threads=1,4 output=sweep.csv
+//
+//The gemmd kernel sends each product to a running gemmd (see gemmService.h);
+//its operands are copied into shared memory during setup, outside the timing.
+//
+//When a system BLAS can be loaded (see systemBlas.h) it is the baseline the
+//other kernels are compared with; baseline= with no value turns that off.
+//
+//The schedule kernel runs the loop nest given by schedule= (see schedule.h),
+//a BLIS-like one by default, so a new schedule can be timed without a
+//rebuild:
+//     ./timeSweep kernels=engine,schedule
+//         schedule="tile i j 32 128 io jo ii ji; reorder io jo k ii ji; vectorize ji"
+//
+// Build:  g++ -O3 -march=native -fopenmp timeSweep.cpp sweep.cpp gemm.cpp gemmJit.cpp gemmPlugin.cpp arena.cpp
+//             multithreading.cpp matrixMul_gold.cpp matrixMul_cache.cpp matrixIO.cpp
+//             systemBlas.cpp gemmService.cpp gemmTrace.cpp gemmMetrics.cpp schedule.cpp cpuFreq.cpp -lpthread -ldl -o timeSweep
+
+// Utilities and system includes
+#include <stdio.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "gemm.h"
+#include "gemmService.h"
+#include "matrixIO.h"
+#include "matrixMul_gold.h"
+#include "schedule.h"
+#include "sweep.h"
+#include "systemBlas.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Kernels
+////////////////////////////////////////////////////////////////////////////////
+
+static void goldRun(void*, const SweepProblem* p)
+{
+    computeGold((float*)p->C, (const float*)p->A, (const float*)p->B, p->M, p->K, p->N);
+}
+
+static void engineRun(void*, const SweepProblem* p)
+{
+    if (p->dtype == MATRIX_FLOAT64) {
+        gemmDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, p->M, p->N, p->K,
+                  1.0, (const double*)p->A, p->K, (const double*)p->B, p->N,
+                  0.0, (double*)p->C, p->N);
+    } else {
+        gemmSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, p->M, p->N, p->K,
+                  1.0f, (const float*)p->A, p->K, (const float*)p->B, p->N,
+                  0.0f, (float*)p->C, p->N);
+    }
+}
+
+static bool blasSetup(void*, const SweepProblem* p)
+{
+    if (!blasLoad()) return false;
+    blasSetNumThreads(p->threads);
+    return true;
+}
+
+static void blasRun(void*, const SweepProblem* p)
+{
+    if (p->dtype == MATRIX_FLOAT64) {
+        blasDgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, p->M, p->N, p->K,
+                  1.0, (const double*)p->A, p->K, (const double*)p->B, p->N,
+                  0.0, (double*)p->C, p->N);
+    } else {
+        blasSgemm(GEMM_NO_TRANS, GEMM_NO_TRANS, p->M, p->N, p->K,
+                  1.0f, (const float*)p->A, p->K, (const float*)p->B, p->N,
+                  0.0f, (float*)p->C, p->N);
+    }
+}
+
+typedef struct {
+    bool        connected;
+    GemmdClient client;
+    void*       A;
+    void*       B;
+    void*       C;
+} GemmdContext;
+
+static GemmdContext gemmdContext;
+
+static bool gemmdSetup(void* ctx, const SweepProblem* p)
+{
+    GemmdContext* g = (GemmdContext*)ctx;
+    if (!g->connected && !(g->connected = gemmdConnect(&g->client, NULL))) return false;
+
+    if (g->A) gemmdFree(&g->client, g->A);
+    if (g->B) gemmdFree(&g->client, g->B);
+    if (g->C) gemmdFree(&g->client, g->C);
+
+    size_t elem = matrixTypeSize(p->dtype);
+    g->A = gemmdAlloc(&g->client, elem * p->M * p->K);
+    g->B = gemmdAlloc(&g->client, elem * p->K * p->N);
+    g->C = gemmdAlloc(&g->client, elem * p->M * p->N);
+    if (!g->A || !g->B || !g->C) return false;
+
+    memcpy(g->A, p->A, elem * p->M * p->K);
+    memcpy(g->B, p->B, elem * p->K * p->N);
+    return true;
+}
+
+static void gemmdRun(void* ctx, const SweepProblem* p)
+{
+    GemmdContext* g = (GemmdContext*)ctx;
+    uint64_t job = gemmdSubmit(&g->client, p->dtype, GEMM_NO_TRANS, GEMM_NO_TRANS,
+                               p->M, p->N, p->K, 1.0, g->A, p->K, g->B, p->N, 0.0, g->C, p->N);
+    int status = job ? gemmdWait(&g->client, job, NULL) : GEMMD_DISCONNECTED;
+    if (status != GEMMD_OK) fprintf(stderr, "gemmd: job failed with status %d\n", status);
+}
+
+static void gemmdFinish(void* ctx, const SweepProblem* p)
+{
+    GemmdContext* g = (GemmdContext*)ctx;
+    memcpy(p->C, g->C, matrixTypeSize(p->dtype) * p->M * p->N);
+}
+
+// Register tiles of 4 x 16 floats or 4 x 8 doubles, A packed per 64-row
+// block and B per 256-deep slice, as the engine does
+#define DEFAULT_SCHEDULE(nr) \
+    "split i 64 io ii; split j 512 jo ji; split k 256 ko ki; split ii 4 iio iii;" \
+    "split ji " nr " jio jii; reorder jo ko io jio iio ki iii jii; vectorize jii;" \
+    "pack B ko; pack A io; parallel io"
+
+typedef struct {
+    const char* text;           // schedule=, or NULL for the defaults
+    Schedule*   schedule[2];    // f32, f64
+    bool        printed[2];
+} ScheduleContext;
+
+static ScheduleContext scheduleContext = { NULL, { NULL, NULL }, { false, false } };
+
+static bool scheduleSetup(void* ctx, const SweepProblem* p)
+{
+    ScheduleContext* s = (ScheduleContext*)ctx;
+    int d = (p->dtype == MATRIX_FLOAT64);
+    if (!s->schedule[d]) {
+        const char* text = s->text ? s->text
+                         : d ? DEFAULT_SCHEDULE("8") : DEFAULT_SCHEDULE("16");
+        Schedule* schedule = scheduleCreate();
+        if (!schedule || !scheduleParse(schedule, text) || !scheduleCheck(schedule)) {
+            fprintf(stderr, "schedule: cannot use '%s'\n", text);
+            scheduleDestroy(schedule);
+            return false;
+        }
+        s->schedule[d] = schedule;
+    }
+    if (!s->printed[d]) {
+        schedulePrint(s->schedule[d], p->M, p->N, p->K, stdout);
+        s->printed[d] = true;
+    }
+#ifdef _OPENMP
+    omp_set_num_threads(p->threads > 0 ? p->threads : omp_get_num_procs());
+#endif
+    return true;
+}
+
+static void scheduleRun(void* ctx, const SweepProblem* p)
+{
+    ScheduleContext* s = (ScheduleContext*)ctx;
+    if (p->dtype == MATRIX_FLOAT64)
+        scheduleDgemm(s->schedule[1], p->M, p->N, p->K, (const double*)p->A, p->K,
+                      (const double*)p->B, p->N, (double*)p->C, p->N);
+    else
+        scheduleSgemm(s->schedule[0], p->M, p->N, p->K, (const float*)p->A, p->K,
+                      (const float*)p->B, p->N, (float*)p->C, p->N);
+}
+
+static SweepKernel cpuKernels[] = {
+    { "gold",   SWEEP_DTYPE_BIT(MATRIX_FLOAT32), NULL, goldRun, NULL, NULL },
+    { "engine", SWEEP_DTYPE_BIT(MATRIX_FLOAT32) | SWEEP_DTYPE_BIT(MATRIX_FLOAT64),
+                NULL, engineRun, NULL, NULL },
+    { "blas",   SWEEP_DTYPE_BIT(MATRIX_FLOAT32) | SWEEP_DTYPE_BIT(MATRIX_FLOAT64),
+                blasSetup, blasRun, NULL, NULL },
+    { "gemmd",  SWEEP_DTYPE_BIT(MATRIX_FLOAT32) | SWEEP_DTYPE_BIT(MATRIX_FLOAT64),
+                gemmdSetup, gemmdRun, gemmdFinish, &gemmdContext },
+    { "schedule", SWEEP_DTYPE_BIT(MATRIX_FLOAT32) | SWEEP_DTYPE_BIT(MATRIX_FLOAT64),
+                scheduleSetup, scheduleRun, NULL, &scheduleContext },
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    SweepGrid grid;
+    sweepDefaults(&grid);
+    if (blasLoad()) strcpy(grid.baseline, "blas");
+
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "schedule=", 9) == 0) {
+            scheduleContext.text = argv[i] + 9;
+            continue;
+        }
+        bool ok = (strncmp(argv[i], "grid=", 5) == 0)
+                ? sweepParseFile(&grid, argv[i] + 5)
+                : sweepParseArg(&grid, argv[i]);
+        if (!ok) return 1;
+    }
+
+    if (!blasLoad()) {
+        printf("No system BLAS found; running without a baseline\n");
+        if (strcmp(grid.baseline, "blas") == 0) grid.baseline[0] = 0;
+    } else if (strcmp(grid.baseline, "blas") == 0) {
+        printf("Baseline: blas (%s)\n", blasLibraryName());
+    }
+
+    int failures = sweepRun(&grid, cpuKernels, sizeof(cpuKernels) / sizeof(cpuKernels[0]));
+    if (gemmdContext.connected) gemmdDisconnect(&gemmdContext.client);
+    scheduleDestroy(scheduleContext.schedule[0]);
+    scheduleDestroy(scheduleContext.schedule[1]);
+    gemmShutdown();
+
+    if (failures < 0) return 1;
+    if (failures > 0) printf("%d points FAILED validation\n", failures);
+    return failures > 0 ? 1 : 0;
+}
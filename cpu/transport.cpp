@@ -0,0 +1,341 @@
+// Point-to-point transport between the processes of a distributed product.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "transport.h"
+
+// Bytes buffered per ordered pair of ranks; a power of two
+#define SHM_CHANNEL_BYTES (1u << 20)
+
+typedef struct {
+    int fds[TRANSPORT_MAX_RANKS];   // by peer; -1 for self
+} SocketImpl;
+
+// Head and tail count bytes and run free; the receiver owns the head, the
+// sender the tail. Each sits on its own cache line.
+typedef struct {
+    uint32_t head;
+    uint32_t pad0[15];
+    uint32_t tail;
+    uint32_t pad1[15];
+    char     data[SHM_CHANNEL_BYTES];
+} ShmChannel;
+
+typedef struct {
+    pid_t      pids[TRANSPORT_MAX_RANKS];
+    ShmChannel channels[1];         // size * size, [from * size + to]
+} ShmRegion;
+
+typedef struct {
+    ShmRegion* region;
+    size_t     length;
+} ShmImpl;
+
+int transportParse(const char* name)
+{
+    if (strcmp(name, "socket") == 0) return TRANSPORT_SOCKET;
+    if (strcmp(name, "shm") == 0)    return TRANSPORT_SHM;
+    return -1;
+}
+
+const char* transportName(int kind)
+{
+    return (kind == TRANSPORT_SHM) ? "shm" : "socket";
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Unix sockets
+////////////////////////////////////////////////////////////////////////////////
+
+static bool socketSend(Transport* t, int peer, const void* buf, size_t bytes)
+{
+    int fd = ((SocketImpl*)t->impl)->fds[peer];
+    const char* p = (const char*)buf;
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static bool socketRecv(Transport* t, int peer, void* buf, size_t bytes)
+{
+    int fd = ((SocketImpl*)t->impl)->fds[peer];
+    char* p = (char*)buf;
+    while (bytes > 0) {
+        ssize_t n = recv(fd, p, bytes, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        bytes -= (size_t)n;
+    }
+    return true;
+}
+
+static void socketDestroy(Transport* t)
+{
+    SocketImpl* impl = (SocketImpl*)t->impl;
+    for (int r = 0; r < t->size; ++r)
+        if (impl->fds[r] >= 0) close(impl->fds[r]);
+    free(impl);
+}
+
+// A socket pair for every pair of ranks, made before forking; each process
+// then keeps its own ends
+static bool socketMesh(int size, int fds[][TRANSPORT_MAX_RANKS])
+{
+    for (int i = 0; i < size; ++i)
+        for (int j = 0; j < size; ++j)
+            fds[i][j] = -1;
+
+    for (int i = 0; i < size; ++i) {
+        for (int j = i + 1; j < size; ++j) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                fprintf(stderr, "transport: socketpair: %s\n", strerror(errno));
+                return false;
+            }
+            fds[i][j] = pair[0];
+            fds[j][i] = pair[1];
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Shared memory
+////////////////////////////////////////////////////////////////////////////////
+
+static void futexWait(uint32_t* word, uint32_t expected)
+{
+    // bounded, so a peer that died is noticed
+    struct timespec ts = { 0, 100 * 1000 * 1000 };
+    syscall(SYS_futex, word, FUTEX_WAIT, expected, &ts, NULL, 0);
+}
+
+static void futexWake(uint32_t* word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static ShmChannel* channel(Transport* t, int from, int to)
+{
+    return &((ShmImpl*)t->impl)->region->channels[from * t->size + to];
+}
+
+static bool peerAlive(Transport* t, int peer)
+{
+    pid_t pid = ((ShmImpl*)t->impl)->region->pids[peer];
+    if (t->rank == 0) {
+        // a child that exited is a zombie until reaped, so ask waitpid
+        int status;
+        return waitpid(pid, &status, WNOHANG) == 0;
+    }
+    return kill(pid, 0) == 0 && getppid() == ((ShmImpl*)t->impl)->region->pids[0];
+}
+
+static bool shmSend(Transport* t, int peer, const void* buf, size_t bytes)
+{
+    ShmChannel* ch = channel(t, t->rank, peer);
+    const char* p = (const char*)buf;
+    uint32_t tail = ch->tail;
+
+    while (bytes > 0) {
+        uint32_t head = __atomic_load_n(&ch->head, __ATOMIC_ACQUIRE);
+        uint32_t space = SHM_CHANNEL_BYTES - (tail - head);
+        if (space == 0) {
+            futexWait(&ch->head, head);
+            if (__atomic_load_n(&ch->head, __ATOMIC_ACQUIRE) == head && !peerAlive(t, peer))
+                return false;
+            continue;
+        }
+
+        uint32_t at = tail & (SHM_CHANNEL_BYTES - 1);
+        size_t n = SHM_CHANNEL_BYTES - at;
+        if (n > space) n = space;
+        if (n > bytes) n = bytes;
+        memcpy(ch->data + at, p, n);
+        tail += (uint32_t)n;
+        __atomic_store_n(&ch->tail, tail, __ATOMIC_RELEASE);
+        futexWake(&ch->tail);
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+static bool shmRecv(Transport* t, int peer, void* buf, size_t bytes)
+{
+    ShmChannel* ch = channel(t, peer, t->rank);
+    char* p = (char*)buf;
+    uint32_t head = ch->head;
+
+    while (bytes > 0) {
+        uint32_t tail = __atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE);
+        if (tail == head) {
+            futexWait(&ch->tail, tail);
+            if (__atomic_load_n(&ch->tail, __ATOMIC_ACQUIRE) == tail && !peerAlive(t, peer))
+                return false;
+            continue;
+        }
+
+        uint32_t at = head & (SHM_CHANNEL_BYTES - 1);
+        size_t n = SHM_CHANNEL_BYTES - at;
+        if (n > tail - head) n = tail - head;
+        if (n > bytes) n = bytes;
+        memcpy(p, ch->data + at, n);
+        head += (uint32_t)n;
+        __atomic_store_n(&ch->head, head, __ATOMIC_RELEASE);
+        futexWake(&ch->head);
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+static void shmDestroy(Transport* t)
+{
+    ShmImpl* impl = (ShmImpl*)t->impl;
+    munmap(impl->region, impl->length);
+    free(impl);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Setup
+////////////////////////////////////////////////////////////////////////////////
+
+Transport* transportSpawn(int kind, int size)
+{
+    if (size < 1 || size > TRANSPORT_MAX_RANKS) {
+        fprintf(stderr, "transport: %d ranks; 1 to %d are supported\n", size, TRANSPORT_MAX_RANKS);
+        return NULL;
+    }
+
+    static int fds[TRANSPORT_MAX_RANKS][TRANSPORT_MAX_RANKS];
+    ShmRegion* region = NULL;
+    size_t length = 0;
+
+    if (kind == TRANSPORT_SHM) {
+        // Pages are only touched as far as channels are used
+        length = sizeof(ShmRegion) + ((size_t)size * size - 1) * sizeof(ShmChannel);
+        void* base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED) {
+            fprintf(stderr, "transport: cannot map %zu bytes of channels\n", length);
+            return NULL;
+        }
+        region = (ShmRegion*)base;
+        region->pids[0] = getpid();
+    } else if (!socketMesh(size, fds)) {
+        return NULL;
+    }
+
+    Transport* t = (Transport*)calloc(1, sizeof(Transport));
+    t->size = size;
+    t->kind = kind;
+
+    int rank = 0;
+    for (int r = 1; r < size; ++r) {
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            rank = r;
+            // don't outlive rank 0
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+            if (getppid() == 1) _exit(1);
+            break;
+        }
+        if (pid < 0) {
+            fprintf(stderr, "transport: fork: %s\n", strerror(errno));
+            for (int c = 1; c < r; ++c) kill(t->children[c], SIGKILL);
+            for (int c = 1; c < r; ++c) waitpid(t->children[c], NULL, 0);
+            if (region) munmap(region, length);
+            free(t);
+            return NULL;
+        }
+        t->children[r] = pid;
+        if (region) region->pids[r] = pid;
+    }
+    t->rank = rank;
+
+    if (kind == TRANSPORT_SHM) {
+        ShmImpl* impl = (ShmImpl*)malloc(sizeof(ShmImpl));
+        impl->region = region;
+        impl->length = length;
+        t->impl = impl;
+        t->send = shmSend;
+        t->recv = shmRecv;
+        t->destroy = shmDestroy;
+        // children may run before rank 0 has filled in every pid
+        region->pids[rank] = getpid();
+    } else {
+        SocketImpl* impl = (SocketImpl*)malloc(sizeof(SocketImpl));
+        for (int i = 0; i < size; ++i) {
+            for (int j = 0; j < size; ++j) {
+                if (i == rank) impl->fds[j] = fds[i][j];
+                else if (fds[i][j] >= 0) close(fds[i][j]);
+            }
+        }
+        t->impl = impl;
+        t->send = socketSend;
+        t->recv = socketRecv;
+        t->destroy = socketDestroy;
+    }
+
+    // every pid is in place once everyone is here
+    if (!transportBarrier(t)) {
+        fprintf(stderr, "transport: rank %d could not reach the others\n", rank);
+        if (rank != 0) _exit(1);
+        transportClose(t);
+        return NULL;
+    }
+    return t;
+}
+
+bool transportBarrier(Transport* t)
+{
+    char token = 0;
+    if (t->rank == 0) {
+        for (int r = 1; r < t->size; ++r)
+            if (!t->recv(t, r, &token, 1)) return false;
+        for (int r = 1; r < t->size; ++r)
+            if (!t->send(t, r, &token, 1)) return false;
+        return true;
+    }
+    return t->send(t, 0, &token, 1) && t->recv(t, 0, &token, 1);
+}
+
+bool transportClose(Transport* t)
+{
+    bool ok = true;
+    t->destroy(t);
+    if (t->rank == 0) {
+        for (int r = 1; r < t->size; ++r) {
+            int status;
+            if (waitpid(t->children[r], &status, 0) != t->children[r]
+                || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            {
+                fprintf(stderr, "transport: rank %d failed\n", r);
+                ok = false;
+            }
+        }
+    }
+    free(t);
+    return ok;
+}
@@ -0,0 +1,57 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+// Point-to-point transport between the processes of a distributed product.
+//
+// A transport moves bytes between ranks 0..size-1 with blocking, in-order
+// send and receive on each ordered pair of ranks. Implementations plug in
+// through the function pointers; the two here connect processes forked on
+// one machine:
+//
+//   TRANSPORT_SOCKET  a Unix stream socket per pair of ranks
+//   TRANSPORT_SHM     a shared-memory ring per ordered pair, with futex waits
+//
+// Each ordered pair may have one sending and one receiving thread at a time,
+// so a rank can send and receive concurrently from two threads.
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TRANSPORT_SOCKET 0
+#define TRANSPORT_SHM    1
+
+#define TRANSPORT_MAX_RANKS 64
+
+typedef struct Transport Transport;
+
+struct Transport {
+    int   rank;
+    int   size;
+    int   kind;                     // TRANSPORT_*
+
+    // false if the peer has gone away
+    bool (*send)(Transport* t, int peer, const void* buf, size_t bytes);
+    bool (*recv)(Transport* t, int peer, void* buf, size_t bytes);
+    void (*destroy)(Transport* t);
+
+    void* impl;
+    pid_t children[TRANSPORT_MAX_RANKS];    // rank 0 only
+};
+
+// "socket" or "shm"; returns -1 for anything else
+int transportParse(const char* name);
+const char* transportName(int kind);
+
+// Forks size - 1 children connected to the caller by a transport of kind.
+// Returns in every process with its own rank; the caller is rank 0. NULL on
+// failure, in the caller only.
+Transport* transportSpawn(int kind, int size);
+
+// Returns once every rank has called it
+bool transportBarrier(Transport* t);
+
+// Tears down the transport. Rank 0 also waits for the children and returns
+// false if any of them failed; other ranks should exit afterwards.
+bool transportClose(Transport* t);
+
+#endif // _TRANSPORT_H_
@@ -3,6 +3,9 @@
 //This takes command line arguements for:
 //     number of runs
 //     matrix side length
+//
+// Build:  nvcc -O2 -Xcompiler -fopenmp -I../cpu timeMulti.cu ../cpu/matrixMul_gold.cpp
+//              ../cpu/matrixMul_cache.cpp ../cpu/matrixIO.cpp -o timeMulti -lgomp
 
 // Utilities and system includes
 #include <stdio.h>
@@ -10,6 +13,8 @@
 #include <sys/time.h>
 
 #include "matrixMul.h"
+#include "matrixMul_gold.h"
+#include "matrixMul_cache.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 //! Matrix multiplication on the device: C = A * B
@@ -94,11 +99,6 @@ struct timeval tp;
 double getTime_sec();
 void runTest(int argc, char** argv);
 void randomInit(float*, int);
-void printDiff(float*, float*, int, int, int, float);
-bool check(float*, float*, int, float);
-
-extern "C"
-void computeGold(float*, const float*, const float*, unsigned int, unsigned int, unsigned int);
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -212,25 +212,29 @@ int main(int argc, char** argv)
 
 
     // copy result from device to host
-    //cudaMemcpy(h_C, d_C, mem_size_C, cudaMemcpyDeviceToHost);
-
-    // compute reference solution    
-    //float* reference = (float*)malloc(mem_size_C);
-    //computeGold(reference, h_A, h_B, uiHA, uiWA, uiWB);
-
-    // check result (matrixMul)
-    // printf("Comparing CUDA matrixMul & Host results\n");
-    // bool resCUDA = check(reference, h_C, size_C, 1.0e-6f); //not sure if I can use this
-    // if (resCUDA != true) 
-    //{
-    //    printDiff(reference, h_C, uiWC, uiHC, 100, 1.0e-3f);
-    // }
-    // printf("CUDA matrixMul compares %s\n\n", (true == resCUDA) ? "OK" : "FAIL");
+    cudaMemcpy(h_C, d_C, mem_size_C, cudaMemcpyDeviceToHost);
+
+    // reference solution; A is fully determined by the seed and the size,
+    // so after the first run it is mapped from the gold cache
+    GoldKey key;
+    GoldRef gold;
+    makeGoldKey(&key, 2006, uiHA, uiWA, uiWB, GOLD_A_TIMES_A);
+    float* reference = (float*)computeGoldCached(&gold, &key, h_A, h_A);
+
+    // check result (matrixMul); float accumulation error grows with wA
+    float fTol = 1.0e-5f * uiWA;
+    printf("Comparing CUDA matrixMul & Host results (reference %s)\n", gold.hit ? "cached" : "computed");
+    bool resCUDA = check(reference, h_C, size_C, fTol);
+    if (resCUDA != true) 
+    {
+        printDiff(reference, h_C, uiWC, uiHC, 100, fTol);
+    }
+    printf("CUDA matrixMul compares %s\n\n", (true == resCUDA) ? "OK" : "FAIL");
 
     // clean up memory
     free(h_A);
     free(h_C);
-    //    free(reference);
+    releaseGold(&gold);
     cudaFree(d_A);
     cudaFree(d_C);
 
@@ -250,55 +254,3 @@ void randomInit(float* data, int size)
     for (int i = 0; i < size; ++i)
         data[i] = rand() / (float)RAND_MAX;
 }
-
-void computeGold(float* C, const float* A, const float* B, unsigned int hA, unsigned int wA, unsigned int wB)
-{
-    for (unsigned int i = 0; i < hA; ++i)
-        for (unsigned int j = 0; j < wB; ++j) {
-            double sum = 0;
-            for (unsigned int k = 0; k < wA; ++k) {
-                double a = A[i * wA + k];
-                double b = B[k * wB + j];
-                sum += a * b;
-            }
-            C[i * wB + j] = (float)sum;
-        }
-}
-
-bool check(float *data1, float *data2, int size, float fListTol)
-{
-    int k;
-    for (k = 0; k < size; k++){ 
-        float fDiff = fabs(data1[k] - data2[k]);
-        if (fDiff > fListTol) return false;
-    }
-    return true;
-}
-
-void printDiff(float *data1, float *data2, int width, int height, int iListLength, float fListTol)
-{
-    //printf("Listing first %d Differences > %.6f...\n", iListLength, fListTol);
-    int i,j,k;
-    int error_count=0;
-    for (j = 0; j < height; j++) 
-    {
-        if (error_count < iListLength)
-        {
-            //printf("\n  Row %d:\n", j);
-        }
-        for (i = 0; i < width; i++) 
-        {
-            k = j * width + i;
-            float fDiff = fabs(data1[k] - data2[k]);
-            if (fDiff > fListTol) 
-            {                
-                if (error_count < iListLength)
-                {
-                    //printf("    Loc(%d,%d)\tCPU=%.5f\tGPU=%.5f\tDiff=%.6f\n", i, j, data1[k], data2[k], fDiff);
-                }
-                error_count++;
-            }
-        }
-    }
-    printf(" \n  Total Errors = %d  with tolerance of %.6f\n\n", error_count, fListTol);
-}
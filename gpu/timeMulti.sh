@@ -1,7 +1,5 @@
-#! /bin/bash                                                                                                                                                                       
-matrixSize=64
-for i in {1..8}
-do
-    ./timeMulti 1 $matrixSize
-    matrixSize=$(expr $matrixSize + $matrixSize)
-done
+#! /bin/bash
+# Sizes 64..8192, one warmup and one timed kernel launch each, all in one
+# process with a single CUDA context.
+# Rerunning resumes into timeMulti.csv; remove it (or pass resume=0) to start over.
+./timeSweep sizes=64:8192:x2 kernels=cuda iters=1 warmup=1 output=timeMulti.csv "$@"
@@ -1,7 +1,4 @@
-#! /bin/bash                                                                                                                                                                       
-matrixSize=64
-for i in {1..8}
-do
-    ./timeSetupMulti 1 $matrixSize
-    matrixSize=$(expr $matrixSize + $matrixSize)
-done
+#! /bin/bash
+# Sizes 64..8192, one timed kernel launch each, all in one process.
+# Host-to-device setup is reported in the setup_sec column.
+./timeSweep sizes=64:8192:x2 kernels=cuda iters=1 warmup=0 output=timeSetupMulti.csv "$@"
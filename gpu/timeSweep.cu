@@ -0,0 +1,215 @@
+//This takes command line arguements of the form key=value (see ../cpu/sweep.h),
+//or grid=<file> to read them from a file:
+//     ./timeSweep sizes=64:1024:x2 kernels=cuda,gold iters=30 output=sweep.csv
+//
+// The CUDA context and the device buffers are created once for the whole
+// sweep. Sizes that are not a multiple of the thread block size are skipped.
+//
+// Build:  nvcc -O2 -Xcompiler -fopenmp -I../cpu timeSweep.cu ../cpu/sweep.cpp ../cpu/gemm.cpp
+//              ../cpu/gemmJit.cpp ../cpu/gemmPlugin.cpp ../cpu/gemmTrace.cpp ../cpu/gemmMetrics.cpp ../cpu/arena.cpp
+//              ../cpu/multithreading.cpp ../cpu/matrixMul_gold.cpp ../cpu/matrixMul_cache.cpp
+//              ../cpu/matrixIO.cpp ../cpu/cpuFreq.cpp -o timeSweep -lgomp -lpthread -ldl
+
+// Utilities and system includes
+#include <stdio.h>
+#include <string.h>
+#include <cuda_runtime.h>
+
+#include "matrixMul.h"
+#include "matrixIO.h"
+#include "matrixMul_gold.h"
+#include "sweep.h"
+
+////////////////////////////////////////////////////////////////////////////////
+//! Matrix multiplication on the device: C = A * B
+//! wA is A's width and wB is B's width
+////////////////////////////////////////////////////////////////////////////////
+template <int BLOCK_SIZE> __global__ void
+matrixMul( float* C, float* A, float* B, int wA, int wB)
+{
+    // Block index
+    int bx = blockIdx.x;
+    int by = blockIdx.y;
+
+    // Thread index
+    int tx = threadIdx.x;
+    int ty = threadIdx.y;
+
+    // Index of the first sub-matrix of A processed by the block
+    int aBegin = wA * BLOCK_SIZE * by;
+
+    // Index of the last sub-matrix of A processed by the block
+    int aEnd   = aBegin + wA - 1;
+
+    // Step size used to iterate through the sub-matrices of A
+    int aStep  = BLOCK_SIZE;
+
+    // Index of the first sub-matrix of B processed by the block
+    int bBegin = BLOCK_SIZE * bx;
+
+    // Step size used to iterate through the sub-matrices of B
+    int bStep  = BLOCK_SIZE * wB;
+
+    // Csub is used to store the element of the block sub-matrix
+    // that is computed by the thread
+    float Csub = 0;
+
+    // Loop over all the sub-matrices of A and B
+    // required to compute the block sub-matrix
+    for (int a = aBegin, b = bBegin;
+             a <= aEnd;
+             a += aStep, b += bStep) {
+
+        // Declaration of the shared memory array As used to
+        // store the sub-matrix of A
+        __shared__ float As[BLOCK_SIZE][BLOCK_SIZE];
+
+        // Declaration of the shared memory array Bs used to
+        // store the sub-matrix of B
+        __shared__ float Bs[BLOCK_SIZE][BLOCK_SIZE];
+
+        // Load the matrices from device memory
+        // to shared memory; each thread loads
+        // one element of each matrix
+        As[ty][tx] = A[a + wA * ty + tx];
+        Bs[ty][tx] = B[b + wB * ty + tx];
+
+        // Synchronize to make sure the matrices are loaded
+        __syncthreads();
+
+        // Multiply the two matrices together;
+        // each thread computes one element
+        // of the block sub-matrix
+#pragma unroll
+        for (int k = 0; k < BLOCK_SIZE; ++k)
+            Csub += As[ty][k] * Bs[k][tx];
+
+        // Synchronize to make sure that the preceding
+        // computation is done before loading two new
+        // sub-matrices of A and B in the next iteration
+        __syncthreads();
+    }
+
+    // Write the block sub-matrix to device memory;
+    // each thread writes one element
+    int c = wB * BLOCK_SIZE * by + BLOCK_SIZE * bx;
+    C[c + wB * ty + tx] = Csub;
+}
+////////////////////////////////////////////////////////////////////////////////
+//    END OF KERNEL
+////////////////////////////////////////////////////////////////////////////////
+
+// Device buffers, grown to the largest point and reused after that
+struct CudaContext {
+    int    block_size;
+    float* d_A;
+    float* d_B;
+    float* d_C;
+    size_t capacity;    // floats per buffer
+};
+
+static bool cudaSetup(void* ctx, const SweepProblem* p)
+{
+    CudaContext* cuda = (CudaContext*)ctx;
+    int bs = cuda->block_size;
+    if (p->M % bs || p->N % bs || p->K % bs) return false;
+
+    size_t need = (size_t)p->M * p->K;
+    if ((size_t)p->K * p->N > need) need = (size_t)p->K * p->N;
+    if ((size_t)p->M * p->N > need) need = (size_t)p->M * p->N;
+    if (need > cuda->capacity) {
+        cudaFree(cuda->d_A);
+        cudaFree(cuda->d_B);
+        cudaFree(cuda->d_C);
+        if (cudaMalloc((void**) &cuda->d_A, sizeof(float) * need) != cudaSuccess
+            || cudaMalloc((void**) &cuda->d_B, sizeof(float) * need) != cudaSuccess
+            || cudaMalloc((void**) &cuda->d_C, sizeof(float) * need) != cudaSuccess)
+        {
+            printf("CUDA Error: cannot allocate %lu bytes\n", (unsigned long)(3 * sizeof(float) * need));
+            cuda->capacity = 0;
+            return false;
+        }
+        cuda->capacity = need;
+    }
+
+    cudaMemcpy(cuda->d_A, p->A, sizeof(float) * p->M * p->K, cudaMemcpyHostToDevice);
+    cudaMemcpy(cuda->d_B, p->B, sizeof(float) * p->K * p->N, cudaMemcpyHostToDevice);
+    return true;
+}
+
+static void cudaRun(void* ctx, const SweepProblem* p)
+{
+    CudaContext* cuda = (CudaContext*)ctx;
+
+    // setup execution parameters
+    dim3 threads(cuda->block_size, cuda->block_size);
+    dim3 grid(p->N / threads.x, p->M / threads.y);
+
+    if (cuda->block_size == 16) {
+        matrixMul<16><<< grid, threads >>>(cuda->d_C, cuda->d_A, cuda->d_B, p->K, p->N);
+    } else {
+        matrixMul<32><<< grid, threads >>>(cuda->d_C, cuda->d_A, cuda->d_B, p->K, p->N);
+    }
+
+    cudaError cuda_error = cudaDeviceSynchronize();
+    if (cuda_error != cudaSuccess)
+        printf("CUDA Error: %s\n", cudaGetErrorString(cuda_error));
+}
+
+static void cudaFinish(void* ctx, const SweepProblem* p)
+{
+    CudaContext* cuda = (CudaContext*)ctx;
+    cudaMemcpy(p->C, cuda->d_C, sizeof(float) * p->M * p->N, cudaMemcpyDeviceToHost);
+}
+
+static void goldRun(void*, const SweepProblem* p)
+{
+    computeGold((float*)p->C, (const float*)p->A, (const float*)p->B, p->M, p->K, p->N);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Program main
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char** argv)
+{
+    int cuda_device;
+    cudaDeviceProp deviceProp;
+
+    cudaGetDevice(&cuda_device);	
+    cudaGetDeviceProperties(&deviceProp, cuda_device);
+
+    CudaContext cuda;
+    memset(&cuda, 0, sizeof(cuda));
+
+    // use a larger block size for Fermi and above
+    cuda.block_size = (deviceProp.major < 2) ? 16 : 32;
+
+    SweepKernel kernels[] = {
+        { "cuda", SWEEP_DTYPE_BIT(MATRIX_FLOAT32), cudaSetup, cudaRun, cudaFinish, &cuda },
+        { "gold", SWEEP_DTYPE_BIT(MATRIX_FLOAT32), NULL, goldRun, NULL, NULL },
+    };
+
+    SweepGrid grid;
+    sweepDefaults(&grid);
+
+    for (int i = 1; i < argc; ++i) {
+        bool ok = (strncmp(argv[i], "grid=", 5) == 0)
+                ? sweepParseFile(&grid, argv[i] + 5)
+                : sweepParseArg(&grid, argv[i]);
+        if (!ok) return 1;
+    }
+
+    int failures = sweepRun(&grid, kernels, sizeof(kernels) / sizeof(kernels[0]));
+
+    // clean up memory
+    cudaFree(cuda.d_A);
+    cudaFree(cuda.d_B);
+    cudaFree(cuda.d_C);
+
+    cudaDeviceReset();
+
+    if (failures < 0) return 1;
+    if (failures > 0) printf("%d points FAILED validation\n", failures);
+    return failures > 0 ? 1 : 0;
+}
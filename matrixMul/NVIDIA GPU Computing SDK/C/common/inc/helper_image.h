@@ -653,26 +653,48 @@ sdkCompareL2fe( const float* reference, const float* data,
 {
     assert( epsilon >= 0);
 
-    float error = 0;
-    float ref = 0;
+    // Elements per work item; small enough to balance, large enough to vectorize
+    const int chunk = 4096;
+    const int nChunks = (int)((len + chunk - 1) / chunk);
 
-    for( unsigned int i = 0; i < len; ++i) {
-
-        float diff = reference[i] - data[i];
-        error += diff * diff;
-        ref += reference[i] * reference[i];
+    // Norm of the reference first, so the error pass knows its budget
+    double ref = 0;
+    #pragma omp parallel for schedule(static) reduction(+:ref)
+    for( int i = 0; i < (int)len; ++i) {
+        ref += (double)reference[i] * reference[i];
     }
 
-    float normRef = sqrtf(ref);
     if (fabs(ref) < 1e-7) {
 #ifdef _DEBUG
         std::cerr << "ERROR, reference l2-norm is 0\n";
 #endif
         return false;
     }
-    float normError = sqrtf(error);
-    error = normError / normRef;
-    bool result = error < epsilon;
+
+    // error / normRef < epsilon  <=>  sum(diff^2) < epsilon^2 * ref. Partial
+    // sums only grow, so once any thread's share reaches that budget the
+    // comparison has failed and the remaining chunks are skipped.
+    double budget = (double)epsilon * epsilon * ref;
+    double error = 0;
+    int exceeded = 0;     // set once, read early: relaxed atomics suffice
+    #pragma omp parallel for schedule(dynamic, 1) reduction(+:error)
+    for( int c = 0; c < nChunks; ++c) {
+        if (__atomic_load_n(&exceeded, __ATOMIC_RELAXED)) continue;
+
+        unsigned int begin = (unsigned int)c * chunk;
+        unsigned int end = (begin + chunk < len) ? begin + chunk : len;
+        double e = 0;
+        #pragma omp simd reduction(+:e)
+        for( unsigned int i = begin; i < end; ++i) {
+            float diff = reference[i] - data[i];
+            e += (double)diff * diff;
+        }
+        error += e;
+        if (error >= budget) __atomic_store_n(&exceeded, 1, __ATOMIC_RELAXED);
+    }
+
+    bool result = !__atomic_load_n(&exceeded, __ATOMIC_RELAXED) && error < budget;
+    error = sqrt(error / ref);
 #ifdef _DEBUG
     if( ! result) 
     {
@@ -458,25 +458,36 @@ void printDiff(float *data1, float *data2, int width, int height, int iListLengt
     shrLog("Listing first %d Differences > %.6f...\n", iListLength, fListTol);
     int i,j,k;
     int error_count=0;
-    for (j = 0; j < height; j++) 
+
+    // The listing is ordered, so it stays serial and stops once
+    // iListLength differences have been printed
+    for (j = 0; j < height && error_count < iListLength; j++) 
     {
-        if (error_count < iListLength)
-        {
-            shrLog("\n  Row %d:\n", j);
-        }
-        for (i = 0; i < width; i++) 
+        shrLog("\n  Row %d:\n", j);
+        for (i = 0; i < width && error_count < iListLength; i++) 
         {
             k = j * width + i;
             float fDiff = fabs(data1[k] - data2[k]);
             if (fDiff > fListTol) 
             {                
-                if (error_count < iListLength)
-                {
-                    shrLog("    Loc(%d,%d)\tCPU=%.5f\tGPU=%.5f\tDiff=%.6f\n", i, j, data1[k], data2[k], fDiff);
-                }
+                shrLog("    Loc(%d,%d)\tCPU=%.5f\tGPU=%.5f\tDiff=%.6f\n", i, j, data1[k], data2[k], fDiff);
                 error_count++;
             }
         }
     }
+
+    // The total is a parallel count over all rows
+    error_count = 0;
+    #pragma omp parallel for schedule(static) reduction(+:error_count)
+    for (j = 0; j < height; j++) 
+    {
+        const float* row1 = data1 + (size_t)j * width;
+        const float* row2 = data2 + (size_t)j * width;
+        int row_errors = 0;
+        #pragma omp simd reduction(+:row_errors)
+        for (int c = 0; c < width; c++)
+            row_errors += (fabsf(row1[c] - row2[c]) > fListTol);
+        error_count += row_errors;
+    }
     shrLog(" \n  Total Errors = %d\n\n", error_count);
 }
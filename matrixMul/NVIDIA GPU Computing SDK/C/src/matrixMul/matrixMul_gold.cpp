@@ -9,14 +9,23 @@
  *
  */
 
+#include <stddef.h>
+
 ////////////////////////////////////////////////////////////////////////////////
 // export C interface
 extern "C"
 void computeGold( float*, const float*, const float*, unsigned int, unsigned int, unsigned int);
 
+// Columns of C accumulated per pass and rows of C sharing each load of B
+#define GOLD_COLS 512
+#define GOLD_ROWS 4
+
 ////////////////////////////////////////////////////////////////////////////////
 //! Compute reference data set
 //! C = A * B
+//! Rows are split across OpenMP threads and independent columns run in SIMD
+//! lanes; each element is still summed in double over k in order, so the
+//! result is bit-identical to the serial loop.
 //! @param C          reference data, computed but preallocated
 //! @param A          matrix A as provided to device
 //! @param B          matrix B as provided to device
@@ -26,14 +35,41 @@ void computeGold( float*, const float*, const float*, unsigned int, unsigned int
 void
 computeGold(float* C, const float* A, const float* B, unsigned int hA, unsigned int wA, unsigned int wB)
 {
-    for (unsigned int i = 0; i < hA; ++i)
-        for (unsigned int j = 0; j < wB; ++j) {
-            double sum = 0;
-            for (unsigned int k = 0; k < wA; ++k) {
-                double a = A[i * wA + k];
-                double b = B[k * wB + j];
-                sum += a * b;
+    int nPanels = (int)((hA + GOLD_ROWS - 1) / GOLD_ROWS);
+
+    #pragma omp parallel
+    {
+        double sum[GOLD_ROWS][GOLD_COLS];
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int p = 0; p < nPanels; ++p) {
+            unsigned int i0 = (unsigned int)p * GOLD_ROWS;
+            unsigned int rows = (hA - i0 < GOLD_ROWS) ? hA - i0 : GOLD_ROWS;
+
+            for (unsigned int j0 = 0; j0 < wB; j0 += GOLD_COLS) {
+                unsigned int cols = (wB - j0 < GOLD_COLS) ? wB - j0 : GOLD_COLS;
+
+                for (unsigned int r = 0; r < rows; ++r)
+                    for (unsigned int j = 0; j < cols; ++j)
+                        sum[r][j] = 0;
+
+                for (unsigned int k = 0; k < wA; ++k) {
+                    const float* b = B + (size_t)k * wB + j0;
+                    for (unsigned int r = 0; r < rows; ++r) {
+                        double a = A[(size_t)(i0 + r) * wA + k];
+                        double* s = sum[r];
+                        #pragma omp simd
+                        for (unsigned int j = 0; j < cols; ++j)
+                            s[j] += a * (double)b[j];
+                    }
+                }
+
+                for (unsigned int r = 0; r < rows; ++r) {
+                    float* c = C + (size_t)(i0 + r) * wB + j0;
+                    for (unsigned int j = 0; j < cols; ++j)
+                        c[j] = (float)sum[r][j];
+                }
             }
-            C[i * wB + j] = (float)sum;
         }
+    }
 }